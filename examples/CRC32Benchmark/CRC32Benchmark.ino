@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: Unlicense */
+
+// Compares the CRC32 kernels on the target. Prints cycles per byte (derived
+// from micros() and F_CPU) and the lookup table size of each kernel.
+// The table is the bulk of the flash cost. To get the exact figure, build
+// any sketch with each of RDS4_CRC32_NIBBLE, RDS4_CRC32_BYTE,
+// RDS4_CRC32_SLICE4 and RDS4_CRC32_SLICE8 defined and compare the sizes.
+
+#include <RDS4-DS4.hpp>
+
+namespace utils = rds4::utils;
+
+typedef uint32_t (*Kernel)(uint32_t crc, const void *buf, size_t len);
+
+struct Entry {
+    const char *name;
+    Kernel kernel;
+    size_t table;
+};
+
+const Entry entries[] = {
+    {"nibble", &utils::crc32_nibble, utils::CRC32_NIBBLE_TABLE_SIZE},
+    {"byte", &utils::crc32_byte, utils::CRC32_BYTE_TABLE_SIZE},
+    {"slice4", &utils::crc32_slice4, utils::CRC32_SLICE4_TABLE_SIZE},
+    {"slice8", &utils::crc32_slice8, utils::CRC32_SLICE8_TABLE_SIZE},
+};
+
+// 60 bytes is what an auth page covers
+uint8_t buf[60];
+const uint16_t ROUNDS = 2000;
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+    for (size_t i=0; i<sizeof(buf); i++) {
+        buf[i] = i * 7 + 3;
+    }
+}
+
+void loop() {
+    for (const auto &e : entries) {
+        volatile uint32_t sink = 0;
+        uint32_t begin = micros();
+        for (uint16_t i=0; i<ROUNDS; i++) {
+            sink = e.kernel(sink, buf, sizeof(buf));
+        }
+        uint32_t elapsed = micros() - begin;
+        Serial.print(e.name);
+        Serial.print(": ");
+        Serial.print((float) elapsed * (F_CPU / 1000000) / ((uint32_t) ROUNDS * sizeof(buf)));
+        Serial.print(" cycles/byte, table ");
+        Serial.print(e.table);
+        Serial.println(" bytes");
+    }
+    Serial.println();
+    delay(5000);
+}
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: Unlicense */
+
+// Compares ds4::Controller (transport calls through the vtable) with
+// ds4::StaticController (direct calls) on the target. Prints cycles per
+// frame, where a frame is what a sketch typically does every loop: handle
+// feedback, set the buttons and sticks, send a report. The transport does
+// nothing so that only the controller and the dispatch are measured.
+// To get the flash cost of each, build with ONLY_DYNAMIC and then with
+// ONLY_STATIC set to 1 and compare the sizes.
+
+#include <RDS4-DS4.hpp>
+
+#define ONLY_DYNAMIC 0
+#define ONLY_STATIC 0
+
+namespace rds4api = rds4::api;
+namespace ds4 = rds4::ds4;
+
+class NullTransport : public rds4api::Transport {
+public:
+    bool available() override final {
+        return false;
+    }
+    uint8_t send(const void *buf, uint8_t len) override final {
+        return len;
+    }
+    uint8_t recv(void *buf, uint8_t len) override final {
+        return 0;
+    }
+protected:
+    uint8_t reply(const void *buf, uint8_t len) override {
+        return 0;
+    }
+    uint8_t check(void *buf, uint8_t len) override {
+        return 0;
+    }
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return false;
+    }
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return false;
+    }
+};
+
+NullTransport DynTr, StaticTr;
+#if !ONLY_STATIC
+ds4::Controller Dyn(&DynTr);
+#endif
+#if !ONLY_DYNAMIC
+ds4::StaticController<NullTransport> Static(&StaticTr);
+#endif
+
+const uint16_t ROUNDS = 2000;
+
+template <class C>
+void run(const char *name, C &controller) {
+    uint32_t begin = micros();
+    for (uint16_t i=0; i<ROUNDS; i++) {
+        controller.update();
+        controller.setButtonsUniversal(i * 0x9e37u);
+        controller.setStick(rds4api::Stick::L, i & 0xff, i >> 8);
+        controller.sendReport();
+    }
+    uint32_t elapsed = micros() - begin;
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print((float) elapsed * (F_CPU / 1000000) / ROUNDS);
+    Serial.println(" cycles/frame");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while (!Serial);
+#if !ONLY_STATIC
+    Dyn.begin();
+#endif
+#if !ONLY_DYNAMIC
+    Static.begin();
+#endif
+}
+
+void loop() {
+#if !ONLY_STATIC
+    run("Controller", Dyn);
+#endif
+#if !ONLY_DYNAMIC
+    run("StaticController", Static);
+#endif
+    Serial.println();
+    delay(5000);
+}
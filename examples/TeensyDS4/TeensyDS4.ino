@@ -22,6 +22,13 @@ ds4::TransportTeensy DS4Tr(&RealDS4Au);
 // Setup the DS4 object using the transport backend
 ds4::Controller DS4(&DS4Tr);
 
+// Send reports right before the console polls for them
+rds4api::ReportScheduler DS4Sched(&DS4, &DS4Tr);
+
+// Read buttons, sticks, etc. here. Called right before each report is sent.
+void sampleInputs() {
+}
+
 void setup() {
     Serial1.begin(115200);
     Serial1.println("Hello");
@@ -30,6 +37,7 @@ void setup() {
         while (1);
     }
     DS4.begin();
+    DS4Sched.attachSampleCallback(&sampleInputs);
 }
 
 void loop() {
@@ -39,6 +47,6 @@ void loop() {
     DS4Tr.update();
     // Grab updates from the host (e.g. rumble and LED state)
     DS4.update();
-    // Send DS4 report if possible
-    DS4.sendReport();
+    // Sample inputs and send DS4 report when it's time
+    DS4Sched.update();
 }
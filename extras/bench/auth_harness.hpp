@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** auth_harness.hpp
+ *  Host-side harness that drives AuthenticationHandler the way a console
+ *  does, without any USB stack. Shared by the auth benchmarks.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "ds4/Transport.hpp"
+
+#include <cstring>
+#include <unistd.h>
+
+namespace rds4 {
+namespace bench {
+
+// Only the auth reports. The harness has no FeatureConfigurator.
+template <class TR>
+struct AuthFeatureReports {
+    static constexpr ds4::FeatureReport<TR> LIST[] = {
+        {ds4::Controller::SET_CHALLENGE, nullptr, &TR::setChallenge},
+        {ds4::Controller::GET_RESPONSE, &TR::getResponse, nullptr},
+        {ds4::Controller::GET_AUTH_STATUS, &TR::getAuthStatus, nullptr},
+        {ds4::Controller::GET_AUTH_PAGE_SIZE, &TR::getAuthPageSize, nullptr},
+    };
+};
+
+template <class TR>
+constexpr ds4::FeatureReport<TR> AuthFeatureReports<TR>::LIST[];
+
+template <bool strictCRC=false, bool prefetch=false>
+class AuthHarness : public api::Transport,
+                    public ds4::AuthenticationHandler<AuthHarness<strictCRC, prefetch>, strictCRC, prefetch>,
+                    public ds4::FeatureDispatcher<AuthHarness<strictCRC, prefetch>, AuthFeatureReports<AuthHarness<strictCRC, prefetch>>> {
+    typedef ds4::AuthenticationHandler<AuthHarness<strictCRC, prefetch>, strictCRC, prefetch> Handler;
+public:
+    AuthHarness(api::Authenticator *auth) : Handler(auth), pollInterval(0), idle(nullptr), idleContext(nullptr), in(nullptr), inLen(0), out(nullptr), outLen(0), outMax(0), seq(0) {}
+    void begin() override {
+        Handler::begin();
+    }
+    bool available() override { return false; }
+    uint8_t send(const void *buf, uint8_t len) override { return 0; }
+    uint8_t sendBlocking(const void *buf, uint8_t len) override { return 0; }
+    uint8_t recv(void *buf, uint8_t len) override { return 0; }
+
+    // Delay between status polls (us). 0 polls as fast as possible.
+    uint32_t pollInterval;
+    // Called between status polls instead of sleeping when set (e.g. to
+    // advance a virtual clock)
+    void (*idle)(void *context);
+    void *idleContext;
+
+    /** Feature report SET from the host. */
+    bool hostSet(uint8_t id, const void *buf, uint8_t len) {
+        this->in = buf;
+        this->inLen = len;
+        return this->onSetReport(0x0300 | id, 0, len);
+    }
+    /** Feature report GET from the host.
+     *
+     *  @return Length of the reply or 0 on stall.
+     */
+    uint8_t hostGet(uint8_t id, void *buf, uint8_t len) {
+        this->out = buf;
+        this->outMax = len;
+        this->outLen = 0;
+        if (not this->onGetReport(0x0300 | id, 0, len)) {
+            return 0;
+        }
+        return this->outLen;
+    }
+    /** Run a whole auth transaction like a console.
+     *
+     *  @param Challenge (AUTH_CHALLENGE_SIZE bytes).
+     *  @param Expected response (AUTH_RESPONSE_SIZE bytes) or `nullptr` to
+     *  skip checking.
+     *  @param Receives the number of busy status replies.
+     *  @return `true` if the transaction succeeded.
+     */
+    bool transaction(const uint8_t *challenge, const uint8_t *expected, uint32_t *polls) {
+        ds4::AuthPageSizeReport ps;
+        ds4::AuthStatusReport status;
+        ds4::AuthReport pkt;
+        uint16_t offset;
+        uint8_t page;
+        *polls = 0;
+        if (this->hostGet(ds4::Controller::GET_AUTH_PAGE_SIZE, &ps, sizeof(ps)) == 0 or \
+                ps.size_challenge == 0 or ps.size_response == 0) {
+            return false;
+        }
+        this->seq++;
+        for (page = 0, offset = 0; offset < ds4::AUTH_CHALLENGE_SIZE; page++, offset += ps.size_challenge) {
+            uint16_t n = ds4::AUTH_CHALLENGE_SIZE - offset;
+            n = n > ps.size_challenge ? ps.size_challenge : n;
+            memset(&pkt, 0, sizeof(pkt));
+            pkt.type = ds4::Controller::SET_CHALLENGE;
+            pkt.seq = this->seq;
+            pkt.page = page;
+            memcpy(pkt.data, &challenge[offset], n);
+            pkt.crc32 = utils::crc32(&pkt, sizeof(pkt) - sizeof(pkt.crc32));
+            if (not this->hostSet(ds4::Controller::SET_CHALLENGE, &pkt, sizeof(pkt))) {
+                return false;
+            }
+            this->update();
+        }
+        for (;;) {
+            this->update();
+            if (this->hostGet(ds4::Controller::GET_AUTH_STATUS, &status, sizeof(status)) == 0) {
+                return false;
+            }
+            if (status.status == 0x00) {
+                break;
+            } else if (status.status != 0x10) {
+                return false;
+            }
+            (*polls)++;
+            if (this->idle != nullptr) {
+                this->idle(this->idleContext);
+            } else if (this->pollInterval != 0) {
+                usleep(this->pollInterval);
+            }
+        }
+        for (page = 0, offset = 0; offset < ds4::AUTH_RESPONSE_SIZE; page++, offset += ps.size_response) {
+            uint16_t n = ds4::AUTH_RESPONSE_SIZE - offset;
+            n = n > ps.size_response ? ps.size_response : n;
+            if (this->hostGet(ds4::Controller::GET_RESPONSE, &pkt, sizeof(pkt)) == 0 or pkt.page != page) {
+                return false;
+            }
+            if (expected != nullptr and memcmp(pkt.data, &expected[offset], n) != 0) {
+                return false;
+            }
+            this->update();
+        }
+        return true;
+    }
+
+protected:
+    friend Handler;
+    friend struct AuthFeatureReports<AuthHarness>;
+    uint8_t check(void *buf, uint8_t len) override {
+        memcpy(buf, this->in, len > this->inLen ? this->inLen : len);
+        return this->inLen;
+    }
+    uint8_t reply(const void *buf, uint8_t len) override {
+        len = len > this->outMax ? this->outMax : len;
+        memcpy(this->out, buf, len);
+        this->outLen = len;
+        return len;
+    }
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return this->dispatchGetReport(value, index, length);
+    }
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return this->dispatchSetReport(value, index, length);
+    }
+
+private:
+    const void *in;
+    uint8_t inLen;
+    void *out;
+    uint8_t outLen;
+    uint8_t outMax;
+    uint8_t seq;
+};
+
+} // namespace bench
+} // namespace rds4
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** auth_replay_bench.cpp
+ *  Host benchmark for AuthenticationHandler driven by a recorded capture.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc -Iextras/bench \
+ *        extras/bench/auth_replay_bench.cpp src/ds4/AuthenticatorReplay.cpp \
+ *        src/utils/crc32.cpp -o auth_replay_bench
+ *
+ *  Usage:
+ *    auth_replay_bench [-r] [-n transactions] [capture]
+ *
+ *  -r replays at the recorded pacing instead of as fast as possible. Without
+ *  a capture file a synthetic one is generated.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "auth_harness.hpp"
+#include "ds4/AuthenticatorReplay.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+using namespace rds4;
+
+static uint64_t nanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Random transactions with a 0x38-byte page layout and 1-3ms signing time
+static bool synthesize(const char *path, uint16_t count) {
+    static ds4::AuthCaptureRecord record;
+    ds4::AuthCaptureHeader header = {};
+    FILE *f = fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    memcpy(header.magic, ds4::AUTH_CAPTURE_MAGIC, sizeof(header.magic));
+    header.challengePageSize = 0x38;
+    header.responsePageSize = 0x38;
+    header.count = count;
+    fwrite(&header, sizeof(header), 1, f);
+    srand(1);
+    for (uint16_t i=0; i<count; i++) {
+        for (auto &b : record.challenge) {
+            b = rand();
+        }
+        for (auto &b : record.response) {
+            b = rand();
+        }
+        record.latency = 1000 + rand() % 2000;
+        record.busyPolls = rand() % 8;
+        fwrite(&record, sizeof(record), 1, f);
+    }
+    fclose(f);
+    return true;
+}
+
+template <bool strictCRC, bool prefetch>
+static void run(const char *name, const char *path, ds4::ReplayPacing pacing, uint32_t n) {
+    ds4::AuthenticatorReplay auth(path, pacing);
+    bench::AuthHarness<strictCRC, prefetch> harness(&auth);
+    uint32_t polls, totalPolls = 0, failed = 0;
+    // Poll about as often as a console does when pacing is realistic
+    harness.pollInterval = (pacing == ds4::ReplayPacing::REALTIME) ? 1000 : 0;
+    harness.begin();
+    if (not auth.available()) {
+        fprintf(stderr, "cannot load %s\n", path);
+        exit(1);
+    }
+    auto start = nanos();
+    for (uint32_t i=0; i<n; i++) {
+        auto record = auth.getRecord(i % auth.count());
+        if (not harness.transaction(record->challenge, record->response, &polls)) {
+            failed++;
+        }
+        totalPolls += polls;
+    }
+    auto elapsed = nanos() - start;
+    printf("%-16s %8u tx %10.0f ns/tx %6.2f polls/tx failed=%u mismatch=%u\n", name, n,
+           static_cast<double>(elapsed) / n, static_cast<double>(totalPolls) / n,
+           failed, auth.getMismatches());
+}
+
+int main(int argc, char *argv[]) {
+    auto pacing = ds4::ReplayPacing::FAST;
+    uint32_t n = 100000;
+    const char *path = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "rn:")) != -1) {
+        switch (opt) {
+            case 'r':
+                pacing = ds4::ReplayPacing::REALTIME;
+                break;
+            case 'n':
+                n = strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r] [-n transactions] [capture]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    } else {
+        path = "/tmp/rds4_synthetic.cap";
+        if (not synthesize(path, 64)) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 1;
+        }
+    }
+    if (pacing == ds4::ReplayPacing::REALTIME and n > 1000) {
+        n = 1000;
+    }
+    run<false, false>("default", path, pacing, n);
+    run<true, false>("strictCRC", path, pacing, n);
+    run<false, true>("prefetch", path, pacing, n);
+    run<true, true>("strictCRC+pf", path, pacing, n);
+    return 0;
+}
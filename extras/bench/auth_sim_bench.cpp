@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** auth_sim_bench.cpp
+ *  Auth completion time against simulated donor timing.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc -Iextras/bench \
+ *        extras/bench/auth_sim_bench.cpp src/ds4/AuthenticatorSim.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o auth_sim_bench
+ *
+ *  Times are on the simulator's virtual clock (us), so results don't depend
+ *  on the host. The host polls the status every 5ms.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "auth_harness.hpp"
+#include "ds4/AuthenticatorSim.hpp"
+#include "utils/trace.hpp"
+
+#include <cstdio>
+
+using namespace rds4;
+
+static const uint32_t HOST_POLL_INTERVAL = 5000;
+static const uint32_t TRANSACTIONS = 2000;
+
+static void hostIdle(void *context) {
+    static_cast<ds4::AuthenticatorSim *>(context)->advance(HOST_POLL_INTERVAL);
+}
+
+static void run(const char *name, const ds4::SimConfig &config) {
+    ds4::AuthenticatorSim sim(config, 0x5eed);
+    bench::AuthHarness<true, false> harness(&sim);
+    static uint8_t challenge[ds4::AUTH_CHALLENGE_SIZE];
+    static uint8_t expected[ds4::AUTH_RESPONSE_SIZE];
+    ds4::SimRandom rng(42);
+    utils::Log2Histogram completion;
+    uint32_t polls, failed = 0;
+    completion.reset();
+    harness.idle = &hostIdle;
+    harness.idleContext = &sim;
+    harness.begin();
+    for (uint32_t i=0; i<TRANSACTIONS; i++) {
+        for (auto &b : challenge) {
+            b = rng.next();
+        }
+        ds4::AuthenticatorSim::fillResponse(challenge, 0, expected, sizeof(expected));
+        auto start = sim.now();
+        if (harness.transaction(challenge, expected, &polls)) {
+            completion.add(sim.now() - start);
+        } else {
+            failed++;
+            // Let the console time out before retrying
+            sim.advance(100000);
+        }
+    }
+    printf("%-14s ok=%-5u failed=%-4u injected=%-4u p50<=%-8lu p90<=%-8lu p99<=%-8lu max=%lu\n",
+           name, static_cast<unsigned>(completion.count), failed, sim.getInjectedErrors(),
+           static_cast<unsigned long>(completion.percentile(50)),
+           static_cast<unsigned long>(completion.percentile(90)),
+           static_cast<unsigned long>(completion.percentile(99)),
+           static_cast<unsigned long>(completion.max));
+}
+
+int main() {
+    ds4::SimConfig base = {};
+    base.challengePageSize = 0x38;
+    base.responsePageSize = 0x38;
+    base.fitOK = true;
+    base.resetOK = true;
+    base.needsReset = false;
+    base.writeLatency = {ds4::SimLatency::FIXED, 1000, 1000, 0};
+    base.readLatency = {ds4::SimLatency::FIXED, 1000, 1000, 0};
+    base.statusLatency = {ds4::SimLatency::FIXED, 1000, 1000, 0};
+    base.signTime = {ds4::SimLatency::FIXED, 100000, 100000, 0};
+    printf("completion time in virtual us\n");
+    run("baseline", base);
+
+    auto slowIO = base;
+    slowIO.writeLatency = {ds4::SimLatency::UNIFORM, 1000, 8000, 0};
+    slowIO.readLatency = {ds4::SimLatency::UNIFORM, 1000, 8000, 0};
+    run("slow io", slowIO);
+
+    auto tail = base;
+    tail.signTime = {ds4::SimLatency::TAIL, 50000, 2000000, 0};
+    run("sign tail", tail);
+
+    auto stall = base;
+    stall.readLatency = {ds4::SimLatency::BIMODAL, 1000, 250000, 20};
+    run("read stalls", stall);
+
+    auto flaky = base;
+    flaky.commErrPermille = 5;
+    run("0.5% comm err", flaky);
+
+    auto broken = base;
+    broken.unknownErrPermille = 50;
+    run("5% status err", broken);
+    return 0;
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** buttons_bench.cpp
+ *  Controller::setButtonsUniversal() compared with one setKeyUniversal()
+ *  call per key.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc \
+ *        extras/bench/buttons_bench.cpp src/ds4/Controller.cpp \
+ *        src/ds4/TransportLoopback.cpp src/api/UnoJoyAPI.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o buttons_bench
+ *
+ *  First checks that both paths produce the same report for every key
+ *  combination, and that an UnoJoy frame translates to the keys it names.
+ *  Then times a full frame update both ways.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "api/UnoJoyAPI.hpp"
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+
+using namespace rds4;
+
+static const uint32_t ROUNDS = 1000000;
+static const uint32_t ALL_KEYS = (1ul << static_cast<uint8_t>(api::Key::_COUNT)) - 1;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// What setButtonsUniversal() did before it had an override
+static void setPerKey(api::Controller *controller, uint32_t mask) {
+    controller->api::Controller::setButtonsUniversal(mask);
+}
+
+static void setBulk(api::Controller *controller, uint32_t mask) {
+    controller->setButtonsUniversal(mask);
+}
+
+static bool check(ds4::Controller *a, ds4::Controller *b) {
+    uint8_t bufA[ds4::Controller::BT_REPORT_SIZE], bufB[ds4::Controller::BT_REPORT_SIZE];
+    // Hold the touchpad button and the D-pad and bump the report counter,
+    // setButtonsUniversal() must leave them alone
+    for (auto *controller : {a, b}) {
+        controller->pressKey(ds4::Controller::KEY_TP);
+        controller->setDpad(0, api::Dpad::NE);
+        controller->sendReport();
+        controller->sendReport();
+    }
+    for (uint32_t mask=0; mask<=ALL_KEYS; mask++) {
+        setPerKey(a, mask);
+        setBulk(b, mask);
+        a->buildReportBT(bufA);
+        b->buildReportBT(bufB);
+        // Sticks, buttons and triggers
+        if (memcmp(&bufA[3], &bufB[3], 9) != 0) {
+            printf("mismatch at mask %04x\n", static_cast<unsigned>(mask));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkUnoJoy() {
+    auto frame = api::getBlankDataForController();
+    frame.triangleOn = 1;
+    frame.l2On = 1;
+    frame.homeOn = 1;
+    frame.dpadLeftOn = 1;
+    frame.dpadDownOn = 1;
+    return api::getButtonsUniversal(frame) == (api::keyMask(api::Key::X) | api::keyMask(api::Key::LTrigger) |
+                                               api::keyMask(api::Key::Home));
+}
+
+static void bench(const char *name, ds4::Controller *controller, void (*set)(api::Controller *, uint32_t)) {
+    uint64_t start = nowNs();
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        set(controller, (i * 0x9e3779b1u >> 7) & ALL_KEYS);
+    }
+    printf("%-8s %6.1f ns/frame\n", name, static_cast<double>(nowNs() - start) / ROUNDS);
+}
+
+int main() {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportLoopback transportA(&auth), transportB(&auth);
+    static ds4::Controller a(&transportA), b(&transportB);
+    a.begin();
+    b.begin();
+    if (not check(&a, &b)) {
+        return 1;
+    }
+    if (not checkUnoJoy()) {
+        printf("UnoJoy translation mismatch\n");
+        return 1;
+    }
+    printf("all %u key combinations match\n", static_cast<unsigned>(ALL_KEYS + 1));
+    bench("per-key", &a, &setPerKey);
+    bench("bulk", &b, &setBulk);
+    return 0;
+}
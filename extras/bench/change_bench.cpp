@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** change_bench.cpp
+ *  Bus load and responsiveness of change-driven report emission.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/change_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/ds4/Controller.cpp src/utils/crc32.cpp src/utils/trace.cpp \
+ *        -o change_bench
+ *
+ *  A host thread polls a TransportLoopback every 1ms. The device main loop
+ *  calls sendReport() as fast as it can, with scripted inputs: a button
+ *  toggled every 16ms for 1s (a 60Hz source), then 2s of idle. Each change
+ *  stamps its time into the stick axes. Reports counts the reports the host
+ *  picked up in each phase, latency is from a change to the first report
+ *  that carries it. Accepted counts the sendReport() calls that handed a
+ *  report to the transport.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <sched.h>
+#include <thread>
+
+using namespace rds4;
+
+static const uint32_t ACTIVE = 1000;
+static const uint32_t IDLE = 2000;
+static const uint32_t TOGGLE_INTERVAL = 16;
+static const uint32_t POLL_INTERVAL = 1000;
+
+static uint64_t nowNs(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void run(const char *name, bool changeDriven) {
+    static ds4::AuthenticatorNull auth;
+    ds4::TransportLoopback transport(&auth, 1, api::TXPolicy::DROP_OLDEST);
+    ds4::Controller controller(&transport);
+    ds4::LoopbackHost host(&transport);
+    std::atomic<bool> running(true);
+    utils::Log2Histogram latency;
+    uint32_t reports[2] = {0, 0};
+    // Sticks are centered by begin()
+    uint32_t lastStamp = 0x80808080;
+    uint64_t sendNs = 0;
+    uint32_t calls = 0, accepted = 0;
+    latency.reset();
+    controller.begin();
+    controller.setChangeDriven(changeDriven);
+
+    uint32_t start = millis();
+    std::thread device([&]() {
+        uint32_t toggles = 0;
+        while (running) {
+            uint32_t elapsed = millis() - start;
+            if (elapsed < ACTIVE and elapsed / TOGGLE_INTERVAL != toggles) {
+                uint32_t now = micros();
+                toggles = elapsed / TOGGLE_INTERVAL;
+                controller.setKey(ds4::Controller::KEY_XRO, toggles & 1);
+                for (uint8_t i=0; i<4; i++) {
+                    controller.setAxis(ds4::Controller::AXIS_LX + i, (now >> (i * 8)) & 0xff);
+                }
+            }
+            auto t = nowNs(CLOCK_MONOTONIC);
+            accepted += controller.sendReport();
+            sendNs += nowNs(CLOCK_MONOTONIC) - t;
+            calls++;
+            sched_yield();
+        }
+    });
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (uint32_t i=0; i<ACTIVE + IDLE; i++) {
+        ds4::InputReport report;
+        deadline.tv_nsec += POLL_INTERVAL * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+        if (host.read(&report, sizeof(report)) != 0) {
+            uint32_t now = micros();
+            uint32_t stamp = report.sticks[0] | (report.sticks[1] << 8) | (report.sticks[2] << 16) | (static_cast<uint32_t>(report.sticks[3]) << 24);
+            reports[millis() - start < ACTIVE ? 0 : 1]++;
+            if (stamp != lastStamp) {
+                latency.add(now - stamp);
+                lastStamp = stamp;
+            }
+        }
+    }
+    running = false;
+    device.join();
+    printf("%-13s reports active=%-4u idle=%-4u  change->host avg=%-4lu p99<=%-4lu max=%-5lu us  accepted=%-7u %.0f ns/call\n",
+           name, static_cast<unsigned>(reports[0]), static_cast<unsigned>(reports[1]),
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)),
+           static_cast<unsigned long>(latency.max),
+           static_cast<unsigned>(accepted), static_cast<double>(sendNs) / calls);
+}
+
+int main() {
+    run("always", false);
+    run("change-driven", true);
+    return 0;
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** crc32_bench.cpp
+ *  Host benchmark for the CRC32 kernels.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc extras/bench/crc32_bench.cpp \
+ *        src/utils/crc32.cpp -o crc32_bench
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "utils/utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+static inline uint64_t cycles() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+using namespace rds4;
+
+typedef uint32_t (*Kernel)(uint32_t crc, const void *buf, size_t len);
+
+struct Entry {
+    const char *name;
+    Kernel kernel;
+    size_t table;
+};
+
+static void bench(const Entry &e, const uint8_t *buf, size_t len, uint32_t expected) {
+    const size_t rounds = (64u << 20) / len;
+    uint32_t crc = e.kernel(0xfffffffful, buf, len) ^ 0xfffffffful;
+    if (crc != expected) {
+        printf("%-8s MISMATCH %08x != %08x\n", e.name, crc, expected);
+        return;
+    }
+    uint64_t begin = cycles();
+    for (size_t i=0; i<rounds; i++) {
+        crc ^= e.kernel(0xfffffffful, buf, len);
+    }
+    uint64_t end = cycles();
+    printf("%-8s %6zu B  %7.3f cyc/B  table %5zu B  (%08x)\n", e.name, len,
+           static_cast<double>(end - begin) / (rounds * len), e.table, crc);
+}
+
+int main() {
+    static uint8_t buf[4096];
+    for (size_t i=0; i<sizeof(buf); i++) {
+        buf[i] = static_cast<uint8_t>(rand());
+    }
+    const Entry entries[] = {
+        {"nibble", &utils::crc32_nibble, utils::CRC32_NIBBLE_TABLE_SIZE},
+        {"byte", &utils::crc32_byte, utils::CRC32_BYTE_TABLE_SIZE},
+        {"slice4", &utils::crc32_slice4, utils::CRC32_SLICE4_TABLE_SIZE},
+        {"slice8", &utils::crc32_slice8, utils::CRC32_SLICE8_TABLE_SIZE},
+#ifdef RDS4_CRC32_HAS_PCLMUL
+        {"pclmul", utils::crc32_pclmul_supported() ? &utils::crc32_pclmul : nullptr, 0},
+#endif
+    };
+    // 60 bytes is the auth page CRC span, 74 is the BT input report span.
+    const size_t lengths[] = {60, 74, 1024, 4096};
+    for (auto len : lengths) {
+        uint32_t expected = utils::crc32_nibble(0xfffffffful, buf, len) ^ 0xfffffffful;
+        for (const auto &e : entries) {
+            if (e.kernel != nullptr) {
+                bench(e, buf, len, expected);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
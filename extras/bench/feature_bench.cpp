@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** feature_bench.cpp
+ *  Cost of dispatching one feature request (the part that runs in the USB
+ *  interrupt on MCUs).
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc \
+ *        extras/bench/feature_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o feature_bench
+ *
+ *  Calls onGetReport()/onSetReport() of TransportLoopback directly, so the
+ *  mailbox and thread handoff are not part of the numbers. Unknown IDs are
+ *  the worst case for an if-chain.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+
+#include <cstdio>
+#include <ctime>
+
+using namespace rds4;
+
+static const uint32_t CALLS = 10000000;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+class Probe : public ds4::TransportLoopback {
+public:
+    using ds4::TransportLoopback::TransportLoopback;
+    using ds4::TransportLoopback::onGetReport;
+    using ds4::TransportLoopback::onSetReport;
+};
+
+int main() {
+    static ds4::AuthenticatorNull auth;
+    static Probe probe(&auth);
+    const struct {
+        const char *name;
+        bool set;
+        uint8_t id;
+    } cases[] = {
+        {"GET 0x02 calibration", false, 0x02},
+        {"GET 0x03 config", false, 0x03},
+        {"GET 0xf2 auth status", false, ds4::Controller::GET_AUTH_STATUS},
+        {"GET 0xf3 page size", false, ds4::Controller::GET_AUTH_PAGE_SIZE},
+        {"GET 0x7f unknown", false, 0x7f},
+        {"SET 0x7f unknown", true, 0x7f},
+    };
+    for (auto &c : cases) {
+        uint32_t ok = 0;
+        auto start = nowNs();
+        for (uint32_t i=0; i<CALLS; i++) {
+            if (c.set) {
+                ok += probe.onSetReport(0x0300 | c.id, 0, 64);
+            } else {
+                ok += probe.onGetReport(0x0300 | c.id, 0, 64);
+            }
+        }
+        auto ns = nowNs() - start;
+        printf("%-22s %6.2f ns/call (handled=%s)\n", c.name, static_cast<double>(ns) / CALLS, ok ? "yes" : "no");
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** feedback_bench.cpp
+ *  Host-to-callback latency and callback count of feedback reports.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/feedback_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/ds4/Controller.cpp src/utils/crc32.cpp src/utils/trace.cpp \
+ *        -o feedback_bench
+ *
+ *  The device main loop runs every 1ms over TransportLoopback. The host
+ *  writes feedback reports either one at a time (latency is from
+ *  LoopbackHost::write() to the rumble callback) or in bursts of 8 that
+ *  each change the LED color (callbacks per burst). Both are run with
+ *  feedback handled in Controller::update() and in immediate mode.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <unistd.h>
+
+using namespace rds4;
+
+static const uint32_t SINGLES = 2000;
+static const uint32_t BURSTS = 500;
+static const uint8_t BURST_SIZE = 8;
+
+static std::atomic<uint64_t> sentAt[256];
+static std::atomic<uint32_t> rumbleCalls(0), ledCalls(0);
+static utils::Log2Histogram latency;
+
+static uint64_t nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void onRumble(uint8_t left, uint8_t right) {
+    (void) right;
+    latency.add(static_cast<uint32_t>(nowUs() - sentAt[left].load()));
+    rumbleCalls++;
+}
+
+static void onLED(uint32_t rgb) {
+    (void) rgb;
+    ledCalls++;
+}
+
+static void run(bool immediate) {
+    static ds4::AuthenticatorNull auth;
+    ds4::TransportLoopback transport(&auth);
+    ds4::Controller controller(&transport);
+    ds4::LoopbackHost host(&transport);
+    std::atomic<bool> running(true);
+    ds4::FeedbackReport pkt;
+    uint32_t written;
+
+    controller.begin();
+    transport.begin();
+    controller.attachRumbleCallback(&onRumble);
+    controller.attachLEDCallback(&onLED);
+    controller.setImmediateFeedback(immediate);
+    latency.reset();
+    rumbleCalls = 0;
+    ledCalls = 0;
+
+    std::thread loop([&]() {
+        while (running) {
+            transport.update();
+            controller.update();
+            usleep(1000);
+        }
+    });
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.type = ds4::Controller::OUT_FEEDBACK;
+    pkt.flags = ds4::Controller::FEEDBACK_RUMBLE;
+    for (uint32_t i=1; i<=SINGLES; i++) {
+        pkt.rumble_left = static_cast<uint8_t>(i);
+        sentAt[pkt.rumble_left] = nowUs();
+        host.write(&pkt, sizeof(pkt));
+        // Let the loop pick it up before the next one
+        usleep(1500 + (i * 7919) % 1000);
+    }
+    printf("%-9s single: callbacks=%-5u avg=%-5lu p99<=%-5lu max=%lu us\n",
+           immediate ? "immediate" : "update()", static_cast<unsigned>(rumbleCalls.load()),
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)),
+           static_cast<unsigned long>(latency.max));
+
+    pkt.flags = ds4::Controller::FEEDBACK_LED;
+    written = 0;
+    for (uint32_t i=0; i<BURSTS; i++) {
+        for (uint8_t j=0; j<BURST_SIZE; j++) {
+            pkt.led_color[0] = static_cast<uint8_t>(i);
+            pkt.led_color[1] = j;
+            written += host.write(&pkt, sizeof(pkt)) != 0;
+        }
+        usleep(3000);
+    }
+    running = false;
+    loop.join();
+    printf("%-9s burst:  written=%-5u LED callbacks=%-5u (%.2f per burst)\n",
+           immediate ? "immediate" : "update()", static_cast<unsigned>(written),
+           static_cast<unsigned>(ledCalls.load()), static_cast<double>(ledCalls.load()) / BURSTS);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return 0;
+}
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** ffs_bench.cpp
+ *  Throughput and latency of TransportFFS on a dummy_hcd loopback.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/ffs_bench.cpp src/ds4/TransportFFS.cpp \
+ *        src/ds4/ReportDescriptor.cpp src/utils/crc32.cpp \
+ *        src/utils/trace.cpp -o ffs_bench
+ *
+ *  Run (as root):
+ *    extras/tools/ffs_dummy_hcd.sh setup
+ *    ./ffs_bench /dev/ffs-ds4 &
+ *    extras/tools/ffs_dummy_hcd.sh bind
+ *
+ *  Before measuring it checks, and logs, that the host enumerated the gadget
+ *  (hidraw node, bus, VID/PID, report descriptor) and that one input and one
+ *  output report make the round trip unchanged. It exits non-zero if any of
+ *  these checks fail, so the log of a run doubles as a smoke test.
+ *
+ *  Measures:
+ *  - input: TransportFFS::send() until the report is read from hidraw
+ *  - throughput: input reports per second with all TX slots in flight
+ *  - feature: HIDIOCGFEATURE round trip through ep0
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/ReportDescriptor.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rds4;
+
+static const uint32_t ROUNDS = 10000;
+static const uint32_t THROUGHPUT_MS = 2000;
+
+static uint32_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+// Find /dev/hidrawN of the gadget by its VID/PID
+static int openHidraw(char *path, size_t pathLen) {
+    char line[256];
+    DIR *dir = opendir("/sys/class/hidraw");
+    struct dirent *ent;
+    int fd = -1;
+    if (dir == nullptr) {
+        return -1;
+    }
+    while (fd < 0 and (ent = readdir(dir)) != nullptr) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, pathLen, "/sys/class/hidraw/%s/device/uevent", ent->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == nullptr) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            if (strncmp(line, "HID_ID=", 7) == 0 and strstr(line, "0000054C:000005C4") != nullptr) {
+                snprintf(path, pathLen, "/dev/%s", ent->d_name);
+                fd = open(path, O_RDWR | O_CLOEXEC);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return fd;
+}
+
+// Check what the host made of the gadget
+static bool checkEnumeration(int hidraw, const char *path) {
+    hidraw_devinfo info;
+    int descSize = 0;
+    hidraw_report_descriptor desc;
+    bool ok;
+    if (ioctl(hidraw, HIDIOCGRAWINFO, &info) < 0 or ioctl(hidraw, HIDIOCGRDESCSIZE, &descSize) < 0) {
+        perror("enum");
+        return false;
+    }
+    desc.size = descSize;
+    if (ioctl(hidraw, HIDIOCGRDESC, &desc) < 0) {
+        perror("enum");
+        return false;
+    }
+    ok = (
+        info.vendor == 0x054c and info.product == 0x05c4 and
+        descSize == ds4::REPORT_DESCRIPTOR_SIZE and
+        memcmp(desc.value, ds4::REPORT_DESCRIPTOR, descSize) == 0
+    );
+    printf("%-8s %s bus=%s vid=%04x pid=%04x rdesc=%d/%u bytes %s\n", "enum", path,
+           info.bustype == BUS_USB ? "usb" : "other",
+           static_cast<unsigned>(info.vendor & 0xffff), static_cast<unsigned>(info.product & 0xffff),
+           descSize, static_cast<unsigned>(ds4::REPORT_DESCRIPTOR_SIZE), ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+// One input report to the host and one output report back, both compared
+static bool checkRoundTrip(ds4::TransportFFS &transport, int hidraw) {
+    uint8_t report[64], out[32], buf[64];
+    ssize_t actual;
+    bool inOk, outOk = false;
+    for (uint8_t i=0; i<sizeof(report); i++) {
+        report[i] = i;
+    }
+    report[0] = 0x01;
+    if (transport.send(report, sizeof(report)) != sizeof(report)) {
+        printf("%-8s send() refused\n", "in");
+        return false;
+    }
+    actual = read(hidraw, buf, sizeof(buf));
+    inOk = actual == sizeof(report) and memcmp(buf, report, sizeof(report)) == 0;
+    printf("%-8s %zd/%zu bytes %s\n", "in", actual, sizeof(report), inOk ? "ok" : "MISMATCH");
+    while (transport.pending() > 0 and transport.poll(1) >= 0);
+
+    for (uint8_t i=0; i<sizeof(out); i++) {
+        out[i] = 0xff - i;
+    }
+    out[0] = 0x05;
+    if (write(hidraw, out, sizeof(out)) != sizeof(out)) {
+        perror("out");
+        return false;
+    }
+    actual = 0;
+    for (int i=0; i<100 and actual == 0; i++) {
+        transport.poll(10);
+        actual = transport.recv(buf, sizeof(buf));
+    }
+    outOk = actual == sizeof(out) and memcmp(buf, out, sizeof(out)) == 0;
+    printf("%-8s %zd/%zu bytes %s\n", "out", actual, sizeof(out), outOk ? "ok" : "MISMATCH");
+    return inOk and outOk;
+}
+
+static void print(const char *name, const utils::Log2Histogram &h) {
+    if (h.count == 0) {
+        printf("%-8s no samples\n", name);
+        return;
+    }
+    printf("%-8s n=%-6u avg=%-8lu p50<=%-8lu p99<=%-8lu max=%lu (ns)\n", name,
+           static_cast<unsigned>(h.count), static_cast<unsigned long>(h.average()),
+           static_cast<unsigned long>(h.percentile(50)),
+           static_cast<unsigned long>(h.percentile(99)),
+           static_cast<unsigned long>(h.max));
+}
+
+int main(int argc, char **argv) {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportFFS transport(&auth, argc > 1 ? argv[1] : "/dev/ffs-ds4");
+    utils::Log2Histogram input, feature;
+    std::atomic<bool> running(true);
+    std::atomic<uint32_t> received(0);
+    uint8_t report[64] = {0x01};
+    uint8_t buf[64];
+    uint32_t sent = 0;
+    int hidraw = -1;
+    char path[300];
+
+    transport.begin();
+    if (transport.getFD() < 0) {
+        fprintf(stderr, "cannot set up FunctionFS\n");
+        return 1;
+    }
+    // Wait for the gadget to be bound and enumerated (ep0 requests are
+    // served here)
+    for (int i=0; i<3000 and hidraw < 0; i++) {
+        transport.poll(10);
+        if (transport.ready()) {
+            hidraw = openHidraw(path, sizeof(path));
+        }
+    }
+    if (hidraw < 0) {
+        fprintf(stderr, "cannot find hidraw node\n");
+        return 1;
+    }
+    if (not checkEnumeration(hidraw, path) or not checkRoundTrip(transport, hidraw)) {
+        fprintf(stderr, "smoke test failed\n");
+        transport.end();
+        return 1;
+    }
+    input.reset();
+    feature.reset();
+
+    // Latency, one report in flight
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        report[1] = static_cast<uint8_t>(i);
+        auto start = nowNs();
+        if (transport.send(report, sizeof(report)) != sizeof(report)) {
+            transport.poll(1);
+            continue;
+        }
+        if (read(hidraw, buf, sizeof(buf)) > 0) {
+            input.add(nowNs() - start);
+        }
+        // Reap the completion
+        while (transport.pending() > 0 and transport.poll(1) >= 0);
+    }
+
+    // Throughput, all slots in flight
+    std::thread reader([&]() {
+        uint8_t rbuf[64];
+        while (running and read(hidraw, rbuf, sizeof(rbuf)) > 0) {
+            received++;
+        }
+    });
+    auto begin = millis();
+    while (millis() - begin < THROUGHPUT_MS) {
+        if (transport.send(report, sizeof(report)) == sizeof(report)) {
+            sent++;
+        } else {
+            transport.poll(1);
+        }
+    }
+    while (transport.pending() > 0 and transport.poll(10) >= 0);
+    auto rate = received.load() * 1000ull / THROUGHPUT_MS;
+
+    // Feature requests need the event loop running while ioctl() blocks
+    std::thread loop([&]() {
+        while (running) {
+            transport.poll(10);
+            transport.update();
+        }
+    });
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        buf[0] = 0x03;
+        auto start = nowNs();
+        if (ioctl(hidraw, HIDIOCGFEATURE(48), buf) > 0) {
+            feature.add(nowNs() - start);
+        }
+    }
+    running = false;
+    loop.join();
+    // Unblock the reader
+    close(hidraw);
+    transport.end();
+    reader.join();
+    print("input", input);
+    printf("%-8s sent=%lu received=%lu rate=%llu reports/s\n", "tput",
+           static_cast<unsigned long>(sent), static_cast<unsigned long>(received.load()),
+           static_cast<unsigned long long>(rate));
+    print("feature", feature);
+    return 0;
+}
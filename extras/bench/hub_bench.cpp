@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** hub_bench.cpp
+ *  Device-side CPU cost per pad of Hub compared with one thread per pad.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/hub_bench.cpp src/ds4/Hub.cpp src/ds4/TransportSocket.cpp \
+ *        src/ds4/Controller.cpp src/utils/crc32.cpp src/utils/trace.cpp \
+ *        -o hub_bench
+ *
+ *  Every pad is a Controller on a TransportSocket (socketpair()) that sends
+ *  a report every 4ms. One host thread reads all of them through epoll.
+ *  - hub: the pads are spread over one Hub per CPU, each on its own pinned
+ *    thread, ticking every 1ms.
+ *  - threads: every pad has its own thread that sleeps in
+ *    TransportSocket::poll() until its next report is due.
+ *  CPU time of the device threads is divided by the number of reports the
+ *  host received, so a flat column means the per-pad cost doesn't grow with
+ *  the number of pads.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Hub.hpp"
+#include "ds4/Transport.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace rds4;
+
+static const uint32_t DURATION = 2000;
+static const uint8_t PAD_INTERVAL = 4;
+static const uint8_t PAD_COUNTS[] = {1, 8, 32, 64};
+
+struct Pad {
+    ds4::AuthenticatorNull auth;
+    ds4::TransportSocket transport;
+    ds4::Controller controller;
+    std::unique_ptr<ds4::SocketHost> host;
+    uint8_t value;
+
+    Pad() : transport(&auth), controller(&transport), value(0) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+        this->transport.begin(fds[0]);
+        this->host.reset(new ds4::SocketHost(fds[1]));
+        this->controller.begin();
+    }
+};
+
+static uint64_t nowNs(clockid_t clock=CLOCK_MONOTONIC) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void tick(void *context) {
+    auto *pad = static_cast<Pad *>(context);
+    pad->controller.update();
+    pad->controller.setAxis(ds4::Controller::AXIS_LX, pad->value++);
+    pad->controller.sendReport();
+}
+
+// Reads everything the pads send until told to stop
+static void hostLoop(std::vector<std::unique_ptr<Pad>> &pads, std::atomic<bool> &running,
+                     std::atomic<uint32_t> &received) {
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event events[32];
+    uint8_t buf[ds4::TransportSocket::REPORT_SIZE];
+    for (auto &pad : pads) {
+        struct epoll_event eev = {};
+        eev.events = EPOLLIN;
+        eev.data.ptr = pad->host.get();
+        epoll_ctl(ep, EPOLL_CTL_ADD, pad->host->getFD(), &eev);
+    }
+    while (running) {
+        int nfds = epoll_wait(ep, events, 32, 10);
+        for (int i=0; i<nfds; i++) {
+            auto *host = static_cast<ds4::SocketHost *>(events[i].data.ptr);
+            while (host->read(buf, sizeof(buf)) != 0) {
+                received++;
+            }
+        }
+    }
+    close(ep);
+}
+
+static void runHub(uint8_t count, unsigned hubCount) {
+    std::vector<std::unique_ptr<Pad>> pads;
+    std::vector<std::unique_ptr<ds4::Hub>> hubs;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running(true);
+    std::atomic<uint32_t> received(0);
+    std::atomic<uint64_t> cpu(0);
+    uint32_t missed = 0;
+    for (unsigned i=0; i<hubCount; i++) {
+        hubs.emplace_back(new ds4::Hub(1000));
+        hubs.back()->begin();
+    }
+    for (uint8_t i=0; i<count; i++) {
+        pads.emplace_back(new Pad());
+        hubs[i % hubCount]->add(&(pads.back()->transport), &tick, pads.back().get(), PAD_INTERVAL);
+    }
+    std::thread host(hostLoop, std::ref(pads), std::ref(running), std::ref(received));
+    for (unsigned i=0; i<hubCount; i++) {
+        threads.emplace_back([&, i]() {
+            ds4::Hub::pinThread(i);
+            hubs[i]->run();
+            cpu += nowNs(CLOCK_THREAD_CPUTIME_ID);
+        });
+    }
+    usleep(DURATION * 1000);
+    for (auto &hub : hubs) {
+        hub->stop();
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    running = false;
+    host.join();
+    for (auto &hub : hubs) {
+        missed += hub->getMissedTicks();
+    }
+    printf("hub      pads=%-3u hubs=%u reports=%-6u %6.2f us CPU/report missed ticks=%u\n", count, hubCount,
+           static_cast<unsigned>(received.load()), cpu.load() / 1000.0 / received.load(),
+           static_cast<unsigned>(missed));
+}
+
+static void runThreads(uint8_t count) {
+    std::vector<std::unique_ptr<Pad>> pads;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running(true), hostRunning(true);
+    std::atomic<uint32_t> received(0);
+    std::atomic<uint64_t> cpu(0);
+    for (uint8_t i=0; i<count; i++) {
+        pads.emplace_back(new Pad());
+    }
+    std::thread host(hostLoop, std::ref(pads), std::ref(hostRunning), std::ref(received));
+    for (uint8_t i=0; i<count; i++) {
+        threads.emplace_back([&, i]() {
+            auto *pad = pads[i].get();
+            uint64_t next = nowNs();
+            while (running) {
+                uint64_t now = nowNs();
+                if (now < next) {
+                    pad->transport.poll(static_cast<int>((next - now + 999999) / 1000000));
+                    continue;
+                }
+                tick(pad);
+                pad->transport.update();
+                next += PAD_INTERVAL * 1000000ull;
+            }
+            cpu += nowNs(CLOCK_THREAD_CPUTIME_ID);
+        });
+    }
+    usleep(DURATION * 1000);
+    running = false;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    hostRunning = false;
+    host.join();
+    printf("threads  pads=%-3u         reports=%-6u %6.2f us CPU/report\n", count,
+           static_cast<unsigned>(received.load()), cpu.load() / 1000.0 / received.load());
+}
+
+int main() {
+    unsigned cpus = std::thread::hardware_concurrency();
+    cpus = cpus == 0 ? 1 : cpus;
+    for (auto count : PAD_COUNTS) {
+        runHub(count, count < cpus ? count : cpus);
+    }
+    for (auto count : PAD_COUNTS) {
+        runThreads(count);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** loopback_bench.cpp
+ *  Per-report overhead of the library over TransportLoopback (no syscalls).
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/loopback_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/ds4/Controller.cpp src/ds4/AuthenticatorSim.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o loopback_bench
+ *
+ *  Measures:
+ *  - input: Controller::sendReport() on one thread, LoopbackHost::read() on
+ *    another
+ *  - input-zc: same, but the host reads reports in place (peek()/release())
+ *  - output: LoopbackHost::write() to Controller::update() (which parses
+ *    feedback in place via borrowRX())
+ *  - feature: GET_REPORT(0x03) round trip through the mailbox
+ *  - auth: whole challenge/response transactions against a zero-latency
+ *    simulated donor
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/AuthenticatorSim.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+using namespace rds4;
+
+static const uint32_t REPORTS = 1000000;
+static const uint32_t FEATURES = 100000;
+static const uint32_t TRANSACTIONS = 2000;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void rate(const char *name, uint32_t count, uint64_t ns) {
+    printf("%-8s n=%-9u %8.1f ns/op %10.0f op/s\n", name, static_cast<unsigned>(count),
+           static_cast<double>(ns) / count, count * 1e9 / ns);
+}
+
+// One auth transaction driven from the host end. Returns false on any
+// protocol error or response mismatch.
+static bool transaction(ds4::LoopbackHost &host, uint8_t seq, const uint8_t *challenge, const uint8_t *expected) {
+    ds4::AuthReport pkt;
+    ds4::AuthStatusReport status;
+    uint16_t offset;
+    uint8_t page;
+    for (offset = 0, page = 0; offset < ds4::AUTH_CHALLENGE_SIZE; offset += sizeof(pkt.data), page++) {
+        uint16_t chunk = ds4::AUTH_CHALLENGE_SIZE - offset;
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.type = ds4::Controller::SET_CHALLENGE;
+        pkt.seq = seq;
+        pkt.page = page;
+        memcpy(pkt.data, &challenge[offset], chunk > sizeof(pkt.data) ? sizeof(pkt.data) : chunk);
+        if (host.setFeature(ds4::Controller::SET_CHALLENGE, &pkt, sizeof(pkt)) < 0) {
+            return false;
+        }
+    }
+    do {
+        if (host.getFeature(ds4::Controller::GET_AUTH_STATUS, &status, sizeof(status)) < 0) {
+            return false;
+        }
+    } while (status.status == 0x10);
+    if (status.status != 0x00) {
+        return false;
+    }
+    for (offset = 0; offset < ds4::AUTH_RESPONSE_SIZE; offset += sizeof(pkt.data)) {
+        uint16_t chunk = ds4::AUTH_RESPONSE_SIZE - offset;
+        if (host.getFeature(ds4::Controller::GET_RESPONSE, &pkt, sizeof(pkt)) < 0) {
+            return false;
+        }
+        if (memcmp(pkt.data, &expected[offset], chunk > sizeof(pkt.data) ? sizeof(pkt.data) : chunk) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    ds4::SimConfig config = {};
+    config.challengePageSize = 0x38;
+    config.responsePageSize = 0x38;
+    config.fitOK = true;
+    config.resetOK = true;
+    config.writeLatency = {ds4::SimLatency::FIXED, 0, 0, 0};
+    config.readLatency = {ds4::SimLatency::FIXED, 0, 0, 0};
+    config.statusLatency = {ds4::SimLatency::FIXED, 0, 0, 0};
+    config.signTime = {ds4::SimLatency::FIXED, 0, 0, 0};
+    static ds4::AuthenticatorSim sim(config);
+    static ds4::TransportLoopback transport(&sim);
+    static ds4::Controller controller(&transport);
+    ds4::LoopbackHost host(&transport);
+    std::atomic<bool> running(true);
+    static uint8_t challenge[ds4::AUTH_CHALLENGE_SIZE];
+    static uint8_t expected[ds4::AUTH_RESPONSE_SIZE];
+    uint8_t buf[64];
+    uint32_t received = 0, failed = 0;
+
+    controller.begin();
+    transport.begin();
+
+    // Input: device thread produces as fast as the ring allows
+    auto start = nowNs();
+    std::thread device([&]() {
+        for (uint32_t i=0; i<REPORTS; i++) {
+            controller.setKey(ds4::Controller::KEY_XRO, i & 1);
+            while (not controller.sendReport()) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    while (received < REPORTS) {
+        if (host.read(buf, sizeof(buf)) != 0) {
+            received++;
+        } else {
+            // Matters when both threads share a core
+            std::this_thread::yield();
+        }
+    }
+    device.join();
+    rate("input", received, nowNs() - start);
+
+    // Same, but the host inspects reports in place
+    received = 0;
+    start = nowNs();
+    device = std::thread([&]() {
+        for (uint32_t i=0; i<REPORTS; i++) {
+            controller.setKey(ds4::Controller::KEY_XRO, i & 1);
+            while (not controller.sendReport()) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    while (received < REPORTS) {
+        uint8_t len;
+        auto *report = host.peek(&len);
+        if (report != nullptr) {
+            received += (report[0] == ds4::Controller::IN_REPORT);
+            host.release();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    device.join();
+    rate("input-zc", received, nowNs() - start);
+
+    // Output and feature: device thread runs the usual main loop
+    std::thread loop([&]() {
+        while (running) {
+            transport.update();
+            if (not transport.available() and not transport.dispatch()) {
+                std::this_thread::yield();
+            }
+            controller.update();
+        }
+    });
+    memset(buf, 0, sizeof(buf));
+    buf[0] = ds4::Controller::OUT_FEEDBACK;
+    start = nowNs();
+    for (uint32_t i=0; i<REPORTS / 10; i++) {
+        while (host.write(buf, 32) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    rate("output", REPORTS / 10, nowNs() - start);
+
+    start = nowNs();
+    for (uint32_t i=0; i<FEATURES; i++) {
+        if (host.getFeature(0x03, buf, 48) != 48) {
+            failed++;
+        }
+    }
+    rate("feature", FEATURES, nowNs() - start);
+
+    ds4::SimRandom rng(42);
+    start = nowNs();
+    for (uint32_t i=0; i<TRANSACTIONS; i++) {
+        for (auto &b : challenge) {
+            b = rng.next();
+        }
+        ds4::AuthenticatorSim::fillResponse(challenge, 0, expected, sizeof(expected));
+        if (not transaction(host, static_cast<uint8_t>(i + 1), challenge, expected)) {
+            failed++;
+        }
+    }
+    rate("auth", TRANSACTIONS, nowNs() - start);
+    running = false;
+    loop.join();
+    printf("failed: %u\n", static_cast<unsigned>(failed));
+    return failed != 0;
+}
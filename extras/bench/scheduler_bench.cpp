@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** scheduler_bench.cpp
+ *  Input-to-pickup latency of free-running sends vs. ReportScheduler.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/scheduler_bench.cpp src/api/ReportScheduler.cpp \
+ *        src/ds4/TransportLoopback.cpp src/ds4/Controller.cpp \
+ *        src/utils/crc32.cpp src/utils/estimator.cpp src/utils/polltracker.cpp \
+ *        src/utils/trace.cpp -o scheduler_bench
+ *
+ *  A host thread polls a TransportLoopback every 1ms (absolute deadlines,
+ *  so the OS adds some real jitter). The device samples its inputs in a
+ *  hook, which stamps the time into the stick axes of the report.
+ *  Latency is the time from sampling to the host picking the report up.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "api/ReportScheduler.hpp"
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <sched.h>
+#include <thread>
+
+using namespace rds4;
+
+static const uint32_t DURATION = 5000;
+static const uint32_t POLL_INTERVAL = 1000;
+
+static ds4::Controller *target;
+
+static void sample() {
+    // Stamp the sampling time into the stick axes
+    uint32_t now = micros();
+    for (uint8_t i=0; i<4; i++) {
+        target->setAxis(ds4::Controller::AXIS_LX + i, (now >> (i * 8)) & 0xff);
+    }
+}
+
+static void run(const char *name, uint8_t depth, api::TXPolicy policy, bool scheduled) {
+    static ds4::AuthenticatorNull auth;
+    ds4::TransportLoopback transport(&auth, depth, policy);
+    ds4::Controller controller(&transport);
+    api::ReportScheduler scheduler(&controller, &transport);
+    ds4::LoopbackHost host(&transport);
+    std::atomic<bool> running(true);
+    utils::Log2Histogram latency;
+    latency.reset();
+    controller.begin();
+    target = &controller;
+    scheduler.attachSampleCallback(&sample);
+
+    std::thread device([&]() {
+        while (running) {
+            if (scheduled) {
+                scheduler.update();
+            } else {
+                sample();
+                controller.sendReport();
+            }
+            sched_yield();
+        }
+    });
+    timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (uint32_t i=0; i<DURATION; i++) {
+        ds4::InputReport report;
+        deadline.tv_nsec += POLL_INTERVAL * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+        if (host.read(&report, sizeof(report)) != 0) {
+            auto now = micros();
+            // Skip the warmup
+            if (i >= DURATION / 5) {
+                uint32_t stamp = report.sticks[0] | (report.sticks[1] << 8) | (report.sticks[2] << 16) | (static_cast<uint32_t>(report.sticks[3]) << 24);
+                latency.add(now - stamp);
+            }
+        }
+    }
+    running = false;
+    device.join();
+    printf("%-22s delivered=%-5u avg=%-5lu p99<=%-5lu us  ",
+           name, static_cast<unsigned>(latency.count),
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)));
+    if (scheduled) {
+        printf("locked=%d interval=%lu jitter=%lu lead=%lu missed=%lu\n", scheduler.isLocked(),
+               static_cast<unsigned long>(scheduler.getHostInterval()),
+               static_cast<unsigned long>(scheduler.getHostJitter()),
+               static_cast<unsigned long>(scheduler.getLead()),
+               static_cast<unsigned long>(scheduler.getMissed()));
+    } else {
+        printf("\n");
+    }
+}
+
+int main() {
+    run("free-run depth=2", 2, api::TXPolicy::DROP_NEWEST, false);
+    run("free-run drop-oldest=1", 1, api::TXPolicy::DROP_OLDEST, false);
+    run("scheduled", 2, api::TXPolicy::DROP_NEWEST, true);
+    return 0;
+}
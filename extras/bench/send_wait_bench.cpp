@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** send_wait_bench.cpp
+ *  CPU cost and latency of sendBlocking() when the host is the bottleneck.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/send_wait_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o send_wait_bench
+ *
+ *  The host takes one report per 1ms. The device keeps a shallow queue full
+ *  with sendBlocking(), once sleeping on the completion event (the default)
+ *  and once spinning on sched_yield() (the old behaviour). Reports the device
+ *  thread's CPU time and the time each sendBlocking() call took. Last, the
+ *  host stops reading and a 20ms sendTimed() must give up on time.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <sched.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rds4;
+
+static const uint32_t REPORTS = 2000;
+static const uint8_t DEPTH = 2;
+
+static uint64_t nowNs(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Polls like sendBlocking() did before waitTX() existed
+class SpinningLoopback : public ds4::TransportLoopback {
+public:
+    using ds4::TransportLoopback::TransportLoopback;
+protected:
+    void waitTX(uint32_t timeout) override {
+        sched_yield();
+    }
+};
+
+static void run(const char *name, ds4::TransportLoopback &transport) {
+    ds4::LoopbackHost host(&transport);
+    std::atomic<bool> running(true);
+    utils::Log2Histogram latency;
+    uint8_t report[64] = {0x01};
+    uint32_t failed = 0;
+    latency.reset();
+    std::thread consumer([&]() {
+        uint8_t buf[64];
+        while (running) {
+            host.read(buf, sizeof(buf));
+            usleep(1000);
+        }
+    });
+    auto cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+    auto start = nowNs(CLOCK_MONOTONIC);
+    for (uint32_t i=0; i<REPORTS; i++) {
+        auto t = nowNs(CLOCK_MONOTONIC);
+        if (transport.sendBlocking(report, sizeof(report)) == 0) {
+            failed++;
+        }
+        latency.add((nowNs(CLOCK_MONOTONIC) - t) / 1000);
+    }
+    cpu = nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    auto wall = nowNs(CLOCK_MONOTONIC) - start;
+    running = false;
+    consumer.join();
+    printf("%-6s cpu=%5.1f%% of wall  send avg=%-5lu p99<=%-5lu max=%-6lu us  failed=%u\n",
+           name, 100.0 * cpu / wall,
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)),
+           static_cast<unsigned long>(latency.max),
+           static_cast<unsigned>(failed));
+}
+
+int main() {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportLoopback event(&auth, DEPTH);
+    static SpinningLoopback spin(&auth, DEPTH);
+    uint8_t report[64] = {0x01};
+
+    run("event", event);
+    run("spin", spin);
+
+    // Nobody is reading now, so the queue stays full
+    while (event.send(report, sizeof(report)) != 0);
+    auto start = nowNs(CLOCK_MONOTONIC);
+    auto sent = event.sendTimed(report, sizeof(report), 20);
+    printf("stalled host: sendTimed(20ms) returned %u after %.1f ms\n",
+           static_cast<unsigned>(sent), (nowNs(CLOCK_MONOTONIC) - start) / 1e6);
+    return sent != 0;
+}
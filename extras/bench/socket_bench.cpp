@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** socket_bench.cpp
+ *  Throughput, syscall count and staleness of TransportSocket.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/socket_bench.cpp src/ds4/TransportSocket.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o socket_bench
+ *
+ *  Both ends run in this process over a socketpair(), the device on its
+ *  own thread. The socket calls are wrapped below to count syscalls (send,
+ *  recv, sendmmsg and recvmmsg; polls are not counted).
+ *  - throughput: the device sends reports as fast as the socket takes
+ *    them, the host reads them as fast as they come. "unbatched" sends and
+ *    receives one frame per syscall, "host batch" only batches on the host
+ *    end, "batched" also sends 8 reports per device loop iteration with one
+ *    flush (corked).
+ *  - stale: the device produces a report every 1ms, the host reads one
+ *    report every 0.5ms but stalls for 30ms every 200ms. Latency is the age
+ *    of a report when the host reads it.
+ *  - feature/output: GET_REPORT(0x03) round trips and OUT reports, with
+ *    the device end sleeping in poll()
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rds4;
+
+static std::atomic<uint32_t> syscalls(0);
+
+// Wrappers that take precedence over libc for the whole program
+extern "C" {
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    syscalls++;
+    return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    syscalls++;
+    return syscall(SYS_recvfrom, fd, buf, len, flags, nullptr, nullptr);
+}
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags) {
+    syscalls++;
+    return syscall(SYS_sendmmsg, fd, msgs, vlen, flags);
+}
+int recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout) {
+    syscalls++;
+    return syscall(SYS_recvmmsg, fd, msgs, vlen, flags, timeout);
+}
+}
+
+static const uint32_t REPORTS = 500000;
+static const uint8_t GROUP = 8;
+static const uint32_t STALE_DURATION = 3000000;
+static const uint32_t FEATURES = 20000;
+
+static std::atomic<uint32_t> outputs(0);
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void waitReadable(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ::poll(&pfd, 1, 10);
+}
+
+static void throughput(const char *name, uint8_t deviceBatch, uint8_t hostBatch, bool corked) {
+    static ds4::AuthenticatorNull auth;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    ds4::TransportSocket transport(&auth, nullptr, ds4::TransportSocket::TX_SLOTS, api::TXPolicy::DROP_NEWEST);
+    ds4::SocketHost host(fds[1]);
+    uint8_t buf[64];
+    uint32_t received = 0;
+    transport.begin(fds[0]);
+    transport.setMaxBatch(deviceBatch);
+    transport.setCorked(corked);
+    host.setMaxBatch(hostBatch);
+    syscalls = 0;
+    auto start = nowNs();
+    std::thread device([&]() {
+        uint8_t report[64] = {0x01};
+        for (uint32_t i=0; i<REPORTS; i++) {
+            report[1] = static_cast<uint8_t>(i);
+            while (transport.send(report, sizeof(report)) == 0) {
+                // Queue full, wait for room
+                transport.flush();
+                transport.poll(10);
+            }
+            if (corked and (i % GROUP) == GROUP - 1) {
+                transport.flush();
+            }
+        }
+        while (not transport.flush()) {
+            transport.poll(10);
+        }
+    });
+    while (received < REPORTS) {
+        if (host.read(buf, sizeof(buf)) != 0) {
+            received++;
+        } else {
+            waitReadable(host.getFD());
+        }
+    }
+    device.join();
+    auto ns = nowNs() - start;
+    printf("%-10s %9.0f reports/s %5.2f syscalls/report\n", name, received * 1e9 / ns,
+           static_cast<double>(syscalls.load()) / received);
+}
+
+static void stale(const char *name, uint8_t depth, api::TXPolicy policy) {
+    static ds4::AuthenticatorNull auth;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    ds4::TransportSocket transport(&auth, nullptr, depth, policy);
+    ds4::SocketHost host(fds[1]);
+    utils::Log2Histogram latency;
+    std::atomic<bool> running(true);
+    uint8_t buf[64];
+    uint32_t produced = 0;
+    transport.begin(fds[0]);
+    latency.reset();
+    std::thread device([&]() {
+        uint8_t report[64] = {0x01};
+        uint64_t next = nowNs();
+        while (running) {
+            uint64_t now = nowNs();
+            if (now < next) {
+                transport.poll(static_cast<int>((next - now + 999999) / 1000000));
+                continue;
+            }
+            uint32_t stamp = static_cast<uint32_t>(now / 1000);
+            memcpy(&report[1], &stamp, sizeof(stamp));
+            transport.send(report, sizeof(report));
+            transport.update();
+            produced++;
+            next += 1000000;
+        }
+    });
+    auto begin = nowNs();
+    uint64_t lastStall = begin;
+    for (;;) {
+        uint64_t now = nowNs();
+        if (now - begin > STALE_DURATION * 1000ull) {
+            break;
+        }
+        if (now - lastStall > 200000000ull) {
+            usleep(30000);
+            lastStall = nowNs();
+        }
+        if (host.read(buf, sizeof(buf)) != 0) {
+            uint32_t stamp;
+            memcpy(&stamp, &buf[1], sizeof(stamp));
+            latency.add(static_cast<uint32_t>(nowNs() / 1000) - stamp);
+        }
+        usleep(500);
+    }
+    running = false;
+    device.join();
+    printf("%-11s depth=%-2u produced=%-5u delivered=%-5u dropped=%-5u avg=%-6lu p99<=%-6lu max=%lu us\n", name,
+           depth, static_cast<unsigned>(produced), static_cast<unsigned>(latency.count), static_cast<unsigned>(transport.getDropped()),
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)),
+           static_cast<unsigned long>(latency.max));
+}
+
+// Takes OUT reports as soon as they arrive, so none get dropped
+static void onRX(void *context) {
+    auto *transport = static_cast<ds4::TransportSocket *>(context);
+    uint8_t report[64];
+    while (transport->recv(report, sizeof(report)) != 0) {
+        outputs++;
+    }
+}
+
+static bool control() {
+    static ds4::AuthenticatorNull auth;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds);
+    ds4::TransportSocket transport(&auth);
+    ds4::SocketHost host(fds[1]);
+    std::atomic<bool> running(true);
+    uint8_t buf[64];
+    uint32_t failed = 0;
+    transport.begin(fds[0]);
+    transport.attachRXCallback(&onRX, &transport);
+    std::thread device([&]() {
+        while (running) {
+            transport.poll(10);
+        }
+    });
+    syscalls = 0;
+    auto start = nowNs();
+    for (uint32_t i=0; i<FEATURES; i++) {
+        if (host.getFeature(0x03, buf, 48) != 48) {
+            failed++;
+        }
+    }
+    auto ns = nowNs() - start;
+    printf("feature    %9.0f requests/s %5.2f syscalls/request\n", FEATURES * 1e9 / ns,
+           static_cast<double>(syscalls.load()) / FEATURES);
+    // Unknown report, should stall
+    failed += host.getFeature(0x42, buf, sizeof(buf)) != -1;
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x05;
+    for (uint32_t i=0; i<FEATURES; i++) {
+        while (host.write(buf, 32) == 0) {
+            std::this_thread::yield();
+        }
+    }
+    while (outputs.load() < FEATURES and nowNs() - start < 10000000000ull) {
+        std::this_thread::yield();
+    }
+    failed += outputs.load() != FEATURES;
+    running = false;
+    device.join();
+    printf("control failed: %u\n", static_cast<unsigned>(failed));
+    return failed == 0;
+}
+
+int main() {
+    throughput("unbatched", 1, 1, false);
+    throughput("host batch", 16, 16, false);
+    throughput("batched", 16, 16, true);
+    stale("drop-newest", 16, api::TXPolicy::DROP_NEWEST);
+    stale("drop-oldest", 1, api::TXPolicy::DROP_OLDEST);
+    return control() ? 0 : 1;
+}
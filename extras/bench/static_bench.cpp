@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** static_bench.cpp
+ *  Controller (virtual transport calls) compared with StaticController.
+ *
+ *  Build (from the repository root), with and without -flto:
+ *    g++ -std=gnu++11 -O2 -flto -DRDS4_LINUX -Isrc \
+ *        extras/bench/static_bench.cpp src/ds4/Controller.cpp \
+ *        src/ds4/TransportLoopback.cpp src/api/UnoJoyAPI.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o static_bench
+ *
+ *  One frame is what a typical sketch does every loop: drain feedback, set
+ *  the buttons and sticks, send a report. First checks that both kinds of
+ *  controller send the same reports over TransportLoopback, then times
+ *  frames over a transport that does nothing, so that only the controller
+ *  and the dispatch to the transport are left.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+
+using namespace rds4;
+
+static const uint32_t ROUNDS = 1000000;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Does nothing, so the time left is the controller's own plus the cost of
+// reaching the transport. Defined in the class like a header-only transport,
+// with the report path final like the transports of the library.
+class NullTransport : public api::Transport {
+public:
+    bool available() override final {
+        return false;
+    }
+    uint8_t send(const void *buf, uint8_t len) override final {
+        return len;
+    }
+    uint8_t recv(void *buf, uint8_t len) override final {
+        return 0;
+    }
+protected:
+    uint8_t reply(const void *buf, uint8_t len) override {
+        return 0;
+    }
+    uint8_t check(void *buf, uint8_t len) override {
+        return 0;
+    }
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return false;
+    }
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override {
+        return false;
+    }
+};
+
+template <class C>
+static void frame(C &controller, uint32_t i) {
+    controller.update();
+    controller.setButtonsUniversal((i * 0x9e3779b1u) >> 19);
+    controller.setStick(api::Stick::L, i & 0xff, (i >> 8) & 0xff);
+    controller.sendReport();
+}
+
+template <class C>
+static double bench(C &controller, ds4::ReportFormat format) {
+    controller.setReportFormat(format);
+    uint64_t start = nowNs();
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        frame(controller, i);
+    }
+    return static_cast<double>(nowNs() - start) / ROUNDS;
+}
+
+// Both kinds of controller must send the same reports
+static bool check() {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportLoopback dynTransport(&auth), staticTransport(&auth);
+    static ds4::Controller dyn(&dynTransport);
+    static ds4::StaticController<ds4::TransportLoopback> fixed(&staticTransport);
+    ds4::LoopbackHost dynHost(&dynTransport), staticHost(&staticTransport);
+    uint8_t a[ds4::Controller::BT_REPORT_SIZE], b[ds4::Controller::BT_REPORT_SIZE];
+    dyn.begin();
+    fixed.begin();
+    for (auto format : {ds4::ReportFormat::USB, ds4::ReportFormat::BT}) {
+        dyn.setReportFormat(format);
+        fixed.setReportFormat(format);
+        for (uint32_t i=0; i<1000; i++) {
+            frame(dyn, i);
+            frame(fixed, i);
+            uint8_t lenA = dynHost.read(a, sizeof(a));
+            uint8_t lenB = staticHost.read(b, sizeof(b));
+            // Stop before the timestamp, the two reports are taken at
+            // different times
+            if (lenA != lenB or lenA < 12 or memcmp(a, b, 10) != 0) {
+                printf("report %u differs\n", static_cast<unsigned>(i));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    static NullTransport dynTransport, staticTransport;
+    static ds4::Controller dyn(&dynTransport);
+    static ds4::StaticController<NullTransport> fixed(&staticTransport);
+
+    if (not check()) {
+        return 1;
+    }
+    dyn.begin();
+    fixed.begin();
+    for (auto format : {ds4::ReportFormat::USB, ds4::ReportFormat::BT}) {
+        const char *name = format == ds4::ReportFormat::USB ? "USB" : "BT";
+        double d = bench(dyn, format);
+        double s = bench(fixed, format);
+        printf("%-3s Controller %6.1f ns/frame  StaticController %6.1f ns/frame\n", name, d, s);
+    }
+    return 0;
+}
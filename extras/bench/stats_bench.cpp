@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** stats_bench.cpp
+ *  Cost of the RDS4_STATS counters and what they pick up.
+ *
+ *  Build (from the repository root), once with and once without
+ *  -DRDS4_STATS:
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -DRDS4_STATS -Isrc \
+ *        extras/bench/stats_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/ds4/Controller.cpp src/utils/crc32.cpp src/utils/trace.cpp \
+ *        src/utils/stats.cpp -o stats_bench
+ *
+ *  Times Controller::sendReport() over TransportLoopback with the host
+ *  draining every report, then provokes each kind of event once (full
+ *  queue, send timeout, refused and truncated OUT reports, bad feedback,
+ *  stalled feature request) and prints the counters.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Controller.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/stats.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+using namespace rds4;
+
+static const uint32_t ROUNDS = 1000000;
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void print(const char *line) {
+    fputs(line, stdout);
+}
+
+int main() {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportLoopback transport(&auth, 4, api::TXPolicy::DROP_NEWEST);
+    static ds4::Controller controller(&transport);
+    ds4::LoopbackHost host(&transport);
+    utils::TransportStats ts;
+    utils::ControllerStats cs;
+    utils::AuthStats as;
+    uint8_t buf[ds4::Controller::BT_REPORT_SIZE];
+    uint64_t start;
+
+    controller.begin();
+    start = nowNs();
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        controller.setAxis(ds4::Controller::AXIS_LX, static_cast<uint8_t>(i));
+        controller.sendReport();
+        host.read(buf, sizeof(buf));
+    }
+    printf("sendReport() %6.1f ns\n", static_cast<double>(nowNs() - start) / ROUNDS);
+
+    // Fill the queue, then one refused send() and one timed out blocking send
+    while (controller.sendReport()) {}
+    transport.setSendTimeout(2);
+    controller.sendReportBlocking();
+    while (host.read(buf, sizeof(buf)) != 0) {}
+    // Bad feedback, then more OUT reports than the ring holds
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x42;
+    host.write(buf, 32);
+    controller.update();
+    buf[0] = ds4::Controller::OUT_FEEDBACK;
+    while (host.write(buf, 32) != 0) {}
+    controller.update();
+    // Truncated OUT report
+    host.write(buf, 32);
+    transport.recv(buf, 8);
+    // Unknown feature report, served from another thread
+    std::atomic<bool> running(true);
+    std::thread device([&]() {
+        while (running) {
+            transport.update();
+            std::this_thread::yield();
+        }
+    });
+    host.getFeature(0x42, buf, sizeof(buf));
+    running = false;
+    device.join();
+
+    if (not transport.getTransportStats(&ts) or not controller.getStats(&cs) or not transport.getAuthStats(&as)) {
+        printf("built without RDS4_STATS\n");
+        return 0;
+    }
+    print("-- transport --\n");
+    utils::statsDump(ts, &print);
+    print("-- controller --\n");
+    utils::statsDump(cs, &print);
+    print("-- auth --\n");
+    utils::statsDump(as, &print);
+    return 0;
+}
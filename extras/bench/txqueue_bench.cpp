@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** txqueue_bench.cpp
+ *  Report latency vs. drop rate for different TX queue depths and policies.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc \
+ *        extras/bench/txqueue_bench.cpp src/ds4/TransportLoopback.cpp \
+ *        src/utils/crc32.cpp src/utils/trace.cpp -o txqueue_bench
+ *
+ *  Runs on a virtual clock over TransportLoopback. The device produces a
+ *  report every 1ms and runs its main loop every 250us. The host picks up
+ *  at most one report per 1ms poll, but now and then stalls for 5-20ms
+ *  (e.g. a busy game thread). Latency is the age of a report when the host
+ *  reads it, in virtual us.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/AuthenticatorSim.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace rds4;
+
+static const uint32_t DURATION = 60000000;
+static const uint32_t TICK = 250;
+static const uint32_t PRODUCE_INTERVAL = 4000;
+static const uint32_t POLL_INTERVAL = 1000;
+// Chance of a stall per poll (1/1000)
+static const uint16_t STALL_PERMILLE = 10;
+
+static void run(uint8_t depth, api::TXPolicy policy) {
+    static ds4::AuthenticatorNull auth;
+    ds4::TransportLoopback transport(&auth, depth, policy);
+    ds4::LoopbackHost host(&transport);
+    ds4::SimRandom rng(0x5eed);
+    utils::Log2Histogram latency;
+    uint32_t produced = 0;
+    uint32_t nextPoll = 0;
+    uint8_t report[64] = {0x01};
+    latency.reset();
+    for (uint32_t now=0; now<DURATION; now+=TICK) {
+        // Device main loop
+        transport.update();
+        if (now % PRODUCE_INTERVAL == 0) {
+            memcpy(&report[1], &now, sizeof(now));
+            produced++;
+            // Refused reports are counted in getDropped()
+            transport.send(report, sizeof(report));
+        }
+        // Host
+        if (now >= nextPoll) {
+            uint8_t buf[64];
+            uint32_t stamp;
+            if (host.read(buf, sizeof(buf)) != 0) {
+                memcpy(&stamp, &buf[1], sizeof(stamp));
+                latency.add(now - stamp);
+            }
+            nextPoll = now + POLL_INTERVAL;
+            if (rng.chance(STALL_PERMILLE)) {
+                nextPoll += 5000 + rng.below(35000);
+            }
+        }
+    }
+    printf("%-11s depth=%-3u delivered=%-6u dropped=%5.2f%% avg=%-6lu p99<=%-6lu max=%lu\n",
+           policy == api::TXPolicy::DROP_OLDEST ? "drop-oldest" : "drop-newest",
+           depth, static_cast<unsigned>(latency.count),
+           100.0 * transport.getDropped() / produced,
+           static_cast<unsigned long>(latency.average()),
+           static_cast<unsigned long>(latency.percentile(99)),
+           static_cast<unsigned long>(latency.max));
+}
+
+int main() {
+    const uint8_t depths[] = {1, 2, 4, 8, 16, 64};
+    const api::TXPolicy policies[] = {api::TXPolicy::DROP_NEWEST, api::TXPolicy::DROP_OLDEST};
+    printf("latency in virtual us\n");
+    for (auto policy : policies) {
+        for (auto depth : depths) {
+            run(depth, policy);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** uhid_bench.cpp
+ *  End-to-end latency of TransportUHID, measured through hidraw.
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -pthread -DRDS4_LINUX -Isrc \
+ *        extras/bench/uhid_bench.cpp src/ds4/TransportUHID.cpp \
+ *        src/ds4/ReportDescriptor.cpp src/utils/crc32.cpp \
+ *        src/utils/trace.cpp -o uhid_bench
+ *
+ *  Needs access to /dev/uhid and the resulting /dev/hidraw* node (usually
+ *  root).
+ *
+ *  Measures:
+ *  - input: TransportUHID::send() until the report is read from hidraw
+ *  - feature: HIDIOCGFEATURE round trip through the transport's event loop
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ds4/Authenticator.hpp"
+#include "ds4/Transport.hpp"
+#include "utils/trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace rds4;
+
+static const char *DEVICE_NAME = "RDS4 UHID bench";
+static const uint32_t ROUNDS = 10000;
+
+static uint32_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+// Find /dev/hidrawN of the device by its name
+static int openHidraw() {
+    char path[300], line[256];
+    DIR *dir = opendir("/sys/class/hidraw");
+    struct dirent *ent;
+    int fd = -1;
+    if (dir == nullptr) {
+        return -1;
+    }
+    while (fd < 0 and (ent = readdir(dir)) != nullptr) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/uevent", ent->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == nullptr) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            if (strncmp(line, "HID_NAME=", 9) == 0 and strncmp(line + 9, DEVICE_NAME, strlen(DEVICE_NAME)) == 0) {
+                snprintf(path, sizeof(path), "/dev/%s", ent->d_name);
+                fd = open(path, O_RDWR | O_CLOEXEC);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return fd;
+}
+
+static void print(const char *name, const utils::Log2Histogram &h) {
+    if (h.count == 0) {
+        printf("%-8s no samples\n", name);
+        return;
+    }
+    printf("%-8s n=%-6u avg=%-8lu p50<=%-8lu p99<=%-8lu max=%lu (ns)\n", name,
+           static_cast<unsigned>(h.count), static_cast<unsigned long>(h.average()),
+           static_cast<unsigned long>(h.percentile(50)),
+           static_cast<unsigned long>(h.percentile(99)),
+           static_cast<unsigned long>(h.max));
+}
+
+int main() {
+    static ds4::AuthenticatorNull auth;
+    static ds4::TransportUHID transport(&auth, DEVICE_NAME);
+    utils::Log2Histogram input, feature;
+    std::atomic<bool> running(true);
+    uint8_t report[64] = {0x01};
+    uint8_t buf[64];
+    int hidraw = -1;
+
+    transport.begin();
+    if (transport.getFD() < 0) {
+        fprintf(stderr, "cannot create UHID device\n");
+        return 1;
+    }
+    // Wait for the kernel to start the device
+    for (int i=0; i<200 and hidraw < 0; i++) {
+        transport.poll(10);
+        if (transport.ready()) {
+            hidraw = openHidraw();
+        }
+    }
+    if (hidraw < 0) {
+        fprintf(stderr, "cannot find hidraw node\n");
+        return 1;
+    }
+    // The event loop serves feature requests while the main thread waits in ioctl()
+    std::thread loop([&]() {
+        while (running) {
+            transport.poll(10);
+            transport.update();
+        }
+    });
+    input.reset();
+    feature.reset();
+    // Give the loop thread a moment to see UHID_OPEN
+    usleep(100000);
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        report[1] = static_cast<uint8_t>(i);
+        auto start = nowNs();
+        if (transport.send(report, sizeof(report)) != sizeof(report)) {
+            continue;
+        }
+        if (read(hidraw, buf, sizeof(buf)) > 0) {
+            input.add(nowNs() - start);
+        }
+    }
+    for (uint32_t i=0; i<ROUNDS; i++) {
+        buf[0] = 0x03;
+        auto start = nowNs();
+        if (ioctl(hidraw, HIDIOCGFEATURE(48), buf) > 0) {
+            feature.add(nowNs() - start);
+        }
+    }
+    running = false;
+    loop.join();
+    close(hidraw);
+    print("input", input);
+    print("feature", feature);
+    return 0;
+}
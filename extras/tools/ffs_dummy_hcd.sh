@@ -0,0 +1,64 @@
+#!/bin/sh
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# ffs_dummy_hcd.sh
+# Set up a DS4 FunctionFS gadget on dummy_hcd so TransportFFS can be tested
+# without any USB device controller hardware.
+#
+# Usage (as root):
+#   ffs_dummy_hcd.sh setup      # create the gadget and mount functionfs
+#   <start the program that uses TransportFFS on /dev/ffs-ds4>
+#   ffs_dummy_hcd.sh bind       # attach the gadget to the dummy UDC
+#   ffs_dummy_hcd.sh teardown
+#
+# The gadget can only be bound after the descriptors are written to ep0,
+# i.e. after TransportFFS::begin().
+#
+# Copyright 2019 dogtopus
+
+set -e
+
+GADGET=/sys/kernel/config/usb_gadget/rds4
+FFS=/dev/ffs-ds4
+UDC=${UDC:-dummy_udc.0}
+
+setup() {
+    modprobe dummy_hcd
+    modprobe libcomposite
+    mountpoint -q /sys/kernel/config || mount -t configfs none /sys/kernel/config
+    mkdir -p "$GADGET"
+    cd "$GADGET"
+    echo 0x054c > idVendor
+    echo 0x05c4 > idProduct
+    echo 0x0100 > bcdDevice
+    echo 0x0200 > bcdUSB
+    mkdir -p strings/0x409
+    echo "Sony Computer Entertainment" > strings/0x409/manufacturer
+    echo "Wireless Controller" > strings/0x409/product
+    mkdir -p configs/c.1/strings/0x409
+    echo "DS4" > configs/c.1/strings/0x409/configuration
+    echo 500 > configs/c.1/MaxPower
+    mkdir -p functions/ffs.ds4
+    [ -e configs/c.1/ffs.ds4 ] || ln -s functions/ffs.ds4 configs/c.1/
+    mkdir -p "$FFS"
+    mountpoint -q "$FFS" || mount -t functionfs ds4 "$FFS"
+}
+
+bind() {
+    echo "$UDC" > "$GADGET/UDC"
+}
+
+teardown() {
+    [ -e "$GADGET/UDC" ] && echo "" > "$GADGET/UDC" || true
+    mountpoint -q "$FFS" && umount "$FFS" || true
+    rm -f "$GADGET/configs/c.1/ffs.ds4"
+    rmdir "$GADGET/functions/ffs.ds4" 2>/dev/null || true
+    rmdir "$GADGET/configs/c.1/strings/0x409" "$GADGET/configs/c.1" 2>/dev/null || true
+    rmdir "$GADGET/strings/0x409" "$GADGET" 2>/dev/null || true
+}
+
+case "$1" in
+    setup) setup ;;
+    bind) bind ;;
+    teardown) teardown ;;
+    *) echo "usage: $0 setup|bind|teardown" >&2; exit 1 ;;
+esac
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** trace_decode.cpp
+ *  Host-side decoder for auth traces printed by utils::traceDump().
+ *
+ *  Build (from the repository root):
+ *    g++ -std=gnu++11 -O2 -DRDS4_LINUX -Isrc extras/tools/trace_decode.cpp \
+ *        src/utils/trace.cpp src/ds4/AuthTrace.cpp -o trace_decode
+ *
+ *  Usage:
+ *    trace_decode < dump.txt
+ *
+ *  Lines that don't look like events (e.g. other serial output) are skipped.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "utils/trace.hpp"
+#include "ds4/AuthTrace.hpp"
+
+#include <cstdio>
+
+using namespace rds4;
+
+static void print(const char *str) {
+    fputs(str, stdout);
+}
+
+int main(int argc, char *argv[]) {
+    static ds4::AuthTraceDecoder decoder;
+    char line[128];
+    unsigned long time;
+    unsigned type, a, b;
+    unsigned long count = 0;
+    while (fgets(line, sizeof(line), stdin) != nullptr) {
+        if (sscanf(line, "%8lx %2x %2x %4x", &time, &type, &a, &b) != 4) {
+            continue;
+        }
+        utils::TraceEvent ev;
+        ev.time = static_cast<uint32_t>(time);
+        ev.type = static_cast<utils::TraceType>(type);
+        ev.a = static_cast<uint8_t>(a);
+        ev.b = static_cast<uint16_t>(b);
+        decoder.feed(&ev, 1);
+        count++;
+    }
+    printf("%lu events\n", count);
+    decoder.report(&print);
+    return 0;
+}
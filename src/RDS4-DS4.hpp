@@ -8,5 +8,10 @@
 #pragma once
 
 #include "ds4/Authenticator.hpp"
+#include "ds4/AuthenticatorPool.hpp"
+#include "ds4/AuthenticatorReplay.hpp"
+#include "ds4/AuthenticatorSim.hpp"
 #include "ds4/Controller.hpp"
+#include "ds4/Hub.hpp"
 #include "ds4/Transport.hpp"
+#include "api/ReportScheduler.hpp"
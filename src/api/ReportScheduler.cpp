@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** ReportScheduler.cpp
+ *  Sends reports just before the host polls for them.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ReportScheduler.hpp"
+
+#include "utils/utils.hpp"
+
+namespace rds4 {
+namespace api {
+
+ReportScheduler::ReportScheduler(Controller *controller, Transport *backend, uint32_t minLead) :
+        controller(controller), backend(backend), _sample(nullptr), minLead(minLead) {
+    this->reset();
+}
+
+void ReportScheduler::reset() {
+    this->tracker.reset();
+    this->lead.configure(this->minLead, this->minLead, this->minLead);
+    this->target = 0;
+    this->missed = 0;
+    this->seen = this->backend->getTXCompleteCount();
+    this->pending = false;
+}
+
+void ReportScheduler::setMinLead(uint32_t lead) {
+    this->minLead = lead;
+    this->reset();
+}
+
+inline bool ReportScheduler::fire() {
+    if (this->_sample != nullptr) {
+        (*this->_sample)();
+    }
+    return this->controller->sendReport();
+}
+
+bool ReportScheduler::update() {
+    uint32_t now, interval, poll;
+    uint16_t count;
+    bool locked = this->tracker.isLocked();
+
+    this->backend->pollTX();
+    count = this->backend->getTXCompleteCount();
+    if (count != this->seen) {
+        uint32_t time = this->backend->getTXCompleteTime();
+        this->seen = count;
+        this->tracker.observe(time);
+        interval = this->tracker.getInterval();
+        if (not locked and this->tracker.isLocked()) {
+            RDS4_DBG_PRINT("ReportScheduler: locked interval=");
+            RDS4_DBG_PHEX(interval);
+            RDS4_DBG_PRINT("\n");
+            // Start with some room for the jitter and tighten from there
+            this->lead.configure(this->minLead + 2 * this->tracker.getJitter(), this->minLead, interval / 2);
+            // This poll has been served
+            this->target = time;
+        } else if (locked and this->pending) {
+            // A report that made its poll is picked up around the target.
+            // One that didn't shows up a whole interval later.
+            if (static_cast<int32_t>(time - this->target) > static_cast<int32_t>(interval / 2)) {
+                this->lead.backoff(this->lead.estimate());
+                this->missed++;
+            } else {
+                this->lead.tighten();
+            }
+        }
+        this->pending = false;
+        locked = this->tracker.isLocked();
+    }
+
+    if (not locked) {
+        // Free-running until there is something to lock onto
+        return this->fire();
+    }
+
+    now = micros();
+    interval = this->tracker.getInterval();
+    if (this->pending and static_cast<int32_t>(now - this->target) > static_cast<int32_t>(LOST_POLLS * interval)) {
+        // The host stopped picking up reports (unplugged, suspended, etc.)
+        RDS4_DBG_PRINTLN("ReportScheduler: lost lock");
+        this->reset();
+        return this->fire();
+    }
+    poll = this->tracker.nextPoll(now);
+    if (static_cast<int32_t>(poll - this->target) < static_cast<int32_t>(interval / 2)) {
+        // Already sent for this one. The host may have picked it up a bit
+        // ahead of the prediction, so don't rely on pending here.
+        return false;
+    }
+    if (static_cast<int32_t>(poll - now) > static_cast<int32_t>(this->lead.estimate())) {
+        return false;
+    }
+    if (this->backend->getTXPending() != 0) {
+        // Whatever is still queued goes out on this poll. Queueing more
+        // would only add a whole interval to every report from now on.
+        return false;
+    }
+    if (not this->fire()) {
+        return false;
+    }
+    this->target = poll;
+    this->pending = true;
+    return true;
+}
+
+} // namespace api
+} // namespace rds4
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** ReportScheduler.hpp
+ *  Sends reports just before the host polls for them.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+#include "utils/estimator.hpp"
+#include "utils/polltracker.hpp"
+#include "internals.hpp"
+
+namespace rds4 {
+namespace api {
+
+/** Late-latching report scheduler.
+ *  Sending from a free-running loop() leaves each report waiting in the
+ *  endpoint for up to a whole poll interval. This class learns when the host
+ *  polls from the TX completion timing of the transport, and samples the
+ *  inputs and sends the report just before the next poll instead.
+ *
+ *  Until it has locked onto the host (or on transports that don't report TX
+ *  completions, e.g. UHID) it behaves like the free-running loop: sample and
+ *  send on every update().
+ *
+ *  The lead time (how early before the predicted poll to sample) adapts
+ *  between the configured minimum and half the poll interval: it grows when
+ *  a report misses its poll and shrinks slowly while none do.
+ *
+ *  A report the controller chose not to send (e.g. nothing changed in
+ *  ds4::Controller's change-driven mode) doesn't count as sent. The inputs
+ *  keep being sampled until the poll passes.
+ *
+ *  Usage:
+ *  @code
+ *  void sampleInputs() { DS4.setKey(...); ... }
+ *  api::ReportScheduler Sched(&DS4, &DS4Tr);
+ *  void setup() { ...; Sched.attachSampleCallback(&sampleInputs); }
+ *  void loop() { DS4Tr.update(); DS4.update(); Sched.update(); }
+ *  @endcode
+ */
+class ReportScheduler {
+public:
+    typedef void (*SampleCallback)(void);
+    // Default minimum lead time (us)
+    static const uint32_t DEFAULT_LEAD = 100;
+    // Give up the lock after this many polls without a completion
+    static const uint8_t LOST_POLLS = 8;
+
+    ReportScheduler(Controller *controller, Transport *backend, uint32_t minLead=DEFAULT_LEAD);
+    /** Forget the host timing and start over in free-running mode. */
+    void reset();
+    /** Run the scheduler. Call this from the main loop as often as
+     *  possible. The more often, the more precise the timing.
+     *
+     *  @return `true` if a report was sent.
+     */
+    bool update();
+    /** Register the function that samples the inputs and updates the
+     *  controller state. Called right before each report is sent.
+     *
+     *  @param The callback or `nullptr` to detach.
+     */
+    void attachSampleCallback(SampleCallback callback) {
+        this->_sample = callback;
+    }
+    /** Set the minimum lead time. Should cover the time the sample
+     *  callback takes plus any delay in noticing TX completions (e.g. the
+     *  main loop period on Teensy).
+     *
+     *  @param Minimum lead time in us.
+     */
+    void setMinLead(uint32_t lead);
+    /** Check if the scheduler is synchronized to the host. */
+    bool isLocked() const {
+        return this->tracker.isLocked();
+    }
+    /** Measured host poll interval in us (0 if unknown). */
+    uint32_t getHostInterval() const {
+        return this->tracker.getInterval();
+    }
+    /** Measured host poll jitter (mean deviation) in us. */
+    uint32_t getHostJitter() const {
+        return this->tracker.getJitter();
+    }
+    /** Current lead time in us. */
+    uint32_t getLead() const {
+        return this->lead.estimate();
+    }
+    /** Number of reports that missed the poll they were meant for. */
+    uint32_t getMissed() const {
+        return this->missed;
+    }
+
+private:
+    bool fire();
+    Controller *controller;
+    Transport *backend;
+    utils::PollTracker tracker;
+    utils::LatencyEstimator lead;
+    SampleCallback _sample;
+    uint32_t minLead;
+    // The poll the latest report was meant for
+    uint32_t target;
+    // Whether that report is still waiting to be picked up
+    bool pending;
+    uint32_t missed;
+    uint16_t seen;
+};
+
+} // namespace api
+} // namespace rds4
@@ -7,10 +7,36 @@
 
 #include "utils/platform.hpp"
 #include "UnoJoyAPI.hpp"
+#include "utils/utils.hpp"
+
+#ifdef RDS4_LINUX
+// for memset()
+#include <cstring>
+#endif
 
 namespace rds4 {
 namespace api {
 
+// api::Key of the first 13 bits of dataForController_t
+static constexpr Key UNOJOY_KEYS[] = {
+    Key::X, Key::A, Key::Y, Key::B, Key::LButton, Key::LTrigger, Key::LStick,
+    Key::RButton, Key::RTrigger, Key::RStick, Key::Select, Key::Start, Key::Home,
+};
+
+struct UnoJoyPermutation {
+    static constexpr uint8_t map(uint8_t bit) {
+        // The D-pad bits are dropped
+        return bit < sizeof(UNOJOY_KEYS) ? static_cast<uint8_t>(UNOJOY_KEYS[bit]) : 0xff;
+    }
+};
+
+static const utils::BitPermutation UNOJOY_PERMUTATION PROGMEM = utils::makeBitPermutation<UnoJoyPermutation>();
+
+uint32_t getButtonsUniversal(const dataForController_t &buf) {
+    auto *raw = reinterpret_cast<const uint8_t *>(&buf);
+    return utils::bitPermute(&UNOJOY_PERMUTATION, raw[0] | (raw[1] << 8));
+}
+
 dataForController_t getBlankDataForController() {
     dataForController_t buf;
     memset(&buf, 0, sizeof(buf));
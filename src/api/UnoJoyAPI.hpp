@@ -45,24 +45,17 @@ typedef struct {
     uint8_t rightStickY : 8;
 } dataForController_t;
 
+/** Translate the buttons of an UnoJoy frame (not the D-pad) into a
+ *  Controller::setButtonsUniversal() mask.
+ */
+extern uint32_t getButtonsUniversal(const dataForController_t &buf);
+
 template <class T>
 class UnoJoyAPI {
 public:
     void setControllerData(dataForController_t buf) {
         auto *t = static_cast<T *>(this);
-        t->setKeyUniversal(Key::X, buf.triangleOn);
-        t->setKeyUniversal(Key::A, buf.circleOn);
-        t->setKeyUniversal(Key::Y, buf.squareOn);
-        t->setKeyUniversal(Key::B, buf.crossOn);
-        t->setKeyUniversal(Key::LButton, buf.l1On);
-        t->setKeyUniversal(Key::LTrigger, buf.l2On);
-        t->setKeyUniversal(Key::LStick, buf.l3On);
-        t->setKeyUniversal(Key::RButton, buf.r1On);
-        t->setKeyUniversal(Key::RTrigger, buf.r2On);
-        t->setKeyUniversal(Key::RStick, buf.r3On);
-        t->setKeyUniversal(Key::Select, buf.selectOn);
-        t->setKeyUniversal(Key::Start, buf.startOn);
-        t->setKeyUniversal(Key::Home, buf.homeOn);
+        t->setButtonsUniversal(getButtonsUniversal(buf));
         t->setDpadUniversalSOCD(buf.dpadUpOn, buf.dpadRightOn, buf.dpadDownOn, buf.dpadLeftOn);
         t->setStick(Stick::L, buf.leftStickX, buf.leftStickY);
         t->setStick(Stick::R, buf.rightStickX, buf.rightStickY);
@@ -8,12 +8,29 @@
 #pragma once
 
 #include "utils/platform.hpp"
+#include "utils/crc32.hpp"
+#include "utils/stats.hpp"
 
 // TODO: More documentation
 
 namespace rds4 {
 namespace api {
 
+/** One report in a batch passed to Transport::sendv(). */
+struct ReportVec {
+    const void *buf;
+    uint8_t len;
+};
+
+/** What a transport does with a report when its TX queue is full. */
+enum class TXPolicy : uint8_t {
+    // Refuse the new report (send() returns 0).
+    DROP_NEWEST,
+    // Accept the new report and drop the oldest one that is not yet on the
+    // wire, so a slow host always gets the freshest state next.
+    DROP_OLDEST,
+};
+
 /** Base class for a Transport class.
  *  A Transport object should be able to handle high-level report transferring
  *  (high-level as hiding details about device discovery and initialization, if
@@ -28,6 +45,15 @@ namespace api {
  */
 class Transport {
 public:
+    typedef void (*TXCompleteCallback)(void *context);
+    typedef void (*RXCallback)(void *context);
+    // Default timeout of sendBlocking() (ms)
+    static const uint32_t DEFAULT_SEND_TIMEOUT = 70;
+
+    Transport() : sendTimeout(DEFAULT_SEND_TIMEOUT), _notifyTXComplete(nullptr), txContext(nullptr), txCompleteTime(0), txCompleteCount(0),
+                  _notifyRX(nullptr), rxContext(nullptr) {
+        this->resetTransportStats();
+    }
     /** Start transport backend. Does nothing by default. */
     virtual void begin() { };
     /** Check if there are packets that are available for receiving.
@@ -53,15 +79,210 @@ public:
      *  @return The number of actual bytes received.
      */
     virtual uint8_t recv(void *buf, uint8_t len) = 0;
-    /** Send data through the link (blocking). The blocking timeout is
-     *  implementation-specific
+    /** Send data through the link (blocking). Gives up after the timeout
+     *  set by setSendTimeout().
+     *
+     *  @param The buffer that contains data to send.
+     *  @param The length of the supplied buffer.
+     *  @return The number of actual bytes sent.
+     */
+    virtual uint8_t sendBlocking(const void *buf, uint8_t len) {
+        return this->sendTimed(buf, len, this->sendTimeout);
+    }
+    /** Send data through the link, waiting at most `timeout` ms for room.
+     *  While waiting, the caller sleeps in waitTX() until a TX slot frees up
+     *  (or something else wakes it up) instead of spinning on send().
      *
      *  @param The buffer that contains data to send.
      *  @param The length of the supplied buffer.
+     *  @param Timeout in ms.
+     *  @return The number of actual bytes sent.
+     */
+    virtual uint8_t sendTimed(const void *buf, uint8_t len, uint32_t timeout) {
+        uint32_t begin = millis();
+        uint8_t actual;
+        RDS4_STAT_BEGIN(waitBegin);
+        while ((actual = this->send(buf, len)) == 0) {
+            uint32_t elapsed = millis() - begin;
+            if (elapsed >= timeout) {
+                RDS4_STAT_INC(this->stats.txTimeouts);
+                RDS4_STAT_END(waitBegin, this->stats.txWait);
+                return 0;
+            }
+            this->waitTX(timeout - elapsed);
+        }
+        RDS4_STAT_END(waitBegin, this->stats.txWait);
+        return actual;
+    }
+    /** Set the timeout of sendBlocking().
+     *
+     *  @param Timeout in ms.
+     */
+    void setSendTimeout(uint32_t timeout) {
+        this->sendTimeout = timeout;
+    }
+    uint32_t getSendTimeout() {
+        return this->sendTimeout;
+    }
+    /** Get notified whenever a TX slot frees up, i.e. the host picked up a
+     *  report. Lets the main loop do other work (e.g. scan inputs) and send
+     *  the next report when there is room for it. Depending on the
+     *  transport the callback may run in interrupt context or on another
+     *  thread, so keep it short (e.g. set a flag).
+     *
+     *  @param The callback or `nullptr` to detach.
+     *  @param Passed to the callback as is.
+     */
+    void attachTXCompleteCallback(TXCompleteCallback callback, void *context=nullptr) {
+        this->txContext = context;
+        this->_notifyTXComplete = callback;
+    }
+    /** Get notified as soon as the transport receives a report. The
+     *  callback runs on the transport's receive path: the USB interrupt,
+     *  the thread that feeds the transport, or the event loop, depending on
+     *  the transport. It may call recv() or borrowRX()/releaseRX(), and
+     *  then nobody else should.
+     *
+     *  @param The callback or `nullptr` to detach.
+     *  @param Passed to the callback as is.
+     */
+    void attachRXCallback(RXCallback callback, void *context=nullptr) {
+        this->rxContext = context;
+        this->_notifyRX = callback;
+    }
+    /** Number of reports accepted by send() that the host hasn't picked up
+     *  yet.
+     *
+     *  @return The number of pending reports, or 0 if unknown.
+     */
+    virtual uint8_t getTXPending() { return 0; }
+    /** Look for TX completions on transports that can't signal them by
+     *  themselves. Call this often if precise completion timing matters
+     *  (e.g. for ReportScheduler). Does nothing by default.
+     */
+    virtual void pollTX() { }
+    /** Number of TX completions seen so far. Wraps around. Stays 0 on
+     *  transports that don't report completions.
+     */
+    uint16_t getTXCompleteCount() {
+        return __atomic_load_n(&(this->txCompleteCount), __ATOMIC_ACQUIRE);
+    }
+    /** micros() timestamp of the latest TX completion. Read it after
+     *  getTXCompleteCount().
+     */
+    uint32_t getTXCompleteTime() {
+        return __atomic_load_n(&(this->txCompleteTime), __ATOMIC_RELAXED);
+    }
+    /** Send several reports in one call (non-blocking). Reports are queued
+     *  in order. Transports with a TX queue check for room once per batch
+     *  and apply their TXPolicy to the reports that don't fit.
+     *  The default implementation calls send() on each report and stops at
+     *  the first one that doesn't go through.
+     *
+     *  @param The reports.
+     *  @param Number of reports.
+     *  @return The number of reports accepted.
+     */
+    virtual uint8_t sendv(const ReportVec *reports, uint8_t count) {
+        uint8_t i;
+        for (i=0; i<count; i++) {
+            if (this->send(reports[i].buf, reports[i].len) != reports[i].len) {
+                break;
+            }
+        }
+        return i;
+    }
+    /** Get a TX buffer to build a report in place (non-blocking). Must be
+     *  followed by commitTX() before any other send call. Transports that
+     *  can't lend out their buffers return `nullptr` by default, and so do
+     *  transports with no room right now. Fall back to send() in either case.
+     *
+     *  @param Size of the report.
+     *  @return A buffer of at least the requested size or `nullptr`.
+     */
+    virtual void *acquireTX(uint8_t len) { return nullptr; }
+    /** Send the report built in the buffer returned by acquireTX().
+     *
+     *  @param Actual size of the report.
      *  @return The number of actual bytes sent.
      */
-    virtual uint8_t sendBlocking(const void *buf, uint8_t len) = 0;
+    virtual uint8_t commitTX(uint8_t len) { return 0; }
+    /** Borrow the oldest received report without copying it (non-blocking).
+     *  Must be followed by releaseRX() before any other receive call.
+     *  Transports that can't lend out their buffers return `nullptr` by
+     *  default. Fall back to recv() in that case.
+     *
+     *  @param Receives the size of the report.
+     *  @return The report or `nullptr` if there is none (or if unsupported).
+     */
+    virtual const void *borrowRX(uint8_t *len) { return nullptr; }
+    /** Give the buffer returned by borrowRX() back to the transport. */
+    virtual void releaseRX() { }
+    /** Take a snapshot of the transport counters (see utils::TransportStats).
+     *  Counters are only kept when built with RDS4_STATS defined, and cost
+     *  nothing otherwise.
+     *
+     *  @param Receives the counters.
+     *  @return `true` if successful, `false` if built without RDS4_STATS.
+     */
+    bool getTransportStats(utils::TransportStats *out) {
+#ifdef RDS4_STATS
+        utils::statsCopy(out, this->stats);
+        return true;
+#else
+        return false;
+#endif
+    }
+    /** Zero the transport counters. */
+    void resetTransportStats() {
+#ifdef RDS4_STATS
+        this->stats.reset();
+#endif
+    }
 protected:
+    /** Sleep until a TX slot may have freed up or the timeout passes. Used
+     *  by sendTimed(). Spurious wakeups are fine. The default returns right
+     *  away, which makes sendTimed() poll.
+     *
+     *  @param Timeout in ms.
+     */
+    virtual void waitTX(uint32_t timeout) { }
+    void notifyTXComplete() {
+        // Count is published last so readers see a time at least this new
+        __atomic_store_n(&(this->txCompleteTime), micros(), __ATOMIC_RELAXED);
+        __atomic_store_n(&(this->txCompleteCount), static_cast<uint16_t>(this->txCompleteCount + 1), __ATOMIC_RELEASE);
+        if (this->_notifyTXComplete != nullptr) {
+            (*this->_notifyTXComplete)(this->txContext);
+        }
+    }
+    uint32_t sendTimeout;
+    TXCompleteCallback _notifyTXComplete;
+    void *txContext;
+    void notifyRX() {
+        if (this->_notifyRX != nullptr) {
+            (*this->_notifyRX)(this->rxContext);
+        }
+    }
+    uint32_t txCompleteTime;
+    uint16_t txCompleteCount;
+    RXCallback _notifyRX;
+    void *rxContext;
+#ifdef RDS4_STATS
+    utils::TransportStats stats;
+#endif
+    /** Count a feature request that is done.
+     *
+     *  @param `true` if it was handled, `false` if it stalled.
+     *  @return The same as the parameter.
+     */
+    bool featureDone(bool ok) {
+        RDS4_STAT_INC(this->stats.featureRequests);
+        if (not ok) {
+            RDS4_STAT_INC(this->stats.featureStalls);
+        }
+        return ok;
+    }
+
     // Feature request API. Intended for internal use. If developing CRTPs
     // (for auth, etc.) one must set the CRTP class as friend in order to
     // use these.
@@ -196,6 +417,24 @@ public:
      *  @return Actual number of bytes copied.
      */
     virtual size_t readResponsePage(uint8_t page, void *buf, size_t len) = 0;
+    /** Read response page from the authenticator to a specified buffer and
+     *  feed the copied data into a running CRC32 calculation.
+     *  The default implementation checksums the buffer after reading.
+     *  Authenticators that copy the page out of an internal buffer should
+     *  override this with utils::copy_and_crc32() so the page is only
+     *  touched once.
+     *
+     *  @param Page number.
+     *  @param A pointer to the destination buffer.
+     *  @param Length of the destination buffer (for sanity checks).
+     *  @param Running CRC32 register (see utils::crc32_update()).
+     *  @return Actual number of bytes copied.
+     */
+    virtual size_t readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) {
+        auto actual = this->readResponsePage(page, buf, len);
+        *crc = utils::crc32_update(*crc, buf, actual);
+        return actual;
+    }
     virtual uint8_t getChallengePageSize() {
         return this->challengePageSize;
     }
@@ -259,6 +498,11 @@ enum class Stick : uint8_t {
 
 using Dpad = Rotary8Pos;
 
+/** Bit of a key in the masks taken by Controller::setButtonsUniversal(). */
+constexpr uint32_t keyMask(Key code) {
+    return 1ul << static_cast<uint8_t>(code);
+}
+
 class Controller {
 public:
     Controller(Transport *backend) {
@@ -307,6 +551,20 @@ public:
     virtual bool setDpadUniversal(Dpad value) = 0;
     virtual bool setStick(Stick index, uint8_t x, uint8_t y) = 0;
     virtual bool setTrigger(Key code, uint8_t value) = 0;
+    /** Set the state of all universal keys at once.
+     *  @param Pressed keys, one bit per key (see keyMask()). Bits beyond
+     *         Key::_COUNT are ignored.
+     *  @return `true` if successful.
+     */
+    virtual bool setButtonsUniversal(uint32_t mask) {
+        bool success = true;
+        // Implementations should override this with something that doesn't
+        // take one virtual call per key
+        for (uint8_t i=0; i<static_cast<uint8_t>(Key::_COUNT); i++) {
+            success = this->setKeyUniversal(static_cast<Key>(i), (mask >> i) & 1) and success;
+        }
+        return success;
+    }
 
     // Helpers
     /** Set state for a D-pad. Equivalent to setRotary8Pos().
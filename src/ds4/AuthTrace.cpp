@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthTrace.cpp
+ *  Decoder for auth transaction traces.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "AuthTrace.hpp"
+
+#ifdef RDS4_LINUX
+// for snprintf()
+#include <cstdio>
+#endif
+
+namespace rds4 {
+namespace ds4 {
+
+static const char *const STATE_NAMES[AuthTraceDecoder::STATE_COUNT] = {
+    "IDLE",
+    "NONCE_RECEIVED",
+    "WAIT_NONCE",
+    "WAIT_RESP",
+    "POLL_RESP",
+    "RESP_BUFFERED",
+    "RESP_UNLOADED",
+    "RESP_PREFETCH",
+    "ERROR",
+};
+
+const char *AuthTraceDecoder::stateName(uint8_t state) {
+    return state < AuthTraceDecoder::STATE_COUNT ? STATE_NAMES[state] : "?";
+}
+
+void AuthTraceDecoder::reset() {
+    for (auto &h : this->phases) {
+        h.reset();
+    }
+    this->transactions.reset();
+    this->busyPolls.reset();
+    this->donorWrites.reset();
+    this->donorReads.reset();
+    this->donorStatus.reset();
+    this->errors = 0;
+    this->stateSince = 0;
+    this->transactionStart = 0;
+    this->polls = 0;
+    this->stateValid = false;
+    this->inTransaction = false;
+}
+
+void AuthTraceDecoder::onState(const utils::TraceEvent &ev) {
+    auto from = static_cast<DS4AuthState>(ev.b);
+    auto to = static_cast<DS4AuthState>(ev.a);
+    if (this->stateValid and ev.b < AuthTraceDecoder::STATE_COUNT) {
+        this->phases[ev.b].add(ev.time - this->stateSince);
+    }
+    this->stateSince = ev.time;
+    this->stateValid = true;
+    if (to == DS4AuthState::ERROR) {
+        this->errors++;
+        this->inTransaction = false;
+    } else if (to == DS4AuthState::IDLE and this->inTransaction and \
+               (from == DS4AuthState::RESP_BUFFERED or from == DS4AuthState::RESP_UNLOADED)) {
+        this->transactions.add(ev.time - this->transactionStart);
+        this->busyPolls.add(this->polls);
+        this->inTransaction = false;
+    }
+}
+
+void AuthTraceDecoder::feed(const utils::TraceEvent *events, uint16_t count) {
+    for (uint16_t i=0; i<count; i++) {
+        auto &ev = events[i];
+        switch (ev.type) {
+            case utils::TraceType::AUTH_STATE:
+                this->onState(ev);
+                break;
+            case utils::TraceType::HOST_SET:
+                if (ev.a == Controller::SET_CHALLENGE and ev.b == 0) {
+                    this->transactionStart = ev.time;
+                    this->polls = 0;
+                    this->inTransaction = true;
+                }
+                break;
+            case utils::TraceType::HOST_GET:
+                if (ev.a == Controller::GET_AUTH_STATUS and ev.b == 0x10) {
+                    this->polls++;
+                }
+                break;
+            case utils::TraceType::DONOR_WRITE:
+                this->donorWrites.add(ev.b);
+                break;
+            case utils::TraceType::DONOR_READ:
+                this->donorReads.add(ev.b);
+                break;
+            case utils::TraceType::DONOR_STATUS:
+                this->donorStatus.add(ev.b);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void printHistogram(utils::TracePrinter print, const char *name, const utils::Log2Histogram &h) {
+    char line[128];
+    if (h.count == 0) {
+        return;
+    }
+    snprintf(line, sizeof(line), "%-16s n=%-5lu avg=%-8lu p50<=%-8lu p90<=%-8lu p99<=%-8lu max=%lu\n",
+             name, static_cast<unsigned long>(h.count),
+             static_cast<unsigned long>(h.average()),
+             static_cast<unsigned long>(h.percentile(50)),
+             static_cast<unsigned long>(h.percentile(90)),
+             static_cast<unsigned long>(h.percentile(99)),
+             static_cast<unsigned long>(h.max));
+    print(line);
+}
+
+void AuthTraceDecoder::report(utils::TracePrinter print) const {
+    char line[48];
+    print("-- auth phases (us) --\n");
+    for (uint8_t i=0; i<AuthTraceDecoder::STATE_COUNT; i++) {
+        printHistogram(print, AuthTraceDecoder::stateName(i), this->phases[i]);
+    }
+    printHistogram(print, "transaction", this->transactions);
+    print("-- donor transfers (us) --\n");
+    printHistogram(print, "write", this->donorWrites);
+    printHistogram(print, "read", this->donorReads);
+    printHistogram(print, "status", this->donorStatus);
+    print("-- host --\n");
+    printHistogram(print, "busy polls/tx", this->busyPolls);
+    snprintf(line, sizeof(line), "errors=%u\n", static_cast<unsigned>(this->errors));
+    print(line);
+}
+
+} // namespace ds4
+} // namespace rds4
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthTrace.hpp
+ *  Decoder for auth transaction traces.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+#include "utils/trace.hpp"
+// For auth states and report IDs
+#include "Controller.hpp"
+
+namespace rds4 {
+namespace ds4 {
+
+/** Turns auth trace events into per-phase latency figures.
+ *
+ *  Build with RDS4_TRACE defined to make AuthenticationHandler and
+ *  AuthenticatorUSBH record into utils::trace. Then either decode on the
+ *  device:
+ *
+ *      utils::TraceEvent events[utils::TraceRing::SIZE];
+ *      auto count = utils::trace.snapshot(events, utils::TraceRing::SIZE);
+ *      decoder.feed(events, count);
+ *      decoder.report(printer);
+ *
+ *  or print the events with utils::traceDump() and feed the output to
+ *  extras/tools/trace_decode on a host.
+ *
+ *  All durations are in us.
+ */
+class AuthTraceDecoder {
+public:
+    static const uint8_t STATE_COUNT = static_cast<uint8_t>(DS4AuthState::ERROR) + 1;
+
+    AuthTraceDecoder() {
+        this->reset();
+    }
+    void reset();
+    /** Feed events in the order they were recorded. Each event should only
+     *  be fed once.
+     */
+    void feed(const utils::TraceEvent *events, uint16_t count);
+    /** Print the latency breakdown. */
+    void report(utils::TracePrinter print) const;
+    /** Name of an auth state for display. */
+    static const char *stateName(uint8_t state);
+
+    // Time spent in each state
+    utils::Log2Histogram phases[STATE_COUNT];
+    // Time from the first challenge page to the end of the last response page
+    utils::Log2Histogram transactions;
+    // Busy GET_AUTH_STATUS replies per transaction
+    utils::Log2Histogram busyPolls;
+    // Donor transfer times
+    utils::Log2Histogram donorWrites;
+    utils::Log2Histogram donorReads;
+    utils::Log2Histogram donorStatus;
+    uint16_t errors;
+
+private:
+    void onState(const utils::TraceEvent &ev);
+    uint32_t stateSince;
+    uint32_t transactionStart;
+    uint16_t polls;
+    bool stateValid;
+    bool inTransaction;
+};
+
+} // namespace ds4
+} // namespace rds4
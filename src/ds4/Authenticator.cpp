@@ -18,6 +18,20 @@ namespace ds4 {
 
 #ifdef RDS4_AUTH_USBH
 
+static const DonorQuirk DONOR_QUIRKS[] = {
+    // Guitar Hero dongle. Takes about 2 seconds to sign the challenge.
+    {PS4USB2::RO_VID, PS4USB2::RO_PID_GHPS4, DonorQuirk::NO_STATUS, 2000, 500, 4000},
+};
+
+const DonorQuirk *PS4USB2::getQuirk(void) {
+    for (auto &q : DONOR_QUIRKS) {
+        if (::HIDUniversal::VID == q.vid and ::HIDUniversal::PID == q.pid) {
+            return &q;
+        }
+    }
+    return nullptr;
+}
+
 uint8_t PS4USB2::OnInitSuccessful() {
     if (this->VIDPIDOK(::HIDUniversal::VID, ::HIDUniversal::PID)) {
         PS4Parser::Reset();
@@ -31,11 +45,27 @@ uint8_t PS4USB2::OnInitSuccessful() {
     return 0;
 }
 
+uint8_t PS4USB2::Release() {
+    auto rcode = ::PS4USB::Release();
+    // Let the authenticator know that the donor is gone
+    if (this->auth != nullptr) {
+        this->auth->onStateChange();
+    }
+    return rcode;
+}
+
 void PS4USB2::registerAuthenticator(AuthenticatorUSBH *auth) {
     this->auth = auth;
 }
 
-AuthenticatorUSBH::AuthenticatorUSBH(PS4USB2 *donor) : donor(donor), statusOverrideEnabled(false), statusOverrideTransactionStartTime(0), statusOverrideInTransaction(false) {
+AuthenticatorUSBH::AuthenticatorUSBH(PS4USB2 *donor) : donor(donor),
+                                                       quirk(nullptr),
+                                                       quirkOverride(nullptr),
+                                                       quirkTransactionStartTime(0),
+                                                       quirkLastProbeTime(0),
+                                                       quirkWaited(0),
+                                                       quirkInTransaction(false),
+                                                       quirkProbeCached(false) {
     donor->registerAuthenticator(this);
 }
 
@@ -94,25 +124,41 @@ size_t AuthenticatorUSBH::writeChallengePage(uint8_t page, void *buf, size_t len
     authbuf->seq = 1;
     authbuf->page = page;
     authbuf->sbz = 0;
-    memcpy(&authbuf->data, buf, expected);
     // CRC32 is a must-have for official controller, not sure about licensed ones.
-    authbuf->crc32 = utils::crc32(this->scratchPad, sizeof(*authbuf) - sizeof(authbuf->crc32));
-    if (this->donor->SetReport(0, 0, 0x03, Controller::SET_CHALLENGE, sizeof(*authbuf), this->scratchPad) != 0) {
+    // Checksum the page while copying it in so the payload is only touched once.
+    auto crc = utils::crc32_update(utils::crc32_init(), authbuf, offsetof(AuthReport, data));
+    crc = utils::copy_and_crc32(&authbuf->data, buf, expected, crc);
+    memset(&authbuf->data[expected], 0, sizeof(authbuf->data) - expected);
+    crc = utils::crc32_update(crc, &authbuf->data[expected], sizeof(authbuf->data) - expected);
+    authbuf->crc32 = utils::crc32_final(crc);
+    RDS4_TRACE_BEGIN(traceStart);
+    auto rcode = this->donor->SetReport(0, 0, 0x03, Controller::SET_CHALLENGE, sizeof(*authbuf), this->scratchPad);
+    RDS4_TRACE_END(traceStart, utils::TraceType::DONOR_WRITE, page);
+    if (rcode != 0) {
         RDS4_DBG_PRINTLN("comm error");
         return 0;
     }
     RDS4_DBG_PHEX(expected);
     RDS4_DBG_PRINTLN(" bytes written");
-    // Guitar Hero Dongle hack
-    if (this->statusOverrideEnabled and this->endOfChallenge(page)) {
-        RDS4_DBG_PRINTLN("gh hack timer start");
-        this->statusOverrideInTransaction = true;
-        this->statusOverrideTransactionStartTime = millis();
+    // Donors that don't report status
+    if (this->quirk != nullptr and this->endOfChallenge(page)) {
+        RDS4_DBG_PRINTLN("quirk timer start");
+        this->quirkInTransaction = true;
+        this->quirkProbeCached = false;
+        this->quirkTransactionStartTime = millis();
     }
     return expected;
 }
 
 size_t AuthenticatorUSBH::readResponsePage(uint8_t page, void *buf, size_t len) {
+    return this->readResponsePage_(page, buf, len, nullptr);
+}
+
+size_t AuthenticatorUSBH::readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) {
+    return this->readResponsePage_(page, buf, len, crc);
+}
+
+size_t AuthenticatorUSBH::readResponsePage_(uint8_t page, void *buf, size_t len, uint32_t *crc) {
     auto authbuf = (AuthReport *) &(this->scratchPad);
     auto expected = this->getActualResponsePageSize(page);
     // Insufficient space for target buffer
@@ -121,8 +167,16 @@ size_t AuthenticatorUSBH::readResponsePage(uint8_t page, void *buf, size_t len)
         RDS4_DBG_PRINTLN("buf too small");
         return 0;
     }
-    if (this->donor->GetReport(0, 0, 0x03, Controller::GET_RESPONSE, sizeof(*authbuf), this->scratchPad) != 0) {
+    // Page 0 may already be fetched while probing
+    if (this->quirkProbeCached and page == 0) {
+        RDS4_DBG_PRINTLN("using probed page");
+        this->quirkProbeCached = false;
+    } else if (this->getReportTraced(Controller::GET_RESPONSE, sizeof(*authbuf), page) != 0) {
         RDS4_DBG_PRINTLN("comm error");
+        // Asked too early
+        if (this->quirkInTransaction and page == 0) {
+            this->estimator.backoff(this->quirkWaited);
+        }
         return 0;
     }
     // Sanity check
@@ -133,15 +187,24 @@ size_t AuthenticatorUSBH::readResponsePage(uint8_t page, void *buf, size_t len)
         RDS4_DBG_PRINT(" act=");
         RDS4_DBG_PHEX(authbuf->page);
         RDS4_DBG_PRINT("\n");
+        if (this->quirkInTransaction and page == 0) {
+            this->estimator.backoff(this->quirkWaited);
+        }
         return 0;
     }
-    memcpy(buf, &authbuf->data, expected);
+    if (crc != nullptr) {
+        *crc = utils::copy_and_crc32(buf, &authbuf->data, expected, *crc);
+    } else {
+        memcpy(buf, &authbuf->data, expected);
+    }
     RDS4_DBG_PHEX(expected);
     RDS4_DBG_PRINTLN(" bytes read");
-    // Guitar Hero Dongle hack
-    if (this->statusOverrideEnabled and this->endOfResponse(page)) {
-        RDS4_DBG_PRINTLN("gh hack end transaction");
-        this->statusOverrideInTransaction = false;
+    if (this->quirkInTransaction and this->endOfResponse(page)) {
+        RDS4_DBG_PRINTLN("quirk end transaction");
+        // Never tightened. A read that works doesn't prove the wait
+        // wasn't longer than needed, and a blind donor may hand out a bad
+        // response instead of refusing, so the wait only ever grows.
+        this->quirkInTransaction = false;
     }
     return expected;
 }
@@ -149,19 +212,11 @@ size_t AuthenticatorUSBH::readResponsePage(uint8_t page, void *buf, size_t len)
 api::AuthStatus AuthenticatorUSBH::getStatus() {
     auto rslbuf = (AuthStatusReport *) &(this->scratchPad);
     RDS4_DBG_PRINTLN("AuthenticatorDS4USBH: getting status");
-    if (this->statusOverrideEnabled) {
-        RDS4_DBG_PRINTLN("gh hack enabled");
-        // wait for 2 seconds since the GH dongle takes about 2 seconds to sign the challenge
-        if (this->statusOverrideInTransaction and millis() - this->statusOverrideTransactionStartTime > 2000) {
-            return api::AuthStatus::OK;
-        } else if (this->statusOverrideInTransaction) {
-            return api::AuthStatus::BUSY;
-        } else {
-            return api::AuthStatus::NO_TRANSACTION;
-        }
+    if (this->quirk != nullptr and (this->quirk->flags & (DonorQuirk::NO_STATUS | DonorQuirk::PROBE))) {
+        return this->getPredictedStatus();
     }
     memset(rslbuf, 0, sizeof(*rslbuf));
-    if (this->donor->GetReport(0, 0, 0x03, Controller::GET_AUTH_STATUS, sizeof(*rslbuf), this->scratchPad) != 0) {
+    if (this->getReportTraced(Controller::GET_AUTH_STATUS, sizeof(*rslbuf), 0) != 0) {
         RDS4_DBG_PRINTLN("comm err");
         return api::AuthStatus::COMM_ERR;
     }
@@ -187,6 +242,67 @@ api::AuthStatus AuthenticatorUSBH::getStatus() {
     }
 }
 
+api::AuthStatus AuthenticatorUSBH::getPredictedStatus() {
+    RDS4_DBG_PRINTLN("predicting status");
+    if (not this->quirkInTransaction) {
+        return api::AuthStatus::NO_TRANSACTION;
+    }
+    if (this->quirkProbeCached) {
+        return api::AuthStatus::OK;
+    }
+    auto now = millis();
+    auto elapsed = now - this->quirkTransactionStartTime;
+    if (this->quirk->flags & DonorQuirk::PROBE) {
+        // Give up probing and let the host try its luck
+        if (elapsed >= this->estimator.getCeiling()) {
+            this->quirkWaited = elapsed;
+            return api::AuthStatus::OK;
+        }
+        if (elapsed < this->estimator.earliest() or now - this->quirkLastProbeTime < AuthenticatorUSBH::PROBE_INTERVAL) {
+            return api::AuthStatus::BUSY;
+        }
+        this->quirkLastProbeTime = now;
+        if (this->probe()) {
+            RDS4_DBG_PRINT("probe ok after ");
+            RDS4_DBG_PHEX(elapsed);
+            RDS4_DBG_PRINT("\n");
+            this->quirkWaited = elapsed;
+            this->estimator.sample(elapsed);
+            this->quirkProbeCached = true;
+            return api::AuthStatus::OK;
+        }
+        return api::AuthStatus::BUSY;
+    }
+    if (elapsed >= this->estimator.estimate()) {
+        this->quirkWaited = elapsed;
+        return api::AuthStatus::OK;
+    }
+    return api::AuthStatus::BUSY;
+}
+
+bool AuthenticatorUSBH::probe() {
+    auto authbuf = (AuthReport *) &(this->scratchPad);
+    if (this->getReportTraced(Controller::GET_RESPONSE, sizeof(*authbuf), 0) != 0) {
+        return false;
+    }
+    return authbuf->type == Controller::GET_RESPONSE and authbuf->page == 0;
+}
+
+uint8_t AuthenticatorUSBH::getReportTraced(uint8_t reportID, uint16_t len, uint8_t page) {
+    RDS4_TRACE_BEGIN(traceStart);
+    auto rcode = this->donor->GetReport(0, 0, 0x03, reportID, len, this->scratchPad);
+#ifdef RDS4_TRACE
+    if (reportID == Controller::GET_AUTH_STATUS) {
+        // Log the raw status byte (0xff on comm error)
+        auto rslbuf = (AuthStatusReport *) &(this->scratchPad);
+        RDS4_TRACE_END(traceStart, utils::TraceType::DONOR_STATUS, rcode != 0 ? 0xff : rslbuf->status);
+    } else {
+        RDS4_TRACE_END(traceStart, utils::TraceType::DONOR_READ, page);
+    }
+#endif
+    return rcode;
+}
+
 uint8_t AuthenticatorUSBH::getActualChallengePageSize(uint8_t page) {
     uint16_t remaining = AuthenticatorUSBH::CHALLENGE_SIZE - (uint16_t) this->challengePageSize * page;
     return remaining > this->challengePageSize ? this->challengePageSize : (uint8_t) remaining;
@@ -198,9 +314,25 @@ uint8_t AuthenticatorUSBH::getActualResponsePageSize(uint8_t page) {
 }
 
 void AuthenticatorUSBH::onStateChange() {
+    if (not this->available()) {
+        RDS4_DBG_PRINTLN("AuthenticatorDS4USBH: Donor removed");
+        this->quirkInTransaction = false;
+        this->quirkProbeCached = false;
+        return;
+    }
     RDS4_DBG_PRINTLN("AuthenticatorDS4USBH: Hotplug detected, re-fitting buffer");
     this->fitPageSize();
-    this->statusOverrideEnabled = this->donor->isQuirky();
+    auto quirk = this->donor->getQuirk();
+    if (this->quirkOverride != nullptr and \
+            this->quirkOverride->vid == this->donor->::HIDUniversal::VID and \
+            this->quirkOverride->pid == this->donor->::HIDUniversal::PID) {
+        quirk = this->quirkOverride;
+    }
+    // Only start over when a different kind of donor shows up
+    if (quirk != nullptr and quirk != this->quirk) {
+        this->estimator.configure(quirk->initialLatency, quirk->minLatency, quirk->maxLatency);
+    }
+    this->quirk = quirk;
 }
 
 #endif // RDS4_AUTH_USBH
@@ -8,6 +8,8 @@
 #pragma once
 
 #include "utils/platform.hpp"
+#include "utils/estimator.hpp"
+#include "utils/trace.hpp"
 #include "api/internals.hpp"
 
 // Sigh... https://github.com/arduino/arduino-builder/issues/15#issuecomment-145558252
@@ -27,7 +29,8 @@ namespace rds4 {
 namespace ds4 {
 
 class AuthenticatorNull : public api::Authenticator {
-    void begin() { this->fitPageSize(); }
+public:
+    void begin() override { this->fitPageSize(); }
     bool available() override { return true; }
     bool canFitPageSize() override { return true; }
     bool canSetPageSize() override { return true; }
@@ -40,11 +43,32 @@ class AuthenticatorNull : public api::Authenticator {
     bool endOfChallenge(uint8_t page) override { return true; }
     bool endOfResponse(uint8_t page) override { return true; }
     bool reset() override { return true; }
-    size_t writeChallengePage(uint8_t page, void *buf, size_t len) { return len; }
-    size_t readResponsePage(uint8_t page, void *buf, size_t len) { return 0; }
+    size_t writeChallengePage(uint8_t page, void *buf, size_t len) override { return len; }
+    size_t readResponsePage(uint8_t page, void *buf, size_t len) override { return 0; }
     api::AuthStatus getStatus() override { return api::AuthStatus::UNKNOWN_ERR; }
 };
 
+/** Workarounds for donors that don't behave like a DS4. */
+struct DonorQuirk {
+    // Donor never reports signing status. Completion is predicted instead,
+    // and the prediction only backs off on failed reads.
+    static const uint8_t NO_STATUS = 0x01;
+    // Donor refuses to return response page 0 until signing is done, so
+    // reading it tells when signing is actually done. Used instead of the
+    // signing status, with or without NO_STATUS.
+    static const uint8_t PROBE = 0x02;
+
+    uint16_t vid;
+    uint16_t pid;
+    uint8_t flags;
+    // Completion prediction before anything is learned (ms)
+    uint16_t initialLatency;
+    // Minimum signing time (ms)
+    uint16_t minLatency;
+    // Maximum wait before giving up on probing (ms, 0 for 4x initialLatency)
+    uint16_t maxLatency;
+};
+
 #ifdef RDS4_AUTH_USBH
 
 class AuthenticatorUSBH;
@@ -53,10 +77,10 @@ class AuthenticatorUSBH;
 /** Modified PS4USB class that adds basic support for some licensed PS4 controllers. */
 class PS4USB2 : public ::PS4USB {
 public:
-    const uint16_t HORI_VID = 0x0f0d;
-    const uint16_t HORI_PID_MINI = 0x00ee;
-    const uint16_t RO_VID = 0x1430;
-    const uint16_t RO_PID_GHPS4 = 0x07bb;
+    static const uint16_t HORI_VID = 0x0f0d;
+    static const uint16_t HORI_PID_MINI = 0x00ee;
+    static const uint16_t RO_VID = 0x1430;
+    static const uint16_t RO_PID_GHPS4 = 0x07bb;
 
     PS4USB2(USB *p) : ::PS4USB(p), auth(nullptr) {};
     bool connected() {
@@ -70,9 +94,15 @@ public:
     }
 
     bool isQuirky(void) {
-        return (::HIDUniversal::VID == RO_VID and ::HIDUniversal::PID == RO_PID_GHPS4);
+        return this->getQuirk() != nullptr;
     }
 
+    /** Look up the workarounds needed by the connected donor.
+     *
+     *  @return The quirk entry or `nullptr` if the donor behaves.
+     */
+    const DonorQuirk *getQuirk(void);
+
 protected:
     friend class AuthenticatorUSBH;
     bool VIDPIDOK(uint16_t vid, uint16_t pid) override {
@@ -93,6 +123,7 @@ protected:
     }
 
     uint8_t OnInitSuccessful() override;
+    uint8_t Release() override;
     void registerAuthenticator(AuthenticatorUSBH *auth);
 private:
     AuthenticatorUSBH *auth;
@@ -102,8 +133,8 @@ private:
 class AuthenticatorUSBH : public api::Authenticator {
 public:
     static const uint8_t PAYLOAD_MAX = 0x38;
-    static const uint16_t CHALLENGE_SIZE = 0x100;
-    static const uint16_t RESPONSE_SIZE = 0x410;
+    static const uint16_t CHALLENGE_SIZE = AUTH_CHALLENGE_SIZE;
+    static const uint16_t RESPONSE_SIZE = AUTH_RESPONSE_SIZE;
     AuthenticatorUSBH(PS4USB2 *donor);
     bool available() override;
     bool canFitPageSize() override { return true; }
@@ -121,19 +152,46 @@ public:
     bool reset() override;
     size_t writeChallengePage(uint8_t page, void *buf, size_t len) override;
     size_t readResponsePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) override;
     api::AuthStatus getStatus() override;
+    /** Use a custom quirk entry for donors with matching VID/PID instead of
+     *  the built-in one. Takes effect on the next hotplug.
+     *
+     *  @param The quirk entry or `nullptr` to only use the built-in table.
+     */
+    void setQuirk(const DonorQuirk *quirk) {
+        this->quirkOverride = quirk;
+    }
+    /** Get the completion estimator used on donors that don't report status. */
+    utils::LatencyEstimator &getEstimator() {
+        return this->estimator;
+    }
 
 protected:
     friend class PS4USB2;
+    // Min. interval between 2 probes (ms)
+    static const uint8_t PROBE_INTERVAL = 50;
     void onStateChange();
 private:
     uint8_t getActualChallengePageSize(uint8_t page);
     uint8_t getActualResponsePageSize(uint8_t page);
+    size_t readResponsePage_(uint8_t page, void *buf, size_t len, uint32_t *crc);
+    // GetReport into the scratch pad and record the transfer in the trace
+    uint8_t getReportTraced(uint8_t reportID, uint16_t len, uint8_t page);
+    api::AuthStatus getPredictedStatus();
+    bool probe();
     PS4USB2 *donor;
     uint8_t scratchPad[64];
-    bool statusOverrideEnabled;
-    uint32_t statusOverrideTransactionStartTime;
-    bool statusOverrideInTransaction;
+    const DonorQuirk *quirk;
+    const DonorQuirk *quirkOverride;
+    utils::LatencyEstimator estimator;
+    uint32_t quirkTransactionStartTime;
+    uint32_t quirkLastProbeTime;
+    // How long we waited before reporting OK
+    uint32_t quirkWaited;
+    bool quirkInTransaction;
+    // Response page 0 was read by probe() and sits in scratchPad
+    bool quirkProbeCached;
 };
 
 #endif // RDS4_AUTH_USBH
@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorPool.cpp
+ *  Authenticator that spreads transactions over several donor authenticators.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "AuthenticatorPool.hpp"
+#include "utils/utils.hpp"
+
+#ifdef RDS4_LINUX
+// for memcpy(), etc.
+#include <cstring>
+#endif
+
+namespace rds4 {
+namespace ds4 {
+
+static_assert(DonorTable::MAX_DONORS <= 8, "Donor bitmask only holds 8 donors");
+
+DonorTable::DonorTable() : donors{nullptr}, stats(), owners{nullptr}, lastUsed{0}, donorCount(0), started(false) { /* pass */ }
+
+bool DonorTable::add(api::Authenticator *donor) {
+    if (this->donorCount >= DonorTable::MAX_DONORS) {
+        return false;
+    }
+    this->donors[this->donorCount++] = donor;
+    if (this->started) {
+        donor->begin();
+    }
+    return true;
+}
+
+void DonorTable::begin() {
+    if (this->started) {
+        return;
+    }
+    for (uint8_t i=0; i<this->donorCount; i++) {
+        this->donors[i]->begin();
+    }
+    this->started = true;
+}
+
+bool DonorTable::usable(uint8_t index) {
+    auto &st = this->stats[index];
+    if (not this->donors[index]->available()) {
+        return false;
+    }
+    return st.consecutiveErrors < DonorTable::MAX_CONSECUTIVE_ERRORS or \
+           millis() - st.lastError >= DonorTable::ERROR_COOLDOWN;
+}
+
+bool DonorTable::anyUsable() {
+    return this->pick() != DonorTable::NO_DONOR;
+}
+
+uint8_t DonorTable::pick(uint8_t skip) {
+    uint8_t best = DonorTable::NO_DONOR;
+    for (uint8_t i=0; i<this->donorCount; i++) {
+        bool claimed = this->owners[i] != nullptr and millis() - this->lastUsed[i] < DonorTable::IDLE_TIMEOUT;
+        if (claimed or (skip & (1 << i)) or not this->usable(i)) {
+            continue;
+        }
+        if (best == DonorTable::NO_DONOR) {
+            best = i;
+            continue;
+        }
+        auto &cand = this->stats[i];
+        auto &cur = this->stats[best];
+        if (cand.latency < cur.latency or \
+            (cand.latency == cur.latency and cand.errors < cur.errors)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint8_t DonorTable::acquire(const void *owner, uint8_t skip) {
+    auto index = this->pick(skip);
+    if (index != DonorTable::NO_DONOR) {
+        if (this->owners[index] != nullptr) {
+            RDS4_DBG_PRINT("DonorTable: idle claim expired ");
+            RDS4_DBG_PHEX(index);
+            RDS4_DBG_PRINT("\n");
+        }
+        this->owners[index] = owner;
+        this->lastUsed[index] = millis();
+    }
+    return index;
+}
+
+void DonorTable::release(uint8_t index, const void *owner) {
+    if (index < this->donorCount and this->owners[index] == owner) {
+        this->owners[index] = nullptr;
+    }
+}
+
+bool DonorTable::renew(uint8_t index, const void *owner) {
+    if (index >= this->donorCount or this->owners[index] != owner) {
+        return false;
+    }
+    this->lastUsed[index] = millis();
+    return true;
+}
+
+void DonorTable::recordSuccess(uint8_t index, uint32_t latency) {
+    auto &st = this->stats[index];
+    // EWMA with alpha = 1/4
+    st.latency = (st.latency == 0) ? latency : (st.latency * 3 + latency) / 4;
+    st.transactions++;
+    st.consecutiveErrors = 0;
+}
+
+void DonorTable::recordError(uint8_t index) {
+    auto &st = this->stats[index];
+    RDS4_DBG_PRINT("DonorTable: donor error ");
+    RDS4_DBG_PHEX(index);
+    RDS4_DBG_PRINT("\n");
+    st.errors++;
+    if (st.consecutiveErrors < 0xff) {
+        st.consecutiveErrors++;
+    }
+    st.lastError = millis();
+}
+
+AuthenticatorPool::AuthenticatorPool(DonorTable *donors) : donors(donors),
+                                                           active(DonorTable::NO_DONOR),
+                                                           challenge{0},
+                                                           challengePages(0),
+                                                           challengeComplete(false),
+                                                           transactionStart(0),
+                                                           latency(0) {
+    this->challengePageSize = 0;
+    this->responsePageSize = 0;
+}
+
+void AuthenticatorPool::begin() {
+    this->donors->begin();
+    this->fitPageSize();
+}
+
+bool AuthenticatorPool::available() {
+    if (this->active != DonorTable::NO_DONOR and this->donors->get(this->active)->available()) {
+        return true;
+    }
+    return this->donors->anyUsable();
+}
+
+bool AuthenticatorPool::fitPageSize() {
+    auto index = this->active;
+    if (index == DonorTable::NO_DONOR) {
+        index = this->donors->pick();
+    }
+    if (index == DonorTable::NO_DONOR) {
+        return false;
+    }
+    auto donor = this->donors->get(index);
+    if (donor->canFitPageSize() and not donor->fitPageSize()) {
+        return false;
+    }
+    this->challengePageSize = donor->getChallengePageSize();
+    this->responsePageSize = donor->getResponsePageSize();
+    return true;
+}
+
+bool AuthenticatorPool::prepare(uint8_t index) {
+    auto donor = this->donors->get(index);
+    bool result = true;
+    if (donor->needsReset()) {
+        result = donor->reset();
+    } else if (donor->canFitPageSize()) {
+        result = donor->fitPageSize();
+    }
+    return result;
+}
+
+/** Check if a donor has the page sizes the host was told about. */
+bool AuthenticatorPool::matchesLayout(uint8_t index) {
+    auto donor = this->donors->get(index);
+    return donor->getChallengePageSize() == this->challengePageSize and \
+           donor->getResponsePageSize() == this->responsePageSize;
+}
+
+bool AuthenticatorPool::reset() {
+    uint8_t tried = 0;
+    // Abandon the previous transaction (not the donor's fault)
+    if (this->active != DonorTable::NO_DONOR) {
+        this->donors->release(this->active, this);
+        this->active = DonorTable::NO_DONOR;
+    }
+    this->challengePages = 0;
+    this->challengeComplete = false;
+    this->latency = 0;
+    while ((this->active = this->donors->acquire(this, tried)) != DonorTable::NO_DONOR) {
+        tried |= 1 << this->active;
+        if (not this->prepare(this->active)) {
+            this->donors->recordError(this->active);
+        } else if (this->challengePageSize == 0) {
+            // Nothing advertised yet (no donor was around in begin())
+            this->fitPageSize();
+            break;
+        } else if (not this->matchesLayout(this->active)) {
+            RDS4_DBG_PRINTLN("AuthenticatorPool: page size mismatch");
+        } else {
+            break;
+        }
+        this->donors->release(this->active, this);
+    }
+    if (this->active == DonorTable::NO_DONOR) {
+        RDS4_DBG_PRINTLN("AuthenticatorPool: no donor available");
+        return false;
+    }
+    RDS4_DBG_PRINT("AuthenticatorPool: using donor ");
+    RDS4_DBG_PHEX(this->active);
+    RDS4_DBG_PRINT("\n");
+    return true;
+}
+
+bool AuthenticatorPool::replay() {
+    auto donor = this->donors->get(this->active);
+    for (uint8_t p=0; p<this->challengePages; p++) {
+        uint16_t offset = static_cast<uint16_t>(p) * this->challengePageSize;
+        if (donor->writeChallengePage(p, &(this->challenge[offset]), AUTH_CHALLENGE_SIZE - offset) == 0) {
+            return false;
+        }
+    }
+    if (this->challengeComplete) {
+        this->transactionStart = millis();
+    }
+    return true;
+}
+
+bool AuthenticatorPool::failover() {
+    uint8_t tried = 1 << this->active;
+    this->donors->release(this->active, this);
+    RDS4_DBG_PRINTLN("AuthenticatorPool: failing over");
+    while ((this->active = this->donors->acquire(this, tried)) != DonorTable::NO_DONOR) {
+        tried |= 1 << this->active;
+        if (not this->prepare(this->active)) {
+            this->donors->recordError(this->active);
+        // The host already knows our page sizes so only a donor with the same
+        // layout can take over.
+        } else if (not this->matchesLayout(this->active)) {
+            RDS4_DBG_PRINTLN("page size mismatch");
+        } else if (not this->replay()) {
+            this->donors->recordError(this->active);
+        } else {
+            RDS4_DBG_PRINT("AuthenticatorPool: took over by donor ");
+            RDS4_DBG_PHEX(this->active);
+            RDS4_DBG_PRINT("\n");
+            return true;
+        }
+        this->donors->release(this->active, this);
+    }
+    RDS4_DBG_PRINTLN("AuthenticatorPool: failover failed");
+    return false;
+}
+
+/** Make sure the donor of the current transaction is still ours. If it sat
+  * idle for too long and another pool took it, replay the challenge to
+  * another donor.
+  *
+  * @return `false` if there is no donor to continue with.
+  */
+bool AuthenticatorPool::hold() {
+    if (this->active == DonorTable::NO_DONOR) {
+        return false;
+    }
+    if (this->donors->renew(this->active, this)) {
+        return true;
+    }
+    RDS4_DBG_PRINTLN("AuthenticatorPool: donor taken over");
+    return this->failover();
+}
+
+void AuthenticatorPool::finish(bool success) {
+    if (success) {
+        this->donors->recordSuccess(this->active, this->latency);
+    } else {
+        this->donors->recordError(this->active);
+    }
+    this->donors->release(this->active, this);
+    this->active = DonorTable::NO_DONOR;
+}
+
+size_t AuthenticatorPool::writeChallengePage(uint8_t page, void *buf, size_t len) {
+    uint16_t offset = static_cast<uint16_t>(page) * this->challengePageSize;
+    size_t actual;
+    if (page != this->challengePages or offset >= AUTH_CHALLENGE_SIZE or not this->hold()) {
+        return 0;
+    }
+    actual = AUTH_CHALLENGE_SIZE - offset;
+    actual = actual > this->challengePageSize ? this->challengePageSize : actual;
+    actual = actual > len ? len : actual;
+    memcpy(&(this->challenge[offset]), buf, actual);
+    this->challengePages++;
+    if (this->endOfChallenge(page)) {
+        this->challengeComplete = true;
+        this->transactionStart = millis();
+    }
+    auto donor = this->donors->get(this->active);
+    if (not donor->available() or donor->writeChallengePage(page, buf, len) == 0) {
+        this->donors->recordError(this->active);
+        if (not this->failover()) {
+            return 0;
+        }
+    }
+    return actual;
+}
+
+api::AuthStatus AuthenticatorPool::getStatus() {
+    if (this->active == DonorTable::NO_DONOR) {
+        return api::AuthStatus::NO_TRANSACTION;
+    }
+    if (not this->hold()) {
+        return api::AuthStatus::COMM_ERR;
+    }
+    auto donor = this->donors->get(this->active);
+    if (not donor->available()) {
+        this->donors->recordError(this->active);
+        return this->failover() ? api::AuthStatus::BUSY : api::AuthStatus::COMM_ERR;
+    }
+    auto status = donor->getStatus();
+    switch (status) {
+        case api::AuthStatus::OK:
+            if (this->latency == 0) {
+                // +1 so a sub-ms signing still counts as measured
+                this->latency = millis() - this->transactionStart + 1;
+            }
+            break;
+        case api::AuthStatus::COMM_ERR:
+        case api::AuthStatus::UNKNOWN_ERR:
+            this->donors->recordError(this->active);
+            if (this->failover()) {
+                status = api::AuthStatus::BUSY;
+            }
+            break;
+        default:
+            break;
+    }
+    return status;
+}
+
+size_t AuthenticatorPool::afterRead(uint8_t page, size_t actual) {
+    if (actual == 0) {
+        this->finish(false);
+    } else if (this->endOfResponse(page)) {
+        this->finish(true);
+    }
+    return actual;
+}
+
+size_t AuthenticatorPool::readResponsePage(uint8_t page, void *buf, size_t len) {
+    if (not this->hold()) {
+        return 0;
+    }
+    return this->afterRead(page, this->donors->get(this->active)->readResponsePage(page, buf, len));
+}
+
+size_t AuthenticatorPool::readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) {
+    if (not this->hold()) {
+        return 0;
+    }
+    return this->afterRead(page, this->donors->get(this->active)->readResponsePageCRC(page, buf, len, crc));
+}
+
+} // namespace ds4
+} // namespace rds4
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorPool.hpp
+ *  Authenticator that spreads transactions over several donor authenticators.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+#include "api/internals.hpp"
+// For auth constants
+#include "Controller.hpp"
+
+#ifndef RDS4_POOL_MAX_DONORS
+#define RDS4_POOL_MAX_DONORS 4
+#endif
+
+namespace rds4 {
+namespace ds4 {
+
+/** Health and performance record of a donor. */
+struct DonorStats {
+    // Smoothed signing latency in ms (0 if never measured)
+    uint32_t latency;
+    // Completed transactions
+    uint16_t transactions;
+    // Failed operations
+    uint16_t errors;
+    // Failed operations since the last success
+    uint8_t consecutiveErrors;
+    // Time of the last failure (millis())
+    uint32_t lastError;
+};
+
+/** A set of donor authenticators shared by one or more AuthenticatorPool
+ *  objects. Tracks which donor is in use and how well each one performs.
+ *  Everything here is expected to be called from the main loop.
+ */
+class DonorTable {
+public:
+    static const uint8_t MAX_DONORS = RDS4_POOL_MAX_DONORS;
+    static const uint8_t NO_DONOR = 0xff;
+    // A donor that failed this many times in a row is skipped...
+    static const uint8_t MAX_CONSECUTIVE_ERRORS = 3;
+    // ...until this many ms have passed since its last failure.
+    static const uint32_t ERROR_COOLDOWN = 5000;
+    // A donor claimed but left unused for this many ms (e.g. the console
+    // abandoned the transaction) can be claimed by another pool.
+    static const uint32_t IDLE_TIMEOUT = 10000;
+
+    DonorTable();
+    /** Register a donor.
+     *
+     *  @param The donor authenticator.
+     *  @return `true` if successful, `false` if the table is full.
+     */
+    bool add(api::Authenticator *donor);
+    /** Start all donors. Only does something on the first call. */
+    void begin();
+    /** Pick the best idle and healthy donor without claiming it. Donors
+     *  with the lowest signing latency win. Donors that were never measured
+     *  are tried first.
+     *
+     *  @param Bitmask of donors to skip.
+     *  @return Index of the donor or NO_DONOR if none is usable.
+     */
+    uint8_t pick(uint8_t skip=0);
+    /** Pick the best idle and healthy donor and claim it.
+     *
+     *  @param The claimant (usually the AuthenticatorPool).
+     *  @param Bitmask of donors to skip.
+     *  @return Index of the donor or NO_DONOR if none is usable.
+     */
+    uint8_t acquire(const void *owner, uint8_t skip=0);
+    /** Mark a donor idle, if it is still claimed by `owner`. */
+    void release(uint8_t index, const void *owner);
+    /** Check if a donor is still claimed by `owner` and restart its idle
+     *  timeout.
+     *
+     *  @return `false` if the claim expired and the donor was taken over.
+     */
+    bool renew(uint8_t index, const void *owner);
+    /** Check if a donor is connected and not in error cooldown. */
+    bool usable(uint8_t index);
+    /** Check if any idle donor is usable. */
+    bool anyUsable();
+    void recordSuccess(uint8_t index, uint32_t latency);
+    void recordError(uint8_t index);
+    api::Authenticator *get(uint8_t index) {
+        return this->donors[index];
+    }
+    const DonorStats &getStats(uint8_t index) {
+        return this->stats[index];
+    }
+    uint8_t count() {
+        return this->donorCount;
+    }
+
+private:
+    api::Authenticator *donors[MAX_DONORS];
+    DonorStats stats[MAX_DONORS];
+    // Current claimant of each donor (nullptr if idle), and when it last
+    // used the donor (millis())
+    const void *owners[MAX_DONORS];
+    uint32_t lastUsed[MAX_DONORS];
+    uint8_t donorCount;
+    bool started;
+};
+
+/** Authenticator that routes each challenge/response transaction to an idle
+ *  and healthy donor from a DonorTable.
+ *  The page sizes are taken from the first donor and never change after
+ *  that, since the host only asks for them once. Donors with a different
+ *  layout are never used.
+ *  If the donor disappears (e.g. hot-unplugged), fails in the middle of a
+ *  transaction, or is taken by another pool after IDLE_TIMEOUT, the
+ *  challenge received so far is replayed to another donor.
+ *  Give each emulated controller its own pool object and share the
+ *  DonorTable between them.
+ */
+class AuthenticatorPool : public api::Authenticator {
+public:
+    AuthenticatorPool(DonorTable *donors);
+    void begin() override;
+    bool available() override;
+    bool canFitPageSize() override { return true; }
+    bool canSetPageSize() override { return false; }
+    bool needsReset() override { return true; }
+    bool fitPageSize() override;
+    bool setChallengePageSize(uint8_t size) override { return false; }
+    bool setResponsePageSize(uint8_t size) override { return false; }
+    bool endOfChallenge(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getChallengePageSize()) >= AUTH_CHALLENGE_SIZE;
+    }
+    bool endOfResponse(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getResponsePageSize()) >= AUTH_RESPONSE_SIZE;
+    }
+    bool reset() override;
+    size_t writeChallengePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) override;
+    api::AuthStatus getStatus() override;
+    /** Get the index of the donor currently serving this pool.
+     *
+     *  @return Index of the donor or DonorTable::NO_DONOR if idle.
+     */
+    uint8_t getActiveDonor() {
+        return this->active;
+    }
+
+private:
+    bool prepare(uint8_t index);
+    bool matchesLayout(uint8_t index);
+    bool hold();
+    bool replay();
+    bool failover();
+    void finish(bool success);
+    size_t afterRead(uint8_t page, size_t actual);
+    DonorTable *donors;
+    uint8_t active;
+    // Copy of the challenge, for replaying to another donor
+    uint8_t challenge[AUTH_CHALLENGE_SIZE];
+    // Number of challenge pages received so far
+    uint8_t challengePages;
+    bool challengeComplete;
+    uint32_t transactionStart;
+    // Signing latency of the current transaction (0 if not done yet)
+    uint32_t latency;
+};
+
+} // namespace ds4
+} // namespace rds4
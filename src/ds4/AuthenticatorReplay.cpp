@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorReplay.cpp
+ *  Authenticator that replays recorded auth transactions (Linux only).
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "AuthenticatorReplay.hpp"
+#include "utils/utils.hpp"
+
+#ifdef RDS4_LINUX
+
+// for memcpy(), etc.
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+const char AUTH_CAPTURE_MAGIC[8] = {'R', 'D', 'S', '4', 'C', 'A', 'P', '1'};
+
+AuthenticatorReplay::AuthenticatorReplay(const char *path, ReplayPacing pacing) : path(path),
+                                                                                   pacing(pacing),
+                                                                                   map(nullptr),
+                                                                                   mapSize(0),
+                                                                                   header(nullptr),
+                                                                                   records(nullptr),
+                                                                                   current(nullptr),
+                                                                                   next(0),
+                                                                                   polls(0),
+                                                                                   signStart(0),
+                                                                                   signing(false),
+                                                                                   mismatches(0) {
+    this->challengePageSize = 0;
+    this->responsePageSize = 0;
+}
+
+AuthenticatorReplay::~AuthenticatorReplay() {
+    if (this->map != nullptr) {
+        munmap(const_cast<uint8_t *>(this->map), this->mapSize);
+    }
+}
+
+void AuthenticatorReplay::begin() {
+    struct stat st;
+    void *map;
+    int fd;
+    if (this->map != nullptr) {
+        return;
+    }
+    fd = open(this->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        RDS4_DBG_PRINTLN("AuthenticatorReplay: cannot open capture");
+        return;
+    }
+    if (fstat(fd, &st) != 0 or static_cast<size_t>(st.st_size) < sizeof(AuthCaptureHeader)) {
+        RDS4_DBG_PRINTLN("AuthenticatorReplay: capture too short");
+        close(fd);
+        return;
+    }
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    // The mapping holds its own reference to the file
+    close(fd);
+    if (map == MAP_FAILED) {
+        RDS4_DBG_PRINTLN("AuthenticatorReplay: mmap failed");
+        return;
+    }
+    this->map = static_cast<const uint8_t *>(map);
+    this->mapSize = st.st_size;
+    auto header = reinterpret_cast<const AuthCaptureHeader *>(this->map);
+    if (memcmp(header->magic, AUTH_CAPTURE_MAGIC, sizeof(header->magic)) != 0 or \
+            header->count == 0 or header->challengePageSize == 0 or header->responsePageSize == 0 or \
+            this->mapSize < sizeof(*header) + header->count * sizeof(AuthCaptureRecord)) {
+        RDS4_DBG_PRINTLN("AuthenticatorReplay: bad capture");
+        munmap(map, this->mapSize);
+        this->map = nullptr;
+        return;
+    }
+    this->header = header;
+    this->records = reinterpret_cast<const AuthCaptureRecord *>(this->map + sizeof(*header));
+    this->fitPageSize();
+}
+
+bool AuthenticatorReplay::fitPageSize() {
+    if (this->header == nullptr) {
+        return false;
+    }
+    this->challengePageSize = this->header->challengePageSize;
+    this->responsePageSize = this->header->responsePageSize;
+    return true;
+}
+
+const AuthCaptureRecord *AuthenticatorReplay::getRecord(uint16_t index) {
+    if (this->records == nullptr or index >= this->header->count) {
+        return nullptr;
+    }
+    return &(this->records[index]);
+}
+
+bool AuthenticatorReplay::reset() {
+    if (not this->fitPageSize()) {
+        return false;
+    }
+    this->current = &(this->records[this->next]);
+    this->next = (this->next + 1) % this->header->count;
+    this->polls = 0;
+    this->signing = false;
+    return true;
+}
+
+const uint8_t *AuthenticatorReplay::getChallengePage(uint8_t page, size_t *len) {
+    uint16_t offset = static_cast<uint16_t>(page) * this->challengePageSize;
+    if (this->current == nullptr or offset >= AUTH_CHALLENGE_SIZE) {
+        return nullptr;
+    }
+    *len = AUTH_CHALLENGE_SIZE - offset;
+    *len = *len > this->challengePageSize ? this->challengePageSize : *len;
+    return &(this->current->challenge[offset]);
+}
+
+const uint8_t *AuthenticatorReplay::getResponsePage(uint8_t page, size_t *len) {
+    uint16_t offset = static_cast<uint16_t>(page) * this->responsePageSize;
+    if (this->current == nullptr or offset >= AUTH_RESPONSE_SIZE) {
+        return nullptr;
+    }
+    *len = AUTH_RESPONSE_SIZE - offset;
+    *len = *len > this->responsePageSize ? this->responsePageSize : *len;
+    return &(this->current->response[offset]);
+}
+
+size_t AuthenticatorReplay::writeChallengePage(uint8_t page, void *buf, size_t len) {
+    size_t expected;
+    auto recorded = this->getChallengePage(page, &expected);
+    if (recorded == nullptr or len < expected) {
+        return 0;
+    }
+    if (memcmp(recorded, buf, expected) != 0) {
+        this->mismatches++;
+    }
+    if (this->endOfChallenge(page)) {
+        this->signing = true;
+        this->polls = 0;
+        this->signStart = micros();
+    }
+    return expected;
+}
+
+size_t AuthenticatorReplay::readResponsePage(uint8_t page, void *buf, size_t len) {
+    size_t actual;
+    auto recorded = this->getResponsePage(page, &actual);
+    if (recorded == nullptr or len < actual) {
+        return 0;
+    }
+    memcpy(buf, recorded, actual);
+    return actual;
+}
+
+size_t AuthenticatorReplay::readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) {
+    size_t actual;
+    auto recorded = this->getResponsePage(page, &actual);
+    if (recorded == nullptr or len < actual) {
+        return 0;
+    }
+    *crc = utils::copy_and_crc32(buf, recorded, actual, *crc);
+    return actual;
+}
+
+api::AuthStatus AuthenticatorReplay::getStatus() {
+    if (not this->signing) {
+        return api::AuthStatus::NO_TRANSACTION;
+    }
+    switch (this->pacing) {
+        case ReplayPacing::REALTIME:
+            if (micros() - this->signStart < this->current->latency) {
+                return api::AuthStatus::BUSY;
+            }
+            break;
+        case ReplayPacing::FAST:
+        default:
+            if (this->polls < this->current->busyPolls) {
+                this->polls++;
+                return api::AuthStatus::BUSY;
+            }
+            break;
+    }
+    return api::AuthStatus::OK;
+}
+
+AuthenticatorRecorder::AuthenticatorRecorder(api::Authenticator *inner, const char *path) : inner(inner),
+                                                                                             path(path),
+                                                                                             file(nullptr),
+                                                                                             header(),
+                                                                                             record(),
+                                                                                             signStart(0),
+                                                                                             signing(false) {
+    memcpy(this->header.magic, AUTH_CAPTURE_MAGIC, sizeof(this->header.magic));
+}
+
+AuthenticatorRecorder::~AuthenticatorRecorder() {
+    if (this->file != nullptr) {
+        fclose(this->file);
+    }
+}
+
+void AuthenticatorRecorder::begin() {
+    this->inner->begin();
+    if (this->file == nullptr) {
+        this->file = fopen(this->path, "wb");
+        if (this->file == nullptr) {
+            RDS4_DBG_PRINTLN("AuthenticatorRecorder: cannot create capture");
+            return;
+        }
+        fwrite(&(this->header), sizeof(this->header), 1, this->file);
+        fflush(this->file);
+    }
+}
+
+bool AuthenticatorRecorder::reset() {
+    memset(&(this->record), 0, sizeof(this->record));
+    this->signing = false;
+    return this->inner->reset();
+}
+
+size_t AuthenticatorRecorder::writeChallengePage(uint8_t page, void *buf, size_t len) {
+    auto actual = this->inner->writeChallengePage(page, buf, len);
+    uint16_t offset = static_cast<uint16_t>(page) * this->inner->getChallengePageSize();
+    if (page == 0 and not this->inner->needsReset()) {
+        memset(&(this->record), 0, sizeof(this->record));
+    }
+    if (actual != 0 and offset < AUTH_CHALLENGE_SIZE) {
+        size_t room = AUTH_CHALLENGE_SIZE - offset;
+        memcpy(&(this->record.challenge[offset]), buf, actual > room ? room : actual);
+        if (this->inner->endOfChallenge(page)) {
+            this->signing = true;
+            this->signStart = micros();
+        }
+    }
+    return actual;
+}
+
+api::AuthStatus AuthenticatorRecorder::getStatus() {
+    auto status = this->inner->getStatus();
+    if (this->signing) {
+        if (status == api::AuthStatus::BUSY) {
+            this->record.busyPolls++;
+        } else if (status == api::AuthStatus::OK) {
+            this->record.latency = micros() - this->signStart;
+            this->signing = false;
+        }
+    }
+    return status;
+}
+
+size_t AuthenticatorRecorder::readResponsePage(uint8_t page, void *buf, size_t len) {
+    auto actual = this->inner->readResponsePage(page, buf, len);
+    uint16_t offset = static_cast<uint16_t>(page) * this->inner->getResponsePageSize();
+    if (actual != 0 and offset < AUTH_RESPONSE_SIZE) {
+        size_t room = AUTH_RESPONSE_SIZE - offset;
+        memcpy(&(this->record.response[offset]), buf, actual > room ? room : actual);
+        if (this->inner->endOfResponse(page)) {
+            this->commit();
+        }
+    }
+    return actual;
+}
+
+void AuthenticatorRecorder::commit() {
+    if (this->file == nullptr or this->header.count == 0xffff) {
+        return;
+    }
+    // Page sizes of the first transaction are used for the whole capture
+    if (this->header.count == 0) {
+        this->header.challengePageSize = this->inner->getChallengePageSize();
+        this->header.responsePageSize = this->inner->getResponsePageSize();
+    }
+    this->header.count++;
+    fseek(this->file, 0, SEEK_END);
+    fwrite(&(this->record), sizeof(this->record), 1, this->file);
+    fseek(this->file, 0, SEEK_SET);
+    fwrite(&(this->header), sizeof(this->header), 1, this->file);
+    fflush(this->file);
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorReplay.hpp
+ *  Authenticator that replays recorded auth transactions (Linux only).
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+#include "api/internals.hpp"
+// For auth constants
+#include "Controller.hpp"
+
+#ifdef RDS4_LINUX
+
+#include <cstdio>
+
+namespace rds4 {
+namespace ds4 {
+
+/* Capture file layout (little-endian): an AuthCaptureHeader followed by
+ * `count` AuthCaptureRecord entries. Records are fixed-size so the file can
+ * be indexed directly after mapping it.
+ */
+struct AuthCaptureHeader {
+    char magic[8]; // "RDS4CAP1"
+    uint8_t challengePageSize;
+    uint8_t responsePageSize;
+    uint16_t count;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct AuthCaptureRecord {
+    // Time between the last challenge page and the first OK status (us)
+    uint32_t latency;
+    // Number of BUSY status replies before OK
+    uint16_t busyPolls;
+    uint16_t reserved;
+    uint8_t challenge[AUTH_CHALLENGE_SIZE];
+    uint8_t response[AUTH_RESPONSE_SIZE];
+} __attribute__((packed));
+
+extern const char AUTH_CAPTURE_MAGIC[8];
+
+enum class ReplayPacing : uint8_t {
+    // Report BUSY as many times as recorded, then OK
+    FAST,
+    // Report BUSY until the recorded signing time has passed
+    REALTIME,
+};
+
+/** Authenticator that serves transactions from a capture file. Each reset()
+ *  moves on to the next recorded transaction and wraps around at the end.
+ *  The file is memory-mapped and pages can be accessed without copying
+ *  through getChallengePage()/getResponsePage().
+ */
+class AuthenticatorReplay : public api::Authenticator {
+public:
+    AuthenticatorReplay(const char *path, ReplayPacing pacing=ReplayPacing::FAST);
+    ~AuthenticatorReplay();
+    /** Map the capture file. available() returns `false` if this fails. */
+    void begin() override;
+    bool available() override {
+        return this->records != nullptr;
+    }
+    bool canFitPageSize() override { return true; }
+    bool canSetPageSize() override { return false; }
+    bool needsReset() override { return true; }
+    bool fitPageSize() override;
+    bool setChallengePageSize(uint8_t size) override { return false; }
+    bool setResponsePageSize(uint8_t size) override { return false; }
+    bool endOfChallenge(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getChallengePageSize()) >= AUTH_CHALLENGE_SIZE;
+    }
+    bool endOfResponse(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getResponsePageSize()) >= AUTH_RESPONSE_SIZE;
+    }
+    bool reset() override;
+    size_t writeChallengePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePageCRC(uint8_t page, void *buf, size_t len, uint32_t *crc) override;
+    api::AuthStatus getStatus() override;
+
+    /** Number of recorded transactions. */
+    uint16_t count() {
+        return this->header != nullptr ? this->header->count : 0;
+    }
+    /** Get a recorded transaction.
+     *
+     *  @param Index of the transaction.
+     *  @return Pointer into the mapped file or `nullptr` if out of range.
+     */
+    const AuthCaptureRecord *getRecord(uint16_t index);
+    /** Get a challenge page of the current transaction without copying.
+     *
+     *  @param Page number.
+     *  @param Receives the size of the page.
+     *  @return Pointer into the mapped file or `nullptr` if out of range.
+     */
+    const uint8_t *getChallengePage(uint8_t page, size_t *len);
+    /** Get a response page of the current transaction without copying.
+     *
+     *  @param Page number.
+     *  @param Receives the size of the page.
+     *  @return Pointer into the mapped file or `nullptr` if out of range.
+     */
+    const uint8_t *getResponsePage(uint8_t page, size_t *len);
+    /** Number of challenge pages that didn't match the recording. */
+    uint32_t getMismatches() {
+        return this->mismatches;
+    }
+
+private:
+    const char *path;
+    ReplayPacing pacing;
+    const uint8_t *map;
+    size_t mapSize;
+    const AuthCaptureHeader *header;
+    const AuthCaptureRecord *records;
+    const AuthCaptureRecord *current;
+    uint16_t next;
+    uint16_t polls;
+    uint32_t signStart;
+    bool signing;
+    uint32_t mismatches;
+};
+
+/** Authenticator wrapper that records every transaction that passes through
+ *  it into a capture file usable by AuthenticatorReplay.
+ */
+class AuthenticatorRecorder : public api::Authenticator {
+public:
+    AuthenticatorRecorder(api::Authenticator *inner, const char *path);
+    ~AuthenticatorRecorder();
+    void begin() override;
+    bool available() override {
+        return this->inner->available();
+    }
+    bool canFitPageSize() override {
+        return this->inner->canFitPageSize();
+    }
+    bool canSetPageSize() override {
+        return this->inner->canSetPageSize();
+    }
+    bool needsReset() override {
+        return this->inner->needsReset();
+    }
+    bool fitPageSize() override {
+        return this->inner->fitPageSize();
+    }
+    bool setChallengePageSize(uint8_t size) override {
+        return this->inner->setChallengePageSize(size);
+    }
+    bool setResponsePageSize(uint8_t size) override {
+        return this->inner->setResponsePageSize(size);
+    }
+    uint8_t getChallengePageSize() override {
+        return this->inner->getChallengePageSize();
+    }
+    uint8_t getResponsePageSize() override {
+        return this->inner->getResponsePageSize();
+    }
+    bool endOfChallenge(uint8_t page) override {
+        return this->inner->endOfChallenge(page);
+    }
+    bool endOfResponse(uint8_t page) override {
+        return this->inner->endOfResponse(page);
+    }
+    bool reset() override;
+    size_t writeChallengePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePage(uint8_t page, void *buf, size_t len) override;
+    api::AuthStatus getStatus() override;
+    /** Number of transactions written so far. */
+    uint16_t count() {
+        return this->header.count;
+    }
+
+private:
+    void commit();
+    api::Authenticator *inner;
+    const char *path;
+    FILE *file;
+    AuthCaptureHeader header;
+    AuthCaptureRecord record;
+    uint32_t signStart;
+    bool signing;
+};
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
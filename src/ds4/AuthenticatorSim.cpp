@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorSim.cpp
+ *  Simulated donor authenticator for load testing.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "AuthenticatorSim.hpp"
+#include "utils/utils.hpp"
+
+namespace rds4 {
+namespace ds4 {
+
+uint32_t SimLatency::sample(SimRandom &rng) const {
+    uint32_t span = this->max > this->min ? this->max - this->min : 0;
+    switch (this->kind) {
+        case SimLatency::UNIFORM:
+            return this->min + rng.below(span + 1);
+        case SimLatency::TAIL: {
+            // Cube of a uniform [0, 1) value in 16.16 fixed point
+            uint64_t u = rng.below(0x10000);
+            u = (u * u * u) >> 32;
+            return this->min + static_cast<uint32_t>((static_cast<uint64_t>(span) * u) >> 16);
+        }
+        case SimLatency::BIMODAL:
+            return rng.chance(this->permille) ? this->max : this->min;
+        case SimLatency::FIXED:
+        default:
+            return this->min;
+    }
+}
+
+AuthenticatorSim::AuthenticatorSim(const SimConfig &config, uint32_t seed) : config(config),
+                                                                             rng(seed),
+                                                                             clock(0),
+                                                                             challengeCRC(utils::crc32_init()),
+                                                                             key(0),
+                                                                             signDone(0),
+                                                                             signing(false),
+                                                                             injectedErrors(0) {
+    this->challengePageSize = 0;
+    this->responsePageSize = 0;
+}
+
+bool AuthenticatorSim::transfer(const SimLatency &latency) {
+    this->clock += latency.sample(this->rng);
+    if (this->rng.chance(this->config.commErrPermille)) {
+        this->injectedErrors++;
+        return false;
+    }
+    return true;
+}
+
+bool AuthenticatorSim::fitPageSize() {
+    if (not this->transfer(this->config.readLatency) or not this->config.fitOK) {
+        return false;
+    }
+    this->challengePageSize = this->config.challengePageSize;
+    this->responsePageSize = this->config.responsePageSize;
+    return true;
+}
+
+bool AuthenticatorSim::reset() {
+    this->signing = false;
+    if (not this->config.resetOK) {
+        return false;
+    }
+    return this->fitPageSize();
+}
+
+size_t AuthenticatorSim::writeChallengePage(uint8_t page, void *buf, size_t len) {
+    uint16_t offset = static_cast<uint16_t>(page) * this->challengePageSize;
+    size_t expected;
+    if (this->challengePageSize == 0 or offset >= AUTH_CHALLENGE_SIZE) {
+        return 0;
+    }
+    expected = AUTH_CHALLENGE_SIZE - offset;
+    expected = expected > this->challengePageSize ? this->challengePageSize : expected;
+    if (len < expected or not this->transfer(this->config.writeLatency)) {
+        return 0;
+    }
+    if (page == 0) {
+        this->challengeCRC = utils::crc32_init();
+        this->signing = false;
+    }
+    this->challengeCRC = utils::crc32_update(this->challengeCRC, buf, expected);
+    if (this->endOfChallenge(page)) {
+        this->key = utils::crc32_final(this->challengeCRC);
+        this->signDone = this->clock + this->config.signTime.sample(this->rng);
+        this->signing = true;
+    }
+    return expected;
+}
+
+size_t AuthenticatorSim::readResponsePage(uint8_t page, void *buf, size_t len) {
+    uint16_t offset = static_cast<uint16_t>(page) * this->responsePageSize;
+    size_t actual;
+    if (this->responsePageSize == 0 or offset >= AUTH_RESPONSE_SIZE) {
+        return 0;
+    }
+    actual = AUTH_RESPONSE_SIZE - offset;
+    actual = actual > this->responsePageSize ? this->responsePageSize : actual;
+    if (len < actual or not this->transfer(this->config.readLatency)) {
+        return 0;
+    }
+    AuthenticatorSim::fillResponseKey(this->key, offset, buf, actual);
+    return actual;
+}
+
+api::AuthStatus AuthenticatorSim::getStatus() {
+    if (not this->transfer(this->config.statusLatency)) {
+        return api::AuthStatus::COMM_ERR;
+    }
+    if (not this->signing) {
+        return api::AuthStatus::NO_TRANSACTION;
+    }
+    if (this->rng.chance(this->config.unknownErrPermille)) {
+        this->injectedErrors++;
+        return api::AuthStatus::UNKNOWN_ERR;
+    }
+    // Wrap-safe comparison
+    if (static_cast<int32_t>(this->clock - this->signDone) < 0) {
+        return api::AuthStatus::BUSY;
+    }
+    return api::AuthStatus::OK;
+}
+
+void AuthenticatorSim::fillResponse(const void *challenge, uint16_t offset, void *buf, size_t len) {
+    AuthenticatorSim::fillResponseKey(utils::crc32(challenge, AUTH_CHALLENGE_SIZE), offset, buf, len);
+}
+
+void AuthenticatorSim::fillResponseKey(uint32_t key, uint16_t offset, void *buf, size_t len) {
+    auto *out = static_cast<uint8_t *>(buf);
+    for (size_t i=0; i<len; i++) {
+        uint16_t o = offset + i;
+        out[i] = static_cast<uint8_t>(key >> ((o & 3) * 8)) ^ static_cast<uint8_t>(o);
+    }
+}
+
+} // namespace ds4
+} // namespace rds4
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** AuthenticatorSim.hpp
+ *  Simulated donor authenticator for load testing.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+#include "api/internals.hpp"
+// For auth constants
+#include "Controller.hpp"
+
+namespace rds4 {
+namespace ds4 {
+
+/** Small seeded PRNG (xorshift32) so simulations are reproducible. */
+class SimRandom {
+public:
+    SimRandom(uint32_t seed=1) : state(seed != 0 ? seed : 1) {}
+    uint32_t next() {
+        this->state ^= this->state << 13;
+        this->state ^= this->state >> 17;
+        this->state ^= this->state << 5;
+        return this->state;
+    }
+    /** Uniform value in [0, range). */
+    uint32_t below(uint32_t range) {
+        return range != 0 ? this->next() % range : 0;
+    }
+    /** Return `true` with the given probability in 1/1000. */
+    bool chance(uint16_t permille) {
+        return this->below(1000) < permille;
+    }
+private:
+    uint32_t state;
+};
+
+/** A latency distribution in virtual us. */
+struct SimLatency {
+    enum Kind : uint8_t {
+        // Always min
+        FIXED,
+        // Uniform between min and max
+        UNIFORM,
+        // Skewed towards min with a long tail up to max
+        TAIL,
+        // min, except max with a probability of `permille`/1000
+        BIMODAL,
+    };
+    Kind kind;
+    uint32_t min;
+    uint32_t max;
+    uint16_t permille;
+
+    uint32_t sample(SimRandom &rng) const;
+};
+
+/** Behavior of the simulated donor. */
+struct SimConfig {
+    // Page sizes reported after fitting
+    uint8_t challengePageSize;
+    uint8_t responsePageSize;
+    // Whether fitPageSize()/reset() succeed
+    bool fitOK;
+    bool resetOK;
+    bool needsReset;
+    // Time each transfer blocks the caller
+    SimLatency writeLatency;
+    SimLatency readLatency;
+    SimLatency statusLatency;
+    // Time from the last challenge page until the status turns OK
+    SimLatency signTime;
+    // Probability of a transfer failing with COMM_ERR (1/1000)
+    uint16_t commErrPermille;
+    // Probability of a status poll returning UNKNOWN_ERR (1/1000)
+    uint16_t unknownErrPermille;
+};
+
+/** Authenticator that simulates a donor on a virtual clock. Every call
+ *  advances the clock by the simulated transfer time. Everything else (e.g.
+ *  the host's poll interval) has to be charged with advance().
+ *
+ *  The response is derived from the challenge so the other end can check it
+ *  with fillResponse().
+ */
+class AuthenticatorSim : public api::Authenticator {
+public:
+    AuthenticatorSim(const SimConfig &config, uint32_t seed=1);
+    void begin() override { this->fitPageSize(); }
+    bool available() override { return true; }
+    bool canFitPageSize() override { return true; }
+    bool canSetPageSize() override { return false; }
+    bool needsReset() override {
+        return this->config.needsReset;
+    }
+    bool fitPageSize() override;
+    bool setChallengePageSize(uint8_t size) override { return false; }
+    bool setResponsePageSize(uint8_t size) override { return false; }
+    bool endOfChallenge(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getChallengePageSize()) >= AUTH_CHALLENGE_SIZE;
+    }
+    bool endOfResponse(uint8_t page) override {
+        return ((static_cast<uint16_t>(page)+1) * this->getResponsePageSize()) >= AUTH_RESPONSE_SIZE;
+    }
+    bool reset() override;
+    size_t writeChallengePage(uint8_t page, void *buf, size_t len) override;
+    size_t readResponsePage(uint8_t page, void *buf, size_t len) override;
+    api::AuthStatus getStatus() override;
+
+    /** Current virtual time (us). */
+    uint32_t now() {
+        return this->clock;
+    }
+    /** Let virtual time pass. */
+    void advance(uint32_t us) {
+        this->clock += us;
+    }
+    /** Generate the expected response bytes for a challenge.
+     *
+     *  @param The whole challenge (AUTH_CHALLENGE_SIZE bytes).
+     *  @param Offset into the response.
+     *  @param Destination buffer.
+     *  @param Number of bytes to generate.
+     */
+    static void fillResponse(const void *challenge, uint16_t offset, void *buf, size_t len);
+    SimConfig &getConfig() {
+        return this->config;
+    }
+    uint32_t getInjectedErrors() {
+        return this->injectedErrors;
+    }
+
+private:
+    static void fillResponseKey(uint32_t key, uint16_t offset, void *buf, size_t len);
+    bool transfer(const SimLatency &latency);
+    SimConfig config;
+    SimRandom rng;
+    uint32_t clock;
+    // Running CRC of the challenge, used as the key for the response
+    uint32_t challengeCRC;
+    uint32_t key;
+    uint32_t signDone;
+    bool signing;
+    uint32_t injectedErrors;
+};
+
+} // namespace ds4
+} // namespace rds4
@@ -7,6 +7,7 @@
 
 #include "Controller.hpp"
 
+#include "utils/crc32.hpp"
 #include "utils/utils.hpp"
 
 #ifdef RDS4_LINUX
@@ -17,7 +18,23 @@
 namespace rds4 {
 namespace ds4 {
 
-const uint8_t Controller::keyLookup[static_cast<uint8_t>(api::Key::_COUNT)] = {
+// buildReportBT() and mergeFeedback() rely on these
+static_assert(sizeof(InputReportBT) == Controller::BT_REPORT_SIZE, "InputReportBT has wrong size");
+static_assert(sizeof(FeedbackReportBT) == Controller::BT_REPORT_SIZE, "FeedbackReportBT has wrong size");
+static_assert(offsetof(InputReportBT, frames) - offsetof(InputReportBT, common) ==
+              offsetof(InputReport, frames) - offsetof(InputReport, sticks), "InputReportBT layout mismatch");
+static_assert(offsetof(FeedbackReportBT, led_flash_off) - offsetof(FeedbackReportBT, flags) ==
+              offsetof(FeedbackReport, led_flash_off) - offsetof(FeedbackReport, flags), "FeedbackReportBT layout mismatch");
+
+// Bluetooth reports include the HID transaction header (DATA|INPUT or
+// DATA|OUTPUT) in their CRC
+static const uint8_t BT_CRC_SEED_IN = 0xa1;
+static const uint8_t BT_CRC_SEED_OUT = 0xa2;
+// Offset of the body shared by USB and Bluetooth-format reports
+static const uint8_t BT_BODY_OFFSET = 2;
+
+// DS4 key code of every api::Key
+static constexpr uint8_t KEY_LOOKUP[static_cast<uint8_t>(api::Key::_COUNT)] = {
     Controller::KEY_CIR,
     Controller::KEY_XRO,
     Controller::KEY_TRI,
@@ -33,12 +50,31 @@ const uint8_t Controller::keyLookup[static_cast<uint8_t>(api::Key::_COUNT)] = {
     Controller::KEY_OPT,
 };
 
-Controller::Controller(api::Transport *backend) : api::Controller(backend), currentTouchSeq(0) { /* pass */ };
+struct KeyPermutation {
+    static constexpr uint8_t map(uint8_t bit) {
+        return bit < static_cast<uint8_t>(api::Key::_COUNT) ? KEY_LOOKUP[bit] : 0xff;
+    }
+};
+
+// api::keyMask() bits to DS4 key code bits, for setButtonsUniversal()
+static const utils::BitPermutation KEY_PERMUTATION PROGMEM = utils::makeBitPermutation<KeyPermutation>();
+// Key bits in the 24-bit button field (KEY_SQR to KEY_PS, after the D-pad)
+static const uint32_t UNIVERSAL_KEYS = 0x1ffful << 4;
+
+ControllerBase::ControllerBase(api::Transport *backend) : api::Controller(backend), format(ReportFormat::USB),
+                                                      btPollInterval(ControllerBase::DEFAULT_BT_POLL_INTERVAL), btHeaderFlags(0), btHeaderCRC(0),
+                                                      currentTouchSeq(0), dirty(ControllerBase::DIRTY_ALL),
+                                                      changeDriven(false), keepalive(ControllerBase::DEFAULT_KEEPALIVE), lastSent(0),
+                                                      immediateFeedback(false), _notifyRumble(nullptr), _notifyLED(nullptr),
+                                                      _notifyFlash(nullptr) {
+    this->resetStats();
+};
 
-void Controller::begin() {
+void ControllerBase::begin() {
     this->backend->begin();
     memset(&(this->report), 0, sizeof(this->report));
     this->report.type = 0x01;
+    memset(&(this->feedback), 0, sizeof(this->feedback));
     // Center the D-Pad
     this->setRotary8Pos(0, api::Rotary8Pos::C);
     // Analog sticks
@@ -48,70 +84,231 @@ void Controller::begin() {
     // Ext TODO
     this->report.state_ext = 0x08;
     this->report.battery = 0xff;
+    // Always send the initial state
+    this->dirty = ControllerBase::DIRTY_ALL;
+}
+
+void ControllerBase::setChangeDriven(bool enable, uint16_t keepalive) {
+    this->changeDriven = enable;
+    this->keepalive = keepalive;
+}
+
+void ControllerBase::setReportFormat(ReportFormat format) {
+    this->format = format;
+    // The frame count doesn't carry over
+    this->clearTouchEvents();
+    this->dirty = ControllerBase::DIRTY_ALL;
 }
 
 void Controller::update() {
-    if (this->backend->available()) {
-        // TODO
-        this->backend->recv(&(this->feedback), sizeof(this->feedback));
+    if (not this->getImmediateFeedback()) {
+        this->drainFeedbackVia(this->backend);
     }
 }
 
-bool Controller::hasValidFeedback() {
-    return this->feedback.type == 0x05;
+void Controller::setImmediateFeedback(bool enable) {
+    this->attachFeedback(enable, &Controller::onRX);
 }
 
-inline bool Controller::sendReport_(bool blocking) {
-    // https://www.psdevwiki.com/ps4/DS4-BT#0x11
-    this->report.sensor_timestamp = ((millis() * 150) & 0xffff);
-    uint8_t actual;
-    if (blocking) {
-        actual = this->backend->sendBlocking(&(this->report), sizeof(this->report));
+void Controller::onRX(void *context) {
+    auto *self = static_cast<Controller *>(context);
+    self->drainFeedbackVia(self->backend);
+}
+
+void ControllerBase::attachFeedback(bool enable, api::Transport::RXCallback callback) {
+    this->immediateFeedback = enable;
+    this->backend->attachRXCallback(enable ? callback : nullptr, this);
+}
+
+/** Store the merged feedback and fire the callbacks of the parts that
+  * changed.
+  */
+void ControllerBase::applyFeedback(const FeedbackReport &latest) {
+    uint8_t changed = 0;
+    if (latest.rumble_left != this->feedback.rumble_left or latest.rumble_right != this->feedback.rumble_right) {
+        changed |= ControllerBase::FEEDBACK_RUMBLE;
+    }
+    if (memcmp(latest.led_color, this->feedback.led_color, sizeof(latest.led_color)) != 0) {
+        changed |= ControllerBase::FEEDBACK_LED;
+    }
+    if (latest.led_flash_on != this->feedback.led_flash_on or latest.led_flash_off != this->feedback.led_flash_off) {
+        changed |= ControllerBase::FEEDBACK_FLASH;
+    }
+    memcpy(&(this->feedback), &latest, offsetof(FeedbackReport, padding));
+    if ((changed & ControllerBase::FEEDBACK_RUMBLE) and this->_notifyRumble != nullptr) {
+        (*this->_notifyRumble)(latest.rumble_left, latest.rumble_right);
+    }
+    if ((changed & ControllerBase::FEEDBACK_LED) and this->_notifyLED != nullptr) {
+        (*this->_notifyLED)(this->getLEDRGB());
+    }
+    if ((changed & ControllerBase::FEEDBACK_FLASH) and this->_notifyFlash != nullptr) {
+        (*this->_notifyFlash)(latest.led_flash_on, latest.led_flash_off);
+    }
+}
+
+/** Apply the parts of an OUT report selected by its flags. Takes both USB
+  * and Bluetooth-format reports.
+  *
+  * @return The parts applied (FEEDBACK_*), 0 if it's not a valid feedback
+  *         report.
+  */
+uint8_t ControllerBase::mergeFeedback(const void *buf, uint8_t len, FeedbackReport *merged) {
+    auto *raw = static_cast<const uint8_t *>(buf);
+    const FeedbackReport *pkt;
+    uint8_t parts;
+    if (len >= offsetof(FeedbackReport, padding) and raw[0] == ControllerBase::OUT_FEEDBACK) {
+        pkt = reinterpret_cast<const FeedbackReport *>(raw);
+    } else if (len >= sizeof(FeedbackReportBT) and raw[0] == ControllerBase::OUT_FEEDBACK_BT) {
+        uint32_t crc, expected;
+        crc = utils::crc32_update(utils::crc32_init(), &BT_CRC_SEED_OUT, 1);
+        crc = utils::crc32_final(utils::crc32_update(crc, raw, offsetof(FeedbackReportBT, crc32)));
+        memcpy(&expected, &raw[offsetof(FeedbackReportBT, crc32)], sizeof(expected));
+        if (crc != expected) {
+            RDS4_DBG_PRINTLN("Controller: BT feedback CRC mismatch");
+            return 0;
+        }
+        if (raw[1] & ControllerBase::BT_FLAG_HID) {
+            this->btPollInterval = raw[1] & ControllerBase::BT_POLL_INTERVAL_MASK;
+        }
+        // Same layout as the USB report from here on (the type field is
+        // not used)
+        pkt = reinterpret_cast<const FeedbackReport *>(&raw[BT_BODY_OFFSET]);
     } else {
-        actual = this->backend->send(&(this->report), sizeof(this->report));
+        return 0;
+    }
+    parts = pkt->flags & ControllerBase::FEEDBACK_ALL;
+    // Treat a report without flags as a full update
+    if (parts == 0) {
+        parts = ControllerBase::FEEDBACK_ALL;
+    }
+    merged->type = ControllerBase::OUT_FEEDBACK;
+    merged->flags = pkt->flags;
+    if (parts & ControllerBase::FEEDBACK_RUMBLE) {
+        merged->rumble_right = pkt->rumble_right;
+        merged->rumble_left = pkt->rumble_left;
+    }
+    if (parts & ControllerBase::FEEDBACK_LED) {
+        memcpy(merged->led_color, pkt->led_color, sizeof(merged->led_color));
+    }
+    if (parts & ControllerBase::FEEDBACK_FLASH) {
+        merged->led_flash_on = pkt->led_flash_on;
+        merged->led_flash_off = pkt->led_flash_off;
     }
-    if (actual != sizeof(this->report)) {
+    return parts;
+}
+
+bool ControllerBase::hasValidFeedback() {
+    return this->feedback.type == 0x05;
+}
+
+/** Check if a report is due and stamp it.
+  *
+  * @return `false` if change-driven mode skips this one.
+  */
+bool ControllerBase::prepareReport(uint32_t now) {
+    if (this->changeDriven and this->dirty == 0 and now - this->lastSent < this->keepalive) {
+        RDS4_STAT_INC(this->stats.reportsSkipped);
         return false;
-    } else {
-        this->incReportCtr();
-        if (this->report.tp_available_frame > 1) {
-            // copy the last frame to the first slot and nuke the rest
-            memcpy(&this->report.frames[0], &this->report.frames[this->report.tp_available_frame - 1], sizeof(this->report.frames[0]));
-            for (uint8_t i=1; i<3; i++) {
-                this->report.frames[i].seq = 0;
-                this->report.frames[i].pos[0] = 1 << 7;
-                this->report.frames[i].pos[1] = 1 << 7;
-            }
-            this->report.tp_available_frame = 1;
+    }
+    // https://www.psdevwiki.com/ps4/DS4-BT#0x11
+    // Derived from the clock, so it stays right across skipped reports
+    this->report.sensor_timestamp = ((now * 150) & 0xffff);
+    return true;
+}
+
+/** Bookkeeping after a report went out (or didn't).
+  *
+  * @return `sent`.
+  */
+bool ControllerBase::finishReport(bool sent, uint32_t now) {
+    if (not sent) {
+        RDS4_STAT_INC(this->stats.reportsFailed);
+        return false;
+    }
+#ifdef RDS4_STATS
+    uint32_t sentTime = micros();
+    if (this->statLastSent != 0) {
+        this->stats.reportInterval.add(sentTime - this->statLastSent);
+    }
+    this->statLastSent = sentTime;
+#endif
+    RDS4_STAT_INC(this->stats.reportsSent);
+    this->dirty = 0;
+    this->lastSent = now;
+    this->incReportCtr();
+    if (this->report.tp_available_frame > 1) {
+        // copy the last frame to the first slot and nuke the rest
+        memcpy(&this->report.frames[0], this->getTouchFrame(this->report.tp_available_frame - 1), sizeof(this->report.frames[0]));
+        for (uint8_t i=1; i<ControllerBase::TOUCH_FRAMES_BT; i++) {
+            auto *frame = this->getTouchFrame(i);
+            frame->seq = 0;
+            frame->pos[0] = 1 << 7;
+            frame->pos[1] = 1 << 7;
         }
-        return true;
+        this->report.tp_available_frame = 1;
     }
-    return false;
+    return true;
+}
+
+uint8_t ControllerBase::buildReportBT(void *buf) {
+    auto *pkt = static_cast<InputReportBT *>(buf);
+    uint32_t crc;
+    pkt->type = ControllerBase::IN_REPORT_BT;
+    pkt->bt_flags = ControllerBase::BT_FLAG_HID | ControllerBase::BT_FLAG_CRC | this->btPollInterval;
+    pkt->u2 = 0;
+#if defined(RDS4_CRC32_HAS_PCLMUL)
+    // Folding only pays off on long runs (see copy_and_crc32()), so copy
+    // first and checksum the whole report in one go
+    memcpy(pkt->common, this->report.sticks, offsetof(InputReport, padding) - offsetof(InputReport, sticks));
+    memcpy(&(pkt->frames[3]), &(this->extraFrame), sizeof(this->extraFrame));
+    memset(pkt->padding, 0, sizeof(pkt->padding));
+    crc = utils::crc32_update(utils::crc32_init(), &BT_CRC_SEED_IN, 1);
+    crc = utils::crc32_update(crc, pkt, offsetof(InputReportBT, crc32));
+#else
+    // The seed and the header only change with the poll interval
+    if (this->btHeaderFlags != pkt->bt_flags) {
+        this->btHeaderCRC = utils::crc32_update(utils::crc32_init(), &BT_CRC_SEED_IN, 1);
+        this->btHeaderCRC = utils::crc32_update(this->btHeaderCRC, pkt, offsetof(InputReportBT, common));
+        this->btHeaderFlags = pkt->bt_flags;
+    }
+    // Everything up to the 3rd touch frame is shared with the USB report
+    crc = utils::copy_and_crc32(pkt->common, this->report.sticks,
+                                offsetof(InputReport, padding) - offsetof(InputReport, sticks), this->btHeaderCRC);
+    memcpy(&(pkt->frames[3]), &(this->extraFrame), sizeof(this->extraFrame));
+    memset(pkt->padding, 0, sizeof(pkt->padding));
+    crc = utils::crc32_update(crc, &(pkt->frames[3]), offsetof(InputReportBT, crc32) - offsetof(InputReportBT, frames[3]));
+#endif
+    crc = utils::crc32_final(crc);
+    memcpy(&(pkt->crc32), &crc, sizeof(crc));
+    return ControllerBase::BT_REPORT_SIZE;
 }
 
 bool Controller::sendReport() {
-    return this->sendReport_(false);
+    return this->sendReportVia(this->backend, false);
 }
 
 bool Controller::sendReportBlocking() {
-    return this->sendReport_(true);
+    return this->sendReportVia(this->backend, true);
 }
 
-inline void Controller::incReportCtr() {
+inline void ControllerBase::incReportCtr() {
     this->report.buttons[2] += 4;
 }
 
-bool Controller::setRotary8Pos(uint8_t code, api::Rotary8Pos value) {
+bool ControllerBase::setRotary8Pos(uint8_t code, api::Rotary8Pos value) {
     if (code != 0) {
         return false;
     }
-    this->report.buttons[0] ^= this->report.buttons[0] & 0x0f;
-    this->report.buttons[0] |= static_cast<uint8_t>(value);
+    uint8_t buttons = (this->report.buttons[0] & 0xf0) | static_cast<uint8_t>(value);
+    if (buttons != this->report.buttons[0]) {
+        this->report.buttons[0] = buttons;
+        this->dirty |= ControllerBase::DIRTY_BUTTONS;
+    }
     return true;
 }
 
-bool Controller::setKey(uint8_t code, bool action) {
-    if (code < Controller::KEY_SQR or code > Controller::KEY_TP) {
+bool ControllerBase::setKey(uint8_t code, bool action) {
+    if (code < ControllerBase::KEY_SQR or code > ControllerBase::KEY_TP) {
         // key does not exist
         return false;
     }
@@ -120,44 +317,54 @@ bool Controller::setKey(uint8_t code, bool action) {
     // keycode structure: 000BBbbb
     // B: byte offset
     // b: bit offset
+    uint8_t &buttons = this->report.buttons[(code >> 3) & 3];
+    uint8_t old = buttons;
     if (action) {
         // pressed
-        this->report.buttons[(code >> 3) & 3] |= 1 << (code & 7);
+        buttons |= 1 << (code & 7);
     } else {
         //released
-        this->report.buttons[(code >> 3) & 3] &= ~(1 << (code & 7));
+        buttons &= ~(1 << (code & 7));
+    }
+    if (buttons != old) {
+        this->dirty |= ControllerBase::DIRTY_BUTTONS;
     }
     return true;
 }
 
-bool Controller::setAxis(uint8_t code, uint8_t value) {
-    if (code >= Controller::AXIS_LX and code <= Controller::AXIS_RY) {
-        this->report.sticks[code] = value;
-    } else if (code >= Controller::AXIS_L2 and code <= Controller::AXIS_R2) {
-        this->report.triggers[code-4] = value;
+bool ControllerBase::setAxis(uint8_t code, uint8_t value) {
+    uint8_t *axis;
+    if (code >= ControllerBase::AXIS_LX and code <= ControllerBase::AXIS_RY) {
+        axis = &(this->report.sticks[code]);
+    } else if (code >= ControllerBase::AXIS_L2 and code <= ControllerBase::AXIS_R2) {
+        axis = &(this->report.triggers[code-4]);
     } else {
         return false;
     }
+    if (*axis != value) {
+        *axis = value;
+        this->dirty |= ControllerBase::DIRTY_AXES;
+    }
     return true;
 }
 
-bool Controller::setAxis16(uint8_t code, uint16_t value) {
+bool ControllerBase::setAxis16(uint8_t code, uint16_t value) {
     // TODO accel and gyro support
     // No 16-bit axes at the moment, stub this
     return false;
 }
 
-bool Controller::setKeyUniversal(api::Key code, bool action) {
+bool ControllerBase::setKeyUniversal(api::Key code, bool action) {
     if (code == api::Key::_COUNT) {
         return false;
     }
-    auto ds4Code = this->keyLookup[static_cast<uint8_t>(code)];
+    auto ds4Code = KEY_LOOKUP[static_cast<uint8_t>(code)];
     switch (code) {
         case api::Key::LTrigger:
-            this->setAxis(Controller::AXIS_L2, action ? 0xff : 0x0);
+            this->setAxis(ControllerBase::AXIS_L2, action ? 0xff : 0x0);
             break;
         case api::Key::RTrigger:
-            this->setAxis(Controller::AXIS_R2, action ? 0xff : 0x0);
+            this->setAxis(ControllerBase::AXIS_R2, action ? 0xff : 0x0);
             break;
         default:
             break;
@@ -166,32 +373,50 @@ bool Controller::setKeyUniversal(api::Key code, bool action) {
     return true;
 }
 
-bool Controller::setDpadUniversal(api::Dpad value) {
+bool ControllerBase::setButtonsUniversal(uint32_t mask) {
+    uint32_t buttons, merged;
+    buttons = this->report.buttons[0] | (this->report.buttons[1] << 8) |
+              (static_cast<uint32_t>(this->report.buttons[2]) << 16);
+    merged = (buttons & ~UNIVERSAL_KEYS) |
+             (static_cast<uint32_t>(utils::bitPermute(&KEY_PERMUTATION, mask & 0xffff)) << 4);
+    if (merged != buttons) {
+        this->report.buttons[0] = merged & 0xff;
+        this->report.buttons[1] = (merged >> 8) & 0xff;
+        this->report.buttons[2] = (merged >> 16) & 0xff;
+        this->dirty |= ControllerBase::DIRTY_BUTTONS;
+    }
+    // Same as setKeyUniversal()
+    this->setAxis(ControllerBase::AXIS_L2, (mask & api::keyMask(api::Key::LTrigger)) ? 0xff : 0x0);
+    this->setAxis(ControllerBase::AXIS_R2, (mask & api::keyMask(api::Key::RTrigger)) ? 0xff : 0x0);
+    return true;
+}
+
+bool ControllerBase::setDpadUniversal(api::Dpad value) {
     return this->setDpad(0, value);
 }
 
-bool Controller::setStick(api::Stick index, uint8_t x, uint8_t y) {
+bool ControllerBase::setStick(api::Stick index, uint8_t x, uint8_t y) {
     switch (index) {
         case api::Stick::L:
-            this->setAxis(Controller::AXIS_LX, x);
-            this->setAxis(Controller::AXIS_LY, y);
+            this->setAxis(ControllerBase::AXIS_LX, x);
+            this->setAxis(ControllerBase::AXIS_LY, y);
             break;
         case api::Stick::R:
-            this->setAxis(Controller::AXIS_RX, x);
-            this->setAxis(Controller::AXIS_RY, y);
+            this->setAxis(ControllerBase::AXIS_RX, x);
+            this->setAxis(ControllerBase::AXIS_RY, y);
             break;
     }
     return true;
 }
 
-bool Controller::setTrigger(api::Key code, uint8_t value) {
-    auto ds4Code = this->keyLookup[static_cast<uint8_t>(code)];
+bool ControllerBase::setTrigger(api::Key code, uint8_t value) {
+    auto ds4Code = KEY_LOOKUP[static_cast<uint8_t>(code)];
     switch (code) {
         case api::Key::LTrigger:
-            this->setAxis(Controller::AXIS_L2, value);
+            this->setAxis(ControllerBase::AXIS_L2, value);
             break;
         case api::Key::RTrigger:
-            this->setAxis(Controller::AXIS_R2, value);
+            this->setAxis(ControllerBase::AXIS_R2, value);
             break;
         default:
             break;
@@ -200,56 +425,68 @@ bool Controller::setTrigger(api::Key code, uint8_t value) {
     return true;
 }
 
-bool Controller::setTouchpad(uint8_t slot, uint8_t pos, bool pressed, uint8_t seq, uint16_t x, uint16_t y) {
-    // TODO Bluetooth has different event buffer size
-    if (slot >= (sizeof(this->report.frames) / sizeof(TouchFrame)) || pos > 1) {
+inline TouchFrame *ControllerBase::getTouchFrame(uint8_t slot) {
+    // The extra frame sits right after the shared part in the Bluetooth
+    // report but not in the USB one
+    return slot < ControllerBase::TOUCH_FRAMES_USB ? &(this->report.frames[slot]) : &(this->extraFrame);
+}
+
+bool ControllerBase::setTouchpad(uint8_t slot, uint8_t pos, bool pressed, uint8_t seq, uint16_t x, uint16_t y) {
+    if (slot >= this->getTouchFrameCount() || pos > 1) {
         return false;
     }
-    this->report.frames[slot].pos[pos] = ((y & 0xfff) << 20) | ((x & 0xfff) << 8) | ((!pressed) << 7) | (seq & 0x7f);
-    this->report.frames[slot].seq++;
+    auto *frame = this->getTouchFrame(slot);
+    frame->pos[pos] = ((y & 0xfff) << 20) | ((x & 0xfff) << 8) | ((!pressed) << 7) | (seq & 0x7f);
+    frame->seq++;
+    this->dirty |= ControllerBase::DIRTY_TOUCH;
     return true;
 }
 
-bool Controller::setTouchEvent(uint8_t pos, bool pressed, uint16_t x, uint16_t y) {
+bool ControllerBase::setTouchEvent(uint8_t pos, bool pressed, uint16_t x, uint16_t y) {
     return this->setTouchpad(this->report.tp_available_frame, pos, pressed, this->currentTouchSeq, x, y);
 }
 
-bool Controller::finalizeTouchEvent() {
-    if (this->report.tp_available_frame < 3) {
+bool ControllerBase::finalizeTouchEvent() {
+    if (this->report.tp_available_frame < this->getTouchFrameCount()) {
         this->report.tp_available_frame++;
         this->currentTouchSeq++;
+        this->dirty |= ControllerBase::DIRTY_TOUCH;
         return true;
     } else {
         return false;
     }
 }
 
-void Controller::clearTouchEvents() {
+void ControllerBase::clearTouchEvents() {
+    if (this->report.tp_available_frame != 0) {
+        this->dirty |= ControllerBase::DIRTY_TOUCH;
+    }
     this->report.tp_available_frame = 0;
-    for (uint8_t i=0; i<3; i++) {
-        this->report.frames[i].seq = 0;
-        this->report.frames[i].pos[0] = 1 << 7;
-        this->report.frames[i].pos[1] = 1 << 7;
+    for (uint8_t i=0; i<ControllerBase::TOUCH_FRAMES_BT; i++) {
+        auto *frame = this->getTouchFrame(i);
+        frame->seq = 0;
+        frame->pos[0] = 1 << 7;
+        frame->pos[1] = 1 << 7;
     }
 }
 
-uint8_t Controller::getRumbleIntensityRight() {
+uint8_t ControllerBase::getRumbleIntensityRight() {
     return this->feedback.rumble_right;
 }
 
-uint8_t Controller::getRumbleIntensityLeft() {
+uint8_t ControllerBase::getRumbleIntensityLeft() {
     return this->feedback.rumble_left;
 }
 
-uint8_t Controller::getLEDDelayOn() {
+uint8_t ControllerBase::getLEDDelayOn() {
     return this->feedback.led_flash_on;
 }
 
-uint8_t Controller::getLEDDelayOff() {
+uint8_t ControllerBase::getLEDDelayOff() {
     return this->feedback.led_flash_off;
 }
 
-uint32_t Controller::getLEDRGB() {
+uint32_t ControllerBase::getLEDRGB() {
     // LED data is in the format of 0x00RRGGBB, same as the format Adafruit_NeoPixel accepts.
     return (this->feedback.led_color[0] << 16 | this->feedback.led_color[1] << 8 | this->feedback.led_color[2]);
 }
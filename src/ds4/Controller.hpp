@@ -11,6 +11,11 @@
 #include "api/internals.hpp"
 #include "api/UnoJoyAPI.hpp"
 
+#ifdef RDS4_LINUX
+// for memcpy()
+#include <cstring>
+#endif
+
 namespace rds4 {
 namespace ds4 {
 
@@ -55,6 +60,19 @@ struct InputReport {
     uint8_t padding[3]; // 61-62 (63?)
 } __attribute__((packed));
 
+// Bluetooth-format input report. Bytes 3-62 have the same layout as bytes
+// 1-60 of InputReport.
+struct InputReportBT {
+    uint8_t type; // 0
+    uint8_t bt_flags; // 1 0x80: HID, 0x40: CRC, 0x3f: poll interval (ms)
+    uint8_t u2; // 2
+    uint8_t common[32]; // 3-34
+    uint8_t tp_available_frame; // 35
+    TouchFrame frames[4]; // 36-71
+    uint8_t padding[2]; // 72-73
+    uint32_t crc32; // 74-77 seeded with 0xa1
+} __attribute__((packed));
+
 struct FeedbackReport {
     uint8_t type; // 0
     uint8_t flags; // 1
@@ -67,6 +85,23 @@ struct FeedbackReport {
     uint8_t padding[21]; // 11-31
 } __attribute__((packed));
 
+// Bluetooth-format feedback report. Bytes 3-12 have the same layout as
+// bytes 1-10 of FeedbackReport.
+struct FeedbackReportBT {
+    uint8_t type; // 0
+    uint8_t bt_flags; // 1 same as InputReportBT
+    uint8_t u2; // 2
+    uint8_t flags; // 3
+    uint8_t padding1[2]; // 4-5
+    uint8_t rumble_right; // 6
+    uint8_t rumble_left; // 7
+    uint8_t led_color[3]; // 8-10
+    uint8_t led_flash_on; // 11
+    uint8_t led_flash_off; // 12
+    uint8_t padding[61]; // 13-73
+    uint32_t crc32; // 74-77 seeded with 0xa2
+} __attribute__((packed));
+
 struct AuthPageSizeReport {
     uint8_t type;
     uint8_t u1;
@@ -84,6 +119,23 @@ struct AuthReport {
     uint32_t crc32; // 60-63
 } __attribute__((packed));
 
+// States of the auth transaction state machine in AuthenticationHandler.
+enum class DS4AuthState : uint8_t {
+    IDLE,
+    NONCE_RECEIVED,
+    WAIT_NONCE,
+    WAIT_RESP,
+    POLL_RESP,
+    RESP_BUFFERED,
+    RESP_UNLOADED,
+    RESP_PREFETCH,
+    ERROR,
+};
+
+// Total payload size of the challenge and the response in one auth transaction.
+const uint16_t AUTH_CHALLENGE_SIZE = 0x100;
+const uint16_t AUTH_RESPONSE_SIZE = 0x410;
+
 struct AuthStatusReport {
     uint8_t type; // 0
     uint8_t seq; // 1
@@ -92,7 +144,17 @@ struct AuthStatusReport {
     uint32_t crc32; // 12-15
 } __attribute__((packed));
 
-class Controller : public api::Controller {
+// Wire format of the reports sent and received by Controller.
+enum class ReportFormat : uint8_t {
+    USB = 0,
+    BT,
+};
+
+/** Report state and everything about it that doesn't depend on the
+ *  transport. Use Controller (any api::Transport) or StaticController
+ *  (one concrete transport type).
+ */
+class ControllerBase : public api::Controller {
 public:
     enum : uint8_t {
         ROT_MAIN = 0,
@@ -124,31 +186,152 @@ public:
     enum : uint8_t {
         IN_REPORT = 0x1,
         OUT_FEEDBACK = 0x5,
+        IN_REPORT_BT = 0x11,
+        OUT_FEEDBACK_BT = 0x11,
         SET_CHALLENGE = 0xf0,
         GET_RESPONSE,
         GET_AUTH_STATUS,
         GET_AUTH_PAGE_SIZE,
     };
-    Controller(api::Transport *backend);
+    // Parts of the report tracked by the change-driven mode
+    enum : uint8_t {
+        DIRTY_BUTTONS = 1 << 0,
+        DIRTY_AXES = 1 << 1,
+        DIRTY_TOUCH = 1 << 2,
+        // Accel/gyro. Nothing sets this until setAxis16() supports them.
+        DIRTY_IMU = 1 << 3,
+        DIRTY_ALL = 0x0f,
+    };
+    // Default keepalive interval of the change-driven mode (ms)
+    static const uint16_t DEFAULT_KEEPALIVE = 50;
+    // FeedbackReport::flags, i.e. which parts of a feedback report are set
+    enum : uint8_t {
+        FEEDBACK_RUMBLE = 1 << 0,
+        FEEDBACK_LED = 1 << 1,
+        FEEDBACK_FLASH = 1 << 2,
+        FEEDBACK_ALL = 0x07,
+    };
+    // InputReportBT/FeedbackReportBT::bt_flags
+    enum : uint8_t {
+        BT_FLAG_HID = 0x80,
+        BT_FLAG_CRC = 0x40,
+        BT_POLL_INTERVAL_MASK = 0x3f,
+    };
+    static const uint8_t BT_REPORT_SIZE = 78;
+    // Default poll interval of the Bluetooth format (ms)
+    static const uint8_t DEFAULT_BT_POLL_INTERVAL = 4;
+    // Touch frames per report in the USB and the Bluetooth format
+    static const uint8_t TOUCH_FRAMES_USB = 3;
+    static const uint8_t TOUCH_FRAMES_BT = 4;
+    // Max. number of OUT reports handled in one go
+    static const uint8_t MAX_FEEDBACK_DRAIN = 16;
+    typedef void (*RumbleCallback)(uint8_t left, uint8_t right);
+    typedef void (*LEDCallback)(uint32_t rgb);
+    typedef void (*FlashCallback)(uint8_t on, uint8_t off);
+    ControllerBase(api::Transport *backend);
     void begin() override;
-    void update();
-    bool sendReport() override;
-    bool sendReportBlocking() override;
-    bool setRotary8Pos(uint8_t code, api::Rotary8Pos value) override;
-    bool setKey(uint8_t code, bool action) override;
-    bool setAxis(uint8_t code, uint8_t value) override;
-    bool setAxis16(uint8_t code, uint16_t value) override;
+    /** Only send reports when something changed since the last one, or
+     *  when the keepalive interval expires. sendReport() and
+     *  sendReportBlocking() return `false` without sending otherwise.
+     *  Off by default.
+     *
+     *  @param `true` to enable change-driven mode.
+     *  @param Keepalive interval in ms.
+     */
+    void setChangeDriven(bool enable, uint16_t keepalive=ControllerBase::DEFAULT_KEEPALIVE);
+    /** Get the parts of the report that changed since the last report sent.
+     *
+     *  @return A combination of the DIRTY_* flags.
+     */
+    uint8_t getDirty() {
+        return this->dirty;
+    }
+    /** Select the format of the reports sent from now on. Feedback reports
+     *  are accepted in either format regardless. Clears pending touch
+     *  events. USB by default.
+     *
+     *  @param The format.
+     */
+    void setReportFormat(ReportFormat format);
+    ReportFormat getReportFormat() {
+        return this->format;
+    }
+    /** Set the poll interval advertised in Bluetooth-format reports. Also
+     *  updated by the host through Bluetooth-format feedback reports.
+     *
+     *  @param Poll interval in ms (0-63).
+     */
+    void setBTPollInterval(uint8_t interval) {
+        this->btPollInterval = interval & ControllerBase::BT_POLL_INTERVAL_MASK;
+    }
+    uint8_t getBTPollInterval() {
+        return this->btPollInterval;
+    }
+    /** Serialize the current state as a Bluetooth-format (0x11) input
+     *  report. The CRC is computed while copying.
+     *
+     *  @param Buffer of at least BT_REPORT_SIZE bytes.
+     *  @return Size of the report.
+     */
+    uint8_t buildReportBT(void *buf);
+    bool setRotary8Pos(uint8_t code, api::Rotary8Pos value) override final;
+    bool setKey(uint8_t code, bool action) override final;
+    bool setAxis(uint8_t code, uint8_t value) override final;
+    bool setAxis16(uint8_t code, uint16_t value) override final;
 
-    bool setKeyUniversal(api::Key code, bool action) override;
-    bool setDpadUniversal(api::Dpad value) override;
-    bool setStick(api::Stick index, uint8_t x, uint8_t y) override;
-    bool setTrigger(api::Key code, uint8_t value) override;
+    bool setKeyUniversal(api::Key code, bool action) override final;
+    bool setDpadUniversal(api::Dpad value) override final;
+    bool setStick(api::Stick index, uint8_t x, uint8_t y) override final;
+    bool setTrigger(api::Key code, uint8_t value) override final;
+    bool setButtonsUniversal(uint32_t mask) override final;
 
     bool setTouchpad(uint8_t slot, uint8_t pos, bool pressed, uint8_t seq, uint16_t x, uint16_t y);
     bool setTouchEvent(uint8_t pos, bool pressed, uint16_t x=0, uint16_t y=0);
     bool finalizeTouchEvent();
     void clearTouchEvents();
 
+    /** Get called when the host changes the rumble intensity. */
+    void attachRumbleCallback(RumbleCallback callback) {
+        this->_notifyRumble = callback;
+    }
+    /** Get called when the host changes the LED color (0x00RRGGBB). */
+    void attachLEDCallback(LEDCallback callback) {
+        this->_notifyLED = callback;
+    }
+    /** Get called when the host changes the LED flash on/off delays. */
+    void attachFlashCallback(FlashCallback callback) {
+        this->_notifyFlash = callback;
+    }
+    /** Check if OUT reports are handled on the transport's receive path
+     *  (see setImmediateFeedback()).
+     */
+    bool getImmediateFeedback() {
+        return this->immediateFeedback;
+    }
+
+    /** Take a snapshot of the report and feedback counters (see
+     *  utils::ControllerStats). Counters are only kept when built with
+     *  RDS4_STATS defined.
+     *
+     *  @param Receives the counters.
+     *  @return `true` if successful, `false` if built without RDS4_STATS.
+     */
+    bool getStats(utils::ControllerStats *out) {
+#ifdef RDS4_STATS
+        utils::statsCopy(out, this->stats);
+        return true;
+#else
+        return false;
+#endif
+    }
+    /** Zero the report and feedback counters. */
+    void resetStats() {
+#ifdef RDS4_STATS
+        this->stats.reset();
+        this->statLastSent = 0;
+#endif
+    }
+
     bool hasValidFeedback();
     uint8_t getRumbleIntensityRight();
     uint8_t getRumbleIntensityLeft();
@@ -156,13 +339,156 @@ public:
     uint8_t getLEDDelayOn();
     uint8_t getLEDDelayOff();
 
+protected:
+    /** Send the current report through a transport. Called with the
+     *  api::Transport back-end by sendReport()/sendReportBlocking(), and
+     *  with a concrete one by StaticController.
+     *
+     *  @param The transport, anything with api::Transport's methods.
+     *  @param `true` to use sendBlocking().
+     *  @return `true` if the report was sent.
+     */
+    template <class TR>
+    bool sendReportVia(TR *backend, bool blocking);
+    /** Handle all queued OUT reports of a transport. See update(). */
+    template <class TR>
+    void drainFeedbackVia(TR *backend);
+    /** Switch immediate feedback mode.
+     *
+     *  @param `true` to enable.
+     *  @param Called by the transport when an OUT report arrives, with the
+     *         controller as its context.
+     */
+    void attachFeedback(bool enable, api::Transport::RXCallback callback);
+
 private:
     InputReport report;
     FeedbackReport feedback;
+    // 4th touch frame, only used by the Bluetooth format
+    TouchFrame extraFrame;
+    ReportFormat format;
+    uint8_t btPollInterval;
+    // CRC state after the header of the last Bluetooth-format report
+    uint8_t btHeaderFlags;
+    uint32_t btHeaderCRC;
     uint8_t currentTouchSeq;
+    uint8_t dirty;
+    bool changeDriven;
+    uint16_t keepalive;
+    uint32_t lastSent;
+    bool immediateFeedback;
+    RumbleCallback _notifyRumble;
+    LEDCallback _notifyLED;
+    FlashCallback _notifyFlash;
+#ifdef RDS4_STATS
+    utils::ControllerStats stats;
+    // micros() of the last report sent, 0 if none
+    uint32_t statLastSent;
+#endif
+    uint8_t mergeFeedback(const void *buf, uint8_t len, FeedbackReport *merged);
+    // Passes the parts through, counts the report in RDS4_STATS builds
+    uint8_t countFeedback(uint8_t parts) {
+#ifdef RDS4_STATS
+        if (parts != 0) {
+            RDS4_STAT_INC(this->stats.feedbackAccepted);
+        } else {
+            RDS4_STAT_INC(this->stats.feedbackRejected);
+        }
+#endif
+        return parts;
+    }
+    void applyFeedback(const FeedbackReport &latest);
+    bool prepareReport(uint32_t now);
+    bool finishReport(bool sent, uint32_t now);
+    TouchFrame *getTouchFrame(uint8_t slot);
+    uint8_t getTouchFrameCount() {
+        return this->format == ReportFormat::BT ? ControllerBase::TOUCH_FRAMES_BT : ControllerBase::TOUCH_FRAMES_USB;
+    }
     void incReportCtr();
-    static const uint8_t keyLookup[];
-    bool sendReport_(bool blocking);
+};
+
+template <class TR>
+bool ControllerBase::sendReportVia(TR *backend, bool blocking) {
+    uint32_t now = millis();
+    uint8_t actual, size;
+    if (not this->prepareReport(now)) {
+        return false;
+    }
+    if (this->format == ReportFormat::BT) {
+        size = ControllerBase::BT_REPORT_SIZE;
+        // Serializing takes one copy anyway, so make it the only one
+        auto *slot = backend->acquireTX(size);
+        if (slot != nullptr) {
+            actual = backend->commitTX(this->buildReportBT(slot));
+        } else {
+            uint8_t buf[ControllerBase::BT_REPORT_SIZE];
+            this->buildReportBT(buf);
+            actual = blocking ? backend->sendBlocking(buf, size) : backend->send(buf, size);
+        }
+    } else {
+        size = sizeof(this->report);
+        // The report state has to survive between frames, so it is copied
+        // once straight into the transport buffer when one can be lent.
+        auto *slot = backend->acquireTX(size);
+        if (slot != nullptr) {
+            memcpy(slot, &(this->report), size);
+            actual = backend->commitTX(size);
+        } else if (blocking) {
+            actual = backend->sendBlocking(&(this->report), size);
+        } else {
+            actual = backend->send(&(this->report), size);
+        }
+    }
+    return this->finishReport(actual == size, now);
+}
+
+template <class TR>
+void ControllerBase::drainFeedbackVia(TR *backend) {
+    FeedbackReport latest;
+    uint8_t updated = 0;
+    memcpy(&latest, &(this->feedback), offsetof(FeedbackReport, padding));
+    for (uint8_t i=0; i<ControllerBase::MAX_FEEDBACK_DRAIN; i++) {
+        uint8_t len;
+        auto *pkt = backend->borrowRX(&len);
+        if (pkt != nullptr) {
+            // Parse in place and only keep the part we actually use
+            updated |= this->countFeedback(this->mergeFeedback(pkt, len, &latest));
+            backend->releaseRX();
+        } else if (backend->available()) {
+            uint8_t buf[ControllerBase::BT_REPORT_SIZE];
+            len = backend->recv(buf, sizeof(buf));
+            updated |= this->countFeedback(this->mergeFeedback(buf, len, &latest));
+        } else {
+            break;
+        }
+    }
+    if (updated != 0) {
+        this->applyFeedback(latest);
+    }
+}
+
+/** DS4 controller on any api::Transport. */
+class Controller : public ControllerBase {
+public:
+    Controller(api::Transport *backend) : ControllerBase(backend) {};
+    bool sendReport() override;
+    bool sendReportBlocking() override;
+    /** Handle all queued OUT reports. Only the newest value of each part
+     *  (rumble, LED color, LED flash) is kept, and the callbacks fire for
+     *  the parts that actually changed. Does nothing in immediate feedback
+     *  mode.
+     */
+    void update();
+    /** Handle OUT reports right on the transport's receive path instead
+     *  of in update(). The callbacks then run in that context (see
+     *  api::Transport::attachRXCallback()).
+     *
+     *  @param `true` to enable.
+     */
+    void setImmediateFeedback(bool enable);
+
+private:
+    static void onRX(void *context);
 };
 
 template <api::Dpad NS=api::Dpad::C, api::Dpad WE=api::Dpad::C>
@@ -171,5 +497,52 @@ public:
     ControllerSOCD(api::Transport *backend) : Controller(backend) {};
 };
 
+/** DS4 controller bound to one concrete transport type. Reports and
+ *  feedback are handled through a `TR *` instead of an api::Transport
+ *  pointer, so every method that TR declares `final` is called directly and
+ *  can be inlined (across translation units with LTO, which the AVR cores
+ *  enable). All transports in this library declare their report path
+ *  (send(), recv(), available(), acquireTX()/commitTX(),
+ *  borrowRX()/releaseRX()) final. Anything else is still a virtual call,
+ *  so overrides always take effect.
+ *
+ *  This is for speed, not size. A sketch that only uses StaticController
+ *  doesn't carry the generic report path, but the compiler may inline the
+ *  transport calls while TR's vtable still keeps the out-of-line copies, so
+ *  expect a few bytes more flash than with a Controller.
+ *
+ *  It works anywhere an api::Controller is taken (e.g. ReportScheduler),
+ *  calls made through a base class pointer go through the vtable as usual.
+ */
+template <class TR>
+class StaticController : public ControllerBase {
+public:
+    StaticController(TR *backend) : ControllerBase(backend), transport(backend) {};
+    bool sendReport() override final {
+        return this->sendReportVia(this->transport, false);
+    }
+    bool sendReportBlocking() override final {
+        return this->sendReportVia(this->transport, true);
+    }
+    /** See Controller::update(). */
+    void update() {
+        if (not this->getImmediateFeedback()) {
+            this->drainFeedbackVia(this->transport);
+        }
+    }
+    /** See Controller::setImmediateFeedback(). */
+    void setImmediateFeedback(bool enable) {
+        this->attachFeedback(enable, &StaticController::onRX);
+    }
+
+private:
+    static void onRX(void *context) {
+        auto *self = static_cast<StaticController *>(context);
+        self->drainFeedbackVia(self->transport);
+    }
+
+    TR *transport;
+};
+
 } // namespace ds4
 } // namespace rds4
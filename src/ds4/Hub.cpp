@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** Hub.cpp
+ *  Event loop that runs many virtual controllers in one thread (Linux).
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "Hub.hpp"
+#include "utils/utils.hpp"
+
+#if defined(RDS4_LINUX)
+
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+static_assert(Hub::MAX_PADS < Hub::INVALID_PAD, "Pad numbers must fit in uint8_t");
+
+Hub::Hub(uint32_t tickInterval) :
+        pads(),
+        tickInterval(tickInterval == 0 ? 1 : tickInterval),
+        ticks(0),
+        missedTicks(0),
+        epoll(-1),
+        timer(-1),
+        padCount(0),
+        padEnd(0),
+        running(false) { /* pass */ }
+
+Hub::~Hub() {
+    this->end();
+}
+
+void Hub::begin() {
+    struct epoll_event eev;
+    struct itimerspec its;
+    if (this->epoll >= 0) {
+        return;
+    }
+    this->epoll = epoll_create1(EPOLL_CLOEXEC);
+    this->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (this->epoll < 0 or this->timer < 0) {
+        RDS4_DBG_PRINTLN("Hub: cannot create epoll/timer");
+        this->end();
+        return;
+    }
+    its.it_interval.tv_sec = this->tickInterval / 1000000;
+    its.it_interval.tv_nsec = (this->tickInterval % 1000000) * 1000;
+    its.it_value = its.it_interval;
+    memset(&eev, 0, sizeof(eev));
+    eev.events = EPOLLIN;
+    // The timer is the only event without a pad
+    eev.data.ptr = nullptr;
+    if (timerfd_settime(this->timer, 0, &its, nullptr) != 0 or
+            epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->timer, &eev) != 0) {
+        RDS4_DBG_PRINTLN("Hub: cannot start timer");
+        this->end();
+    }
+}
+
+void Hub::end() {
+    if (this->timer >= 0) {
+        close(this->timer);
+        this->timer = -1;
+    }
+    if (this->epoll >= 0) {
+        close(this->epoll);
+        this->epoll = -1;
+    }
+    memset(this->pads, 0, sizeof(this->pads));
+    this->padCount = 0;
+    this->padEnd = 0;
+}
+
+uint8_t Hub::addPad(int fd, void *transport, DispatchFunc dispatch, UpdateFunc update, TickCallback tick,
+                    void *context, uint8_t interval) {
+    struct epoll_event eev;
+    uint8_t slot;
+    if (this->epoll < 0 or fd < 0) {
+        return Hub::INVALID_PAD;
+    }
+    for (slot=0; slot<Hub::MAX_PADS; slot++) {
+        if (this->pads[slot].transport == nullptr) {
+            break;
+        }
+    }
+    if (slot >= Hub::MAX_PADS) {
+        return Hub::INVALID_PAD;
+    }
+    auto &pad = this->pads[slot];
+    memset(&eev, 0, sizeof(eev));
+    // Every dispatch() reads until there is nothing left, so edge-triggered
+    // is enough and the interest set never needs to change. EPOLLOUT fires
+    // when a full socket drains so that queued reports go out right away.
+    eev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    eev.data.ptr = &pad;
+    if (epoll_ctl(this->epoll, EPOLL_CTL_ADD, fd, &eev) != 0) {
+        RDS4_DBG_PRINTLN("Hub: cannot add pad");
+        return Hub::INVALID_PAD;
+    }
+    pad.transport = transport;
+    pad.dispatch = dispatch;
+    pad.update = update;
+    pad.tick = tick;
+    pad.context = context;
+    pad.fd = fd;
+    pad.interval = interval == 0 ? 1 : interval;
+    // Spread pads with the same interval over different ticks
+    pad.countdown = 1 + slot % pad.interval;
+    this->padCount++;
+    if (slot >= this->padEnd) {
+        this->padEnd = slot + 1;
+    }
+    return slot;
+}
+
+void Hub::remove(uint8_t pad) {
+    if (this->attached(pad)) {
+        this->detach(&(this->pads[pad]));
+    }
+}
+
+void Hub::detach(Pad *pad) {
+    // Fails harmlessly if the transport already closed the descriptor
+    epoll_ctl(this->epoll, EPOLL_CTL_DEL, pad->fd, nullptr);
+    memset(pad, 0, sizeof(*pad));
+    this->padCount--;
+    while (this->padEnd > 0 and this->pads[this->padEnd - 1].transport == nullptr) {
+        this->padEnd--;
+    }
+}
+
+void Hub::onTick() {
+    uint64_t expirations;
+    if (read(this->timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    this->ticks++;
+    // Late ticks are dropped rather than caught up on
+    this->missedTicks += static_cast<uint32_t>(expirations - 1);
+    for (uint8_t i=0; i<this->padEnd; i++) {
+        auto &pad = this->pads[i];
+        if (pad.transport == nullptr or --pad.countdown != 0) {
+            continue;
+        }
+        pad.countdown = pad.interval;
+        if (pad.tick != nullptr) {
+            pad.tick(pad.context);
+        }
+        // Might have been removed by the callback
+        if (pad.transport != nullptr) {
+            pad.update(pad.transport);
+        }
+    }
+}
+
+int Hub::runOnce(int timeout) {
+    struct epoll_event events[Hub::MAX_EVENTS];
+    int nfds;
+    if (this->epoll < 0) {
+        return -1;
+    }
+    nfds = epoll_wait(this->epoll, events, Hub::MAX_EVENTS, timeout);
+    if (nfds < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i=0; i<nfds; i++) {
+        auto *pad = static_cast<Pad *>(events[i].data.ptr);
+        if (pad == nullptr) {
+            this->onTick();
+        } else if (pad->transport != nullptr and pad->dispatch(pad->transport) < 0) {
+            RDS4_DBG_PRINTLN("Hub: pad detached");
+            this->detach(pad);
+        }
+    }
+    return nfds;
+}
+
+void Hub::run() {
+    __atomic_store_n(&(this->running), true, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&(this->running), __ATOMIC_ACQUIRE)) {
+        if (this->runOnce() < 0) {
+            break;
+        }
+    }
+}
+
+bool Hub::pinThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
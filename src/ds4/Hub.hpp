@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** Hub.hpp
+ *  Event loop that runs many virtual controllers in one thread (Linux).
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+
+#ifndef RDS4_HUB_MAX_PADS
+#define RDS4_HUB_MAX_PADS 64
+#endif
+
+#if defined(RDS4_LINUX)
+
+namespace rds4 {
+namespace ds4 {
+
+/** Drives the I/O of many pads from one epoll loop. A pad is a Linux
+ *  transport (TransportUHID, TransportFFS, TransportSocket, or anything with
+ *  getFD(), dispatch() and update()) plus whatever the application drives
+ *  from its tick callback (usually a Controller).
+ *
+ *  All pads of a hub live on the thread that calls run(). To use several
+ *  cores, create one hub per core, spread the pads over them and run each
+ *  hub on its own thread (see pinThread()). Pads are independent: they
+ *  share no state with each other or with other hubs.
+ *
+ *  Each loop iteration costs one epoll_wait() no matter how many pads there
+ *  are. Only the pads with pending I/O get dispatched, and every tick the
+ *  due pads get their tick callback. Pads with longer intervals are
+ *  staggered so that not all of them are due on the same tick.
+ */
+class Hub {
+public:
+    static const uint8_t MAX_PADS = RDS4_HUB_MAX_PADS;
+    static const uint8_t INVALID_PAD = 0xff;
+    // Max. number of events handled per epoll_wait()
+    static const uint8_t MAX_EVENTS = 32;
+    typedef int (*DispatchFunc)(void *transport);
+    typedef void (*UpdateFunc)(void *transport);
+    /** Called when a pad is due. Usually updates the controller state and
+     *  sends a report.
+     */
+    typedef void (*TickCallback)(void *context);
+
+    /** Constructor.
+     *
+     *  @param Tick period in µs.
+     */
+    Hub(uint32_t tickInterval=1000);
+    ~Hub();
+    /** Create the epoll instance and start the tick timer. */
+    void begin();
+    /** Stop the timer and forget all pads. Does not end the transports. */
+    void end();
+    /** Add a pad. The transport must already be started (begin()).
+     *
+     *  @param The transport.
+     *  @param Callback that runs when the pad is due (can be `nullptr`).
+     *  @param Context passed to the callback.
+     *  @param Number of ticks between two callbacks (at least 1).
+     *  @return Pad number, or INVALID_PAD if the hub is full, not started,
+     *          or the transport has no file descriptor.
+     */
+    template <class TR>
+    uint8_t add(TR *transport, TickCallback tick=nullptr, void *context=nullptr, uint8_t interval=1) {
+        return this->addPad(transport->getFD(), transport, &Hub::dispatchThunk<TR>, &Hub::updateThunk<TR>,
+                            tick, context, interval);
+    }
+    /** Remove a pad. Its number may be reused by the next add().
+     *
+     *  @param Pad number.
+     */
+    void remove(uint8_t pad);
+    /** Check if a pad is still attached. Pads whose transport reports an
+     *  error (e.g. the host hung up) are detached automatically.
+     *
+     *  @param Pad number.
+     */
+    bool attached(uint8_t pad) {
+        return pad < MAX_PADS and this->pads[pad].transport != nullptr;
+    }
+    /** Number of attached pads. */
+    uint8_t getPadCount() {
+        return this->padCount;
+    }
+    /** Wait for I/O or the next tick and handle everything that is pending.
+     *
+     *  @param Timeout in ms. -1 waits until something happens.
+     *  @return Number of events handled, or -1 on error.
+     */
+    int runOnce(int timeout=-1);
+    /** Run the loop until stop() is called. */
+    void run();
+    /** Make run() return after the current iteration. Can be called from
+     *  other threads and signal handlers.
+     */
+    void stop() {
+        __atomic_store_n(&(this->running), false, __ATOMIC_RELEASE);
+    }
+    /** Number of ticks so far. */
+    uint32_t getTicks() {
+        return this->ticks;
+    }
+    /** Number of ticks that were skipped because an iteration took longer
+     *  than the tick period.
+     */
+    uint32_t getMissedTicks() {
+        return this->missedTicks;
+    }
+    /** Pin the calling thread to a CPU.
+     *
+     *  @param CPU number.
+     *  @return `true` if successful.
+     */
+    static bool pinThread(int cpu);
+
+private:
+    struct Pad {
+        void *transport;
+        DispatchFunc dispatch;
+        UpdateFunc update;
+        TickCallback tick;
+        void *context;
+        int fd;
+        uint8_t interval;
+        // Ticks until the pad is due
+        uint8_t countdown;
+    };
+
+    template <class TR>
+    static int dispatchThunk(void *transport) {
+        return static_cast<TR *>(transport)->dispatch();
+    }
+    template <class TR>
+    static void updateThunk(void *transport) {
+        static_cast<TR *>(transport)->update();
+    }
+    uint8_t addPad(int fd, void *transport, DispatchFunc dispatch, UpdateFunc update, TickCallback tick,
+                   void *context, uint8_t interval);
+    void detach(Pad *pad);
+    void onTick();
+
+    Pad pads[MAX_PADS];
+    uint32_t tickInterval;
+    uint32_t ticks;
+    uint32_t missedTicks;
+    int epoll;
+    int timer;
+    uint8_t padCount;
+    // One past the highest pad number in use
+    uint8_t padEnd;
+    bool running;
+};
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** ReportDescriptor.cpp
+ *  HID report descriptor of the emulated PS4 controller.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "ReportDescriptor.hpp"
+
+namespace rds4 {
+namespace ds4 {
+
+// Report counts below exclude the report ID byte.
+const uint8_t REPORT_DESCRIPTOR[] PROGMEM = {
+    0x05, 0x01,       // Usage Page (Generic Desktop)
+    0x09, 0x05,       // Usage (Game Pad)
+    0xa1, 0x01,       // Collection (Application)
+    // Input report
+    0x85, 0x01,       //   Report ID (0x01)
+    0x09, 0x30,       //   Usage (X)
+    0x09, 0x31,       //   Usage (Y)
+    0x09, 0x32,       //   Usage (Z)
+    0x09, 0x35,       //   Usage (Rz)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x26, 0xff, 0x00, //   Logical Maximum (255)
+    0x75, 0x08,       //   Report Size (8)
+    0x95, 0x04,       //   Report Count (4)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    0x09, 0x39,       //   Usage (Hat Switch)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x25, 0x07,       //   Logical Maximum (7)
+    0x35, 0x00,       //   Physical Minimum (0)
+    0x46, 0x3b, 0x01, //   Physical Maximum (315)
+    0x65, 0x14,       //   Unit (Degrees)
+    0x75, 0x04,       //   Report Size (4)
+    0x95, 0x01,       //   Report Count (1)
+    0x81, 0x42,       //   Input (Data, Var, Abs, Null State)
+    0x65, 0x00,       //   Unit (None)
+    0x05, 0x09,       //   Usage Page (Button)
+    0x19, 0x01,       //   Usage Minimum (1)
+    0x29, 0x0e,       //   Usage Maximum (14)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x25, 0x01,       //   Logical Maximum (1)
+    0x75, 0x01,       //   Report Size (1)
+    0x95, 0x0e,       //   Report Count (14)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    0x06, 0x00, 0xff, //   Usage Page (Vendor 0xff00)
+    0x09, 0x20,       //   Usage (0x20)
+    0x75, 0x06,       //   Report Size (6)
+    0x95, 0x01,       //   Report Count (1)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x25, 0x7f,       //   Logical Maximum (127)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    0x05, 0x01,       //   Usage Page (Generic Desktop)
+    0x09, 0x33,       //   Usage (Rx)
+    0x09, 0x34,       //   Usage (Ry)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x26, 0xff, 0x00, //   Logical Maximum (255)
+    0x75, 0x08,       //   Report Size (8)
+    0x95, 0x02,       //   Report Count (2)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    0x06, 0x00, 0xff, //   Usage Page (Vendor 0xff00)
+    0x09, 0x21,       //   Usage (0x21)
+    0x95, 0x36,       //   Report Count (54)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    // Output report (rumble, LED)
+    0x85, 0x05,       //   Report ID (0x05)
+    0x09, 0x22,       //   Usage (0x22)
+    0x95, 0x1f,       //   Report Count (31)
+    0x91, 0x02,       //   Output (Data, Var, Abs)
+    // Calibration
+    0x85, 0x02,       //   Report ID (0x02)
+    0x09, 0x24,       //   Usage (0x24)
+    0x95, 0x24,       //   Report Count (36)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    // Controller configuration
+    0x85, 0x03,       //   Report ID (0x03)
+    0x0a, 0x21, 0x27, //   Usage (0x2721)
+    0x95, 0x2f,       //   Report Count (47)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    // Pairing info
+    0x06, 0x02, 0xff, //   Usage Page (Vendor 0xff02)
+    0x85, 0x12,       //   Report ID (0x12)
+    0x09, 0x21,       //   Usage (0x21)
+    0x95, 0x0f,       //   Report Count (15)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    // Firmware info
+    0x06, 0x80, 0xff, //   Usage Page (Vendor 0xff80)
+    0x85, 0xa3,       //   Report ID (0xa3)
+    0x09, 0x45,       //   Usage (0x45)
+    0x95, 0x30,       //   Report Count (48)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    // Auth
+    0x06, 0x03, 0xff, //   Usage Page (Vendor 0xff03)
+    0x85, 0xf0,       //   Report ID (0xf0, SET_CHALLENGE)
+    0x09, 0x47,       //   Usage (0x47)
+    0x95, 0x3f,       //   Report Count (63)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    0x85, 0xf1,       //   Report ID (0xf1, GET_RESPONSE)
+    0x09, 0x48,       //   Usage (0x48)
+    0x95, 0x3f,       //   Report Count (63)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    0x85, 0xf2,       //   Report ID (0xf2, GET_AUTH_STATUS)
+    0x09, 0x49,       //   Usage (0x49)
+    0x95, 0x0f,       //   Report Count (15)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    0x85, 0xf3,       //   Report ID (0xf3, GET_AUTH_PAGE_SIZE)
+    0x0a, 0x01, 0x47, //   Usage (0x4701)
+    0x95, 0x07,       //   Report Count (7)
+    0xb1, 0x02,       //   Feature (Data, Var, Abs)
+    0xc0,             // End Collection
+};
+
+const uint16_t REPORT_DESCRIPTOR_SIZE = sizeof(REPORT_DESCRIPTOR);
+
+} // namespace ds4
+} // namespace rds4
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** ReportDescriptor.hpp
+ *  HID report descriptor of the emulated PS4 controller.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+#include "utils/platform.hpp"
+
+namespace rds4 {
+namespace ds4 {
+
+/** HID report descriptor for transports that have to present one themselves
+ *  (e.g. UHID on Linux). Declares the input report (0x01), the output report
+ *  (0x05) and the feature reports that RDS4 answers to.
+ */
+extern const uint8_t REPORT_DESCRIPTOR[];
+extern const uint16_t REPORT_DESCRIPTOR_SIZE;
+
+} // namespace ds4
+} // namespace rds4
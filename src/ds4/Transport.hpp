@@ -10,35 +10,117 @@
 #include "utils/platform.hpp"
 #include "api/internals.hpp"
 #include "utils/utils.hpp"
+#include "utils/trace.hpp"
+#include "utils/spsc.hpp"
 
 #if defined(RDS4_ARDUINO) && defined(RDS4_TEENSY_3)
 #include <usb_ds4stub.h>
+// usb_packet_t from usb_mem.h
+struct usb_packet_struct;
 #endif
 
 #include "Controller.hpp"
 
 #ifdef RDS4_LINUX
 #include <cstdio>
+// for memcpy(), etc.
+#include <cstring>
 #endif
 
 namespace rds4 {
 namespace ds4 {
 
-enum class DS4AuthState : uint8_t {
-    IDLE,
-    NONCE_RECEIVED,
-    WAIT_NONCE,
-    WAIT_RESP,
-    POLL_RESP,
-    RESP_BUFFERED,
-    RESP_UNLOADED,
-    ERROR,
+// Define RDS4_AUTH_PREFETCH to make transports that use the default
+// AuthenticationHandler parameters prefetch the whole response. Costs a bit
+// more than 1KiB of RAM.
+#ifdef RDS4_AUTH_PREFETCH
+const bool AUTH_PREFETCH_DEFAULT = true;
+#else
+const bool AUTH_PREFETCH_DEFAULT = false;
+#endif
+
+/** RAM cache of a whole auth response. Used by AuthenticationHandler in
+  * prefetch mode.
+  */
+template <bool enabled>
+class AuthResponseCache {
+public:
+    /** Start a new response with the specified page size. */
+    void reset(uint8_t pageSize) {
+        this->pageSize = pageSize;
+        this->filled = 0;
+        this->pages = 0;
+    }
+    /** Read a response page from the authenticator into the cache.
+     *
+     *  @return `true` if successful.
+     */
+    bool load(api::Authenticator *auth, uint8_t page) {
+        uint16_t offset = static_cast<uint16_t>(page) * this->pageSize;
+        uint16_t space = sizeof(this->data) - offset;
+        if (page != this->pages or offset >= sizeof(this->data)) {
+            return false;
+        }
+        auto actual = auth->readResponsePage(page, &(this->data[offset]), space > this->pageSize ? this->pageSize : space);
+        if (actual == 0) {
+            return false;
+        }
+        this->filled = offset + actual;
+        this->pages++;
+        return true;
+    }
+    /** Copy a cached page to an auth report and fill in the payload CRC.
+     *  Cheap enough to run in the control transfer callback.
+     *
+     *  @return `true` if successful.
+     */
+    bool unload(uint8_t page, AuthReport *pkt, bool crc) {
+        uint16_t offset = static_cast<uint16_t>(page) * this->pageSize;
+        uint8_t actual;
+        if (page >= this->pages) {
+            return false;
+        }
+        actual = (this->filled - offset > this->pageSize) ? this->pageSize : this->filled - offset;
+        if (crc) {
+            auto c = utils::crc32_update(utils::crc32_init(), pkt, offsetof(AuthReport, data));
+            c = utils::copy_and_crc32(&(pkt->data), &(this->data[offset]), actual, c);
+            memset(&(pkt->data[actual]), 0, sizeof(pkt->data) - actual);
+            c = utils::crc32_update(c, &(pkt->data[actual]), sizeof(pkt->data) - actual);
+            pkt->crc32 = utils::crc32_final(c);
+        } else {
+            memcpy(&(pkt->data), &(this->data[offset]), actual);
+            memset(&(pkt->data[actual]), 0, sizeof(pkt->data) - actual);
+            pkt->crc32 = 0;
+        }
+        return true;
+    }
+    /** Check if a page is the last cached page. */
+    bool isLast(uint8_t page) {
+        return page + 1 >= this->pages;
+    }
+private:
+    uint8_t data[AUTH_RESPONSE_SIZE];
+    uint16_t filled;
+    uint8_t pageSize;
+    uint8_t pages;
+};
+
+template <>
+class AuthResponseCache<false> {
+public:
+    void reset(uint8_t pageSize) {}
+    bool load(api::Authenticator *auth, uint8_t page) { return false; }
+    bool unload(uint8_t page, AuthReport *pkt, bool crc) { return false; }
+    bool isLast(uint8_t page) { return true; }
 };
 
 /** A wrapper for TransportDS4 family classes that adds ability to respond to
   * authentication requests.
+  * When `prefetch` is set, the whole response is read into RAM as soon as
+  * the authenticator finishes signing and all GET_RESPONSE requests are
+  * answered from the cache within the control transfer.
   */
-template <class TR, bool strictCRC=false>
+template <class TR, bool strictCRC=false, bool prefetch=AUTH_PREFETCH_DEFAULT>
 class AuthenticationHandler : public api::AuthenticationHandler {
 public:
     typedef void (*StateChangeCallback)(void);
@@ -47,7 +129,11 @@ public:
                                                       page(-1),
                                                       seq(0),
                                                       scratchPad{0},
-                                                      _notifyStateChange(nullptr) {}
+                                                      challengeHead(0),
+                                                      challengeTail(0),
+                                                      _notifyStateChange(nullptr) {
+        this->resetAuthStats();
+    }
     void begin() override {
         this->auth->begin();
     }
@@ -55,6 +141,27 @@ public:
     void attachStateChangeCallback(StateChangeCallback callback) {
         _notifyStateChange = callback;
     }
+    /** Take a snapshot of the auth counters (see utils::AuthStats).
+     *  Counters are only kept when built with RDS4_STATS defined.
+     *
+     *  @param Receives the counters.
+     *  @return `true` if successful, `false` if built without RDS4_STATS.
+     */
+    bool getAuthStats(utils::AuthStats *out) {
+#ifdef RDS4_STATS
+        utils::statsCopy(out, this->authStats);
+        return true;
+#else
+        return false;
+#endif
+    }
+    /** Zero the auth counters. */
+    void resetAuthStats() {
+#ifdef RDS4_STATS
+        this->authStats.reset();
+        this->signBegin = 0;
+#endif
+    }
 
 protected:
     DS4AuthState state;
@@ -62,8 +169,38 @@ protected:
     uint8_t seq;
     // Maximum size for challenge/response
     uint8_t scratchPad[64];
-    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override;
-    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override;
+    AuthResponseCache<prefetch> responseCache;
+    // Challenge pages received from the host and not yet forwarded. Filled
+    // by the control transfer callback and drained by update(). Indices are
+    // free-running.
+    static const uint8_t CHALLENGE_SLOTS = 2;
+    AuthReport challengeQueue[CHALLENGE_SLOTS];
+    volatile uint8_t challengeHead;
+    volatile uint8_t challengeTail;
+#ifdef RDS4_STATS
+    utils::AuthStats authStats;
+    // millis() of the last challenge page going to the authenticator
+    uint32_t signBegin;
+#endif
+    // Feature report handlers. Dispatched by FeatureDispatcher.
+    bool setChallenge(uint16_t length);
+    bool getResponse(uint16_t length);
+    bool getAuthStatus(uint16_t length);
+    bool getAuthPageSize(uint16_t length);
+    void forwardChallengePage();
+    void dropChallenge();
+    bool loadResponsePage();
+    bool prefetchResponse();
+    void unloadCachedPage();
+    void setState(DS4AuthState state) {
+        if (state != this->state) {
+            RDS4_TRACE_EVENT(utils::TraceType::AUTH_STATE, static_cast<uint8_t>(state), static_cast<uint8_t>(this->state));
+            if (state == DS4AuthState::ERROR) {
+                RDS4_STAT_INC(this->authStats.errors);
+            }
+        }
+        this->state = state;
+    }
     void notifyStateChange(void) {
         if (this->_notifyStateChange != nullptr) {
             (*this->_notifyStateChange)();
@@ -72,67 +209,44 @@ protected:
     StateChangeCallback _notifyStateChange;
 };
 
-template <class TR, bool strictCRC>
-void AuthenticationHandler<TR, strictCRC>::update() {
-    auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
+template <class TR, bool strictCRC, bool prefetch>
+void AuthenticationHandler<TR, strictCRC, prefetch>::update() {
     if (this->auth->available()) {
+        // Got nonce (challenge) from host. Drain the queue regardless of the
+        // state so a page that arrived while the previous one was in flight
+        // is never stranded.
+        while (this->challengeTail != this->challengeHead and this->state != DS4AuthState::ERROR) {
+            this->forwardChallengePage();
+        }
+        // Nothing queued for a failed transaction may revive it
+        this->dropChallenge();
         switch (this->state) {
-            // Got nonce (challenge) from host
-            case DS4AuthState::NONCE_RECEIVED:
-                RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: consuming nonce");
-                // If this is the first page and the auth device is resettable, reset it
-                if (this->page == 0) {
-                    // Use auto fit if available, otherwise manually set to maximum size if possible
-                    // TODO verify buffer size 0x38 on A7105
-                    if (this->auth->canSetPageSize() and not this->auth->canFitPageSize()) {
-                        RDS4_DBG_PRINTLN("set pagesize to maximum");
-                        this->auth->setChallengePageSize(sizeof(pkt->data));
-                        this->auth->setResponsePageSize(sizeof(pkt->data));
-                    }
-                    // Reset also fits the buffer size if possible
-                    if (this->auth->needsReset()) {
-                        RDS4_DBG_PRINTLN("reset");
-                        this->auth->reset();
-                    // Otherwise trigger auto fit explicitly
-                    } else if (this->auth->canFitPageSize()) {
-                        RDS4_DBG_PRINTLN("auto fit");
-                        this->auth->fitPageSize();
-                    }
-                }
-                // Submit the page to auth device
-                if (this->auth->writeChallengePage(this->page, &(pkt->data), sizeof(pkt->data))) {
-                    if (this->auth->endOfChallenge(this->page)) {
-                        RDS4_DBG_PRINTLN("last cpage");
-                        this->state = DS4AuthState::WAIT_RESP;
-                    } else {
-                        // wait for more
-                        this->state = DS4AuthState::WAIT_NONCE;
-                    }
-                } else {
-                    RDS4_DBG_PRINTLN("write err");
-                    this->state = DS4AuthState::ERROR;
-                }
-                break;
             case DS4AuthState::POLL_RESP: {
                 auto as = this->auth->getStatus();
                 RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: checking auth status");
                 switch (as) {
                     // Authenticator is ready to answer the challenge.
                     case api::AuthStatus::OK: {
-                        // buffer the first response packet
-                        auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
                         RDS4_DBG_PRINTLN("ok");
-                        pkt->type = Controller::GET_RESPONSE;
-                        pkt->seq = this->seq;
-                        pkt->page = 0;
-                        pkt->crc32 = strictCRC ? utils::crc32(this->scratchPad, sizeof(*pkt) - sizeof(pkt->crc32)) : 0;
+                        RDS4_STAT_SAMPLE(this->authStats.signTime, millis() - this->signBegin);
                         this->page = 0;
-
-                        if (this->auth->readResponsePage(this->page, &(pkt->data), sizeof(pkt->data))) {
-                            this->state = DS4AuthState::RESP_BUFFERED;
+                        if (prefetch) {
+                            // pull the whole response in before reporting ready
+                            this->setState(DS4AuthState::RESP_PREFETCH);
+                            if (this->prefetchResponse()) {
+                                this->setState(DS4AuthState::RESP_BUFFERED);
+                            } else {
+                                RDS4_DBG_PRINTLN("err");
+                                this->setState(DS4AuthState::ERROR);
+                            }
+                            break;
+                        }
+                        // buffer the first response packet
+                        if (this->loadResponsePage()) {
+                            this->setState(DS4AuthState::RESP_BUFFERED);
                         } else {
                             RDS4_DBG_PRINTLN("err");
-                            this->state = DS4AuthState::ERROR;
+                            this->setState(DS4AuthState::ERROR);
                         }
                         break;
                     }
@@ -140,12 +254,12 @@ void AuthenticationHandler<TR, strictCRC>::update() {
                     case api::AuthStatus::BUSY:
                         // Wait until host polls again.
                         RDS4_DBG_PRINTLN("busy");
-                        this->state = DS4AuthState::WAIT_RESP;
+                        this->setState(DS4AuthState::WAIT_RESP);
                         break;
                     // Something went wrong
                     default:
                         RDS4_DBG_PRINTLN("err");
-                        this->state = DS4AuthState::ERROR;
+                        this->setState(DS4AuthState::ERROR);
                         break;
                 }
                 break;
@@ -154,24 +268,18 @@ void AuthenticationHandler<TR, strictCRC>::update() {
                 RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: producing resp");
                 if (this->auth->endOfResponse(this->page)) {
                     RDS4_DBG_PRINTLN("last rpage");
-                    this->state = DS4AuthState::IDLE;
+                    RDS4_STAT_INC(this->authStats.completed);
+                    this->setState(DS4AuthState::IDLE);
                     this->page = -1;
                     break;
                 }
-                auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
                 RDS4_DBG_PRINTLN("next");
                 this->page++;
-                pkt->type = Controller::GET_RESPONSE;
-                pkt->seq = this->seq;
-                pkt->page = this->page;
-                pkt->crc32 = strictCRC ? utils::crc32(this->scratchPad, sizeof(*pkt) - sizeof(pkt->crc32)) : 0;
-                // clear the buffer just in case
-                memset(&(pkt->data), 0, sizeof(pkt->data));
-                if (this->auth->readResponsePage(this->page, &(pkt->data), sizeof(pkt->data))) {
-                    this->state = DS4AuthState::RESP_BUFFERED;
+                if (this->loadResponsePage()) {
+                    this->setState(DS4AuthState::RESP_BUFFERED);
                 } else {
                     RDS4_DBG_PRINTLN("err");
-                    this->state = DS4AuthState::ERROR;
+                    this->setState(DS4AuthState::ERROR);
                 }
                 break;
             }
@@ -182,132 +290,308 @@ void AuthenticationHandler<TR, strictCRC>::update() {
     }
 }
 
-template <class TR, bool strictCRC>
-bool AuthenticationHandler<TR, strictCRC>::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
+/** Forward the oldest queued challenge page to the authenticator. The slot
+  * stays occupied until the page has been written so the control transfer
+  * callback can keep accepting pages into the other slot(s) meanwhile.
+  */
+template <class TR, bool strictCRC, bool prefetch>
+void AuthenticationHandler<TR, strictCRC, prefetch>::forwardChallengePage() {
+    auto *pkt = &(this->challengeQueue[this->challengeTail & (CHALLENGE_SLOTS - 1)]);
+    RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: consuming nonce");
+    // Left over from an aborted transaction
+    if (pkt->seq != this->seq) {
+        RDS4_DBG_PRINTLN("stale");
+        this->challengeTail++;
+        return;
+    }
+    // If this is the first page and the auth device is resettable, reset it
+    if (pkt->page == 0) {
+        // Use auto fit if available, otherwise manually set to maximum size if possible
+        // TODO verify buffer size 0x38 on A7105
+        if (this->auth->canSetPageSize() and not this->auth->canFitPageSize()) {
+            RDS4_DBG_PRINTLN("set pagesize to maximum");
+            this->auth->setChallengePageSize(sizeof(pkt->data));
+            this->auth->setResponsePageSize(sizeof(pkt->data));
+        }
+        // Reset also fits the buffer size if possible
+        if (this->auth->needsReset()) {
+            RDS4_DBG_PRINTLN("reset");
+            this->auth->reset();
+        // Otherwise trigger auto fit explicitly
+        } else if (this->auth->canFitPageSize()) {
+            RDS4_DBG_PRINTLN("auto fit");
+            this->auth->fitPageSize();
+        }
+    }
+    // Submit the page to auth device
+    RDS4_STAT_BEGIN(writeBegin);
+    size_t written = this->auth->writeChallengePage(pkt->page, &(pkt->data), sizeof(pkt->data));
+    RDS4_STAT_END(writeBegin, this->authStats.pageWrite);
+    if (not written) {
+        RDS4_DBG_PRINTLN("write err");
+    }
+    // The control transfer callback changes seq, state and challengeHead
+    // from the interrupt, so check and update them in one go
+    auto irq = utils::irqSave();
+    if (pkt->seq != this->seq) {
+        // A new transaction started while this page was in flight, leave the state alone.
+    } else if (not written) {
+        this->setState(DS4AuthState::ERROR);
+    } else if (this->state == DS4AuthState::ERROR) {
+        // The host broke the page order meanwhile
+    } else if (this->auth->endOfChallenge(pkt->page)) {
+#ifdef RDS4_STATS
+        this->signBegin = millis();
+#endif
+        this->setState(DS4AuthState::WAIT_RESP);
+    } else if (static_cast<uint8_t>(this->challengeHead - this->challengeTail) == 1) {
+        // wait for more
+        this->setState(DS4AuthState::WAIT_NONCE);
+    }
+    this->challengeTail++;
+    utils::irqRestore(irq);
+}
+
+/** Drop the queued challenge pages of a failed transaction. Pages that
+  * arrive after a new page 0 are kept, since page 0 leaves the error state.
+  */
+template <class TR, bool strictCRC, bool prefetch>
+void AuthenticationHandler<TR, strictCRC, prefetch>::dropChallenge() {
+    auto irq = utils::irqSave();
+    if (this->state == DS4AuthState::ERROR) {
+        this->challengeTail = this->challengeHead;
+    }
+    utils::irqRestore(irq);
+}
+
+/** Read the whole response into the response cache and buffer its first
+  * page (prefetch mode only). Done in one pass, so the host's next status
+  * poll already sees the response ready. This holds up the main loop for
+  * one authenticator read per page.
+  */
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::prefetchResponse() {
+    RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: prefetching resp");
+    this->responseCache.reset(this->auth->getResponsePageSize());
+    for (this->page = 0; ; this->page++) {
+        if (not this->responseCache.load(this->auth, this->page)) {
+            return false;
+        }
+        if (this->auth->endOfResponse(this->page)) {
+            break;
+        }
+    }
+    RDS4_DBG_PRINTLN("last rpage");
+    this->page = 0;
+    this->unloadCachedPage();
+    return true;
+}
+
+/** Copy the current response page from the response cache to the scratch
+  * pad (prefetch mode only).
+  */
+template <class TR, bool strictCRC, bool prefetch>
+void AuthenticationHandler<TR, strictCRC, prefetch>::unloadCachedPage() {
+    auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
+    pkt->type = Controller::GET_RESPONSE;
+    pkt->seq = this->seq;
+    pkt->page = this->page;
+    pkt->sbz = 0;
+    this->responseCache.unload(this->page, pkt, strictCRC);
+}
+
+/** Read the current response page from the authenticator into the scratch
+  * pad. When strictCRC is set, the CRC is calculated while the page is being
+  * copied.
+  */
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::loadResponsePage() {
+    auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
+    uint32_t crc = utils::crc32_init();
+    size_t actual;
+    pkt->type = Controller::GET_RESPONSE;
+    pkt->seq = this->seq;
+    pkt->page = this->page;
+    pkt->sbz = 0;
+    if (strictCRC) {
+        crc = utils::crc32_update(crc, pkt, offsetof(AuthReport, data));
+        actual = this->auth->readResponsePageCRC(this->page, &(pkt->data), sizeof(pkt->data), &crc);
+    } else {
+        actual = this->auth->readResponsePage(this->page, &(pkt->data), sizeof(pkt->data));
+    }
+    if (actual == 0) {
+        return false;
+    }
+    // clear the rest of the buffer just in case
+    memset(&(pkt->data[actual]), 0, sizeof(pkt->data) - actual);
+    if (strictCRC) {
+        crc = utils::crc32_update(crc, &(pkt->data[actual]), sizeof(pkt->data) - actual);
+        pkt->crc32 = utils::crc32_final(crc);
+    } else {
+        pkt->crc32 = 0;
+    }
+    return true;
+}
+
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::setChallenge(uint16_t length) {
     TR *tr = static_cast<TR *>(this);
-    if ((value >> 8) == 0x03) {
-        switch (value & 0xff) {
-            case Controller::SET_CHALLENGE: {
-                auto *pkt = reinterpret_cast<AuthReport *>(&(this->scratchPad));
-                RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: SET_CHALLENGE");
-                if (tr->check(pkt, sizeof(*pkt)) != sizeof(*pkt)) {
-                    RDS4_DBG_PRINTLN("wrong size");
-                    return false;
-                }
-                // sanity check
-                if (pkt->type != Controller::SET_CHALLENGE) {
-                    RDS4_DBG_PRINT("wrong magic ");
-                    RDS4_DBG_PHEX(pkt->type);
-                    RDS4_DBG_PRINT("\n");
-                    return false;
-                }
-                // Page 0 acts like a reset
-                if (pkt->page == 0) {
-                    RDS4_DBG_PRINTLN("reset");
-                    this->page = 0;
-                    this->seq = pkt->seq;
-                    this->state = DS4AuthState::NONCE_RECEIVED;
-                    this->notifyStateChange();
-                } else if (this->state == DS4AuthState::WAIT_NONCE) {
-                    // If currently waiting for more nonce, make sure the order is consistent. Otherwise go to error state.
-                    if (pkt->seq == this->seq and pkt->page == this->page + 1) {
-                        RDS4_DBG_PRINTLN("cont");
-                        this->page++;
-                        this->state = DS4AuthState::NONCE_RECEIVED;
-                        this->notifyStateChange();
-                        this->notifyStateChange();
-                    } else {
-                        RDS4_DBG_PRINTLN("ooo");
-                        this->state = DS4AuthState::ERROR;
-                    }
-                } else {
-                    RDS4_DBG_PRINTLN("err");
-                    this->page = -1;
-                    this->state = DS4AuthState::ERROR;
-                }
-                break;
-            }
-            default:
-                // unknown cmd, stall
-                return false;
+    auto *pkt = &(this->challengeQueue[this->challengeHead & (CHALLENGE_SLOTS - 1)]);
+    RDS4_DBG_PRINTLN("AuthenticationHandlerDS4: SET_CHALLENGE");
+    // All slots are in use. Stall and let the host retry.
+    if (static_cast<uint8_t>(this->challengeHead - this->challengeTail) >= CHALLENGE_SLOTS) {
+        RDS4_DBG_PRINTLN("queue full");
+        RDS4_STAT_INC(this->authStats.challengeStalls);
+        return false;
+    }
+    if (tr->check(pkt, sizeof(*pkt)) != sizeof(*pkt)) {
+        RDS4_DBG_PRINTLN("wrong size");
+        RDS4_STAT_INC(this->authStats.challengeStalls);
+        return false;
+    }
+    // sanity check
+    if (pkt->type != Controller::SET_CHALLENGE) {
+        RDS4_DBG_PRINT("wrong magic ");
+        RDS4_DBG_PHEX(pkt->type);
+        RDS4_DBG_PRINT("\n");
+        RDS4_STAT_INC(this->authStats.challengeStalls);
+        return false;
+    }
+    RDS4_TRACE_EVENT(utils::TraceType::HOST_SET, Controller::SET_CHALLENGE, pkt->page);
+    // Page 0 acts like a reset
+    if (pkt->page == 0) {
+        RDS4_DBG_PRINTLN("reset");
+        RDS4_STAT_INC(this->authStats.transactions);
+        this->page = 0;
+        this->seq = pkt->seq;
+        this->challengeHead++;
+        this->setState(DS4AuthState::NONCE_RECEIVED);
+        this->notifyStateChange();
+    } else if (this->state == DS4AuthState::WAIT_NONCE or this->state == DS4AuthState::NONCE_RECEIVED) {
+        // If currently waiting for more nonce (or still forwarding the previous page), make sure the order is consistent. Otherwise go to error state.
+        if (pkt->seq == this->seq and pkt->page == this->page + 1) {
+            RDS4_DBG_PRINTLN("cont");
+            this->page++;
+            this->challengeHead++;
+            this->setState(DS4AuthState::NONCE_RECEIVED);
+            this->notifyStateChange();
+        } else {
+            RDS4_DBG_PRINTLN("ooo");
+            this->setState(DS4AuthState::ERROR);
         }
+    } else {
+        RDS4_DBG_PRINTLN("err");
+        this->page = -1;
+        this->setState(DS4AuthState::ERROR);
     }
     return true;
 }
 
-template <class TR, bool strictCRC>
-bool AuthenticationHandler<TR, strictCRC>::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::getResponse(uint16_t length) {
     TR *tr = static_cast<TR *>(this);
-    if ((value >> 8) == 0x03) {
-        switch (value & 0xff) {
-            case Controller::GET_RESPONSE:
-                // Will be processed in update()
-                if (this->state == DS4AuthState::RESP_BUFFERED) {
-                    this->state = DS4AuthState::RESP_UNLOADED;
-                    this->notifyStateChange();
-                } else {
-                    // TODO do we need to clean the buffer?
-                    this->state = DS4AuthState::ERROR;
-                }
-                tr->reply(&scratchPad, sizeof(AuthReport));
-                break;
-            case Controller::GET_AUTH_STATUS: {
-                // Use a separate buffer here to make sure we don't overwrite buffered response.
-                AuthStatusReport pkt = {0};
-                pkt.type = Controller::GET_AUTH_STATUS;
-                pkt.seq = this->seq;
-                pkt.crc32 = strictCRC ? utils::crc32(&pkt, sizeof(pkt) - sizeof(pkt.crc32)) : 0;
-                switch (this->state) {
-                    // Already responding to the host (aka. ready)
-                    case DS4AuthState::RESP_BUFFERED:
-                    case DS4AuthState::RESP_UNLOADED:
-                        pkt.status = 0x00; // ok
-                        break;
-                    // Still waiting for the auth device
-                    case DS4AuthState::WAIT_RESP:
-                    case DS4AuthState::POLL_RESP:
-                        pkt.status = 0x10; // busy
-                        // notify the other end that the host polled us
-                        this->state = DS4AuthState::POLL_RESP;
-                        this->notifyStateChange();
-                        break;
-                    // Something went wrong or not in a transaction
-                    case DS4AuthState::ERROR:
-                        pkt.status = 0xf0;
-                        break;
-                    default:
-                        pkt.status = 0x01; // not in a transaction
-                        break;
-                }
-                tr->reply(&pkt, sizeof(pkt));
-                break;
-            }
-            case Controller::GET_AUTH_PAGE_SIZE: {
-                auto *ps = reinterpret_cast<AuthPageSizeReport *>(&(this->scratchPad));
-                memset(ps, 0, sizeof(*ps));
-                ps->type = Controller::GET_AUTH_PAGE_SIZE;
-                ps->size_challenge = this->auth->getChallengePageSize();
-                ps->size_response = this->auth->getResponsePageSize();
-                tr->reply(ps, sizeof(*ps));
-                break;
-            }
-            default:
-                // unknown cmd, stall
-                return false;
+    RDS4_TRACE_EVENT(utils::TraceType::HOST_GET, Controller::GET_RESPONSE, this->page);
+    if (this->state != DS4AuthState::RESP_BUFFERED) {
+        // TODO do we need to clean the buffer?
+        this->setState(DS4AuthState::ERROR);
+        tr->reply(&scratchPad, sizeof(AuthReport));
+    } else if (prefetch) {
+        // Serve the next page straight from the cache
+        tr->reply(&scratchPad, sizeof(AuthReport));
+        if (this->responseCache.isLast(this->page)) {
+            RDS4_STAT_INC(this->authStats.completed);
+            this->setState(DS4AuthState::IDLE);
+            this->page = -1;
+        } else {
+            this->page++;
+            this->unloadCachedPage();
         }
+    } else {
+        // Will be processed in update()
+        this->setState(DS4AuthState::RESP_UNLOADED);
+        this->notifyStateChange();
+        tr->reply(&scratchPad, sizeof(AuthReport));
     }
     return true;
 }
 
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::getAuthStatus(uint16_t length) {
+    TR *tr = static_cast<TR *>(this);
+    // Use a separate buffer here to make sure we don't overwrite buffered response.
+    AuthStatusReport pkt = {0};
+    pkt.type = Controller::GET_AUTH_STATUS;
+    pkt.seq = this->seq;
+    pkt.crc32 = strictCRC ? utils::crc32(&pkt, sizeof(pkt) - sizeof(pkt.crc32)) : 0;
+    switch (this->state) {
+        // Already responding to the host (aka. ready)
+        case DS4AuthState::RESP_BUFFERED:
+        case DS4AuthState::RESP_UNLOADED:
+            pkt.status = 0x00; // ok
+            break;
+        // Challenge is still being forwarded or response is still being prefetched
+        case DS4AuthState::NONCE_RECEIVED:
+        case DS4AuthState::RESP_PREFETCH:
+            pkt.status = 0x10; // busy
+            break;
+        // Still waiting for the auth device
+        case DS4AuthState::WAIT_RESP:
+        case DS4AuthState::POLL_RESP:
+            pkt.status = 0x10; // busy
+            // notify the other end that the host polled us
+            this->setState(DS4AuthState::POLL_RESP);
+            this->notifyStateChange();
+            break;
+        // Something went wrong or not in a transaction
+        case DS4AuthState::ERROR:
+            pkt.status = 0xf0;
+            break;
+        default:
+            pkt.status = 0x01; // not in a transaction
+            break;
+    }
+    RDS4_TRACE_EVENT(utils::TraceType::HOST_GET, Controller::GET_AUTH_STATUS, pkt.status);
+    tr->reply(&pkt, sizeof(pkt));
+    return true;
+}
+
+template <class TR, bool strictCRC, bool prefetch>
+bool AuthenticationHandler<TR, strictCRC, prefetch>::getAuthPageSize(uint16_t length) {
+    TR *tr = static_cast<TR *>(this);
+    auto *ps = reinterpret_cast<AuthPageSizeReport *>(&(this->scratchPad));
+    memset(ps, 0, sizeof(*ps));
+    ps->type = Controller::GET_AUTH_PAGE_SIZE;
+    ps->size_challenge = this->auth->getChallengePageSize();
+    ps->size_response = this->auth->getResponsePageSize();
+    tr->reply(ps, sizeof(*ps));
+    return true;
+}
+
+/** Serves the static DS4 feature reports (configuration and IMU
+  * calibration) from PROGMEM (CRTP mixin). Pairing info (0x12) and firmware
+  * info (0xa3) are device specific and still stall.
+  */
 template <class TR>
 class FeatureConfigurator {
 protected:
-    static const uint8_t RESPONSE[48];
-    bool onGetReport(uint16_t value, uint16_t index, uint16_t length);
+    static const uint8_t CONFIGURATION[48];
+    static const uint8_t CALIBRATION[37];
+    // Feature report handlers. Dispatched by FeatureDispatcher.
+    bool getConfiguration(uint16_t length) {
+        return this->replyStatic(FeatureConfigurator::CONFIGURATION, sizeof(FeatureConfigurator::CONFIGURATION));
+    }
+    bool getCalibration(uint16_t length) {
+        return this->replyStatic(FeatureConfigurator::CALIBRATION, sizeof(FeatureConfigurator::CALIBRATION));
+    }
+private:
+    bool replyStatic(const uint8_t *data, uint8_t size) {
+        static_cast<TR *>(this)->reply(data, size);
+        return true;
+    }
 };
 
 template <class TR>
-const uint8_t FeatureConfigurator<TR>::RESPONSE[] PROGMEM = {
+const uint8_t FeatureConfigurator<TR>::CONFIGURATION[] PROGMEM = {
     0x03, 0x21, 0x27, 0x04, 0x4d, 0x00, 0x2c, 0x56,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x0d, 0x0d, 0x00, 0x00, 0x00, 0x00,
@@ -316,15 +600,260 @@ const uint8_t FeatureConfigurator<TR>::RESPONSE[] PROGMEM = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+// No bias, +/-8192 full scale on every gyro and accel axis, 540 deg/s
+// reference speed. Matches the all-zero IMU fields in InputReport.
+template <class TR>
+const uint8_t FeatureConfigurator<TR>::CALIBRATION[] PROGMEM = {
+    0x02,
+    // gyro bias (pitch, yaw, roll)
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    // gyro pitch+/-, yaw+/-, roll+/-
+    0x00, 0x20, 0x00, 0xe0, 0x00, 0x20, 0x00, 0xe0, 0x00, 0x20, 0x00, 0xe0,
+    // gyro speed +/-
+    0x1c, 0x02, 0x1c, 0x02,
+    // accel x+/-, y+/-, z+/-
+    0x00, 0x20, 0x00, 0xe0, 0x00, 0x20, 0x00, 0xe0, 0x00, 0x20, 0x00, 0xe0,
+    0x00, 0x00
+};
+
+/** One entry of a feature report dispatch table. Handlers are member
+  * functions of the transport or its mixins and return `false` to stall.
+  * `nullptr` stalls that direction.
+  */
+template <class TR>
+struct FeatureReport {
+    typedef bool (TR::*Handler)(uint16_t length);
+    uint8_t id;
+    Handler get;
+    Handler set;
+};
+
+/** Feature reports every DS4 transport answers. Transports must befriend
+  * this so the handlers can stay protected.
+  * To add reports, define a struct like this with its own LIST and pass it
+  * to FeatureDispatcher.
+  */
+template <class TR>
+struct DS4FeatureReports {
+    static constexpr FeatureReport<TR> LIST[] = {
+        {0x02, &TR::getCalibration, nullptr},
+        {0x03, &TR::getConfiguration, nullptr},
+        {Controller::SET_CHALLENGE, nullptr, &TR::setChallenge},
+        {Controller::GET_RESPONSE, &TR::getResponse, nullptr},
+        {Controller::GET_AUTH_STATUS, &TR::getAuthStatus, nullptr},
+        {Controller::GET_AUTH_PAGE_SIZE, &TR::getAuthPageSize, nullptr},
+    };
+};
+
 template <class TR>
-bool FeatureConfigurator<TR>::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+constexpr FeatureReport<TR> DS4FeatureReports<TR>::LIST[];
+
+// Report ID to (1-based) LIST slot, 0 for unhandled IDs
+struct FeatureIndex {
+    uint8_t slot[256];
+};
+
+// Index generators. Everything here is evaluated at compile time.
+template <class L>
+constexpr size_t featureCount() {
+    return sizeof(L::LIST) / sizeof(L::LIST[0]);
+}
+
+template <class L>
+constexpr uint8_t featureSlot(size_t id, size_t i=0) {
+    return i == featureCount<L>() ? 0 : (L::LIST[i].id == id ? i + 1 : featureSlot<L>(id, i + 1));
+}
+
+template <class L>
+constexpr bool featureUnique(size_t i=0) {
+    return i == featureCount<L>() ? true : (featureSlot<L>(L::LIST[i].id) == i + 1 and featureUnique<L>(i + 1));
+}
+
+template <class L, size_t... I>
+constexpr FeatureIndex featureMakeIndex(utils::IndexSequence<I...>) {
+    return FeatureIndex {{ featureSlot<L>(I)... }};
+}
+
+/** Dispatches feature GET/SET_REPORT requests to the handlers in `L::LIST`
+  * (CRTP mixin). The report ID lookup is a single read from a 256-entry
+  * table built at compile time, so the time spent in the control transfer
+  * callback doesn't grow with the number of reports.
+  * Requests for other report types are acknowledged without data, like
+  * before.
+  */
+template <class TR, class L=DS4FeatureReports<TR>>
+class FeatureDispatcher {
+protected:
+    bool dispatchGetReport(uint16_t value, uint16_t index, uint16_t length) {
+        return this->dispatch(value, length, false);
+    }
+    bool dispatchSetReport(uint16_t value, uint16_t index, uint16_t length) {
+        return this->dispatch(value, length, true);
+    }
+private:
+    bool dispatch(uint16_t value, uint16_t length, bool set);
+    static const FeatureIndex INDEX;
+};
+
+template <class TR, class L>
+const FeatureIndex FeatureDispatcher<TR, L>::INDEX PROGMEM = featureMakeIndex<L>(utils::MakeIndexSequence<256>::type());
+
+template <class TR, class L>
+bool FeatureDispatcher<TR, L>::dispatch(uint16_t value, uint16_t length, bool set) {
+    static_assert(featureCount<L>() < 256, "Too many feature reports");
+    static_assert(featureUnique<L>(), "Duplicate feature report ID");
     TR *tr = static_cast<TR *>(this);
-    if (value == 0x0303) {
-        tr->reply(&FeatureConfigurator::RESPONSE, sizeof(FeatureConfigurator::RESPONSE));
+    uint8_t slot;
+    if ((value >> 8) != 0x03) {
         return true;
-    } else {
+    }
+    slot = pgm_read_byte(&(FeatureDispatcher::INDEX.slot[value & 0xff]));
+    if (slot == 0) {
+        // unknown cmd, stall
         return false;
     }
+    auto handler = set ? L::LIST[slot - 1].set : L::LIST[slot - 1].get;
+    if (handler == nullptr) {
+        return false;
+    }
+    return (tr->*handler)(length);
+}
+
+/** TX queue depth limit and overflow policy for transports that queue IN
+  * reports (CRTP mixin).
+  * `TR` must implement `uint8_t txQueued()` (reports submitted but not yet
+  * picked up by the host) and `bool txSubmit(const void *, uint8_t)` (queue
+  * one report), and call flushTX() whenever queue entries free up.
+  * Under TXPolicy::DROP_OLDEST, a report that doesn't fit waits in a single
+  * coalescing slot and is replaced by any newer one, so at most one report
+  * beyond the queue depth is ever kept back.
+  * Reports longer than the max. length given to the constructor are refused
+  * under either policy, as is everything after them in a batch.
+  */
+template <class TR>
+class TXQueue {
+public:
+    // Large enough for Bluetooth-format reports
+    static const uint8_t COALESCE_SIZE = 78;
+
+    TXQueue(uint8_t depth, api::TXPolicy policy, uint8_t maxLen=COALESCE_SIZE) :
+            txDepth(depth == 0 ? 1 : depth),
+            txPolicy(policy),
+            txMaxLen(maxLen > COALESCE_SIZE ? COALESCE_SIZE : maxLen),
+            coalesced{0},
+            coalescedLen(0),
+            dropped(0) {}
+    /** Submit the report in the coalescing slot if there is room now.
+     *
+     *  @return `true` if the slot was submitted.
+     */
+    bool flushTX() {
+        TR *tr = static_cast<TR *>(this);
+        if (this->coalescedLen == 0 or this->room() == 0) {
+            return false;
+        }
+        if (not tr->txSubmit(this->coalesced, this->coalescedLen)) {
+            return false;
+        }
+        this->coalescedLen = 0;
+        return true;
+    }
+    /** Number of reports dropped by the TX policy so far. Reports refused
+     *  under DROP_NEWEST are counted as well.
+     */
+    uint32_t getDropped() {
+        return this->dropped;
+    }
+    uint8_t getQueueDepth() {
+        return this->txDepth;
+    }
+    api::TXPolicy getTXPolicy() {
+        return this->txPolicy;
+    }
+
+protected:
+    uint8_t queueSend(const void *buf, uint8_t len) {
+        api::ReportVec report = {buf, len};
+        return this->queueSendv(&report, 1) == 1 ? len : 0;
+    }
+    uint8_t queueSendv(const api::ReportVec *reports, uint8_t count);
+    /** Reports queued or waiting in the coalescing slot. */
+    uint8_t txPending() {
+        return static_cast<TR *>(this)->txQueued() + (this->coalescedLen != 0 ? 1 : 0);
+    }
+    /** Free entries in the TX queue, taking the depth limit into account. */
+    uint8_t room() {
+        uint8_t queued = static_cast<TR *>(this)->txQueued();
+        return queued < this->txDepth ? this->txDepth - queued : 0;
+    }
+    uint8_t txDepth;
+    api::TXPolicy txPolicy;
+    // Longest report txSubmit() takes
+    uint8_t txMaxLen;
+
+private:
+    void coalesce(const api::ReportVec &report) {
+        if (this->coalescedLen != 0) {
+            this->dropped++;
+        }
+        // queueSendv() only gets here with reports up to txMaxLen
+        this->coalescedLen = report.len;
+        memcpy(this->coalesced, report.buf, this->coalescedLen);
+    }
+    uint8_t coalesced[COALESCE_SIZE];
+    uint8_t coalescedLen;
+    uint32_t dropped;
+};
+
+template <class TR>
+uint8_t TXQueue<TR>::queueSendv(const api::ReportVec *reports, uint8_t count) {
+    TR *tr = static_cast<TR *>(this);
+    uint8_t room = this->room();
+    uint8_t first = 0, i;
+    // Never send a report cut short, refuse it and everything after it
+    for (i=0; i<count; i++) {
+        if (reports[i].len > this->txMaxLen) {
+            count = i;
+            break;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    if (this->txPolicy == api::TXPolicy::DROP_OLDEST) {
+        // The coalesced report is older than the whole batch
+        if (this->coalescedLen != 0) {
+            if (room > count and tr->txSubmit(this->coalesced, this->coalescedLen)) {
+                room--;
+            } else {
+                this->dropped++;
+            }
+            this->coalescedLen = 0;
+        }
+        // Keep only the newest room + 1 reports
+        if (count > room + 1) {
+            first = count - room - 1;
+            this->dropped += first;
+        }
+    }
+    for (i=first; i<count; i++) {
+        if (room == 0 or not tr->txSubmit(reports[i].buf, reports[i].len)) {
+            break;
+        }
+        room--;
+    }
+    if (i == count) {
+        return count;
+    }
+    RDS4_STAT_INC(tr->stats.txFull);
+    if (this->txPolicy == api::TXPolicy::DROP_OLDEST) {
+        // Whatever is left is the newest report
+        this->dropped += count - i - 1;
+        this->coalesce(reports[count - 1]);
+        return count;
+    }
+    this->dropped += count - i;
+    return i;
 }
 
 #if defined(RDS4_ARDUINO) && defined(RDS4_TEENSY_3)
@@ -343,9 +872,18 @@ typedef struct {
 
 /** Tansport backend for teensy 3.x/LC boards. Requires patched teensyduino core library */
 class TransportTeensy;
-class TransportTeensy : public api::Transport, public AuthenticationHandler<TransportTeensy>, public FeatureConfigurator<TransportTeensy> {
+class TransportTeensy : public api::Transport, public AuthenticationHandler<TransportTeensy>, public FeatureConfigurator<TransportTeensy>, public FeatureDispatcher<TransportTeensy>, public TXQueue<TransportTeensy> {
 public:
-    TransportTeensy(api::Authenticator *auth) : AuthenticationHandler(auth) {
+    // Size of the IN endpoint, should be in sync with the DS4 stub
+    static const uint8_t TX_SIZE = 64;
+    /** Constructor.
+     *
+     *  @param The authenticator.
+     *  @param Max. number of IN reports waiting in the USB stack's TX queue.
+     *  @param What to do with reports that don't fit.
+     */
+    TransportTeensy(api::Authenticator *auth, uint8_t queueDepth=2, api::TXPolicy policy=api::TXPolicy::DROP_NEWEST) :
+            AuthenticationHandler(auth), TXQueue(queueDepth, policy, TransportTeensy::TX_SIZE), txPacket(nullptr), rxPacket(nullptr), txLastQueued(0) {
         TransportTeensy::inst = this;
         usb_ds4stub_on_get_report = &(TransportTeensy::frCallbackGet);
         usb_ds4stub_on_set_report = &(TransportTeensy::frCallbackSet);
@@ -353,14 +891,43 @@ public:
     void begin() override {
         AuthenticationHandler<TransportTeensy>::begin();
     }
-    bool available() override;
-    uint8_t send(const void *buf, uint8_t len) override;
-    uint8_t sendBlocking(const void *buf, uint8_t len) override;
-    uint8_t recv(void *buf, uint8_t len) override;
+    /** Submit the coalesced report (if any), fire the TX complete and RX
+     *  callbacks if anything happened and update authentication.
+     *  The core has no RX hook either, so the RX callback fires from here.
+     */
+    void update() override {
+        this->pollTX();
+        this->flushTX();
+        if (this->available()) {
+            this->notifyRX();
+        }
+        AuthenticationHandler<TransportTeensy>::update();
+    }
+    bool available() override final;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t sendTimed(const void *buf, uint8_t len, uint32_t timeout) override;
+    uint8_t sendv(const api::ReportVec *reports, uint8_t count) override;
+    uint8_t getTXPending() override {
+        return this->txPending();
+    }
+    uint8_t recv(void *buf, uint8_t len) override final;
+    // Hands out USB packets directly
+    void *acquireTX(uint8_t len) override final;
+    uint8_t commitTX(uint8_t len) override final;
+    const void *borrowRX(uint8_t *len) override final;
+    void releaseRX() override final;
+    // The core has no TX complete hook. Watch the queue instead.
+    void pollTX() override;
 
 protected:
     friend class AuthenticationHandler<TransportTeensy>;
     friend class FeatureConfigurator<TransportTeensy>;
+    friend struct DS4FeatureReports<TransportTeensy>;
+    friend class TXQueue<TransportTeensy>;
+    uint8_t txQueued();
+    bool txSubmit(const void *buf, uint8_t len);
+    // Sleeps until the next interrupt
+    void waitTX(uint32_t timeout) override;
     // Copy data to DMA buffer
     uint8_t check(void *buf, uint8_t len) override;
     // Unload data from DMA buffer
@@ -374,6 +941,11 @@ protected:
     static uint32_t *frSize;
     // Since this class can only be instantiated once, this should be fine.
     static TransportTeensy *inst;
+private:
+    // Packets lent out by acquireTX()/borrowRX()
+    usb_packet_struct *txPacket;
+    usb_packet_struct *rxPacket;
+    uint8_t txLastQueued;
 };
 
 #elif defined(RDS4_ARDUINO) && defined(USBCON)
@@ -410,9 +982,9 @@ public:
         
     }
     int begin(void) override { return; }
-    uint8_t send(const void *buf, uint8_t len) override;
-    uint8_t recv(void *buf, uint8_t len) override;
-    bool available() override;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t recv(void *buf, uint8_t len) override final;
+    bool available() override final;
 
 protected:
     // PluggableUSB API
@@ -432,27 +1004,626 @@ private:
 };
 
 #endif
-#if 0
-// This is outdated, update soon
-#ifdef RDS4_LINUX
 
-class TransportNull : public Transport {
-    bool sendAvailable() { return false; }
-    bool recvAvailable() { return false; }
-    size_t sendReport(const void *buf, size_t len) { return 0; }
-    size_t recvReport(void *buf, size_t len) { return 0; }
+#if defined(RDS4_LINUX)
+
+/** Transport backend for Linux. Creates a virtual DS4 through /dev/uhid.
+  * Feature requests from the host are dispatched to AuthenticationHandler and
+  * FeatureConfigurator like on the USB transports, and OUTPUT reports are
+  * queued for recv().
+  * Nothing happens on its own: either call poll() in a loop or add getFD()
+  * to an existing event loop and call dispatch() when it becomes readable.
+  */
+class TransportUHID : public api::Transport, public AuthenticationHandler<TransportUHID>, public FeatureConfigurator<TransportUHID>, public FeatureDispatcher<TransportUHID> {
+public:
+    static const uint16_t DS4_VID = 0x054c;
+    static const uint16_t DS4_PID = 0x05c4;
+    // Max. number of OUTPUT reports kept for recv()
+    static const uint8_t RX_SLOTS = 4;
+    static const uint8_t RX_SIZE = 64;
+
+    TransportUHID(api::Authenticator *auth, const char *name="Wireless Controller",
+                  uint16_t vid=DS4_VID, uint16_t pid=DS4_PID);
+    ~TransportUHID();
+    /** Create the virtual device. */
+    void begin() override;
+    /** Destroy the virtual device. */
+    void end();
+    bool available() override final;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t sendBlocking(const void *buf, uint8_t len) override final;
+    uint8_t recv(void *buf, uint8_t len) override final;
+    /** Check if the virtual device exists and is started by the kernel. */
+    bool ready() {
+        return this->started;
+    }
+    /** Check if any user on the host side has the device open. */
+    bool opened() {
+        return this->openCount != 0;
+    }
+    /** Get the UHID file descriptor for use in external event loops.
+     *
+     *  @return The file descriptor or -1 if not created.
+     */
+    int getFD() {
+        return this->uhid;
+    }
+    /** Handle all pending UHID events without blocking.
+     *
+     *  @return Number of events handled or -1 on error.
+     */
+    int dispatch();
+    /** Wait for UHID events and handle them.
+     *
+     *  @param Timeout in ms. 0 returns immediately, -1 waits indefinitely.
+     *  @return Number of events handled or -1 on error.
+     */
+    int poll(int timeout);
+
+protected:
+    friend class AuthenticationHandler<TransportUHID>;
+    friend class FeatureConfigurator<TransportUHID>;
+    friend struct DS4FeatureReports<TransportUHID>;
+    uint8_t check(void *buf, uint8_t len) override;
+    uint8_t reply(const void *buf, uint8_t len) override;
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override;
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override;
+
+private:
+    bool writeEvent(const void *ev, size_t len);
+    void handleEvent(const void *ev);
+    const char *name;
+    uint16_t vid;
+    uint16_t pid;
+    int uhid;
+    int epoll;
+    bool started;
+    uint8_t openCount;
+    // Payload of the feature request being dispatched
+    const uint8_t *frData;
+    uint16_t frSize;
+    // Reply to the feature request being dispatched
+    uint8_t *frReply;
+    uint16_t frReplySize;
+    // OUTPUT report queue. Indices are free-running.
+    uint8_t rxQueue[RX_SLOTS][RX_SIZE];
+    uint8_t rxLen[RX_SLOTS];
+    uint8_t rxHead;
+    uint8_t rxTail;
 };
 
-class TransportStdio : public Transport {
-    bool sendAvailable() { return true; }
-    bool recvAvailable() { return false; }
-    size_t sendReport(const void *buf, size_t len) {
-        return fwrite(buf, sizeof(uint8_t), len, stdout);
+/** Transport backend for Linux USB gadgets via FunctionFS. Turns a Linux
+  * board with a UDC (or any Linux box with dummy_hcd) into a USB DS4.
+  * Interrupt IN/OUT transfers use kernel AIO with several reports in flight
+  * and ep0 control requests go through the usual onGetReport()/onSetReport()
+  * path.
+  * Like TransportUHID, call poll() in a loop or add getFD() to an existing
+  * event loop and call dispatch() when it becomes readable.
+  */
+class TransportFFS : public api::Transport, public AuthenticationHandler<TransportFFS>, public FeatureConfigurator<TransportFFS>, public FeatureDispatcher<TransportFFS>, public TXQueue<TransportFFS> {
+public:
+    // Reports in flight in each direction
+    static const uint8_t TX_SLOTS = 4;
+    static const uint8_t RX_SLOTS = 4;
+    static const uint8_t EP_SIZE = 64;
+
+    /** Constructor.
+     *
+     *  @param The authenticator.
+     *  @param Mount point of the FunctionFS instance (e.g. /dev/ffs-ds4).
+     *  @param Max. number of IN reports in flight (at most TX_SLOTS).
+     *  @param What to do with reports that don't fit.
+     */
+    TransportFFS(api::Authenticator *auth, const char *path, uint8_t queueDepth=TX_SLOTS,
+                 api::TXPolicy policy=api::TXPolicy::DROP_NEWEST);
+    ~TransportFFS();
+    /** Write the descriptors and set up the event loop. The gadget can be
+     *  bound to a UDC afterwards.
+     */
+    void begin() override;
+    void end();
+    bool available() override final;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t sendv(const api::ReportVec *reports, uint8_t count) override;
+    uint8_t getTXPending() override {
+        return this->txPending();
+    }
+    uint8_t recv(void *buf, uint8_t len) override final;
+    // Hands out the AIO buffers directly
+    void *acquireTX(uint8_t len) override final;
+    uint8_t commitTX(uint8_t len) override final;
+    const void *borrowRX(uint8_t *len) override final;
+    void releaseRX() override final;
+    /** Check if the host has configured the device. */
+    bool ready() {
+        return this->enabled;
+    }
+    /** Number of IN reports submitted but not yet picked up by the host. */
+    uint8_t pending() {
+        return this->txInFlight;
     }
-    size_t recvReport(void *buf, size_t len) { return 0; }
+    /** Get a file descriptor that becomes readable when dispatch() has
+     *  something to do.
+     *
+     *  @return The file descriptor or -1 if not started.
+     */
+    int getFD() {
+        return this->epoll;
+    }
+    /** Handle all pending ep0 events and transfer completions without
+     *  blocking.
+     *
+     *  @return Number of events handled or -1 on error.
+     */
+    int dispatch();
+    /** Wait for events and handle them.
+     *
+     *  @param Timeout in ms. 0 returns immediately, -1 waits indefinitely.
+     *  @return Number of events handled or -1 on error.
+     */
+    int poll(int timeout);
+
+protected:
+    friend class AuthenticationHandler<TransportFFS>;
+    friend class FeatureConfigurator<TransportFFS>;
+    friend struct DS4FeatureReports<TransportFFS>;
+    friend class TXQueue<TransportFFS>;
+    uint8_t txQueued();
+    bool txSubmit(const void *buf, uint8_t len);
+    // Runs the event loop until something happens
+    void waitTX(uint32_t timeout) override;
+    uint8_t check(void *buf, uint8_t len) override;
+    uint8_t reply(const void *buf, uint8_t len) override;
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override;
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override;
+
+private:
+    bool writeDescriptors();
+    int handleEP0();
+    void handleSetup(const void *setup);
+    int handleCompletions();
+    bool enable();
+    void disable();
+    bool submitRx(uint8_t slot);
+    bool submitTx(uint8_t slot, uint8_t len);
+    // Whether a failed RX completion is worth resubmitting
+    static bool isTransient(int64_t res);
+    void stallEP0(bool in);
+    const char *path;
+    int ep0;
+    int epIn;
+    int epOut;
+    int epoll;
+    int eventFD;
+    // aio_context_t
+    unsigned long aio;
+    bool enabled;
+    // Payload of the control request being dispatched
+    const uint8_t *frData;
+    uint16_t frSize;
+    // Reply to the control request being dispatched
+    uint8_t frReply[EP_SIZE];
+    uint16_t frReplySize;
+    bool frReplied;
+    uint8_t txBuf[TX_SLOTS][EP_SIZE];
+    bool txBusy[TX_SLOTS];
+    uint8_t txInFlight;
+    // TX slot lent out by acquireTX() (0xff if none)
+    uint8_t txLent;
+    uint8_t rxBuf[RX_SLOTS][EP_SIZE];
+    uint8_t rxLen[RX_SLOTS];
+    // Completed OUT transfers waiting for recv(), in completion order
+    uint8_t rxReady[RX_SLOTS];
+    uint8_t rxHead;
+    uint8_t rxTail;
 };
 
-#endif // RDS4_MOCK
-#endif
+class LoopbackHost;
+
+/** Device end of an in-process loopback link. Reports go through lock-free
+  * SPSC rings instead of a kernel interface, so the library's own per-report
+  * overhead can be measured without any syscalls in the way.
+  * The device end (Controller, update(), etc.) must stay on one thread and
+  * the LoopbackHost end on another (or the same one). Feature requests from
+  * the host are handed over through a single-entry mailbox and are served
+  * by dispatch(), which update() also calls. The RX callback also fires
+  * from update(), never on the host's thread.
+  */
+class TransportLoopback : public api::Transport, public AuthenticationHandler<TransportLoopback>, public FeatureConfigurator<TransportLoopback>, public FeatureDispatcher<TransportLoopback>, public TXQueue<TransportLoopback> {
+public:
+    // Must be powers of 2
+    static const uint16_t IN_SLOTS = 64;
+    static const uint16_t OUT_SLOTS = 16;
+    // Large enough for Bluetooth-format reports
+    static const uint8_t REPORT_SIZE = 78;
+
+    /** Constructor.
+     *
+     *  @param The authenticator.
+     *  @param Max. number of INPUT reports waiting for the host (at most
+     *         IN_SLOTS).
+     *  @param What to do with reports that don't fit.
+     */
+    TransportLoopback(api::Authenticator *auth, uint8_t queueDepth=IN_SLOTS,
+                      api::TXPolicy policy=api::TXPolicy::DROP_NEWEST) :
+                                                  AuthenticationHandler(auth),
+                                                  TXQueue(queueDepth > IN_SLOTS ? IN_SLOTS : queueDepth, policy, REPORT_SIZE),
+                                                  txLent(false),
+                                                  txWaiting(0),
+                                                  txEvent(-1),
+                                                  rxPending(0),
+                                                  ctlState(CTL_IDLE),
+                                                  ctlSet(false),
+                                                  ctlValue(0),
+                                                  ctlIndex(0),
+                                                  ctlLength(0),
+                                                  ctlData{0},
+                                                  ctlSize(0),
+                                                  ctlResult(false) {}
+    ~TransportLoopback();
+    void begin() override {
+        AuthenticationHandler<TransportLoopback>::begin();
+    }
+    bool available() override final;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t sendv(const api::ReportVec *reports, uint8_t count) override;
+    uint8_t getTXPending() override {
+        return this->txPending();
+    }
+    uint8_t recv(void *buf, uint8_t len) override final;
+    // Hands out ring slots directly
+    void *acquireTX(uint8_t len) override final;
+    uint8_t commitTX(uint8_t len) override final;
+    const void *borrowRX(uint8_t *len) override final;
+    void releaseRX() override final;
+    /** Serve the pending feature request from the host (if any), fire the
+     *  RX callback if the host wrote reports since the last call, submit the
+     *  coalesced report (if any) and update authentication.
+     */
+    void update() override;
+    /** Serve the pending feature request from the host (if any).
+     *
+     *  @return `true` if a request was served.
+     */
+    bool dispatch();
+
+protected:
+    friend class AuthenticationHandler<TransportLoopback>;
+    friend class FeatureConfigurator<TransportLoopback>;
+    friend struct DS4FeatureReports<TransportLoopback>;
+    friend class TXQueue<TransportLoopback>;
+    friend class LoopbackHost;
+    uint8_t txQueued();
+    bool txSubmit(const void *buf, uint8_t len);
+    // Sleeps on an eventfd that the host end signals after taking a report
+    void waitTX(uint32_t timeout) override;
+    uint8_t check(void *buf, uint8_t len) override;
+    uint8_t reply(const void *buf, uint8_t len) override;
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override;
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override;
+
+private:
+    enum : uint8_t {
+        CTL_IDLE = 0,
+        // Filled in by the host
+        CTL_REQUEST,
+        // Claimed by the device
+        CTL_BUSY,
+        // Reply ready for the host
+        CTL_DONE,
+    };
+    // INPUT reports (device to host)
+    utils::PacketRing<IN_SLOTS, REPORT_SIZE> inRing;
+    // OUTPUT reports (host to device)
+    utils::PacketRing<OUT_SLOTS, REPORT_SIZE> outRing;
+    // inRing slot lent out by acquireTX()
+    bool txLent;
+    // Set by the device end while it sleeps in waitTX()
+    alignas(RDS4_CACHE_LINE) uint8_t txWaiting;
+    // Created by the device end, read by the host end
+    int txEvent;
+    // Set by the host end after writing a report, cleared by update()
+    alignas(RDS4_CACHE_LINE) uint8_t rxPending;
+    // Feature request mailbox
+    alignas(RDS4_CACHE_LINE) uint8_t ctlState;
+    bool ctlSet;
+    uint16_t ctlValue;
+    uint16_t ctlIndex;
+    uint16_t ctlLength;
+    uint8_t ctlData[REPORT_SIZE];
+    uint8_t ctlSize;
+    bool ctlResult;
+};
+
+/** Host end of an in-process loopback link. Taking a report fires the
+  * device's TX complete callback on the host's thread. Writing one only
+  * flags it, the device's RX callback fires from its next update().
+  */
+class LoopbackHost {
+public:
+    LoopbackHost(TransportLoopback *device) : device(device) {}
+    /** Read the oldest INPUT report sent by the device (non-blocking).
+     *
+     *  @return The number of bytes read or 0 if there is none.
+     */
+    uint8_t read(void *buf, uint8_t len);
+    /** Read the oldest INPUT report without copying it. Call release()
+     *  when done with it.
+     *
+     *  @param Receives the length of the report.
+     *  @return The report or `nullptr` if there is none.
+     */
+    const uint8_t *peek(uint8_t *len);
+    void release();
+    /** Send an OUTPUT report to the device (non-blocking).
+     *
+     *  @return The number of bytes written or 0 if the queue is full.
+     */
+    uint8_t write(const void *buf, uint8_t len);
+    /** Issue a GET_REPORT(Feature) request and wait for the device to
+     *  serve it.
+     *
+     *  @param Report ID.
+     *  @param Buffer for the report.
+     *  @param Size of the buffer (used as wLength).
+     *  @param Timeout in ms.
+     *  @return The number of bytes received or -1 on stall or timeout.
+     */
+    int getFeature(uint8_t id, void *buf, uint8_t len, uint32_t timeout=100);
+    /** Issue a SET_REPORT(Feature) request and wait for the device to
+     *  serve it.
+     *
+     *  @return The number of bytes sent or -1 on stall or timeout.
+     */
+    int setFeature(uint8_t id, const void *buf, uint8_t len, uint32_t timeout=100);
+
+private:
+    int request(bool set, uint8_t id, void *buf, uint8_t len, uint32_t timeout);
+    // Wake up the device end after a report was taken
+    void onTaken();
+    TransportLoopback *device;
+};
+
+/** Frame types of the TransportSocket protocol. Each SOCK_SEQPACKET packet
+  * is one frame: the type byte followed by the payload.
+  */
+enum class SocketFrame : uint8_t {
+    // Device to host: IN report
+    INPUT = 0x01,
+    // Host to device: OUT report
+    OUTPUT,
+    // Host to device: report ID, wLength (little endian)
+    GET_FEATURE,
+    // Host to device: report ID, report
+    SET_FEATURE,
+    // Device to host: 0 (OK) or 1 (stall), report ID, report (GET_FEATURE
+    // only)
+    REPLY,
+};
+
+/** Transport backend for IPC over a Unix domain socket (SOCK_SEQPACKET),
+  * e.g. an input converter in one process and the emulation in another
+  * (see SocketHost).
+  * IN reports are queued and go out several at a time with sendmmsg(),
+  * either when the socket has room again or, when corked, on flush().
+  * The kernel send buffer is kept small so reports that can't go out pile
+  * up in the TX queue, where the TX policy drops the stale ones.
+  * Call update() or poll() in a loop, or add getFD() to an existing event
+  * loop and call dispatch() when it becomes readable.
+  */
+class TransportSocket : public api::Transport, public AuthenticationHandler<TransportSocket>, public FeatureConfigurator<TransportSocket>, public FeatureDispatcher<TransportSocket>, public TXQueue<TransportSocket> {
+public:
+    // Must be powers of 2
+    static const uint8_t TX_SLOTS = 16;
+    static const uint8_t RX_SLOTS = 8;
+    // Large enough for Bluetooth-format reports
+    static const uint8_t REPORT_SIZE = 78;
+    static const uint8_t FRAME_SIZE = REPORT_SIZE + 2;
+    // SO_SNDBUF. The kernel doubles this and rounds it up to its minimum,
+    // which holds about 6 frames (the default holds hundreds).
+    static const int SOCKET_BUFFER = 2048;
+
+    /** Constructor.
+     *
+     *  @param The authenticator.
+     *  @param Path of the socket to connect to in begin().
+     *  @param Max. number of IN reports waiting for the socket (at most
+     *         TX_SLOTS).
+     *  @param What to do with reports that don't fit.
+     */
+    TransportSocket(api::Authenticator *auth, const char *path=nullptr, uint8_t queueDepth=4,
+                    api::TXPolicy policy=api::TXPolicy::DROP_OLDEST);
+    ~TransportSocket();
+    /** Connect to the socket. */
+    void begin() override;
+    /** Use an already connected socket instead (e.g. one end of a
+     *  socketpair()). The transport takes ownership of it.
+     *
+     *  @param The socket.
+     */
+    void begin(int fd);
+    void end();
+    /** Check if the socket is connected. */
+    bool ready() {
+        return this->sock >= 0;
+    }
+    bool available() override final;
+    uint8_t send(const void *buf, uint8_t len) override final;
+    uint8_t sendv(const api::ReportVec *reports, uint8_t count) override;
+    uint8_t getTXPending() override {
+        return this->txPending();
+    }
+    uint8_t recv(void *buf, uint8_t len) override final;
+    // Hands out TX queue slots directly
+    void *acquireTX(uint8_t len) override final;
+    uint8_t commitTX(uint8_t len) override final;
+    const void *borrowRX(uint8_t *len) override final;
+    void releaseRX() override final;
+    /** Hold IN reports back until flush() (or update()) so that they go
+     *  out in one syscall. Off by default.
+     *
+     *  @param `true` to cork.
+     */
+    void setCorked(bool corked) {
+        this->corked = corked;
+    }
+    /** Limit the number of frames per sendmmsg()/recvmmsg() call.
+     *
+     *  @param Frames per call (1 disables batching).
+     */
+    void setMaxBatch(uint8_t batch) {
+        this->maxBatch = batch == 0 ? 1 : (batch > TX_SLOTS ? TX_SLOTS : batch);
+    }
+    /** Send the queued IN reports (non-blocking).
+     *
+     *  @return `true` if nothing is left in the queue.
+     */
+    bool flush();
+    /** Get the socket for use in external event loops.
+     *
+     *  @return The socket or -1 if not connected.
+     */
+    int getFD() {
+        return this->sock;
+    }
+    /** Handle all pending frames from the host and send the queued IN
+     *  reports (unless corked and there is still room) without blocking.
+     *
+     *  @return Number of frames handled or -1 on error (e.g. the host
+     *          hung up).
+     */
+    int dispatch();
+    /** Wait for frames (or room for queued IN reports) and handle them.
+     *
+     *  @param Timeout in ms. 0 returns immediately, -1 waits indefinitely.
+     *  @return Number of frames handled or -1 on error.
+     */
+    int poll(int timeout);
+    /** Handle pending frames, flush the queue and update authentication. */
+    void update() override;
+
+protected:
+    friend class AuthenticationHandler<TransportSocket>;
+    friend class FeatureConfigurator<TransportSocket>;
+    friend struct DS4FeatureReports<TransportSocket>;
+    friend class TXQueue<TransportSocket>;
+    uint8_t txQueued();
+    bool txSubmit(const void *buf, uint8_t len);
+    // Waits for the socket to become writable
+    void waitTX(uint32_t timeout) override;
+    uint8_t check(void *buf, uint8_t len) override;
+    uint8_t reply(const void *buf, uint8_t len) override;
+    bool onGetReport(uint16_t value, uint16_t index, uint16_t length) override;
+    bool onSetReport(uint16_t value, uint16_t index, uint16_t length) override;
+
+private:
+    void handleFrame(const uint8_t *frame, uint8_t len);
+    bool sendReply(bool ok);
+    const char *path;
+    int sock;
+    bool corked;
+    uint8_t maxBatch;
+    // IN frames. Indices are free-running.
+    uint8_t txBuf[TX_SLOTS][FRAME_SIZE];
+    uint8_t txLen[TX_SLOTS];
+    uint8_t txHead;
+    uint8_t txTail;
+    bool txLent;
+    // Frames of the last recvmmsg() call
+    uint8_t rxBatch[RX_SLOTS][FRAME_SIZE];
+    // OUT reports waiting for recv(). Indices are free-running.
+    uint8_t rxBuf[RX_SLOTS][REPORT_SIZE];
+    uint8_t rxLen[RX_SLOTS];
+    uint8_t rxHead;
+    uint8_t rxTail;
+    // Payload of the feature request being dispatched
+    const uint8_t *frData;
+    uint16_t frSize;
+    // Reply to the feature request being dispatched
+    uint8_t frReply[FRAME_SIZE];
+    uint8_t frReplySize;
+};
+
+/** Host end of a TransportSocket link, e.g. in the emulation process.
+  * IN reports are fetched several at a time with recvmmsg() and handed out
+  * one by one.
+  */
+class SocketHost {
+public:
+    static const uint8_t RX_SLOTS = 16;
+
+    /** Constructor.
+     *
+     *  @param A connected socket (e.g. from accept()). SocketHost takes
+     *         ownership of it.
+     */
+    SocketHost(int fd);
+    ~SocketHost();
+    /** Create a listening SOCK_SEQPACKET socket for TransportSocket to
+     *  connect to. Removes any stale socket file first.
+     *
+     *  @param Path of the socket.
+     *  @return The socket or -1 on error.
+     */
+    static int listen(const char *path);
+    int getFD() {
+        return this->sock;
+    }
+    /** Limit the number of frames per recvmmsg() call.
+     *
+     *  @param Frames per call (1 disables batching).
+     */
+    void setMaxBatch(uint8_t batch) {
+        this->maxBatch = batch == 0 ? 1 : (batch > RX_SLOTS ? RX_SLOTS : batch);
+    }
+    /** Read the oldest IN report (non-blocking).
+     *
+     *  @return The number of bytes read or 0 if there is none.
+     */
+    uint8_t read(void *buf, uint8_t len);
+    /** Read the oldest IN report without copying it. Call release() when
+     *  done with it.
+     *
+     *  @param Receives the length of the report.
+     *  @return The report or `nullptr` if there is none.
+     */
+    const uint8_t *peek(uint8_t *len);
+    void release();
+    /** Send an OUT report to the device (non-blocking).
+     *
+     *  @return The number of bytes written or 0 if the socket is full.
+     */
+    uint8_t write(const void *buf, uint8_t len);
+    /** Issue a GET_REPORT(Feature) request and wait for the reply. IN
+     *  reports arriving in the meantime are kept for read() as long as
+     *  there is room.
+     *
+     *  @param Report ID.
+     *  @param Buffer for the report.
+     *  @param Size of the buffer (used as wLength).
+     *  @param Timeout in ms.
+     *  @return The number of bytes received or -1 on stall or timeout.
+     */
+    int getFeature(uint8_t id, void *buf, uint8_t len, uint32_t timeout=100);
+    /** Issue a SET_REPORT(Feature) request and wait for the reply.
+     *
+     *  @return The number of bytes sent or -1 on stall or timeout.
+     */
+    int setFeature(uint8_t id, const void *buf, uint8_t len, uint32_t timeout=100);
+
+private:
+    int fill();
+    int request(bool set, uint8_t id, void *buf, uint8_t len, uint32_t timeout);
+    int sock;
+    uint8_t maxBatch;
+    uint8_t batch[RX_SLOTS][TransportSocket::FRAME_SIZE];
+    uint8_t batchLen[RX_SLOTS];
+    // Next frame to hand out and number of frames in the batch
+    uint8_t batchHead;
+    uint8_t batchCount;
+};
+
+#endif // RDS4_LINUX
+
 } // namespace ds4
 } // namespace rds4
@@ -0,0 +1,629 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** TransportFFS.cpp
+ *  FunctionFS (USB gadget) transport back-end for Linux.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "Transport.hpp"
+#include "ReportDescriptor.hpp"
+#include "utils/utils.hpp"
+
+#if defined(RDS4_LINUX)
+
+#include <cerrno>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <linux/aio_abi.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/functionfs.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+// glibc has no wrappers for the kernel AIO syscalls
+static inline int io_setup(unsigned nr, aio_context_t *ctx) {
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static inline int io_destroy(aio_context_t ctx) {
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp) {
+    return syscall(__NR_io_submit, ctx, nr, iocbpp);
+}
+
+static inline int io_getevents(aio_context_t ctx, long min_nr, long max_nr, struct io_event *events, struct timespec *timeout) {
+    return syscall(__NR_io_getevents, ctx, min_nr, max_nr, events, timeout);
+}
+
+// HID class
+static const uint8_t HID_DT_HID = 0x21;
+static const uint8_t HID_DT_REPORT = 0x22;
+static const uint8_t HID_REQ_GET_REPORT = 0x01;
+static const uint8_t HID_REQ_GET_IDLE = 0x02;
+static const uint8_t HID_REQ_GET_PROTOCOL = 0x03;
+static const uint8_t HID_REQ_SET_REPORT = 0x09;
+static const uint8_t HID_REQ_SET_IDLE = 0x0a;
+static const uint8_t HID_REQ_SET_PROTOCOL = 0x0b;
+
+// aio_data tags
+static const uint64_t TAG_TX = 0x100;
+static const uint64_t TAG_RX = 0x200;
+
+struct HIDDescriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdHID;
+    uint8_t bCountryCode;
+    uint8_t bNumDescriptors;
+    uint8_t bReportDescriptorType;
+    uint16_t wReportDescriptorLength;
+} __attribute__((packed));
+
+struct DS4InterfaceDescriptors {
+    struct usb_interface_descriptor intf;
+    HIDDescriptor hid;
+    struct usb_endpoint_descriptor_no_audio in;
+    struct usb_endpoint_descriptor_no_audio out;
+} __attribute__((packed));
+
+struct DS4FunctionDescriptors {
+    struct usb_functionfs_descs_head_v2 header;
+    uint32_t fsCount;
+    uint32_t hsCount;
+    DS4InterfaceDescriptors fs;
+    DS4InterfaceDescriptors hs;
+} __attribute__((packed));
+
+struct DS4FunctionStrings {
+    struct usb_functionfs_strings_head header;
+    uint16_t lang;
+    char interface[sizeof("DS4")];
+} __attribute__((packed));
+
+/** Fill in the interface descriptors for one speed.
+ *
+ *  @param The descriptors.
+ *  @param bInterval (in frames for FS, 2^(n-1) microframes for HS).
+ */
+static void fillInterface(DS4InterfaceDescriptors *d, uint8_t interval) {
+    d->intf.bLength = sizeof(d->intf);
+    d->intf.bDescriptorType = USB_DT_INTERFACE;
+    d->intf.bNumEndpoints = 2;
+    d->intf.bInterfaceClass = USB_CLASS_HID;
+    d->intf.iInterface = 1;
+    d->hid.bLength = sizeof(d->hid);
+    d->hid.bDescriptorType = HID_DT_HID;
+    d->hid.bcdHID = htole16(0x0111);
+    d->hid.bNumDescriptors = 1;
+    d->hid.bReportDescriptorType = HID_DT_REPORT;
+    d->hid.wReportDescriptorLength = htole16(REPORT_DESCRIPTOR_SIZE);
+    d->in.bLength = sizeof(d->in);
+    d->in.bDescriptorType = USB_DT_ENDPOINT;
+    d->in.bEndpointAddress = 1 | USB_DIR_IN;
+    d->in.bmAttributes = USB_ENDPOINT_XFER_INT;
+    d->in.wMaxPacketSize = htole16(TransportFFS::EP_SIZE);
+    d->in.bInterval = interval;
+    d->out.bLength = sizeof(d->out);
+    d->out.bDescriptorType = USB_DT_ENDPOINT;
+    d->out.bEndpointAddress = 2 | USB_DIR_OUT;
+    d->out.bmAttributes = USB_ENDPOINT_XFER_INT;
+    d->out.wMaxPacketSize = htole16(TransportFFS::EP_SIZE);
+    d->out.bInterval = interval;
+}
+
+TransportFFS::TransportFFS(api::Authenticator *auth, const char *path, uint8_t queueDepth, api::TXPolicy policy) :
+        AuthenticationHandler(auth),
+        TXQueue(queueDepth > TX_SLOTS ? TX_SLOTS : queueDepth, policy, EP_SIZE),
+        path(path),
+        ep0(-1),
+        epIn(-1),
+        epOut(-1),
+        epoll(-1),
+        eventFD(-1),
+        aio(0),
+        enabled(false),
+        frData(nullptr),
+        frSize(0),
+        frReply{0},
+        frReplySize(0),
+        frReplied(false),
+        txBusy{false},
+        txInFlight(0),
+        txLent(0xff),
+        rxLen{0},
+        rxReady{0},
+        rxHead(0),
+        rxTail(0) { /* pass */ }
+
+TransportFFS::~TransportFFS() {
+    this->end();
+}
+
+bool TransportFFS::writeDescriptors() {
+    DS4FunctionDescriptors descs;
+    DS4FunctionStrings strings;
+    memset(&descs, 0, sizeof(descs));
+    descs.header.magic = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+    descs.header.length = htole32(sizeof(descs));
+    descs.header.flags = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+    descs.fsCount = htole32(4);
+    descs.hsCount = htole32(4);
+    // 1ms on both speeds
+    fillInterface(&descs.fs, 1);
+    fillInterface(&descs.hs, 4);
+    memset(&strings, 0, sizeof(strings));
+    strings.header.magic = htole32(FUNCTIONFS_STRINGS_MAGIC);
+    strings.header.length = htole32(sizeof(strings));
+    strings.header.str_count = htole32(1);
+    strings.header.lang_count = htole32(1);
+    strings.lang = htole16(0x0409);
+    memcpy(strings.interface, "DS4", sizeof(strings.interface));
+    if (write(this->ep0, &descs, sizeof(descs)) != sizeof(descs)) {
+        RDS4_DBG_PRINTLN("TransportFFS: cannot write descriptors");
+        return false;
+    }
+    if (write(this->ep0, &strings, sizeof(strings)) != sizeof(strings)) {
+        RDS4_DBG_PRINTLN("TransportFFS: cannot write strings");
+        return false;
+    }
+    return true;
+}
+
+void TransportFFS::begin() {
+    char name[256];
+    struct epoll_event eev;
+    if (this->ep0 >= 0) {
+        return;
+    }
+    AuthenticationHandler<TransportFFS>::begin();
+    snprintf(name, sizeof(name), "%s/ep0", this->path);
+    this->ep0 = open(name, O_RDWR | O_CLOEXEC);
+    if (this->ep0 < 0) {
+        RDS4_DBG_PRINTLN("TransportFFS: cannot open ep0");
+        return;
+    }
+    if (not this->writeDescriptors()) {
+        this->end();
+        return;
+    }
+    // Endpoint files only show up after the descriptors are written. They
+    // must be non-blocking: io_submit() on a blocking one waits for the
+    // endpoint to be enabled, which could be forever after a disconnect.
+    snprintf(name, sizeof(name), "%s/ep1", this->path);
+    this->epIn = open(name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    snprintf(name, sizeof(name), "%s/ep2", this->path);
+    this->epOut = open(name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    this->eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    this->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epIn < 0 or this->epOut < 0 or this->eventFD < 0 or this->epoll < 0) {
+        RDS4_DBG_PRINTLN("TransportFFS: setup failed");
+        this->end();
+        return;
+    }
+    // Events are only read from ep0 once epoll says so
+    fcntl(this->ep0, F_SETFL, fcntl(this->ep0, F_GETFL) | O_NONBLOCK);
+    memset(&eev, 0, sizeof(eev));
+    eev.events = EPOLLIN;
+    eev.data.fd = this->ep0;
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->ep0, &eev);
+    eev.data.fd = this->eventFD;
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->eventFD, &eev);
+}
+
+void TransportFFS::end() {
+    this->disable();
+    int *fds[] = {&(this->epIn), &(this->epOut), &(this->ep0), &(this->eventFD), &(this->epoll)};
+    for (auto fd : fds) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+bool TransportFFS::enable() {
+    if (this->enabled) {
+        return true;
+    }
+    this->aio = 0;
+    if (io_setup(TransportFFS::TX_SLOTS + TransportFFS::RX_SLOTS, reinterpret_cast<aio_context_t *>(&(this->aio))) != 0) {
+        RDS4_DBG_PRINTLN("TransportFFS: io_setup failed");
+        return false;
+    }
+    this->enabled = true;
+    for (uint8_t i=0; i<TransportFFS::RX_SLOTS; i++) {
+        this->submitRx(i);
+    }
+    return true;
+}
+
+void TransportFFS::disable() {
+    if (not this->enabled) {
+        return;
+    }
+    // Cancels and waits for everything in flight
+    io_destroy(this->aio);
+    this->aio = 0;
+    this->enabled = false;
+    for (auto &busy : this->txBusy) {
+        busy = false;
+    }
+    this->txInFlight = 0;
+    this->txLent = 0xff;
+    this->rxHead = 0;
+    this->rxTail = 0;
+}
+
+bool TransportFFS::submitRx(uint8_t slot) {
+    struct iocb cb;
+    struct iocb *cbs[1] = {&cb};
+    memset(&cb, 0, sizeof(cb));
+    cb.aio_fildes = this->epOut;
+    cb.aio_lio_opcode = IOCB_CMD_PREAD;
+    cb.aio_buf = reinterpret_cast<uintptr_t>(this->rxBuf[slot]);
+    cb.aio_nbytes = TransportFFS::EP_SIZE;
+    cb.aio_flags = IOCB_FLAG_RESFD;
+    cb.aio_resfd = this->eventFD;
+    cb.aio_data = TAG_RX | slot;
+    return io_submit(this->aio, 1, cbs) == 1;
+}
+
+int TransportFFS::poll(int timeout) {
+    struct epoll_event eev;
+    int nfds;
+    if (this->epoll < 0) {
+        return -1;
+    }
+    nfds = epoll_wait(this->epoll, &eev, 1, timeout);
+    if (nfds < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    return nfds == 0 ? 0 : this->dispatch();
+}
+
+int TransportFFS::dispatch() {
+    int ep0Events, completions;
+    if (this->ep0 < 0) {
+        return -1;
+    }
+    ep0Events = this->handleEP0();
+    completions = this->handleCompletions();
+    if (ep0Events < 0 or completions < 0) {
+        return -1;
+    }
+    return ep0Events + completions;
+}
+
+int TransportFFS::handleEP0() {
+    struct usb_functionfs_event events[4];
+    int handled = 0;
+    for (;;) {
+        auto actual = read(this->ep0, events, sizeof(events));
+        if (actual < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN or errno == EWOULDBLOCK) ? handled : -1;
+        }
+        for (size_t i=0; i<actual / sizeof(events[0]); i++) {
+            switch (events[i].type) {
+                case FUNCTIONFS_ENABLE:
+                    RDS4_DBG_PRINTLN("TransportFFS: enable");
+                    this->enable();
+                    break;
+                case FUNCTIONFS_DISABLE:
+                case FUNCTIONFS_UNBIND:
+                    RDS4_DBG_PRINTLN("TransportFFS: disable");
+                    this->disable();
+                    break;
+                case FUNCTIONFS_SETUP:
+                    this->handleSetup(&(events[i].u.setup));
+                    break;
+                default:
+                    break;
+            }
+            handled++;
+        }
+    }
+}
+
+int TransportFFS::handleCompletions() {
+    struct io_event events[TransportFFS::TX_SLOTS + TransportFFS::RX_SLOTS];
+    struct timespec zero = {0, 0};
+    uint64_t count;
+    int handled = 0, nr;
+    // Clear the eventfd before reaping so no completion gets lost
+    if (read(this->eventFD, &count, sizeof(count)) != sizeof(count) or not this->enabled) {
+        return 0;
+    }
+    while ((nr = io_getevents(this->aio, 0, sizeof(events) / sizeof(events[0]), events, &zero)) > 0) {
+        for (int i=0; i<nr; i++) {
+            uint8_t slot = events[i].data & 0xff;
+            if ((events[i].data & TAG_TX) and slot < TransportFFS::TX_SLOTS) {
+                this->txBusy[slot] = false;
+                this->txInFlight--;
+                this->notifyTXComplete();
+            } else if ((events[i].data & TAG_RX) and slot < TransportFFS::RX_SLOTS) {
+                if (events[i].res > 0) {
+                    this->rxLen[slot] = events[i].res;
+                    this->rxReady[this->rxHead & (TransportFFS::RX_SLOTS - 1)] = slot;
+                    this->rxHead++;
+                    this->notifyRX();
+                } else if (this->enabled and TransportFFS::isTransient(events[i].res)) {
+                    // Zero-length packet or a bad transfer, try again
+                    this->submitRx(slot);
+                } else {
+                    // The endpoint went away. enable() resubmits the slot
+                    // once the host brings it back.
+                    RDS4_DBG_PRINTLN("TransportFFS: RX stopped");
+                }
+            }
+        }
+        handled += nr;
+    }
+    // TX slots might have freed up
+    this->flushTX();
+    return nr < 0 ? -1 : handled;
+}
+
+bool TransportFFS::isTransient(int64_t res) {
+    switch (-res) {
+        // Endpoint disabled, host disconnected, or request cancelled
+        case ESHUTDOWN:
+        case ECONNRESET:
+        case ECANCELED:
+        case ENODEV:
+        // Non-blocking submit to a disabled endpoint
+        case EAGAIN:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void TransportFFS::stallEP0(bool in) {
+    // FunctionFS halts ep0 when the data stage is accessed in the wrong direction
+    if (in) {
+        (void) read(this->ep0, nullptr, 0);
+    } else {
+        (void) write(this->ep0, nullptr, 0);
+    }
+}
+
+void TransportFFS::handleSetup(const void *setup) {
+    auto req = static_cast<const struct usb_ctrlrequest *>(setup);
+    uint16_t value = le16toh(req->wValue);
+    uint16_t index = le16toh(req->wIndex);
+    uint16_t length = le16toh(req->wLength);
+    bool in = req->bRequestType & USB_DIR_IN;
+    uint8_t buf[256];
+    RDS4_DBG_PRINT("TransportFFS: setup req=");
+    RDS4_DBG_PHEX(req->bRequest);
+    RDS4_DBG_PRINT(" value=");
+    RDS4_DBG_PHEX(value);
+    RDS4_DBG_PRINT("\n");
+    if ((req->bRequestType & USB_TYPE_MASK) == USB_TYPE_STANDARD) {
+        if (in and req->bRequest == USB_REQ_GET_DESCRIPTOR and (value >> 8) == HID_DT_REPORT) {
+            (void) write(this->ep0, REPORT_DESCRIPTOR, length > REPORT_DESCRIPTOR_SIZE ? REPORT_DESCRIPTOR_SIZE : length);
+        } else {
+            this->stallEP0(in);
+        }
+        return;
+    }
+    if ((req->bRequestType & USB_TYPE_MASK) != USB_TYPE_CLASS) {
+        this->stallEP0(in);
+        return;
+    }
+    switch (req->bRequest) {
+        case HID_REQ_GET_REPORT:
+            this->frReplied = false;
+            if (in and this->onGetReport(value, index, length) and this->frReplied) {
+                (void) write(this->ep0, this->frReply, this->frReplySize > length ? length : this->frReplySize);
+            } else {
+                this->stallEP0(in);
+            }
+            break;
+        case HID_REQ_SET_REPORT: {
+            if (in) {
+                this->stallEP0(in);
+                break;
+            }
+            // Reading the data stage also acks the request
+            auto actual = read(this->ep0, buf, length > sizeof(buf) ? sizeof(buf) : length);
+            if (actual < 0) {
+                break;
+            }
+            this->frData = buf;
+            this->frSize = actual;
+            if (not this->onSetReport(value, index, length)) {
+                RDS4_DBG_PRINTLN("TransportFFS: SET_REPORT rejected after data stage");
+            }
+            this->frData = nullptr;
+            this->frSize = 0;
+            break;
+        }
+        case HID_REQ_SET_IDLE:
+        case HID_REQ_SET_PROTOCOL:
+            // Ack
+            (void) read(this->ep0, nullptr, 0);
+            break;
+        case HID_REQ_GET_IDLE:
+        case HID_REQ_GET_PROTOCOL:
+            // Idle rate 0 (indefinite), report protocol
+            buf[0] = (req->bRequest == HID_REQ_GET_PROTOCOL) ? 1 : 0;
+            (void) write(this->ep0, buf, length > 1 ? 1 : length);
+            break;
+        default:
+            this->stallEP0(in);
+            break;
+    }
+}
+
+bool TransportFFS::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchGetReport(value, index, length));
+}
+
+bool TransportFFS::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchSetReport(value, index, length));
+}
+
+uint8_t TransportFFS::reply(const void *buf, uint8_t len) {
+    len = len > TransportFFS::EP_SIZE ? TransportFFS::EP_SIZE : len;
+    memcpy(this->frReply, buf, len);
+    this->frReplySize = len;
+    this->frReplied = true;
+    return len;
+}
+
+uint8_t TransportFFS::check(void *buf, uint8_t len) {
+    uint8_t actual;
+    if (this->frData != nullptr) {
+        actual = len > this->frSize ? this->frSize : len;
+        memcpy(buf, this->frData, actual);
+        return actual;
+    }
+    return 0;
+}
+
+bool TransportFFS::available() {
+    return this->rxHead != this->rxTail;
+}
+
+uint8_t TransportFFS::send(const void *buf, uint8_t len) {
+    return this->queueSend(buf, len);
+}
+
+uint8_t TransportFFS::sendv(const api::ReportVec *reports, uint8_t count) {
+    return this->queueSendv(reports, count);
+}
+
+uint8_t TransportFFS::txQueued() {
+    // Nothing goes through while disabled
+    return this->enabled ? this->txInFlight : TransportFFS::TX_SLOTS;
+}
+
+bool TransportFFS::txSubmit(const void *buf, uint8_t len) {
+    uint8_t slot;
+    if (not this->enabled or len > TransportFFS::EP_SIZE or this->txInFlight >= TransportFFS::TX_SLOTS) {
+        return false;
+    }
+    for (slot = 0; slot < TransportFFS::TX_SLOTS and this->txBusy[slot]; slot++);
+    if (slot >= TransportFFS::TX_SLOTS) {
+        return false;
+    }
+    memcpy(this->txBuf[slot], buf, len);
+    return this->submitTx(slot, len);
+}
+
+bool TransportFFS::submitTx(uint8_t slot, uint8_t len) {
+    struct iocb cb;
+    struct iocb *cbs[1] = {&cb};
+    memset(&cb, 0, sizeof(cb));
+    cb.aio_fildes = this->epIn;
+    cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+    cb.aio_buf = reinterpret_cast<uintptr_t>(this->txBuf[slot]);
+    cb.aio_nbytes = len;
+    cb.aio_flags = IOCB_FLAG_RESFD;
+    cb.aio_resfd = this->eventFD;
+    cb.aio_data = TAG_TX | slot;
+    if (io_submit(this->aio, 1, cbs) != 1) {
+        this->txBusy[slot] = false;
+        return false;
+    }
+    this->txBusy[slot] = true;
+    this->txInFlight++;
+    return true;
+}
+
+void *TransportFFS::acquireTX(uint8_t len) {
+    uint8_t slot;
+    if (not this->enabled or len > TransportFFS::EP_SIZE) {
+        return nullptr;
+    }
+    if (this->txLent != 0xff) {
+        return this->txBuf[this->txLent];
+    }
+    // Anything coalesced is older and goes first
+    this->flushTX();
+    if (this->room() == 0) {
+        return nullptr;
+    }
+    for (slot = 0; slot < TransportFFS::TX_SLOTS and this->txBusy[slot]; slot++);
+    if (slot >= TransportFFS::TX_SLOTS) {
+        return nullptr;
+    }
+    // Keep txSubmit() away from it
+    this->txBusy[slot] = true;
+    this->txLent = slot;
+    return this->txBuf[slot];
+}
+
+uint8_t TransportFFS::commitTX(uint8_t len) {
+    uint8_t slot = this->txLent;
+    if (slot == 0xff) {
+        return 0;
+    }
+    this->txLent = 0xff;
+    len = len > TransportFFS::EP_SIZE ? TransportFFS::EP_SIZE : len;
+    if (not this->submitTx(slot, len)) {
+        RDS4_STAT_INC(this->stats.txFull);
+        return 0;
+    }
+    return len;
+}
+
+void TransportFFS::waitTX(uint32_t timeout) {
+    // Completions and ep0 events (e.g. ENABLE) both wake this up
+    this->poll(timeout);
+}
+
+const void *TransportFFS::borrowRX(uint8_t *len) {
+    uint8_t slot;
+    if (this->rxHead == this->rxTail) {
+        return nullptr;
+    }
+    slot = this->rxReady[this->rxTail & (TransportFFS::RX_SLOTS - 1)];
+    *len = this->rxLen[slot];
+    return this->rxBuf[slot];
+}
+
+void TransportFFS::releaseRX() {
+    uint8_t slot;
+    if (this->rxHead == this->rxTail) {
+        return;
+    }
+    slot = this->rxReady[this->rxTail & (TransportFFS::RX_SLOTS - 1)];
+    this->rxTail++;
+    // Hand the buffer back to the kernel
+    this->submitRx(slot);
+}
+
+uint8_t TransportFFS::recv(void *buf, uint8_t len) {
+    uint8_t slot, actual;
+    if (this->rxHead == this->rxTail) {
+        return 0;
+    }
+    slot = this->rxReady[this->rxTail & (TransportFFS::RX_SLOTS - 1)];
+    this->rxTail++;
+    if (this->rxLen[slot] > len) {
+        RDS4_STAT_INC(this->stats.rxTruncated);
+    }
+    actual = this->rxLen[slot] > len ? len : this->rxLen[slot];
+    memcpy(buf, this->rxBuf[slot], actual);
+    // Hand the buffer back to the kernel
+    this->submitRx(slot);
+    return actual;
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** TransportLoopback.cpp
+ *  In-process loopback transport back-end.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "Transport.hpp"
+#include "utils/utils.hpp"
+
+#if defined(RDS4_LINUX)
+
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+TransportLoopback::~TransportLoopback() {
+    if (this->txEvent >= 0) {
+        close(this->txEvent);
+    }
+}
+
+bool TransportLoopback::available() {
+    return not this->outRing.empty();
+}
+
+uint8_t TransportLoopback::txQueued() {
+    return this->inRing.size();
+}
+
+bool TransportLoopback::txSubmit(const void *buf, uint8_t len) {
+    // The lent slot is the one push() would fill. Never cut a report short.
+    if (this->txLent or len > TransportLoopback::REPORT_SIZE) {
+        return false;
+    }
+    return this->inRing.push(buf, len);
+}
+
+uint8_t TransportLoopback::send(const void *buf, uint8_t len) {
+    return this->queueSend(buf, len);
+}
+
+uint8_t TransportLoopback::sendv(const api::ReportVec *reports, uint8_t count) {
+    return this->queueSendv(reports, count);
+}
+
+void TransportLoopback::waitTX(uint32_t timeout) {
+    struct pollfd pfd;
+    uint64_t count;
+    if (this->txEvent < 0) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            sched_yield();
+            return;
+        }
+        // The host end reads it from its own thread
+        __atomic_store_n(&(this->txEvent), fd, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&(this->txWaiting), 1, __ATOMIC_SEQ_CST);
+    // The host might have taken a report before it saw the flag
+    if (this->room() == 0) {
+        pfd.fd = this->txEvent;
+        pfd.events = POLLIN;
+        ::poll(&pfd, 1, timeout);
+    }
+    __atomic_store_n(&(this->txWaiting), 0, __ATOMIC_RELAXED);
+    (void) ::read(this->txEvent, &count, sizeof(count));
+}
+
+uint8_t TransportLoopback::recv(void *buf, uint8_t len) {
+#ifndef RDS4_STATS
+    return this->outRing.pop(buf, len);
+#else
+    // Same as pop(), but sees the truncation
+    uint8_t actual;
+    auto *data = this->outRing.peek(&actual);
+    if (data == nullptr) {
+        return 0;
+    }
+    if (actual > len) {
+        RDS4_STAT_INC(this->stats.rxTruncated);
+        actual = len;
+    }
+    memcpy(buf, data, actual);
+    this->outRing.release();
+    return actual;
+#endif
+}
+
+void *TransportLoopback::acquireTX(uint8_t len) {
+    if (len > TransportLoopback::REPORT_SIZE) {
+        return nullptr;
+    }
+    if (this->txLent) {
+        return this->inRing.reserve();
+    }
+    // Anything coalesced is older and goes first
+    this->flushTX();
+    if (this->room() == 0) {
+        return nullptr;
+    }
+    auto *slot = this->inRing.reserve();
+    this->txLent = slot != nullptr;
+    return slot;
+}
+
+uint8_t TransportLoopback::commitTX(uint8_t len) {
+    if (not this->txLent) {
+        return 0;
+    }
+    this->txLent = false;
+    len = len > TransportLoopback::REPORT_SIZE ? TransportLoopback::REPORT_SIZE : len;
+    this->inRing.commit(len);
+    return len;
+}
+
+const void *TransportLoopback::borrowRX(uint8_t *len) {
+    return this->outRing.peek(len);
+}
+
+void TransportLoopback::releaseRX() {
+    this->outRing.release();
+}
+
+void TransportLoopback::update() {
+    this->dispatch();
+    // The callback reads the ring, so it must run here and not on the host
+    // thread
+    if (__atomic_exchange_n(&(this->rxPending), 0, __ATOMIC_ACQUIRE)) {
+        this->notifyRX();
+    }
+    this->flushTX();
+    AuthenticationHandler<TransportLoopback>::update();
+}
+
+bool TransportLoopback::dispatch() {
+    uint8_t expected = TransportLoopback::CTL_REQUEST;
+    // Claim the request so the host can't withdraw it while it's being served
+    if (not __atomic_compare_exchange_n(&(this->ctlState), &expected, TransportLoopback::CTL_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    if (this->ctlSet) {
+        this->ctlResult = this->onSetReport(this->ctlValue, this->ctlIndex, this->ctlLength);
+    } else {
+        this->ctlSize = 0;
+        this->ctlResult = this->onGetReport(this->ctlValue, this->ctlIndex, this->ctlLength);
+    }
+    __atomic_store_n(&(this->ctlState), TransportLoopback::CTL_DONE, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool TransportLoopback::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchGetReport(value, index, length));
+}
+
+bool TransportLoopback::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchSetReport(value, index, length));
+}
+
+uint8_t TransportLoopback::reply(const void *buf, uint8_t len) {
+    uint8_t limit = this->ctlLength > sizeof(this->ctlData) ? sizeof(this->ctlData) : this->ctlLength;
+    len = len > limit ? limit : len;
+    memcpy(this->ctlData, buf, len);
+    this->ctlSize = len;
+    return len;
+}
+
+uint8_t TransportLoopback::check(void *buf, uint8_t len) {
+    len = len > this->ctlSize ? this->ctlSize : len;
+    memcpy(buf, this->ctlData, len);
+    return len;
+}
+
+uint8_t LoopbackHost::read(void *buf, uint8_t len) {
+    auto actual = this->device->inRing.pop(buf, len);
+    if (actual != 0) {
+        this->onTaken();
+    }
+    return actual;
+}
+
+const uint8_t *LoopbackHost::peek(uint8_t *len) {
+    return this->device->inRing.peek(len);
+}
+
+void LoopbackHost::release() {
+    this->device->inRing.release();
+    this->onTaken();
+}
+
+void LoopbackHost::onTaken() {
+    auto *dev = this->device;
+    uint64_t one = 1;
+    int fd;
+    dev->notifyTXComplete();
+    // Pairs with the flag store and room check in waitTX()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(dev->txWaiting), __ATOMIC_RELAXED)) {
+        fd = __atomic_load_n(&(dev->txEvent), __ATOMIC_ACQUIRE);
+        if (fd >= 0) {
+            (void) ::write(fd, &one, sizeof(one));
+        }
+    }
+}
+
+uint8_t LoopbackHost::write(const void *buf, uint8_t len) {
+    if (not this->device->outRing.push(buf, len)) {
+        RDS4_STAT_INC(this->device->stats.rxDropped);
+        return 0;
+    }
+    __atomic_store_n(&(this->device->rxPending), 1, __ATOMIC_RELEASE);
+    return len > TransportLoopback::REPORT_SIZE ? TransportLoopback::REPORT_SIZE : len;
+}
+
+int LoopbackHost::getFeature(uint8_t id, void *buf, uint8_t len, uint32_t timeout) {
+    return this->request(false, id, buf, len, timeout);
+}
+
+int LoopbackHost::setFeature(uint8_t id, const void *buf, uint8_t len, uint32_t timeout) {
+    return this->request(true, id, const_cast<void *>(buf), len, timeout);
+}
+
+int LoopbackHost::request(bool set, uint8_t id, void *buf, uint8_t len, uint32_t timeout) {
+    auto *dev = this->device;
+    uint32_t begin = millis();
+    int result;
+    if (__atomic_load_n(&(dev->ctlState), __ATOMIC_ACQUIRE) != TransportLoopback::CTL_IDLE) {
+        return -1;
+    }
+    len = len > sizeof(dev->ctlData) ? sizeof(dev->ctlData) : len;
+    dev->ctlSet = set;
+    dev->ctlValue = (0x03 << 8) | id;
+    dev->ctlIndex = 0;
+    dev->ctlLength = len;
+    if (set) {
+        memcpy(dev->ctlData, buf, len);
+        dev->ctlSize = len;
+    }
+    __atomic_store_n(&(dev->ctlState), TransportLoopback::CTL_REQUEST, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&(dev->ctlState), __ATOMIC_ACQUIRE) != TransportLoopback::CTL_DONE) {
+        if (millis() - begin > timeout) {
+            uint8_t expected = TransportLoopback::CTL_REQUEST;
+            // Withdraw the request unless the device already picked it up
+            if (__atomic_compare_exchange_n(&(dev->ctlState), &expected, TransportLoopback::CTL_IDLE, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return -1;
+            }
+        }
+        sched_yield();
+    }
+    if (not dev->ctlResult) {
+        result = -1;
+    } else if (set) {
+        result = len;
+    } else {
+        memcpy(buf, dev->ctlData, dev->ctlSize);
+        result = dev->ctlSize;
+    }
+    __atomic_store_n(&(dev->ctlState), TransportLoopback::CTL_IDLE, __ATOMIC_RELEASE);
+    return result;
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
@@ -0,0 +1,616 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** TransportSocket.cpp
+ *  Unix domain socket (IPC) transport back-end for Linux.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "Transport.hpp"
+#include "utils/utils.hpp"
+
+#if defined(RDS4_LINUX)
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+// Never block and never raise SIGPIPE
+static const int SOCKET_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+// Time allowed for frames that must not be dropped (ms)
+static const int FRAME_TIMEOUT = 100;
+// Type, status and report ID
+static const uint8_t REPLY_HEADER_SIZE = 3;
+
+static bool makeAddress(const char *path, struct sockaddr_un *addr) {
+    size_t len = strlen(path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (len >= sizeof(addr->sun_path)) {
+        return false;
+    }
+    memcpy(addr->sun_path, path, len);
+    return true;
+}
+
+/** Send one frame, waiting for room if the socket is full.
+ *
+ *  @return `true` if the frame was sent.
+ */
+static bool sendFrame(int sock, const void *frame, size_t len, int timeout) {
+    struct pollfd pfd;
+    for (;;) {
+        auto actual = ::send(sock, frame, len, SOCKET_FLAGS);
+        if (actual >= 0) {
+            return actual == static_cast<ssize_t>(len);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN and errno != EWOULDBLOCK) {
+            return false;
+        }
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if (::poll(&pfd, 1, timeout) <= 0) {
+            return false;
+        }
+    }
+}
+
+TransportSocket::TransportSocket(api::Authenticator *auth, const char *path, uint8_t queueDepth, api::TXPolicy policy) :
+        AuthenticationHandler(auth),
+        TXQueue(queueDepth > TX_SLOTS ? TX_SLOTS : queueDepth, policy, REPORT_SIZE),
+        path(path),
+        sock(-1),
+        corked(false),
+        maxBatch(TX_SLOTS),
+        txLen{0},
+        txHead(0),
+        txTail(0),
+        txLent(false),
+        rxLen{0},
+        rxHead(0),
+        rxTail(0),
+        frData(nullptr),
+        frSize(0),
+        frReply{0},
+        frReplySize(0) { /* pass */ }
+
+TransportSocket::~TransportSocket() {
+    this->end();
+}
+
+void TransportSocket::begin() {
+    struct sockaddr_un addr;
+    int fd;
+    if (this->sock >= 0 or this->path == nullptr) {
+        return;
+    }
+    if (not makeAddress(this->path, &addr)) {
+        RDS4_DBG_PRINTLN("TransportSocket: path too long");
+        return;
+    }
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        RDS4_DBG_PRINTLN("TransportSocket: cannot create socket");
+        return;
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        RDS4_DBG_PRINTLN("TransportSocket: cannot connect");
+        close(fd);
+        return;
+    }
+    this->begin(fd);
+}
+
+void TransportSocket::begin(int fd) {
+    int size = TransportSocket::SOCKET_BUFFER;
+    this->end();
+    AuthenticationHandler<TransportSocket>::begin();
+    // Reports that can't go out should wait in the TX queue, not in the kernel
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    this->sock = fd;
+    this->txHead = 0;
+    this->txTail = 0;
+    this->txLent = false;
+    this->rxHead = 0;
+    this->rxTail = 0;
+}
+
+void TransportSocket::end() {
+    if (this->sock >= 0) {
+        close(this->sock);
+        this->sock = -1;
+    }
+}
+
+int TransportSocket::poll(int timeout) {
+    struct pollfd pfd;
+    int nfds;
+    if (this->sock < 0) {
+        return -1;
+    }
+    pfd.fd = this->sock;
+    pfd.events = POLLIN;
+    // Corking doesn't help once the queue is full
+    if (this->txHead != this->txTail and (not this->corked or this->room() == 0)) {
+        pfd.events |= POLLOUT;
+    }
+    nfds = ::poll(&pfd, 1, timeout);
+    if (nfds < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    return nfds == 0 ? 0 : this->dispatch();
+}
+
+int TransportSocket::dispatch() {
+    struct mmsghdr msgs[TransportSocket::RX_SLOTS];
+    struct iovec iov[TransportSocket::RX_SLOTS];
+    uint8_t count = this->maxBatch > TransportSocket::RX_SLOTS ? TransportSocket::RX_SLOTS : this->maxBatch;
+    int handled = 0, nr;
+    if (this->sock < 0) {
+        return -1;
+    }
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (uint8_t i=0; i<count; i++) {
+            iov[i].iov_base = this->rxBatch[i];
+            iov[i].iov_len = TransportSocket::FRAME_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        nr = recvmmsg(this->sock, msgs, count, MSG_DONTWAIT, nullptr);
+        if (nr < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                break;
+            }
+            this->end();
+            return -1;
+        }
+        for (int i=0; i<nr; i++) {
+            // Frames are never empty, so this is the host hanging up
+            if (msgs[i].msg_len == 0) {
+                RDS4_DBG_PRINTLN("TransportSocket: host hung up");
+                this->end();
+                return -1;
+            }
+            this->handleFrame(this->rxBatch[i], msgs[i].msg_len > TransportSocket::FRAME_SIZE ? TransportSocket::FRAME_SIZE : msgs[i].msg_len);
+        }
+        handled += nr;
+        if (nr < count) {
+            break;
+        }
+    }
+    if (not this->corked or this->room() == 0) {
+        this->flush();
+    }
+    return handled;
+}
+
+void TransportSocket::handleFrame(const uint8_t *frame, uint8_t len) {
+    bool ok;
+    switch (static_cast<SocketFrame>(frame[0])) {
+        case SocketFrame::OUTPUT: {
+            if (len < 2) {
+                break;
+            }
+            // Drop the oldest report if the queue is full
+            if (static_cast<uint8_t>(this->rxHead - this->rxTail) >= TransportSocket::RX_SLOTS) {
+                RDS4_STAT_INC(this->stats.rxDropped);
+                this->rxTail++;
+            }
+            auto slot = this->rxHead & (TransportSocket::RX_SLOTS - 1);
+            this->rxLen[slot] = len - 1 > TransportSocket::REPORT_SIZE ? TransportSocket::REPORT_SIZE : len - 1;
+            memcpy(this->rxBuf[slot], &frame[1], this->rxLen[slot]);
+            this->rxHead++;
+            this->notifyRX();
+            break;
+        }
+        case SocketFrame::GET_FEATURE:
+            if (len < 4) {
+                break;
+            }
+            this->frReplySize = 0;
+            this->frReply[2] = frame[1];
+            ok = this->onGetReport((0x03 << 8) | frame[1], 0, frame[2] | (frame[3] << 8));
+            this->sendReply(ok);
+            break;
+        case SocketFrame::SET_FEATURE:
+            if (len < 2) {
+                break;
+            }
+            this->frData = &frame[2];
+            this->frSize = len - 2;
+            this->frReplySize = 0;
+            this->frReply[2] = frame[1];
+            ok = this->onSetReport((0x03 << 8) | frame[1], 0, this->frSize);
+            this->frData = nullptr;
+            this->frSize = 0;
+            this->sendReply(ok);
+            break;
+        default:
+            RDS4_DBG_PRINT("TransportSocket: unknown frame ");
+            RDS4_DBG_PHEX(frame[0]);
+            RDS4_DBG_PRINT("\n");
+            break;
+    }
+}
+
+bool TransportSocket::sendReply(bool ok) {
+    this->frReply[0] = static_cast<uint8_t>(SocketFrame::REPLY);
+    this->frReply[1] = ok ? 0 : 1;
+    return sendFrame(this->sock, this->frReply, REPLY_HEADER_SIZE + (ok ? this->frReplySize : 0), FRAME_TIMEOUT);
+}
+
+void TransportSocket::update() {
+    this->dispatch();
+    this->flush();
+    AuthenticationHandler<TransportSocket>::update();
+}
+
+bool TransportSocket::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchGetReport(value, index, length));
+}
+
+bool TransportSocket::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchSetReport(value, index, length));
+}
+
+uint8_t TransportSocket::reply(const void *buf, uint8_t len) {
+    len = len > TransportSocket::FRAME_SIZE - REPLY_HEADER_SIZE ? TransportSocket::FRAME_SIZE - REPLY_HEADER_SIZE : len;
+    memcpy(&(this->frReply[REPLY_HEADER_SIZE]), buf, len);
+    this->frReplySize = len;
+    return len;
+}
+
+uint8_t TransportSocket::check(void *buf, uint8_t len) {
+    uint8_t actual;
+    if (this->frData != nullptr) {
+        actual = len > this->frSize ? this->frSize : len;
+        memcpy(buf, this->frData, actual);
+        return actual;
+    }
+    return 0;
+}
+
+bool TransportSocket::available() {
+    return this->rxHead != this->rxTail;
+}
+
+uint8_t TransportSocket::send(const void *buf, uint8_t len) {
+    len = this->queueSend(buf, len);
+    if (not this->corked) {
+        this->flush();
+    }
+    return len;
+}
+
+uint8_t TransportSocket::sendv(const api::ReportVec *reports, uint8_t count) {
+    count = this->queueSendv(reports, count);
+    if (not this->corked) {
+        this->flush();
+    }
+    return count;
+}
+
+uint8_t TransportSocket::txQueued() {
+    // Nothing goes through while disconnected
+    return this->sock >= 0 ? static_cast<uint8_t>(this->txHead - this->txTail) : TransportSocket::TX_SLOTS;
+}
+
+bool TransportSocket::txSubmit(const void *buf, uint8_t len) {
+    uint8_t slot;
+    if (this->sock < 0 or this->txLent or static_cast<uint8_t>(this->txHead - this->txTail) >= TransportSocket::TX_SLOTS) {
+        return false;
+    }
+    // Never cut a report short
+    if (len > TransportSocket::REPORT_SIZE) {
+        return false;
+    }
+    slot = this->txHead & (TransportSocket::TX_SLOTS - 1);
+    this->txBuf[slot][0] = static_cast<uint8_t>(SocketFrame::INPUT);
+    memcpy(&(this->txBuf[slot][1]), buf, len);
+    this->txLen[slot] = len + 1;
+    this->txHead++;
+    return true;
+}
+
+bool TransportSocket::flush() {
+    struct mmsghdr msgs[TransportSocket::TX_SLOTS];
+    struct iovec iov[TransportSocket::TX_SLOTS];
+    if (this->sock < 0) {
+        return false;
+    }
+    do {
+        while (this->txHead != this->txTail) {
+            uint8_t count = this->txHead - this->txTail;
+            int sent;
+            count = count > this->maxBatch ? this->maxBatch : count;
+            memset(msgs, 0, sizeof(msgs[0]) * count);
+            for (uint8_t i=0; i<count; i++) {
+                uint8_t slot = (this->txTail + i) & (TransportSocket::TX_SLOTS - 1);
+                iov[i].iov_base = this->txBuf[slot];
+                iov[i].iov_len = this->txLen[slot];
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            sent = sendmmsg(this->sock, msgs, count, SOCKET_FLAGS);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN and errno != EWOULDBLOCK) {
+                    RDS4_DBG_PRINTLN("TransportSocket: send failed");
+                    this->end();
+                }
+                return false;
+            }
+            this->txTail += sent;
+            // The host can't be tracked any further than the socket
+            for (int i=0; i<sent; i++) {
+                this->notifyTXComplete();
+            }
+            if (sent < count) {
+                // Socket is full
+                return false;
+            }
+        }
+        // The coalesced report can go in now
+    } while (this->flushTX());
+    return true;
+}
+
+void TransportSocket::waitTX(uint32_t timeout) {
+    struct pollfd pfd;
+    if (this->sock < 0) {
+        return;
+    }
+    // Even when corked. Whoever waits for room wants the reports out.
+    if (this->flush() or this->room() != 0) {
+        return;
+    }
+    pfd.fd = this->sock;
+    pfd.events = POLLOUT;
+    ::poll(&pfd, 1, timeout);
+    this->flush();
+}
+
+void *TransportSocket::acquireTX(uint8_t len) {
+    uint8_t *slot;
+    if (this->sock < 0 or len > TransportSocket::REPORT_SIZE) {
+        return nullptr;
+    }
+    slot = this->txBuf[this->txHead & (TransportSocket::TX_SLOTS - 1)];
+    if (this->txLent) {
+        return &slot[1];
+    }
+    // Anything coalesced is older and goes first
+    this->flushTX();
+    if (this->room() == 0) {
+        return nullptr;
+    }
+    this->txLent = true;
+    return &slot[1];
+}
+
+uint8_t TransportSocket::commitTX(uint8_t len) {
+    uint8_t slot = this->txHead & (TransportSocket::TX_SLOTS - 1);
+    if (not this->txLent) {
+        return 0;
+    }
+    this->txLent = false;
+    len = len > TransportSocket::REPORT_SIZE ? TransportSocket::REPORT_SIZE : len;
+    this->txBuf[slot][0] = static_cast<uint8_t>(SocketFrame::INPUT);
+    this->txLen[slot] = len + 1;
+    this->txHead++;
+    if (not this->corked) {
+        this->flush();
+    }
+    return len;
+}
+
+const void *TransportSocket::borrowRX(uint8_t *len) {
+    uint8_t slot;
+    if (this->rxHead == this->rxTail) {
+        return nullptr;
+    }
+    slot = this->rxTail & (TransportSocket::RX_SLOTS - 1);
+    *len = this->rxLen[slot];
+    return this->rxBuf[slot];
+}
+
+void TransportSocket::releaseRX() {
+    if (this->rxHead != this->rxTail) {
+        this->rxTail++;
+    }
+}
+
+uint8_t TransportSocket::recv(void *buf, uint8_t len) {
+    uint8_t slot, actual;
+    if (this->rxHead == this->rxTail) {
+        return 0;
+    }
+    slot = this->rxTail & (TransportSocket::RX_SLOTS - 1);
+    if (this->rxLen[slot] > len) {
+        RDS4_STAT_INC(this->stats.rxTruncated);
+    }
+    actual = this->rxLen[slot] > len ? len : this->rxLen[slot];
+    memcpy(buf, this->rxBuf[slot], actual);
+    this->rxTail++;
+    return actual;
+}
+
+SocketHost::SocketHost(int fd) : sock(fd), maxBatch(RX_SLOTS), batchLen{0}, batchHead(0), batchCount(0) { /* pass */ }
+
+SocketHost::~SocketHost() {
+    if (this->sock >= 0) {
+        close(this->sock);
+    }
+}
+
+int SocketHost::listen(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+    if (not makeAddress(path, &addr)) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 or ::listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int SocketHost::fill() {
+    struct mmsghdr msgs[SocketHost::RX_SLOTS];
+    struct iovec iov[SocketHost::RX_SLOTS];
+    int nr;
+    this->batchHead = 0;
+    this->batchCount = 0;
+    memset(msgs, 0, sizeof(msgs[0]) * this->maxBatch);
+    for (uint8_t i=0; i<this->maxBatch; i++) {
+        iov[i].iov_base = this->batch[i];
+        iov[i].iov_len = TransportSocket::FRAME_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    do {
+        nr = recvmmsg(this->sock, msgs, this->maxBatch, MSG_DONTWAIT, nullptr);
+    } while (nr < 0 and errno == EINTR);
+    for (int i=0; i<nr; i++) {
+        this->batchLen[i] = msgs[i].msg_len > TransportSocket::FRAME_SIZE ? TransportSocket::FRAME_SIZE : msgs[i].msg_len;
+    }
+    this->batchCount = nr > 0 ? nr : 0;
+    return nr;
+}
+
+const uint8_t *SocketHost::peek(uint8_t *len) {
+    for (;;) {
+        if (this->batchHead == this->batchCount and this->fill() <= 0) {
+            return nullptr;
+        }
+        // The device hung up
+        if (this->batchLen[this->batchHead] == 0) {
+            this->batchCount = 0;
+            return nullptr;
+        }
+        // Skip anything but IN reports (e.g. replies that came in too late)
+        if (this->batchLen[this->batchHead] > 1 and this->batch[this->batchHead][0] == static_cast<uint8_t>(SocketFrame::INPUT)) {
+            *len = this->batchLen[this->batchHead] - 1;
+            return &(this->batch[this->batchHead][1]);
+        }
+        this->batchHead++;
+    }
+}
+
+void SocketHost::release() {
+    if (this->batchHead < this->batchCount) {
+        this->batchHead++;
+    }
+}
+
+uint8_t SocketHost::read(void *buf, uint8_t len) {
+    uint8_t actual;
+    auto *report = this->peek(&actual);
+    if (report == nullptr) {
+        return 0;
+    }
+    actual = actual > len ? len : actual;
+    memcpy(buf, report, actual);
+    this->release();
+    return actual;
+}
+
+uint8_t SocketHost::write(const void *buf, uint8_t len) {
+    uint8_t frame[TransportSocket::FRAME_SIZE];
+    len = len > TransportSocket::REPORT_SIZE ? TransportSocket::REPORT_SIZE : len;
+    frame[0] = static_cast<uint8_t>(SocketFrame::OUTPUT);
+    memcpy(&frame[1], buf, len);
+    return ::send(this->sock, frame, len + 1, SOCKET_FLAGS) == len + 1 ? len : 0;
+}
+
+int SocketHost::getFeature(uint8_t id, void *buf, uint8_t len, uint32_t timeout) {
+    return this->request(false, id, buf, len, timeout);
+}
+
+int SocketHost::setFeature(uint8_t id, const void *buf, uint8_t len, uint32_t timeout) {
+    return this->request(true, id, const_cast<void *>(buf), len, timeout);
+}
+
+int SocketHost::request(bool set, uint8_t id, void *buf, uint8_t len, uint32_t timeout) {
+    uint8_t frame[TransportSocket::FRAME_SIZE];
+    uint32_t begin = millis();
+    struct pollfd pfd;
+    len = len > TransportSocket::FRAME_SIZE - REPLY_HEADER_SIZE ? TransportSocket::FRAME_SIZE - REPLY_HEADER_SIZE : len;
+    frame[1] = id;
+    if (set) {
+        frame[0] = static_cast<uint8_t>(SocketFrame::SET_FEATURE);
+        memcpy(&frame[2], buf, len);
+    } else {
+        frame[0] = static_cast<uint8_t>(SocketFrame::GET_FEATURE);
+        frame[2] = len;
+        frame[3] = 0;
+    }
+    if (not sendFrame(this->sock, frame, set ? len + 2 : 4, timeout)) {
+        return -1;
+    }
+    for (;;) {
+        uint32_t elapsed = millis() - begin;
+        ssize_t actual;
+        if (elapsed >= timeout) {
+            return -1;
+        }
+        pfd.fd = this->sock;
+        pfd.events = POLLIN;
+        if (::poll(&pfd, 1, timeout - elapsed) < 0 and errno != EINTR) {
+            return -1;
+        }
+        actual = ::recv(this->sock, frame, sizeof(frame), MSG_DONTWAIT);
+        if (actual < 0) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (actual == 0) {
+            // Hung up
+            return -1;
+        }
+        if (frame[0] == static_cast<uint8_t>(SocketFrame::INPUT)) {
+            // Keep it for read() if there is room
+            if (this->batchCount < SocketHost::RX_SLOTS) {
+                memcpy(this->batch[this->batchCount], frame, actual);
+                this->batchLen[this->batchCount] = actual;
+                this->batchCount++;
+            }
+        } else if (frame[0] == static_cast<uint8_t>(SocketFrame::REPLY) and actual >= REPLY_HEADER_SIZE and frame[2] == id) {
+            if (frame[1] != 0) {
+                return -1;
+            } else if (set) {
+                return len;
+            }
+            actual -= REPLY_HEADER_SIZE;
+            actual = actual > len ? len : actual;
+            memcpy(buf, &frame[REPLY_HEADER_SIZE], actual);
+            return actual;
+        }
+    }
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
@@ -15,11 +15,8 @@
 
 // These should be in sync with the DS4 stub
 static const uint8_t TX_ENDPOINT = 1;
-static const uint8_t TX_SIZE = 64;
 static const uint8_t RX_ENDPOINT = 2;
 
-static const uint8_t MAX_PACKETS = 2;
-
 namespace rds4 {
 namespace ds4 {
 
@@ -56,15 +53,11 @@ int TransportTeensy::frCallbackSet(void *setup_ptr, uint8_t *data) {
 }
 
 bool TransportTeensy::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
-    bool result = false;
-    // Report error if nobody responds to the request and return true as soon as somebody responds.
-    result = FeatureConfigurator<TransportTeensy>::onGetReport(value, index, length) or \
-             AuthenticationHandler<TransportTeensy>::onGetReport(value, index, length);
-    return result;
+    return this->featureDone(this->dispatchGetReport(value, index, length));
 }
 
 bool TransportTeensy::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
-    return AuthenticationHandler<TransportTeensy>::onSetReport(value, index, length);
+    return this->featureDone(this->dispatchSetReport(value, index, length));
 }
 
 bool TransportTeensy::available() {
@@ -78,58 +71,140 @@ bool TransportTeensy::available() {
     }
 }
 
-uint8_t TransportTeensy::send(const void *buf, uint8_t len) {
-    usb_packet_t *pkt = NULL;
-
+uint8_t TransportTeensy::txQueued() {
+    uint32_t queued;
     // make sure the USB is initialized
-    if (!usb_configuration) return 0;
-    // check for queued packets
-    if (usb_tx_packet_count(TX_ENDPOINT) < MAX_PACKETS) {
-        pkt = usb_malloc();
-        if (pkt) {
-            memcpy(pkt->buf, buf, len);
-            pkt->len = len;
-            usb_tx(TX_ENDPOINT, pkt);
-            return len;
-        } else {
-            return 0;
-        }
+    if (!usb_configuration) return 0xff;
+    queued = usb_tx_packet_count(TX_ENDPOINT);
+    return queued > 0xff ? 0xff : queued;
+}
+
+bool TransportTeensy::txSubmit(const void *buf, uint8_t len) {
+    usb_packet_t *pkt;
+    if (len > TX_SIZE) {
+        return false;
     }
-    return 0;
+    pkt = usb_malloc();
+    if (pkt) {
+        memcpy(pkt->buf, buf, len);
+        pkt->len = len;
+        usb_tx(TX_ENDPOINT, pkt);
+        this->txLastQueued = this->txQueued();
+        return true;
+    }
+    return false;
 }
 
-uint8_t TransportTeensy::sendBlocking(const void *buf, uint8_t len) {
-    usb_packet_t *pkt = NULL;
+uint8_t TransportTeensy::send(const void *buf, uint8_t len) {
+    return this->queueSend(buf, len);
+}
+
+uint8_t TransportTeensy::sendv(const api::ReportVec *reports, uint8_t count) {
+    return this->queueSendv(reports, count);
+}
+
+uint8_t TransportTeensy::sendTimed(const void *buf, uint8_t len, uint32_t timeout) {
     uint32_t begin = millis();
+    RDS4_STAT_BEGIN(waitBegin);
 
     // Blocking send
     while (1) {
+        uint32_t elapsed;
         // make sure the USB is initialized
         if (!usb_configuration) return 0;
+        // Anything coalesced is older and goes first
+        this->flushTX();
         // check for queued packets
-        if (usb_tx_packet_count(TX_ENDPOINT) < MAX_PACKETS) {
-            if ((pkt = usb_malloc())) {
-                break;
-            }
+        if (this->txQueued() < this->txDepth and this->txSubmit(buf, len)) {
+            break;
         }
-        if (millis() - begin > 70) {
+        elapsed = millis() - begin;
+        if (elapsed >= timeout) {
             RDS4_DBG_PRINTLN("send timeout");
+            RDS4_STAT_INC(this->stats.txTimeouts);
+            RDS4_STAT_END(waitBegin, this->stats.txWait);
             return 0;
         }
-        // Make sure any on-yield tasks got executed during waiting
-        yield();
+        this->waitTX(timeout - elapsed);
     }
-    memcpy(pkt->buf, buf, len);
-    pkt->len = len;
-    usb_tx(TX_ENDPOINT, pkt);
+    RDS4_STAT_END(waitBegin, this->stats.txWait);
     return len;
 }
 
+void TransportTeensy::waitTX(uint32_t timeout) {
+    // Make sure any on-yield tasks got executed during waiting
+    yield();
+    this->pollTX();
+    // Sleep until the next interrupt. The USB interrupt fires when the host
+    // picks up a packet, and SysTick bounds the nap to 1ms either way.
+    if (this->txQueued() >= this->txDepth) {
+        __asm__ volatile ("wfi");
+    }
+}
+
+void TransportTeensy::pollTX() {
+    uint8_t queued = this->txQueued();
+    if (queued < this->txLastQueued) {
+        this->notifyTXComplete();
+    }
+    this->txLastQueued = queued;
+}
+
+void *TransportTeensy::acquireTX(uint8_t len) {
+    // make sure the USB is initialized
+    if (!usb_configuration or len > TX_SIZE) return nullptr;
+    // Anything coalesced is older and goes first
+    this->flushTX();
+    if (this->txPacket == nullptr) {
+        if (this->room() == 0) {
+            return nullptr;
+        }
+        this->txPacket = usb_malloc();
+        if (this->txPacket == nullptr) {
+            return nullptr;
+        }
+    }
+    return this->txPacket->buf;
+}
+
+uint8_t TransportTeensy::commitTX(uint8_t len) {
+    if (this->txPacket == nullptr) {
+        return 0;
+    }
+    len = len > TX_SIZE ? TX_SIZE : len;
+    this->txPacket->len = len;
+    usb_tx(TX_ENDPOINT, this->txPacket);
+    this->txPacket = nullptr;
+    this->txLastQueued = this->txQueued();
+    return len;
+}
+
+const void *TransportTeensy::borrowRX(uint8_t *len) {
+    if (this->rxPacket == nullptr) {
+        this->rxPacket = usb_rx(RX_ENDPOINT);
+        if (this->rxPacket == nullptr) {
+            return nullptr;
+        }
+    }
+    *len = this->rxPacket->len;
+    return this->rxPacket->buf;
+}
+
+void TransportTeensy::releaseRX() {
+    if (this->rxPacket != nullptr) {
+        usb_free(this->rxPacket);
+        this->rxPacket = nullptr;
+    }
+}
+
 uint8_t TransportTeensy::recv(void *buf, uint8_t len) {
     usb_packet_t *pkt = NULL;
     uint8_t actualSize;
     if ((pkt = usb_rx(RX_ENDPOINT))) {
         // Copy at most len bytes of data. Any remaining data will be discarded
+        if (pkt->len > len) {
+            RDS4_STAT_INC(this->stats.rxTruncated);
+        }
         actualSize = (pkt->len > len) ? len : pkt->len;
         memcpy(buf, pkt->buf, actualSize);
         usb_free(pkt);
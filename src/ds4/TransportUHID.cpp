@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** TransportUHID.cpp
+ *  UHID transport back-end for Linux.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "Transport.hpp"
+#include "ReportDescriptor.hpp"
+#include "utils/utils.hpp"
+
+#if defined(RDS4_LINUX)
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace rds4 {
+namespace ds4 {
+
+TransportUHID::TransportUHID(api::Authenticator *auth, const char *name, uint16_t vid, uint16_t pid) :
+        AuthenticationHandler(auth),
+        name(name),
+        vid(vid),
+        pid(pid),
+        uhid(-1),
+        epoll(-1),
+        started(false),
+        openCount(0),
+        frData(nullptr),
+        frSize(0),
+        frReply(nullptr),
+        frReplySize(0),
+        rxLen{0},
+        rxHead(0),
+        rxTail(0) { /* pass */ }
+
+TransportUHID::~TransportUHID() {
+    this->end();
+}
+
+void TransportUHID::begin() {
+    struct uhid_event ev;
+    struct epoll_event eev;
+    if (this->uhid >= 0) {
+        return;
+    }
+    AuthenticationHandler<TransportUHID>::begin();
+    this->uhid = open("/dev/uhid", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (this->uhid < 0) {
+        RDS4_DBG_PRINTLN("TransportUHID: cannot open /dev/uhid");
+        return;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    strncpy(reinterpret_cast<char *>(ev.u.create2.name), this->name, sizeof(ev.u.create2.name) - 1);
+    memcpy(ev.u.create2.rd_data, REPORT_DESCRIPTOR, REPORT_DESCRIPTOR_SIZE);
+    ev.u.create2.rd_size = REPORT_DESCRIPTOR_SIZE;
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = this->vid;
+    ev.u.create2.product = this->pid;
+    if (not this->writeEvent(&ev, sizeof(ev))) {
+        RDS4_DBG_PRINTLN("TransportUHID: cannot create device");
+        this->end();
+        return;
+    }
+    this->epoll = epoll_create1(EPOLL_CLOEXEC);
+    memset(&eev, 0, sizeof(eev));
+    eev.events = EPOLLIN;
+    if (this->epoll < 0 or epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->uhid, &eev) != 0) {
+        RDS4_DBG_PRINTLN("TransportUHID: epoll setup failed");
+        this->end();
+    }
+}
+
+void TransportUHID::end() {
+    struct uhid_event ev;
+    if (this->uhid >= 0) {
+        memset(&ev, 0, sizeof(ev));
+        ev.type = UHID_DESTROY;
+        this->writeEvent(&ev, sizeof(ev));
+        close(this->uhid);
+        this->uhid = -1;
+    }
+    if (this->epoll >= 0) {
+        close(this->epoll);
+        this->epoll = -1;
+    }
+    this->started = false;
+    this->openCount = 0;
+}
+
+bool TransportUHID::writeEvent(const void *ev, size_t len) {
+    ssize_t actual;
+    do {
+        actual = write(this->uhid, ev, len);
+    } while (actual < 0 and errno == EINTR);
+    return actual == static_cast<ssize_t>(len);
+}
+
+int TransportUHID::poll(int timeout) {
+    struct epoll_event eev;
+    int nfds;
+    if (this->epoll < 0) {
+        return -1;
+    }
+    nfds = epoll_wait(this->epoll, &eev, 1, timeout);
+    if (nfds < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    return nfds == 0 ? 0 : this->dispatch();
+}
+
+int TransportUHID::dispatch() {
+    struct uhid_event ev;
+    int handled = 0;
+    if (this->uhid < 0) {
+        return -1;
+    }
+    for (;;) {
+        auto actual = read(this->uhid, &ev, sizeof(ev));
+        if (actual < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN or errno == EWOULDBLOCK) ? handled : -1;
+        }
+        // Events are at least 4 bytes (type)
+        if (actual < static_cast<ssize_t>(sizeof(ev.type))) {
+            return -1;
+        }
+        this->handleEvent(&ev);
+        handled++;
+    }
+}
+
+/** Map UHID report types to USB HID GET_REPORT/SET_REPORT report types. */
+static inline uint8_t usbReportType(uint8_t rtype) {
+    switch (rtype) {
+        case UHID_FEATURE_REPORT:
+            return 0x03;
+        case UHID_OUTPUT_REPORT:
+            return 0x02;
+        case UHID_INPUT_REPORT:
+        default:
+            return 0x01;
+    }
+}
+
+void TransportUHID::handleEvent(const void *evp) {
+    auto ev = static_cast<const struct uhid_event *>(evp);
+    switch (ev->type) {
+        case UHID_START:
+            RDS4_DBG_PRINTLN("TransportUHID: start");
+            this->started = true;
+            break;
+        case UHID_STOP:
+            RDS4_DBG_PRINTLN("TransportUHID: stop");
+            this->started = false;
+            break;
+        case UHID_OPEN:
+            this->openCount++;
+            break;
+        case UHID_CLOSE:
+            if (this->openCount != 0) {
+                this->openCount--;
+            }
+            break;
+        case UHID_OUTPUT: {
+            auto &out = ev->u.output;
+            if (out.rtype != UHID_OUTPUT_REPORT or out.size == 0) {
+                break;
+            }
+            // Drop the oldest report if the queue is full
+            if (static_cast<uint8_t>(this->rxHead - this->rxTail) >= TransportUHID::RX_SLOTS) {
+                RDS4_STAT_INC(this->stats.rxDropped);
+                this->rxTail++;
+            }
+            if (out.size > TransportUHID::RX_SIZE) {
+                RDS4_STAT_INC(this->stats.rxTruncated);
+            }
+            auto slot = this->rxHead & (TransportUHID::RX_SLOTS - 1);
+            this->rxLen[slot] = out.size > TransportUHID::RX_SIZE ? TransportUHID::RX_SIZE : out.size;
+            memcpy(this->rxQueue[slot], out.data, this->rxLen[slot]);
+            this->rxHead++;
+            this->notifyRX();
+            break;
+        }
+        case UHID_GET_REPORT: {
+            struct uhid_event rep;
+            auto &req = ev->u.get_report;
+            memset(&rep, 0, sizeof(rep));
+            rep.type = UHID_GET_REPORT_REPLY;
+            rep.u.get_report_reply.id = req.id;
+            this->frReply = rep.u.get_report_reply.data;
+            this->frReplySize = 0;
+            if (this->onGetReport((usbReportType(req.rtype) << 8) | req.rnum, 0, UHID_DATA_MAX)) {
+                rep.u.get_report_reply.size = this->frReplySize;
+            } else {
+                rep.u.get_report_reply.err = EIO;
+            }
+            this->frReply = nullptr;
+            this->writeEvent(&rep, sizeof(rep));
+            break;
+        }
+        case UHID_SET_REPORT: {
+            struct uhid_event rep;
+            auto &req = ev->u.set_report;
+            memset(&rep, 0, sizeof(rep));
+            rep.type = UHID_SET_REPORT_REPLY;
+            rep.u.set_report_reply.id = req.id;
+            this->frData = req.data;
+            this->frSize = req.size;
+            if (not this->onSetReport((usbReportType(req.rtype) << 8) | req.rnum, 0, req.size)) {
+                rep.u.set_report_reply.err = EIO;
+            }
+            this->frData = nullptr;
+            this->frSize = 0;
+            this->writeEvent(&rep, sizeof(rep));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool TransportUHID::onGetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchGetReport(value, index, length));
+}
+
+bool TransportUHID::onSetReport(uint16_t value, uint16_t index, uint16_t length) {
+    return this->featureDone(this->dispatchSetReport(value, index, length));
+}
+
+uint8_t TransportUHID::reply(const void *buf, uint8_t len) {
+    if (this->frReply != nullptr) {
+        memcpy(this->frReply, buf, len);
+        this->frReplySize = len;
+        return len;
+    }
+    return 0;
+}
+
+uint8_t TransportUHID::check(void *buf, uint8_t len) {
+    uint8_t actual;
+    if (this->frData != nullptr) {
+        actual = len > this->frSize ? this->frSize : len;
+        memcpy(buf, this->frData, actual);
+        return actual;
+    }
+    return 0;
+}
+
+bool TransportUHID::available() {
+    return this->rxHead != this->rxTail;
+}
+
+uint8_t TransportUHID::send(const void *buf, uint8_t len) {
+    struct uhid_event ev;
+    if (not this->started) {
+        RDS4_STAT_INC(this->stats.txFull);
+        return 0;
+    }
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = len;
+    memcpy(ev.u.input2.data, buf, len);
+    // Only write the used part of the event
+    if (not this->writeEvent(&ev, offsetof(struct uhid_event, u.input2.data) + len)) {
+        RDS4_STAT_INC(this->stats.txFull);
+        return 0;
+    }
+    return len;
+}
+
+uint8_t TransportUHID::sendBlocking(const void *buf, uint8_t len) {
+    // UHID never pushes back on input reports
+    return this->send(buf, len);
+}
+
+uint8_t TransportUHID::recv(void *buf, uint8_t len) {
+    uint8_t actual;
+    if (this->rxHead == this->rxTail) {
+        return 0;
+    }
+    auto slot = this->rxTail & (TransportUHID::RX_SLOTS - 1);
+    if (this->rxLen[slot] > len) {
+        RDS4_STAT_INC(this->stats.rxTruncated);
+    }
+    actual = this->rxLen[slot] > len ? len : this->rxLen[slot];
+    memcpy(buf, this->rxQueue[slot], actual);
+    this->rxTail++;
+    return actual;
+}
+
+} // namespace ds4
+} // namespace rds4
+
+#endif // RDS4_LINUX
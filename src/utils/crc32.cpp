@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** crc32.cpp
+ *  CRC32 (IEEE 802.3, reflected) kernels with compile-time strategy
+ *  selection.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "utils.hpp"
+
+#ifdef RDS4_LINUX
+// for memcpy(), etc.
+#include <cstring>
+#endif
+
+#ifdef RDS4_CRC32_HAS_PCLMUL
+#include <immintrin.h>
+#endif
+
+namespace rds4 {
+namespace utils {
+
+namespace {
+
+const uint32_t CRC32_POLY = 0xedb88320ul;
+
+// Table generators. Everything here is evaluated at compile time.
+constexpr uint32_t crc32Shift(uint32_t crc, uint8_t bits) {
+    return bits == 0 ? crc : crc32Shift((crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0), bits - 1);
+}
+
+constexpr uint32_t crc32SliceNext(uint32_t prev) {
+    return (prev >> 8) ^ crc32Shift(prev & 0xff, 8);
+}
+
+constexpr uint32_t crc32SliceEntry(uint8_t slice, uint32_t index) {
+    return slice == 0 ? crc32Shift(index, 8) : crc32SliceNext(crc32SliceEntry(slice - 1, index));
+}
+
+struct Crc32Row {
+    uint32_t v[256];
+};
+
+template <size_t S>
+struct Crc32Table {
+    Crc32Row s[S];
+};
+
+template <size_t... I>
+constexpr Crc32Row crc32MakeRow(uint8_t slice, IndexSequence<I...>) {
+    return Crc32Row {{ crc32SliceEntry(slice, I)... }};
+}
+
+template <size_t... S>
+constexpr Crc32Table<sizeof...(S)> crc32MakeTable(IndexSequence<S...>) {
+    return Crc32Table<sizeof...(S)> {{ crc32MakeRow(S, MakeIndexSequence<256>::type())... }};
+}
+
+const uint32_t crc32_table_4b[] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+const Crc32Table<1> crc32_table_8b = crc32MakeTable(MakeIndexSequence<1>::type());
+const Crc32Table<4> crc32_table_s4 = crc32MakeTable(MakeIndexSequence<4>::type());
+const Crc32Table<8> crc32_table_s8 = crc32MakeTable(MakeIndexSequence<8>::type());
+
+// Assemble the word byte-by-byte. Cortex-M0+ does not do unaligned loads and
+// the compiler merges this into a single load where it can.
+inline uint32_t load32le(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | \
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint32_t nibbleStep(uint32_t crc, uint8_t b) {
+    crc ^= b;
+    crc = crc32_table_4b[crc & 0xf] ^ (crc >> 4);
+    return crc32_table_4b[crc & 0xf] ^ (crc >> 4);
+}
+
+inline uint32_t byteStep(const uint32_t *t, uint32_t crc, uint8_t b) {
+    return t[(crc ^ b) & 0xff] ^ (crc >> 8);
+}
+
+inline uint32_t slice4Step(const Crc32Row *t, uint32_t crc, uint32_t w) {
+    crc ^= w;
+    return t[3].v[crc & 0xff] ^ t[2].v[(crc >> 8) & 0xff] ^ \
+           t[1].v[(crc >> 16) & 0xff] ^ t[0].v[crc >> 24];
+}
+
+inline uint32_t slice8Step(const Crc32Row *t, uint32_t crc, uint32_t lo, uint32_t hi) {
+    lo ^= crc;
+    return t[7].v[lo & 0xff] ^ t[6].v[(lo >> 8) & 0xff] ^ \
+           t[5].v[(lo >> 16) & 0xff] ^ t[4].v[lo >> 24] ^ \
+           t[3].v[hi & 0xff] ^ t[2].v[(hi >> 8) & 0xff] ^ \
+           t[1].v[(hi >> 16) & 0xff] ^ t[0].v[hi >> 24];
+}
+
+} // namespace
+
+uint32_t crc32_nibble(uint32_t crc, const void *buf, size_t len) {
+    auto p = static_cast<const uint8_t *>(buf);
+    for (size_t i=0; i<len; i++) {
+        crc = nibbleStep(crc, p[i]);
+    }
+    return crc;
+}
+
+uint32_t crc32_byte(uint32_t crc, const void *buf, size_t len) {
+    auto p = static_cast<const uint8_t *>(buf);
+    const uint32_t *t = crc32_table_8b.s[0].v;
+    for (size_t i=0; i<len; i++) {
+        crc = byteStep(t, crc, p[i]);
+    }
+    return crc;
+}
+
+uint32_t crc32_slice4(uint32_t crc, const void *buf, size_t len) {
+    auto p = static_cast<const uint8_t *>(buf);
+    const Crc32Row *t = crc32_table_s4.s;
+    while (len >= 4) {
+        crc = slice4Step(t, crc, load32le(p));
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = byteStep(t[0].v, crc, *p++);
+    }
+    return crc;
+}
+
+uint32_t crc32_slice8(uint32_t crc, const void *buf, size_t len) {
+    auto p = static_cast<const uint8_t *>(buf);
+    const Crc32Row *t = crc32_table_s8.s;
+    while (len >= 8) {
+        crc = slice8Step(t, crc, load32le(p), load32le(p + 4));
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = byteStep(t[0].v, crc, *p++);
+    }
+    return crc;
+}
+
+#ifdef RDS4_CRC32_HAS_PCLMUL
+
+bool crc32_pclmul_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") and __builtin_cpu_supports("sse4.1");
+}
+
+// Folding constants for the reflected polynomial, from Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" paper.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t *buf, size_t len) {
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    // Fold by 4 (len >= 64 guaranteed by the caller)
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+    buf += 64;
+    len -= 64;
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold into 128 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold by 1
+    while (len >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    // 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const void *buf, size_t len) {
+    auto p = static_cast<const uint8_t *>(buf);
+    if (len >= 64) {
+        size_t bulk = len & ~static_cast<size_t>(15);
+        crc = crc32_pclmul_fold(crc, p, bulk);
+        p += bulk;
+        len -= bulk;
+    }
+    return crc32_slice8(crc, p, len);
+}
+
+#endif // RDS4_CRC32_HAS_PCLMUL
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len) {
+#ifdef RDS4_CRC32_HAS_PCLMUL
+    static const bool pclmul = crc32_pclmul_supported();
+    if (pclmul) {
+        return crc32_pclmul(crc, buf, len);
+    }
+#endif
+#if defined(RDS4_CRC32_NIBBLE)
+    return crc32_nibble(crc, buf, len);
+#elif defined(RDS4_CRC32_BYTE)
+    return crc32_byte(crc, buf, len);
+#elif defined(RDS4_CRC32_SLICE4)
+    return crc32_slice4(crc, buf, len);
+#else
+    return crc32_slice8(crc, buf, len);
+#endif
+}
+
+uint32_t copy_and_crc32(void *dst, const void *src, size_t len, uint32_t crc) {
+    auto d = static_cast<uint8_t *>(dst);
+    auto s = static_cast<const uint8_t *>(src);
+#if defined(RDS4_CRC32_HAS_PCLMUL)
+    // Folding wants long runs and the destination is hot in cache after the
+    // copy, so keep these separate.
+    memcpy(d, s, len);
+    return crc32_update(crc, d, len);
+#elif defined(RDS4_CRC32_NIBBLE)
+    for (size_t i=0; i<len; i++) {
+        uint8_t b = s[i];
+        d[i] = b;
+        crc = nibbleStep(crc, b);
+    }
+    return crc;
+#elif defined(RDS4_CRC32_BYTE)
+    const uint32_t *t = crc32_table_8b.s[0].v;
+    for (size_t i=0; i<len; i++) {
+        uint8_t b = s[i];
+        d[i] = b;
+        crc = byteStep(t, crc, b);
+    }
+    return crc;
+#elif defined(RDS4_CRC32_SLICE4)
+    const Crc32Row *t = crc32_table_s4.s;
+    while (len >= 4) {
+        uint32_t w = load32le(s);
+        memcpy(d, &w, 4);
+        crc = slice4Step(t, crc, w);
+        s += 4;
+        d += 4;
+        len -= 4;
+    }
+    while (len--) {
+        uint8_t b = *s++;
+        *d++ = b;
+        crc = byteStep(t[0].v, crc, b);
+    }
+    return crc;
+#else
+    const Crc32Row *t = crc32_table_s8.s;
+    while (len >= 8) {
+        uint32_t lo = load32le(s);
+        uint32_t hi = load32le(s + 4);
+        memcpy(d, &lo, 4);
+        memcpy(d + 4, &hi, 4);
+        crc = slice8Step(t, crc, lo, hi);
+        s += 8;
+        d += 8;
+        len -= 8;
+    }
+    while (len--) {
+        uint8_t b = *s++;
+        *d++ = b;
+        crc = byteStep(t[0].v, crc, b);
+    }
+    return crc;
+#endif
+}
+
+uint32_t crc32(const void *buf, size_t len) {
+    return crc32_final(crc32_update(crc32_init(), buf, len));
+}
+
+}
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** crc32.hpp
+ *  CRC32 (IEEE 802.3, reflected) kernels with compile-time strategy
+ *  selection.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+
+/* Strategy selection. Define one of the following to override the default:
+ *
+ *  - RDS4_CRC32_NIBBLE: 16-entry table, 2 lookups per byte (64 bytes of table)
+ *  - RDS4_CRC32_BYTE:   256-entry table, 1 lookup per byte (1KiB of table)
+ *  - RDS4_CRC32_SLICE4: slice-by-4, 4 bytes per iteration (4KiB of table)
+ *  - RDS4_CRC32_SLICE8: slice-by-8, 8 bytes per iteration (8KiB of table)
+ *
+ * By default AVR uses nibble (keeps the flash budget), Linux uses slice-by-8
+ * and everything else uses the byte table.
+ *
+ * On x86 Linux builds the PCLMUL folding kernel is also compiled in and is
+ * picked at runtime when the CPU supports it (define RDS4_CRC32_NO_PCLMUL to
+ * opt out). It falls back to the selected strategy otherwise.
+ */
+#if !defined(RDS4_CRC32_NIBBLE) && !defined(RDS4_CRC32_BYTE) && \
+    !defined(RDS4_CRC32_SLICE4) && !defined(RDS4_CRC32_SLICE8)
+#if defined(__AVR__)
+#define RDS4_CRC32_NIBBLE
+#elif defined(RDS4_LINUX)
+#define RDS4_CRC32_SLICE8
+#else
+#define RDS4_CRC32_BYTE
+#endif
+#endif
+
+#if defined(RDS4_LINUX) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(RDS4_CRC32_NO_PCLMUL)
+#define RDS4_CRC32_HAS_PCLMUL
+#endif
+
+namespace rds4 {
+namespace utils {
+
+/** Table footprint of each kernel in bytes. */
+enum : size_t {
+    CRC32_NIBBLE_TABLE_SIZE = 16 * sizeof(uint32_t),
+    CRC32_BYTE_TABLE_SIZE = 256 * sizeof(uint32_t),
+    CRC32_SLICE4_TABLE_SIZE = 4 * 256 * sizeof(uint32_t),
+    CRC32_SLICE8_TABLE_SIZE = 8 * 256 * sizeof(uint32_t),
+};
+
+/** Calculate the CRC32 of a buffer using the selected strategy.
+ *
+ *  @param The buffer.
+ *  @param Length of the buffer.
+ *  @return The CRC32 checksum.
+ */
+extern uint32_t crc32(const void *buf, size_t len);
+
+// Streaming API. Chain crc32_update() calls between crc32_init() and
+// crc32_final() to checksum data that arrives in pieces.
+
+/** Start a new CRC32 calculation.
+ *
+ *  @return The initial CRC register value.
+ */
+inline uint32_t crc32_init() {
+    return 0xfffffffful;
+}
+
+/** Feed more data into a CRC32 calculation.
+ *
+ *  @param Current CRC register value.
+ *  @param The buffer.
+ *  @param Length of the buffer.
+ *  @return Updated CRC register value.
+ */
+extern uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+/** Finish a CRC32 calculation.
+ *
+ *  @param Current CRC register value.
+ *  @return The CRC32 checksum.
+ */
+inline uint32_t crc32_final(uint32_t crc) {
+    return crc ^ 0xfffffffful;
+}
+
+/** Copy a buffer and feed the copied data into a CRC32 calculation in the
+ *  same pass. The buffers must not overlap.
+ *
+ *  @param The destination buffer.
+ *  @param The source buffer.
+ *  @param Number of bytes to copy.
+ *  @param Current CRC register value.
+ *  @return Updated CRC register value.
+ */
+extern uint32_t copy_and_crc32(void *dst, const void *src, size_t len, uint32_t crc);
+
+// Raw kernels. Like crc32_update() but bypasses strategy selection. Mostly
+// useful for benchmarking.
+extern uint32_t crc32_nibble(uint32_t crc, const void *buf, size_t len);
+extern uint32_t crc32_byte(uint32_t crc, const void *buf, size_t len);
+extern uint32_t crc32_slice4(uint32_t crc, const void *buf, size_t len);
+extern uint32_t crc32_slice8(uint32_t crc, const void *buf, size_t len);
+
+#ifdef RDS4_CRC32_HAS_PCLMUL
+/** Check if the CPU supports the PCLMUL kernel. */
+extern bool crc32_pclmul_supported();
+/** PCLMUL folding kernel. Only call this when crc32_pclmul_supported()
+ *  returns `true`.
+ */
+extern uint32_t crc32_pclmul(uint32_t crc, const void *buf, size_t len);
+#endif
+
+}
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** estimator.cpp
+ *  Online latency estimator for operations that can't be polled reliably.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "estimator.hpp"
+
+namespace rds4 {
+namespace utils {
+
+LatencyEstimator::LatencyEstimator(uint32_t initial, uint32_t floor, uint32_t ceiling) {
+    this->configure(initial, floor, ceiling);
+}
+
+void LatencyEstimator::configure(uint32_t initial, uint32_t floor, uint32_t ceiling) {
+    this->initial = initial;
+    this->floor = floor;
+    this->ceiling = (ceiling == 0) ? initial * 4 : ceiling;
+    this->reset();
+}
+
+void LatencyEstimator::reset() {
+    this->srtt8 = 0;
+    this->rttvar4 = 0;
+    this->failedWait = 0;
+    this->samples = 0;
+    this->streak = 0;
+}
+
+void LatencyEstimator::sample(uint32_t latency) {
+    int32_t m = static_cast<int32_t>(latency);
+    if (this->samples == 0) {
+        this->srtt8 = m << 3;
+        this->rttvar4 = (m >> 1) << 2;
+    } else {
+        // srtt += (m - srtt) / 8
+        int32_t delta = m - (this->srtt8 >> 3);
+        this->srtt8 += delta;
+        // rttvar += (|m - srtt| - rttvar) / 4
+        if (delta < 0) {
+            delta = -delta;
+        }
+        delta -= this->rttvar4 >> 2;
+        this->rttvar4 += delta;
+    }
+    if (this->samples < 0xffff) {
+        this->samples++;
+    }
+}
+
+void LatencyEstimator::tighten() {
+    if (++this->streak < LatencyEstimator::TIGHTEN_STREAK) {
+        return;
+    }
+    this->streak = 0;
+    // Nothing is known about the spread here. Lower the prediction by 1/16
+    // and let the deviation decay.
+    int32_t target = static_cast<int32_t>(this->estimate());
+    target -= target >> 4;
+    this->rttvar4 -= this->rttvar4 >> 2;
+    // The margin can exceed the target when the deviation is large
+    int32_t mean = target - LatencyEstimator::K * (this->rttvar4 >> 2);
+    this->srtt8 = (mean < 0 ? 0 : mean) << 3;
+    if (this->samples == 0) {
+        this->samples = 1;
+    }
+}
+
+void LatencyEstimator::backoff(uint32_t waited) {
+    this->streak = 0;
+    if (waited > this->failedWait) {
+        this->failedWait = waited;
+    }
+    if (this->samples == 0) {
+        return;
+    }
+    // Inflate both the mean and the deviation by half
+    this->srtt8 += this->srtt8 >> 1;
+    this->rttvar4 += this->rttvar4 >> 1;
+}
+
+uint32_t LatencyEstimator::clamp(int32_t value) const {
+    uint32_t lower = this->floor;
+    // Stay clear of waits that already failed
+    if (this->failedWait != 0) {
+        uint32_t failed = this->failedWait + (this->failedWait >> 3);
+        lower = failed > lower ? failed : lower;
+    }
+    if (value < 0 or static_cast<uint32_t>(value) < lower) {
+        return lower > this->ceiling ? this->ceiling : lower;
+    }
+    return static_cast<uint32_t>(value) > this->ceiling ? this->ceiling : static_cast<uint32_t>(value);
+}
+
+uint32_t LatencyEstimator::estimate() const {
+    if (this->samples == 0) {
+        return this->clamp(static_cast<int32_t>(this->initial));
+    }
+    return this->clamp((this->srtt8 >> 3) + LatencyEstimator::K * (this->rttvar4 >> 2));
+}
+
+uint32_t LatencyEstimator::earliest() const {
+    if (this->samples == 0) {
+        return this->floor;
+    }
+    int32_t value = (this->srtt8 >> 3) - 2 * (this->rttvar4 >> 2);
+    return (value < 0 or static_cast<uint32_t>(value) < this->floor) ? this->floor : static_cast<uint32_t>(value);
+}
+
+} // namespace utils
+} // namespace rds4
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** estimator.hpp
+ *  Online latency estimator for operations that can't be polled reliably.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+
+namespace rds4 {
+namespace utils {
+
+/** Learns how long an operation takes and predicts when it is safe to assume
+ *  it has finished.
+ *
+ *  Uses the same smoothed mean/deviation filter as the TCP retransmission
+ *  timer (RFC 6298): the prediction is `srtt + K * rttvar`, clamped to a
+ *  configurable floor and ceiling. Before the first observation the initial
+ *  value is used as-is.
+ *
+ *  Two feedback modes are supported:
+ *  - sample() when the actual latency is known (e.g. by probing).
+ *  - tighten()/backoff() when only the outcome of waiting is known. In this
+ *    mode the prediction is lowered a bit after a streak of verified
+ *    successes and raised again on failure. A wait that ever failed becomes a lower bound
+ *    so the failure isn't repeated.
+ *
+ *  All times are in ms.
+ */
+class LatencyEstimator {
+public:
+    // Safety margin in multiples of the mean deviation
+    static const uint8_t K = 4;
+    // Successes in a row needed before tighten() lowers the prediction
+    static const uint8_t TIGHTEN_STREAK = 8;
+
+    LatencyEstimator(uint32_t initial=2000, uint32_t floor=0, uint32_t ceiling=0);
+    /** Change the parameters. Also forgets everything learned so far.
+     *
+     *  @param Prediction used before any feedback.
+     *  @param Minimum prediction.
+     *  @param Maximum prediction (0 for 4 times the initial prediction).
+     */
+    void configure(uint32_t initial, uint32_t floor=0, uint32_t ceiling=0);
+    /** Forget everything learned so far. */
+    void reset();
+    /** Feed an observed latency. */
+    void sample(uint32_t latency);
+    /** Report that waiting for the current estimate was verifiably enough
+     *  (e.g. a scheduled report made its poll). Only call this on a signal that
+     *  would also catch a wait that was too short.
+     */
+    void tighten();
+    /** Report that waiting for the given time was not enough. */
+    void backoff(uint32_t waited);
+    /** Predicted time after which the operation is finished. */
+    uint32_t estimate() const;
+    /** Predicted time before which the operation is very unlikely to be
+     *  finished. Useful for deciding when to start probing.
+     */
+    uint32_t earliest() const;
+    uint16_t getSamples() const {
+        return this->samples;
+    }
+    uint32_t getCeiling() const {
+        return this->ceiling;
+    }
+
+private:
+    uint32_t clamp(int32_t value) const;
+    // Smoothed latency, scaled by 8
+    int32_t srtt8;
+    // Smoothed mean deviation, scaled by 4
+    int32_t rttvar4;
+    uint32_t initial;
+    uint32_t floor;
+    uint32_t ceiling;
+    // Longest wait that turned out to be too short
+    uint32_t failedWait;
+    uint16_t samples;
+    uint8_t streak;
+};
+
+} // namespace utils
+} // namespace rds4
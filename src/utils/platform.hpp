@@ -31,6 +31,33 @@
 #include <cstdint>
 // for size_t
 #include <cstddef>
+// for clock_gettime()
+#include <ctime>
+
+// No separate program memory
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t *>(addr))
+#endif
+#ifndef pgm_read_word
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t *>(addr))
+#endif
+
+// Arduino-style monotonic millisecond clock
+static inline uint32_t millis() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000ull + ts.tv_nsec / 1000000ul);
+}
+
+// Arduino-style monotonic microsecond clock
+static inline uint32_t micros() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000ul);
+}
 
 #else
 #error "Unknown/unsupported environment. If you are targeting for Linux system did you forget to set RDS4_LINUX?"
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** polltracker.cpp
+ *  Host polling phase and interval tracker.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "polltracker.hpp"
+
+namespace rds4 {
+namespace utils {
+
+void PollTracker::reset() {
+    this->phase = 0;
+    this->interval16 = 0;
+    this->jitter4 = 0;
+    this->samples = 0;
+}
+
+void PollTracker::observe(uint32_t time) {
+    uint32_t elapsed = time - this->phase;
+    uint32_t interval = this->interval16 >> 4;
+    uint32_t count;
+    int32_t error;
+
+    if (this->samples == 0) {
+        this->phase = time;
+        this->samples++;
+        return;
+    }
+    if (elapsed == 0 or static_cast<int32_t>(elapsed) < 0) {
+        // Same poll seen twice, or out of order
+        return;
+    }
+    if (not this->isLocked()) {
+        // Back-to-back pickups are one interval apart at most
+        if (interval == 0 or elapsed < interval) {
+            this->interval16 = elapsed << 4;
+        }
+        this->phase = time;
+        this->samples++;
+        return;
+    }
+    count = (elapsed + (interval >> 1)) / interval;
+    if (count == 0) {
+        // Closer to the last poll than to the next one
+        return;
+    }
+    if (count > PollTracker::MAX_GAP) {
+        // Too far to tell which poll this was. Keep the interval.
+        this->phase = time;
+        return;
+    }
+    error = static_cast<int32_t>(time - (this->phase + count * interval));
+    // Phase gain 1/4, interval gain 1/16 per elapsed interval
+    this->phase += count * interval + error / 4;
+    this->interval16 += error / static_cast<int32_t>(count);
+    // jitter += (|error| - jitter) / 4
+    if (error < 0) {
+        error = -error;
+    }
+    this->jitter4 += error - static_cast<int32_t>(this->jitter4 >> 2);
+}
+
+uint32_t PollTracker::nextPoll(uint32_t now) const {
+    uint32_t interval = this->interval16 >> 4;
+    uint32_t elapsed = now - this->phase;
+    if (interval == 0 or static_cast<int32_t>(elapsed) <= 0) {
+        return this->phase;
+    }
+    return this->phase + ((elapsed + interval - 1) / interval) * interval;
+}
+
+} // namespace utils
+} // namespace rds4
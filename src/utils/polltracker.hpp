@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** polltracker.hpp
+ *  Host polling phase and interval tracker.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+
+namespace rds4 {
+namespace utils {
+
+/** Learns when the host polls an interrupt IN endpoint from the times it
+ *  picked up reports, and predicts the next poll.
+ *
+ *  Works like a simple software PLL. During acquisition the interval is the
+ *  shortest gap seen so far. Once locked, every observation is matched to
+ *  the nearest predicted poll (so polls that found nothing to pick up don't
+ *  confuse it) and the phase and interval are nudged towards it. Jitter is
+ *  the smoothed mean deviation of the observations from the prediction.
+ *
+ *  Observations usually come in a bit after the actual poll (e.g. when
+ *  completions are only checked from the main loop), so the phase has the
+ *  same bias. Users should keep a margin.
+ *
+ *  All times are micros() timestamps and may wrap around.
+ */
+class PollTracker {
+public:
+    // Observations needed before the prediction is trusted
+    static const uint8_t LOCK_SAMPLES = 16;
+    // Gaps longer than this many intervals re-anchor the phase
+    static const uint8_t MAX_GAP = 32;
+
+    PollTracker() {
+        this->reset();
+    }
+    /** Forget everything learned so far. */
+    void reset();
+    /** Feed the time the host was seen picking up a report. */
+    void observe(uint32_t time);
+    bool isLocked() const {
+        return this->samples >= PollTracker::LOCK_SAMPLES;
+    }
+    /** Estimated host poll interval in us (0 if unknown). */
+    uint32_t getInterval() const {
+        return this->interval16 >> 4;
+    }
+    /** Estimated jitter (mean deviation) of the host polls in us. */
+    uint32_t getJitter() const {
+        return this->jitter4 >> 2;
+    }
+    /** Predicted time of the first poll at or after the given time. Only
+     *  meaningful when locked.
+     */
+    uint32_t nextPoll(uint32_t now) const;
+
+private:
+    // Time of a recent poll
+    uint32_t phase;
+    // Poll interval, scaled by 16
+    uint32_t interval16;
+    // Mean deviation, scaled by 4
+    uint32_t jitter4;
+    uint8_t samples;
+};
+
+} // namespace utils
+} // namespace rds4
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** spsc.hpp
+ *  Lock-free single-producer/single-consumer packet ring.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+
+#ifdef RDS4_LINUX
+// for memcpy(), etc.
+#include <cstring>
+#endif
+
+// Size of the region each ring index owns. Keeps the producer and consumer
+// from bouncing the same cache line between cores. MCUs have no caches to
+// speak of, so don't waste RAM there.
+#ifndef RDS4_CACHE_LINE
+#if defined(RDS4_LINUX)
+#define RDS4_CACHE_LINE 64
+#else
+#define RDS4_CACHE_LINE 4
+#endif
+#endif
+
+namespace rds4 {
+namespace utils {
+
+/** Ring of up to `SLOTS` packets of at most `SIZE` bytes each. One thread (or
+ *  ISR) may produce and one may consume at the same time without locks.
+ *  Both zero-copy (reserve()/commit(), peek()/release()) and copying
+ *  (push()/pop()) interfaces are provided. Indices are free-running.
+ */
+template <uint16_t SLOTS, uint8_t SIZE>
+class PacketRing {
+public:
+    static_assert(SLOTS != 0 and (SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of 2");
+
+    PacketRing() : head(0), tailCache(0), tail(0), headCache(0) {}
+
+    // Producer side
+
+    /** Get the next free slot for writing without publishing it.
+     *
+     *  @return Pointer to a SIZE-byte buffer or `nullptr` if the ring is full.
+     */
+    uint8_t *reserve() {
+        uint32_t head = __atomic_load_n(&(this->head), __ATOMIC_RELAXED);
+        if (head - this->tailCache >= SLOTS) {
+            // Only touch the consumer's line when the cached index says full
+            this->tailCache = __atomic_load_n(&(this->tail), __ATOMIC_ACQUIRE);
+            if (head - this->tailCache >= SLOTS) {
+                return nullptr;
+            }
+        }
+        return this->slots[head & (SLOTS - 1)].data;
+    }
+    /** Publish the slot returned by reserve().
+     *
+     *  @param Number of bytes written to the slot.
+     */
+    void commit(uint8_t len) {
+        uint32_t head = __atomic_load_n(&(this->head), __ATOMIC_RELAXED);
+        this->slots[head & (SLOTS - 1)].len = len > SIZE ? SIZE : len;
+        __atomic_store_n(&(this->head), head + 1, __ATOMIC_RELEASE);
+    }
+    /** Copy a packet into the ring.
+     *
+     *  @return `true` if successful, `false` if the ring is full.
+     */
+    bool push(const void *buf, uint8_t len) {
+        auto *slot = this->reserve();
+        if (slot == nullptr) {
+            return false;
+        }
+        len = len > SIZE ? SIZE : len;
+        memcpy(slot, buf, len);
+        this->commit(len);
+        return true;
+    }
+
+    // Consumer side
+
+    /** Get the oldest packet without removing it.
+     *
+     *  @param Receives the length of the packet.
+     *  @return Pointer to the packet or `nullptr` if the ring is empty.
+     */
+    const uint8_t *peek(uint8_t *len) {
+        uint32_t tail = __atomic_load_n(&(this->tail), __ATOMIC_RELAXED);
+        if (tail == this->headCache) {
+            this->headCache = __atomic_load_n(&(this->head), __ATOMIC_ACQUIRE);
+            if (tail == this->headCache) {
+                return nullptr;
+            }
+        }
+        auto *slot = &(this->slots[tail & (SLOTS - 1)]);
+        *len = slot->len;
+        return slot->data;
+    }
+    /** Remove the packet returned by peek(). */
+    void release() {
+        uint32_t tail = __atomic_load_n(&(this->tail), __ATOMIC_RELAXED);
+        __atomic_store_n(&(this->tail), tail + 1, __ATOMIC_RELEASE);
+    }
+    /** Copy the oldest packet out of the ring and remove it.
+     *
+     *  @return The number of bytes copied or 0 if the ring is empty.
+     */
+    uint8_t pop(void *buf, uint8_t len) {
+        uint8_t actual;
+        auto *data = this->peek(&actual);
+        if (data == nullptr) {
+            return 0;
+        }
+        actual = actual > len ? len : actual;
+        memcpy(buf, data, actual);
+        this->release();
+        return actual;
+    }
+
+    // Either side
+
+    bool empty() {
+        return __atomic_load_n(&(this->head), __ATOMIC_ACQUIRE) == __atomic_load_n(&(this->tail), __ATOMIC_ACQUIRE);
+    }
+    uint16_t size() {
+        return __atomic_load_n(&(this->head), __ATOMIC_ACQUIRE) - __atomic_load_n(&(this->tail), __ATOMIC_ACQUIRE);
+    }
+
+private:
+    struct Slot {
+        uint8_t len;
+        uint8_t data[SIZE];
+    };
+    // Written by the producer. tailCache is producer-private.
+    alignas(RDS4_CACHE_LINE) uint32_t head;
+    uint32_t tailCache;
+    // Written by the consumer. headCache is consumer-private.
+    alignas(RDS4_CACHE_LINE) uint32_t tail;
+    uint32_t headCache;
+    alignas(RDS4_CACHE_LINE) Slot slots[SLOTS];
+};
+
+} // namespace utils
+} // namespace rds4
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** stats.cpp
+ *  Optional performance counters of transports, controllers and the auth
+ *  handler.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "stats.hpp"
+
+#ifdef RDS4_LINUX
+// for snprintf()
+#include <cstdio>
+#endif
+
+namespace rds4 {
+namespace utils {
+
+void TransportStats::reset() {
+    this->txFull = 0;
+    this->txTimeouts = 0;
+    this->rxDropped = 0;
+    this->rxTruncated = 0;
+    this->featureRequests = 0;
+    this->featureStalls = 0;
+    this->txWait.reset();
+}
+
+void ControllerStats::reset() {
+    this->reportsSent = 0;
+    this->reportsFailed = 0;
+    this->reportsSkipped = 0;
+    this->feedbackAccepted = 0;
+    this->feedbackRejected = 0;
+    this->reportInterval.reset();
+}
+
+void AuthStats::reset() {
+    this->transactions = 0;
+    this->completed = 0;
+    this->errors = 0;
+    this->challengeStalls = 0;
+    this->signTime.reset();
+    this->pageWrite.reset();
+}
+
+static void printCounter(TracePrinter print, const char *name, uint32_t value) {
+    char line[48];
+    snprintf(line, sizeof(line), "%s %lu\n", name, static_cast<unsigned long>(value));
+    print(line);
+}
+
+static void printHistogram(TracePrinter print, const char *name, const Log2Histogram &h) {
+    char line[128];
+    snprintf(line, sizeof(line), "%s n=%lu avg=%lu p50<=%lu p90<=%lu p99<=%lu max=%lu\n",
+             name, static_cast<unsigned long>(h.count),
+             static_cast<unsigned long>(h.average()),
+             static_cast<unsigned long>(h.percentile(50)),
+             static_cast<unsigned long>(h.percentile(90)),
+             static_cast<unsigned long>(h.percentile(99)),
+             static_cast<unsigned long>(h.max));
+    print(line);
+}
+
+void statsDump(const TransportStats &stats, TracePrinter print) {
+    printCounter(print, "tx_full", stats.txFull);
+    printCounter(print, "tx_timeouts", stats.txTimeouts);
+    printCounter(print, "rx_dropped", stats.rxDropped);
+    printCounter(print, "rx_truncated", stats.rxTruncated);
+    printCounter(print, "feature_requests", stats.featureRequests);
+    printCounter(print, "feature_stalls", stats.featureStalls);
+    printHistogram(print, "tx_wait_us", stats.txWait);
+}
+
+void statsDump(const ControllerStats &stats, TracePrinter print) {
+    printCounter(print, "reports_sent", stats.reportsSent);
+    printCounter(print, "reports_failed", stats.reportsFailed);
+    printCounter(print, "reports_skipped", stats.reportsSkipped);
+    printCounter(print, "feedback_accepted", stats.feedbackAccepted);
+    printCounter(print, "feedback_rejected", stats.feedbackRejected);
+    printHistogram(print, "report_interval_us", stats.reportInterval);
+}
+
+void statsDump(const AuthStats &stats, TracePrinter print) {
+    printCounter(print, "auth_transactions", stats.transactions);
+    printCounter(print, "auth_completed", stats.completed);
+    printCounter(print, "auth_errors", stats.errors);
+    printCounter(print, "challenge_stalls", stats.challengeStalls);
+    printHistogram(print, "sign_time_ms", stats.signTime);
+    printHistogram(print, "page_write_us", stats.pageWrite);
+}
+
+} // namespace utils
+} // namespace rds4
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** stats.hpp
+ *  Optional performance counters of transports, controllers and the auth
+ *  handler.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+// For Log2Histogram and TracePrinter
+#include "trace.hpp"
+
+namespace rds4 {
+namespace utils {
+
+/** Counters of an api::Transport. See Transport::getTransportStats(). */
+struct TransportStats {
+    // send()/sendv()/commitTX() calls that found the endpoint or queue full
+    // (the report was refused, or coalesced under TXPolicy::DROP_OLDEST)
+    uint32_t txFull;
+    // sendBlocking()/sendTimed() calls that gave up
+    uint32_t txTimeouts;
+    // OUT reports thrown away because nobody received them in time
+    uint32_t rxDropped;
+    // OUT reports cut short by recv() because the buffer was too small
+    uint32_t rxTruncated;
+    // Feature GET/SET_REPORT requests handled, and the ones that stalled
+    uint32_t featureRequests;
+    uint32_t featureStalls;
+    // Time sendTimed() spent waiting for room (us)
+    Log2Histogram txWait;
+
+    void reset();
+};
+
+/** Counters of a ds4::Controller. See Controller::getStats(). */
+struct ControllerStats {
+    // Reports the transport accepted
+    uint32_t reportsSent;
+    // Reports the transport refused
+    uint32_t reportsFailed;
+    // sendReport() calls skipped because nothing changed (change-driven mode)
+    uint32_t reportsSkipped;
+    // OUT reports applied, and the ones that weren't feedback reports (or
+    // failed the Bluetooth CRC check)
+    uint32_t feedbackAccepted;
+    uint32_t feedbackRejected;
+    // Time between two sent reports (us)
+    Log2Histogram reportInterval;
+
+    void reset();
+};
+
+/** Counters of an AuthenticationHandler. See getAuthStats(). */
+struct AuthStats {
+    // Transactions started by the host (challenge page 0), and the ones
+    // whose response went out completely
+    uint32_t transactions;
+    uint32_t completed;
+    // Transitions into the error state
+    uint32_t errors;
+    // Challenge pages stalled (queue full or malformed)
+    uint32_t challengeStalls;
+    // Time from the last challenge page to the response being ready (ms)
+    Log2Histogram signTime;
+    // Time spent forwarding one challenge page to the authenticator (us)
+    Log2Histogram pageWrite;
+
+    void reset();
+};
+
+/** Add to a counter. Safe against interrupts and other threads. */
+inline void statAdd(uint32_t *counter, uint32_t n) {
+#if defined(__AVR__)
+    uint8_t sreg = SREG;
+    cli();
+    *counter += n;
+    SREG = sreg;
+#elif defined(__ARM_ARCH_6M__)
+    // No LDREX/STREX on Cortex-M0+
+    uint32_t primask;
+    __asm__ volatile ("mrs %0, primask" : "=r" (primask));
+    __asm__ volatile ("cpsid i" ::: "memory");
+    *counter += n;
+    __asm__ volatile ("msr primask, %0" :: "r" (primask) : "memory");
+#else
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#endif
+}
+
+/** Copy a stats structure without getting torn by interrupts. Histograms
+ *  are only ever updated from the main loop, so take snapshots there too.
+ */
+template <class T>
+void statsCopy(T *out, const T &in) {
+#if defined(__AVR__)
+    uint8_t sreg = SREG;
+    cli();
+    *out = in;
+    SREG = sreg;
+#elif defined(__arm__) && !defined(RDS4_LINUX)
+    uint32_t primask;
+    __asm__ volatile ("mrs %0, primask" : "=r" (primask));
+    __asm__ volatile ("cpsid i" ::: "memory");
+    *out = in;
+    __asm__ volatile ("msr primask, %0" :: "r" (primask) : "memory");
+#else
+    *out = in;
+#endif
+}
+
+/** Print a stats structure one `name value` line per counter. Histograms
+ *  are printed as `name n= avg= p50<= p90<= p99<= max=`.
+ */
+extern void statsDump(const TransportStats &stats, TracePrinter print);
+extern void statsDump(const ControllerStats &stats, TracePrinter print);
+extern void statsDump(const AuthStats &stats, TracePrinter print);
+
+} // namespace utils
+} // namespace rds4
+
+#ifdef RDS4_STATS
+#define RDS4_STAT_INC(counter) ::rds4::utils::statAdd(&(counter), 1)
+#define RDS4_STAT_ADD(counter, n) ::rds4::utils::statAdd(&(counter), (n))
+// Histograms are not interrupt safe, only sample from the main loop
+#define RDS4_STAT_SAMPLE(histogram, value) (histogram).add(value)
+// Time an operation in us and add it to a histogram
+#define RDS4_STAT_BEGIN(var) uint32_t var = micros()
+#define RDS4_STAT_END(var, histogram) (histogram).add(micros() - (var))
+#else
+#define RDS4_STAT_INC(counter)
+#define RDS4_STAT_ADD(counter, n)
+#define RDS4_STAT_SAMPLE(histogram, value)
+#define RDS4_STAT_BEGIN(var)
+#define RDS4_STAT_END(var, histogram)
+#endif
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** trace.cpp
+ *  Fixed-size binary event trace ring.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#include "trace.hpp"
+
+#ifdef RDS4_LINUX
+// for snprintf()
+#include <cstdio>
+#endif
+
+namespace rds4 {
+namespace utils {
+
+#ifdef RDS4_TRACE
+TraceRing trace;
+#endif
+
+uint16_t TraceRing::snapshot(TraceEvent *out, uint16_t max) {
+    uint32_t end = this->load();
+    uint32_t n = end < TraceRing::SIZE ? end : TraceRing::SIZE;
+    uint32_t start, after, skip = 0;
+    uint16_t copied = 0;
+    n = n > max ? max : n;
+    start = end - n;
+    for (uint32_t i=0; i<n; i++) {
+        out[i] = this->events[(start + i) & (TraceRing::SIZE - 1)];
+    }
+    // Slots below after - SIZE might have been reused while copying
+    after = this->load();
+    if (after - start > TraceRing::SIZE) {
+        skip = after - start - TraceRing::SIZE;
+    }
+    for (uint32_t i=skip; i<n; i++) {
+        if (out[i].type != TraceType::NONE) {
+            out[copied++] = out[i];
+        }
+    }
+    return copied;
+}
+
+void TraceRing::clear() {
+    for (auto &ev : this->events) {
+        ev.type = TraceType::NONE;
+    }
+    this->head = 0;
+}
+
+void Log2Histogram::reset() {
+    for (auto &b : this->buckets) {
+        b = 0;
+    }
+    this->count = 0;
+    this->sumCount = 0;
+    this->min = 0xfffffffful;
+    this->max = 0;
+    this->sum = 0;
+}
+
+void Log2Histogram::add(uint32_t value) {
+    uint8_t bucket = 0;
+    // Bucket n holds [2^n, 2^(n+1)), bucket 0 also holds 0
+    for (uint32_t v = value >> 1; v != 0; v >>= 1) {
+        bucket++;
+    }
+    if (this->buckets[bucket] < 0xfffffffful) {
+        this->buckets[bucket]++;
+    }
+    if (this->count < 0xfffffffful) {
+        this->count++;
+    }
+    // Keep the average consistent with the samples it covers
+    if (value <= 0xfffffffful - this->sum) {
+        this->sumCount++;
+        this->sum += value;
+    }
+    this->min = value < this->min ? value : this->min;
+    this->max = value > this->max ? value : this->max;
+}
+
+uint32_t Log2Histogram::percentile(uint8_t p) const {
+    uint32_t total = 0, rank, seen = 0;
+    for (auto b : this->buckets) {
+        total += b;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Nearest rank
+    rank = (total * p + 99) / 100;
+    rank = rank == 0 ? 1 : rank;
+    for (uint8_t i=0; i<32; i++) {
+        seen += this->buckets[i];
+        if (seen >= rank) {
+            uint32_t upper = (i == 31) ? 0xfffffffful : ((2ul << i) - 1);
+            return upper > this->max ? this->max : upper;
+        }
+    }
+    return this->max;
+}
+
+void traceDump(const TraceEvent *events, uint16_t count, TracePrinter print) {
+    char line[32];
+    for (uint16_t i=0; i<count; i++) {
+        snprintf(line, sizeof(line), "%08lx %02x %02x %04x\n",
+                 static_cast<unsigned long>(events[i].time),
+                 static_cast<unsigned>(events[i].type),
+                 static_cast<unsigned>(events[i].a),
+                 static_cast<unsigned>(events[i].b));
+        print(line);
+    }
+}
+
+} // namespace utils
+} // namespace rds4
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/** trace.hpp
+ *  Fixed-size binary event trace ring.
+ *
+ *  Copyright 2019 dogtopus
+ */
+
+#pragma once
+
+// For sysdep
+#include "platform.hpp"
+
+// Number of events kept in the global trace ring. Must be a power of 2.
+// Each event takes 8 bytes.
+#ifndef RDS4_TRACE_SIZE
+#define RDS4_TRACE_SIZE 128
+#endif
+
+namespace rds4 {
+namespace utils {
+
+enum class TraceType : uint8_t {
+    // Unused or half-written slot
+    NONE = 0,
+    // Auth state machine transition. a: new state, b: old state
+    AUTH_STATE,
+    // Feature report written by the host. a: report ID, b: page
+    HOST_SET,
+    // Feature report read by the host. a: report ID, b: page or status
+    HOST_GET,
+    // Donor transfers. a: page or status, b: duration in us (saturated)
+    DONOR_WRITE,
+    DONOR_READ,
+    DONOR_STATUS,
+};
+
+struct TraceEvent {
+    // micros() at the time of recording
+    uint32_t time;
+    TraceType type;
+    uint8_t a;
+    uint16_t b;
+};
+
+static_assert(sizeof(TraceEvent) == 8, "TraceEvent must be 8 bytes");
+
+/** Lock-free ring of trace events. Recording is safe from interrupt context
+ *  and only costs a slot reservation and an 8-byte store. Old events are
+ *  overwritten when the ring is full.
+ */
+class TraceRing {
+public:
+    static const uint16_t SIZE = RDS4_TRACE_SIZE;
+    static_assert(SIZE != 0 and (SIZE & (SIZE - 1)) == 0, "RDS4_TRACE_SIZE must be a power of 2");
+
+    constexpr TraceRing() : head(0), events() {}
+    /** Record an event. */
+    void record(TraceType type, uint8_t a=0, uint16_t b=0) {
+        uint32_t time = micros();
+        auto *ev = &(this->events[this->reserve() & (TraceRing::SIZE - 1)]);
+        // Mark the slot as incomplete while writing so readers can skip it
+        ev->type = TraceType::NONE;
+        __asm__ volatile ("" ::: "memory");
+        ev->time = time;
+        ev->a = a;
+        ev->b = b;
+        __asm__ volatile ("" ::: "memory");
+        ev->type = type;
+    }
+    /** Copy the most recent events out of the ring, oldest first. Events
+     *  that got overwritten while copying are discarded.
+     *
+     *  @param Destination buffer.
+     *  @param Size of the destination buffer in events.
+     *  @return Number of events copied.
+     */
+    uint16_t snapshot(TraceEvent *out, uint16_t max);
+    /** Total number of events recorded since the last clear(), including
+     *  the ones that were overwritten.
+     */
+    uint32_t recorded() {
+        return this->load();
+    }
+    /** Drop all events. Not safe to call while events are being recorded. */
+    void clear();
+
+private:
+    uint32_t reserve() {
+#if defined(__AVR__)
+        uint8_t sreg = SREG;
+        cli();
+        uint32_t index = this->head++;
+        SREG = sreg;
+        return index;
+#elif defined(__ARM_ARCH_6M__)
+        // No LDREX/STREX on Cortex-M0+
+        uint32_t primask;
+        __asm__ volatile ("mrs %0, primask" : "=r" (primask));
+        __asm__ volatile ("cpsid i" ::: "memory");
+        uint32_t index = this->head++;
+        __asm__ volatile ("msr primask, %0" :: "r" (primask) : "memory");
+        return index;
+#else
+        return __atomic_fetch_add(&(this->head), 1, __ATOMIC_RELAXED);
+#endif
+    }
+    uint32_t load() {
+#if defined(__AVR__)
+        uint8_t sreg = SREG;
+        cli();
+        uint32_t index = this->head;
+        SREG = sreg;
+        return index;
+#else
+        return __atomic_load_n(&(this->head), __ATOMIC_ACQUIRE);
+#endif
+    }
+    // Free-running index of the next slot
+    uint32_t head;
+    TraceEvent events[SIZE];
+};
+
+/** log2-bucketed histogram for latency figures. */
+struct Log2Histogram {
+    uint32_t buckets[32];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+    // Samples in sum, which stops growing before it would overflow
+    uint32_t sumCount;
+
+    void reset();
+    void add(uint32_t value);
+    /** Average of the samples that fit in sum.
+     *
+     *  @return The average or 0 if empty.
+     */
+    uint32_t average() const {
+        return this->sumCount == 0 ? 0 : this->sum / this->sumCount;
+    }
+    /** Estimate a percentile. The result is the upper bound of the bucket the
+     *  percentile falls in, capped to the max. value seen.
+     *
+     *  @param Percentile (0-100).
+     *  @return The estimate or 0 if empty.
+     */
+    uint32_t percentile(uint8_t p) const;
+};
+
+/** Line output function used by the trace decoders. */
+typedef void (*TracePrinter)(const char *str);
+
+/** Print events one per line as `time type a b` in hex. This is the input
+ *  format of the host-side decoder in extras/tools.
+ */
+extern void traceDump(const TraceEvent *events, uint16_t count, TracePrinter print);
+
+#ifdef RDS4_TRACE
+/** The global trace ring. */
+extern TraceRing trace;
+#endif
+
+} // namespace utils
+} // namespace rds4
+
+#ifdef RDS4_TRACE
+#define RDS4_TRACE_EVENT(...) ::rds4::utils::trace.record(__VA_ARGS__)
+// Time an operation and record it with its duration in b.
+#define RDS4_TRACE_BEGIN(var) uint32_t var = micros()
+#define RDS4_TRACE_END(var, type, a) do { \
+    uint32_t _rds4_dt = micros() - (var); \
+    ::rds4::utils::trace.record((type), (a), _rds4_dt > 0xffff ? 0xffff : _rds4_dt); \
+} while (0)
+#else
+#define RDS4_TRACE_EVENT(...)
+#define RDS4_TRACE_BEGIN(var)
+#define RDS4_TRACE_END(var, type, a)
+#endif
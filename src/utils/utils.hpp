@@ -39,8 +39,125 @@
 #define RDS4_DBG_PRINTLN(str) do {} while (0)
 #endif
 
+// CRC32
+#include "crc32.hpp"
+
 namespace rds4 {
 namespace utils {
-extern uint32_t crc32(void *buf, size_t len);
+
+/** Mask interrupts. Pair with irqRestore(). Does nothing on Linux, where the
+ *  transports serve control requests on the thread that calls update().
+ *
+ *  @return The previous interrupt state.
+ */
+inline uint32_t irqSave() {
+#if defined(__AVR__)
+    uint8_t sreg = SREG;
+    cli();
+    return sreg;
+#elif defined(__arm__) && !defined(RDS4_LINUX)
+    uint32_t primask;
+    __asm__ volatile ("mrs %0, primask" : "=r" (primask));
+    __asm__ volatile ("cpsid i" ::: "memory");
+    return primask;
+#else
+    return 0;
+#endif
+}
+
+/** Restore the interrupt state returned by irqSave(). */
+inline void irqRestore(uint32_t state) {
+#if defined(__AVR__)
+    SREG = static_cast<uint8_t>(state);
+#elif defined(__arm__) && !defined(RDS4_LINUX)
+    __asm__ volatile ("msr primask, %0" :: "r" (state) : "memory");
+#else
+    (void) state;
+#endif
+}
+
+// Compile-time index sequence (C++11 does not have std::index_sequence and
+// AVR does not have the STL anyway). Used for generating lookup tables.
+template <size_t... I>
+struct IndexSequence {};
+
+template <class A, class B>
+struct ConcatIndexSequence;
+
+template <size_t... A, size_t... B>
+struct ConcatIndexSequence<IndexSequence<A...>, IndexSequence<B...>> {
+    typedef IndexSequence<A..., (sizeof...(A) + B)...> type;
+};
+
+template <size_t N>
+struct MakeIndexSequence {
+    typedef typename ConcatIndexSequence<typename MakeIndexSequence<N / 2>::type,
+                                         typename MakeIndexSequence<N - N / 2>::type>::type type;
+};
+
+template <>
+struct MakeIndexSequence<0> {
+    typedef IndexSequence<> type;
+};
+
+template <>
+struct MakeIndexSequence<1> {
+    typedef IndexSequence<0> type;
+};
+
+/** Lookup table that moves the bits of a 16-bit word to other positions.
+ *  Row `n` holds the output bits set by every value of input nibble `n`, so
+ *  applying it takes 4 lookups no matter how many bits move. Generate it at
+ *  compile time with makeBitPermutation() and keep it in PROGMEM.
+ */
+struct BitPermutationRow {
+    uint16_t v[16];
+};
+
+struct BitPermutation {
+    BitPermutationRow nibble[4];
+};
+
+// M::map(n) returns the output bit of input bit n, or 16 and up to drop it
+template <class M>
+constexpr uint16_t bitPermutationEntry(uint8_t nibble, uint8_t value, uint8_t bit=0) {
+    return bit >= 4 ? 0 : static_cast<uint16_t>(
+        ((((value >> bit) & 1) and M::map(nibble * 4 + bit) < 16) ? (1u << M::map(nibble * 4 + bit)) : 0) |
+        bitPermutationEntry<M>(nibble, value, bit + 1));
+}
+
+template <class M, size_t... I>
+constexpr BitPermutationRow bitPermutationMakeRow(uint8_t nibble, IndexSequence<I...>) {
+    return BitPermutationRow {{ bitPermutationEntry<M>(nibble, I)... }};
+}
+
+template <class M, size_t... N>
+constexpr BitPermutation bitPermutationMake(IndexSequence<N...>) {
+    return BitPermutation {{ bitPermutationMakeRow<M>(N, MakeIndexSequence<16>::type())... }};
+}
+
+/** Generate a BitPermutation.
+ *
+ *  @tparam Class with a `static constexpr uint8_t map(uint8_t bit)` that
+ *          returns where each input bit goes (16 or more drops it).
+ */
+template <class M>
+constexpr BitPermutation makeBitPermutation() {
+    return bitPermutationMake<M>(MakeIndexSequence<4>::type());
+}
+
+/** Apply a BitPermutation stored in PROGMEM.
+ *
+ *  @param The table.
+ *  @param Input word.
+ *  @return Input bits moved to where the table says.
+ */
+inline uint16_t bitPermute(const BitPermutation *perm, uint16_t value) {
+    return pgm_read_word(&(perm->nibble[0].v[value & 0xf])) |
+           pgm_read_word(&(perm->nibble[1].v[(value >> 4) & 0xf])) |
+           pgm_read_word(&(perm->nibble[2].v[(value >> 8) & 0xf])) |
+           pgm_read_word(&(perm->nibble[3].v[value >> 12]));
+}
+
 }
 }